@@ -213,6 +213,7 @@ LSMASHVideoSource::LSMASHVideoSource
     const char         *preferred_decoder_names,
     int                 prefer_hw_decoder,
     const char         *ff_options,
+    const char         *timecodes,
     IScriptEnvironment *env
 ) : LSMASHVideoSource{}
 {
@@ -237,6 +238,15 @@ LSMASHVideoSource::LSMASHVideoSource
     vohp->free_private_handler = as_free_video_output_handler;
     get_video_track( source, track_number, env );
     prepare_video_decoding( vdhp, vohp, format_ctx.get(), threads, direct_rendering, pixel_format, vi, env );
+    /* The timecodes are of the samples, which are output as they are unless converted into CFR. */
+    if( timecodes && !vohp->vfr2cfr )
+    {
+        uint32_t timestamp_count;
+        const lw_video_timestamp_t *timestamp_list = libavsmash_video_get_timestamp_list( vdhp, &timestamp_count );
+        if( lw_write_timecodes_v2( timecodes, timestamp_list, timestamp_count, vohp->frame_count,
+                                   1, libavsmash_video_get_media_timescale( vdhp ) ) < 0 )
+            env->ThrowError( "LSMASHVideoSource: failed to write the timecodes file %s.", timecodes );
+    }
     lsmash_discard_boxes( libavsmash_video_get_root( vdhp ) );
 
     has_at_least_v8 = env->FunctionExists("propShow");
@@ -462,6 +472,7 @@ LSMASHAudioSource::LSMASHAudioSource
     const char         *preferred_decoder_names,
     const double        drc,
     const char         *ff_options,
+    size_t              cache_size,
     IScriptEnvironment *env
 ) : LSMASHAudioSource{}
 {
@@ -474,6 +485,7 @@ LSMASHAudioSource::LSMASHAudioSource
     libavsmash_audio_set_decoder_options( adhp, ff_options );
     get_audio_track( source, track_number, env );
     prepare_audio_decoding( adhp, aohp, format_ctx.get(), channel_layout, sample_rate, skip_priming, vi, env );
+    aohp->block_cache_budget = cache_size;
     lsmash_discard_boxes( libavsmash_audio_get_root( adhp ) );
 }
 
@@ -542,6 +554,7 @@ AVSValue __cdecl CreateLSMASHVideoSource( AVSValue args, void *user_data, IScrip
     int         prefer_hw_decoder       = args[10].AsInt( 0 );
     int         ff_loglevel             = args[11].AsInt( 0 );
     const char* ff_options              = args[12].AsString( nullptr );
+    const char *timecodes               = args[13].AsString( nullptr );
     threads                = threads >= 0 ? threads : 0;
     seek_mode              = CLIP_VALUE( seek_mode, 0, 2 );
     forward_seek_threshold = CLIP_VALUE( forward_seek_threshold, 1, 999 );
@@ -549,7 +562,7 @@ AVSValue __cdecl CreateLSMASHVideoSource( AVSValue args, void *user_data, IScrip
     prefer_hw_decoder      = CLIP_VALUE( prefer_hw_decoder, 0, 3 );
     set_av_log_level( ff_loglevel );
     return new LSMASHVideoSource( source, track_number, threads, seek_mode, forward_seek_threshold,
-                                  direct_rendering, fps_num, fps_den, pixel_format, preferred_decoder_names, prefer_hw_decoder, ff_options, env );
+                                  direct_rendering, fps_num, fps_den, pixel_format, preferred_decoder_names, prefer_hw_decoder, ff_options, timecodes, env );
 }
 
 AVSValue __cdecl CreateLSMASHAudioSource( AVSValue args, void *user_data, IScriptEnvironment *env )
@@ -563,7 +576,9 @@ AVSValue __cdecl CreateLSMASHAudioSource( AVSValue args, void *user_data, IScrip
     int         ff_loglevel             = args[6].AsInt( 0 );
     const double drc                    = args[7].AsFloat(-1.0);
     const char* ff_options              = args[8].AsString( nullptr );
+    int         cache_mb                = args[9].AsInt( 0 );
     set_av_log_level( ff_loglevel );
     return new LSMASHAudioSource( source, track_number, skip_priming,
-                                  layout_string, sample_rate, preferred_decoder_names, drc, ff_options, env );
+                                  layout_string, sample_rate, preferred_decoder_names, drc, ff_options,
+                                  (size_t)MAX( cache_mb, 0 ) << 20, env );
 }
@@ -76,6 +76,7 @@ public:
         const char         *preferred_decoder_names,
         int                 prefer_hw_decoder,
         const char         *ff_options,
+        const char         *timecodes,
         IScriptEnvironment *env
     );
     ~LSMASHVideoSource();
@@ -115,6 +116,7 @@ public:
         const char         *preferred_decoder_names,
         const double        drc,
         const char         *ff_options,
+        size_t              cache_size,
         IScriptEnvironment *env
     );
     ~LSMASHAudioSource();
@@ -114,12 +114,17 @@ LWLibavVideoSource::LWLibavVideoSource
     lwlibav_option_t   *opt,
     int                 seek_mode,
     uint32_t            forward_seek_threshold,
+    uint32_t            seek_hint_threshold,
     int                 direct_rendering,
     enum AVPixelFormat  pixel_format,
     const char         *preferred_decoder_names,
     int                 prefer_hw_decoder,
     bool                progress,
     const char         *ff_options,
+    uint32_t            prefetch,
+    size_t              frame_cache_size,
+    int                 pipelined_decoding,
+    const char         *timecodes,
     IScriptEnvironment *env
 ) : LWLibavVideoSource{}
 {
@@ -130,9 +135,13 @@ LWLibavVideoSource::LWLibavVideoSource
     set_preferred_decoder_names( preferred_decoder_names );
     lwlibav_video_set_seek_mode              ( vdhp, seek_mode );
     lwlibav_video_set_forward_seek_threshold ( vdhp, forward_seek_threshold );
+    lwlibav_video_set_seek_hint_threshold    ( vdhp, seek_hint_threshold );
     lwlibav_video_set_preferred_decoder_names( vdhp, tokenize_preferred_decoder_names() );
     lwlibav_video_set_prefer_hw_decoder      ( vdhp, prefer_hw_decoder );
     lwlibav_video_set_decoder_options        ( vdhp, ff_options );
+    lwlibav_video_set_prefetch               ( vdhp, prefetch );
+    lwlibav_video_set_frame_cache_size       ( vdhp, frame_cache_size );
+    lwlibav_video_set_pipelined_decoding     ( vdhp, pipelined_decoding );
     as_video_output_handler_t *as_vohp = (as_video_output_handler_t *)lw_malloc_zero( sizeof(as_video_output_handler_t) );
     if( !as_vohp )
         env->ThrowError( "LWLibavVideoSource: failed to allocate the AviSynth video output handler." );
@@ -170,6 +179,16 @@ LWLibavVideoSource::LWLibavVideoSource
     int64_t fps_num = 25;
     int64_t fps_den = 1;
     lwlibav_video_setup_timestamp_info( &lwh, vdhp, vohp, &fps_num, &fps_den, opt->apply_repeat_flag );
+    /* The timecodes are of the frames in presentation order, which are output as they are unless converted or repeated. */
+    if( timecodes && !vohp->vfr2cfr && !vohp->repeat_control )
+    {
+        uint32_t   timestamp_count;
+        AVRational time_base;
+        const lw_video_timestamp_t *timestamp_list = lwlibav_video_get_timestamp_list( vdhp, &timestamp_count, &time_base );
+        if( lw_write_timecodes_v2( timecodes, timestamp_list, timestamp_count, vohp->frame_count,
+                                   time_base.num, time_base.den ) < 0 )
+            env->ThrowError( "LWLibavVideoSource: failed to write the timecodes file %s.", timecodes );
+    }
     vi.fps_numerator   = static_cast<unsigned>(fps_num);
     vi.fps_denominator = static_cast<unsigned>(fps_den);
     vi.num_frames      = vohp->frame_count;
@@ -306,6 +325,7 @@ LWLibavAudioSource::LWLibavAudioSource
     bool                progress,
     const double        drc,
     const char         *ff_options,
+    size_t              cache_size,
     IScriptEnvironment *env
 ) : LWLibavAudioSource{}
 {
@@ -336,6 +356,7 @@ LWLibavAudioSource::LWLibavAudioSource
     if( lwlibav_audio_get_desired_track( lwh.file_path, adhp, lwh.threads ) < 0 )
         env->ThrowError( "LWLibavAudioSource: failed to get the audio track." );
     prepare_audio_decoding( adhp, aohp, channel_layout, sample_rate, lwh, vi, env );
+    aohp->block_cache_budget = cache_size;
 }
 
 LWLibavAudioSource::~LWLibavAudioSource()
@@ -430,6 +451,15 @@ AVSValue __cdecl CreateLWLibavVideoSource( AVSValue args, void *user_data, IScri
     const char* cdir                    = args[16].AsString( nullptr );
     const bool  progress                = args[17].AsBool( true );
     const char* ff_options              = args[18].AsString( nullptr );
+    int         prefetch                = args[19].AsInt( 0 );
+    int         cache_mb                = args[20].AsInt( 0 );
+    int         seek_hint_threshold     = args[21].AsInt( 0 );
+    const bool  pipelined_decoding      = args[22].AsBool( false );
+    int         read_ahead              = args[23].AsInt( 0 );
+    const bool  direct_io               = args[24].AsBool( false );
+    const bool  selective_index         = args[25].AsBool( false );
+    const bool  range_index             = args[26].AsBool( false );
+    const char *timecodes               = args[27].AsString( nullptr );
     /* Set LW-Libav options. */
     lwlibav_option_t opt;
     opt.file_path         = source;
@@ -438,22 +468,31 @@ AVSValue __cdecl CreateLWLibavVideoSource( AVSValue args, void *user_data, IScri
     opt.av_sync           = 0;
     opt.no_create_index   = no_create_index;
     opt.index_file_path   = index_file_path;
+    opt.text_index        = 0;
     opt.force_video       = (stream_index >= 0);
     opt.force_video_index = stream_index >= 0 ? stream_index : -1;
     opt.force_audio       = 0;
     opt.force_audio_index = -2;
+    opt.parallel_index    = 1;
     opt.apply_repeat_flag = apply_repeat_flag;
     opt.field_dominance   = CLIP_VALUE( field_dominance, 0, 2 );    /* 0: Obey source flags, 1: TFF, 2: BFF */
     opt.vfr2cfr.active    = fps_num > 0 && fps_den > 0 ? 1 : 0;
     opt.vfr2cfr.fps_num   = fps_num;
     opt.vfr2cfr.fps_den   = fps_den;
+    opt.read_ahead        = CLIP_VALUE( read_ahead, 0, 4096 );
+    opt.direct_io         = direct_io ? 1 : 0;
+    opt.selective_index   = selective_index ? 1 : 0;
+    opt.range_index       = range_index ? 1 : 0;
     seek_mode              = CLIP_VALUE( seek_mode, 0, 2 );
     forward_seek_threshold = CLIP_VALUE( forward_seek_threshold, 1, 999 );
     direct_rendering      &= (pixel_format == AV_PIX_FMT_NONE);
     prefer_hw_decoder      = CLIP_VALUE( prefer_hw_decoder, 0, 3 );
+    /* The background decoder cannot allocate frame buffers through the script environment. */
+    prefetch               = direct_rendering ? 0 : CLIP_VALUE( prefetch, 0, 256 );
     set_av_log_level( ff_loglevel );
-    return new LWLibavVideoSource( &opt, seek_mode, forward_seek_threshold,
-                                   direct_rendering, pixel_format, preferred_decoder_names, prefer_hw_decoder, progress, ff_options, env );
+    return new LWLibavVideoSource( &opt, seek_mode, forward_seek_threshold, MAX( seek_hint_threshold, 0 ),
+                                   direct_rendering, pixel_format, preferred_decoder_names, prefer_hw_decoder, progress, ff_options, prefetch,
+                                   (size_t)MAX( cache_mb, 0 ) << 20, pipelined_decoding, timecodes, env );
 }
 
 AVSValue __cdecl CreateLWLibavAudioSource( AVSValue args, void *user_data, IScriptEnvironment *env )
@@ -471,6 +510,11 @@ AVSValue __cdecl CreateLWLibavAudioSource( AVSValue args, void *user_data, IScri
     const bool  progress                = args[10].AsBool( true );
     const double drc                    = args[11].AsFloat(-1.0);
     const char* ff_options              = args[12].AsString(nullptr);
+    int         cache_mb                = args[13].AsInt( 0 );
+    int         read_ahead              = args[14].AsInt( 0 );
+    const bool  direct_io               = args[15].AsBool( false );
+    const bool  selective_index         = args[16].AsBool( false );
+    const bool  range_index             = args[17].AsBool( false );
     /* Set LW-Libav options. */
     lwlibav_option_t opt;
     opt.file_path         = source;
@@ -479,15 +523,22 @@ AVSValue __cdecl CreateLWLibavAudioSource( AVSValue args, void *user_data, IScri
     opt.av_sync           = av_sync;
     opt.no_create_index   = no_create_index;
     opt.index_file_path   = index_file_path;
+    opt.text_index        = 0;
     opt.force_video       = 0;
     opt.force_video_index = -1;
     opt.force_audio       = (stream_index >= 0);
     opt.force_audio_index = stream_index >= 0 ? stream_index : -1;
+    opt.parallel_index    = 1;
     opt.apply_repeat_flag = 0;
     opt.field_dominance   = 0;
     opt.vfr2cfr.active    = 0;
     opt.vfr2cfr.fps_num   = 0;
     opt.vfr2cfr.fps_den   = 0;
+    opt.read_ahead        = CLIP_VALUE( read_ahead, 0, 4096 );
+    opt.direct_io         = direct_io ? 1 : 0;
+    opt.selective_index   = selective_index ? 1 : 0;
+    opt.range_index       = range_index ? 1 : 0;
     set_av_log_level( ff_loglevel );
-    return new LWLibavAudioSource( &opt, layout_string, sample_rate, preferred_decoder_names, progress, drc, ff_options, env );
+    return new LWLibavAudioSource( &opt, layout_string, sample_rate, preferred_decoder_names, progress, drc, ff_options,
+                                   (size_t)MAX( cache_mb, 0 ) << 20, env );
 }
@@ -63,12 +63,17 @@ public:
         lwlibav_option_t   *opt,
         int                 seek_mode,
         uint32_t            forward_seek_threshold,
+        uint32_t            seek_hint_threshold,
         int                 direct_rendering,
         enum AVPixelFormat  pixel_format,
         const char         *preferred_decoder_names,
         int                 prefer_hw_decoder,
         bool                progress,
         const char         *ff_options,
+        uint32_t            prefetch,
+        size_t              frame_cache_size,
+        int                 pipelined_decoding,
+        const char         *timecodes,
         IScriptEnvironment *env
     );
     ~LWLibavVideoSource();
@@ -92,6 +97,7 @@ public:
         bool                progress,
         const double        drc,
         const char         *ff_options,
+        size_t              cache_size,
         IScriptEnvironment *env
     );
     ~LWLibavAudioSource();
@@ -205,10 +205,16 @@ static void *open_file( char *file_path, reader_option_t *opt )
     lwlibav_opt.av_sync           = opt->av_sync;
     lwlibav_opt.no_create_index   = opt->no_create_index;
     lwlibav_opt.index_file_path   = NULL;
+    lwlibav_opt.text_index        = 0;
     lwlibav_opt.force_video       = opt->force_video;
     lwlibav_opt.force_video_index = opt->force_video_index;
     lwlibav_opt.force_audio       = opt->force_audio;
     lwlibav_opt.force_audio_index = opt->force_audio_index;
+    lwlibav_opt.parallel_index    = 1;
+    lwlibav_opt.read_ahead        = 0;
+    lwlibav_opt.direct_io         = 0;
+    lwlibav_opt.selective_index   = 0;
+    lwlibav_opt.range_index       = 0;
     lwlibav_opt.apply_repeat_flag = opt->video_opt.apply_repeat_flag;
     lwlibav_opt.field_dominance   = opt->video_opt.field_dominance;
     lwlibav_opt.vfr2cfr.active    = opt->video_opt.vfr2cfr.active;
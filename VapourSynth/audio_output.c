@@ -0,0 +1,180 @@
+/*****************************************************************************
+ * audio_output.c
+ *****************************************************************************
+ * Copyright (C) 2012-2015 L-SMASH Works project
+ *
+ * Authors: Yusuke Nakamura <muken.the.vfrmaniac@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license.
+ * However, when distributing its binary file, it will be under LGPL or GPL. */
+
+#include <string.h>
+
+/* Libav */
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+#include <libavutil/opt.h>
+
+#include "lsmashsource.h"
+#include "audio_output.h"
+
+static inline enum AVSampleFormat vs_decide_audio_output_sample_format( enum AVSampleFormat input_sample_format )
+{
+    /* VapourSynth supports neither 8bit integer nor IEEE double precision floating point format. */
+    switch( input_sample_format )
+    {
+        case AV_SAMPLE_FMT_U8 :
+        case AV_SAMPLE_FMT_U8P :
+        case AV_SAMPLE_FMT_S16 :
+        case AV_SAMPLE_FMT_S16P :
+            return AV_SAMPLE_FMT_S16;
+        case AV_SAMPLE_FMT_S32 :
+        case AV_SAMPLE_FMT_S32P :
+            return AV_SAMPLE_FMT_S32;
+        default :
+            return AV_SAMPLE_FMT_FLT;
+    }
+}
+
+int vs_setup_audio_rendering
+(
+    lw_audio_output_handler_t *aohp,
+    AVCodecContext            *ctx,
+    VSAudioInfo               *ai,
+    VSMap                     *out,
+    VSCore                    *core,
+    const VSAPI               *vsapi,
+    const char                *channel_layout,
+    int                        sample_rate
+)
+{
+    /* Channel layout. */
+    if( ctx->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC )
+        av_channel_layout_default( &ctx->ch_layout, ctx->ch_layout.nb_channels );
+    av_channel_layout_uninit( &aohp->output_channel_layout );
+    if( channel_layout )
+    {
+        if( av_channel_layout_from_string( &aohp->output_channel_layout, channel_layout ) < 0 )
+        {
+            set_error_on_init( out, vsapi, "lsmas: %s is not a valid channel layout.", channel_layout );
+            return -1;
+        }
+    }
+    else
+        av_channel_layout_copy( &aohp->output_channel_layout, &ctx->ch_layout );
+    /* The channels of VapourSynth are identified by the same bits as the native order of Libav. */
+    if( aohp->output_channel_layout.order != AV_CHANNEL_ORDER_NATIVE )
+    {
+        int output_channels = aohp->output_channel_layout.nb_channels;
+        av_channel_layout_uninit( &aohp->output_channel_layout );
+        av_channel_layout_default( &aohp->output_channel_layout, output_channels );
+    }
+    /* Sample rate. */
+    if( sample_rate > 0 )
+        aohp->output_sample_rate = sample_rate;
+    /* Decide output Bits Per Sample.
+     * 24bit samples are stored in the upper bits of 32bit integers as they are, so no conversion is needed. */
+    aohp->output_sample_format = vs_decide_audio_output_sample_format( aohp->output_sample_format );
+    int vs_bits_per_sample = aohp->output_sample_format == AV_SAMPLE_FMT_S32 && aohp->output_bits_per_sample == 24 ? 24
+                           : av_get_bytes_per_sample( aohp->output_sample_format ) * 8;
+    aohp->s24_output             = 0;
+    aohp->output_bits_per_sample = av_get_bytes_per_sample( aohp->output_sample_format ) * 8;
+    /* Set up the number of planes and the block alignment of decoded and output data. */
+    int input_channels = ctx->ch_layout.nb_channels;
+    if( av_sample_fmt_is_planar( ctx->sample_fmt ) )
+    {
+        aohp->input_planes      = input_channels;
+        aohp->input_block_align = av_get_bytes_per_sample( ctx->sample_fmt );
+    }
+    else
+    {
+        aohp->input_planes      = 1;
+        aohp->input_block_align = av_get_bytes_per_sample( ctx->sample_fmt ) * input_channels;
+    }
+    int output_channels = aohp->output_channel_layout.nb_channels;
+    aohp->output_block_align = (output_channels * aohp->output_bits_per_sample) / 8;
+    /* Set up resampler. */
+    SwrContext *swr_ctx = swr_alloc();
+    if( !swr_ctx )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to swr_alloc." );
+        return -1;
+    }
+    aohp->swr_ctx = swr_ctx;
+    av_opt_set_chlayout(   swr_ctx, "in_chlayout",        &ctx->ch_layout,             0 );
+    av_opt_set_sample_fmt( swr_ctx, "in_sample_fmt",       ctx->sample_fmt,            0 );
+    av_opt_set_int(        swr_ctx, "in_sample_rate",      ctx->sample_rate,           0 );
+    av_opt_set_chlayout(   swr_ctx, "out_chlayout",       &aohp->output_channel_layout, 0 );
+    av_opt_set_sample_fmt( swr_ctx, "out_sample_fmt",      aohp->output_sample_format, 0 );
+    av_opt_set_int(        swr_ctx, "out_sample_rate",     aohp->output_sample_rate,   0 );
+    av_opt_set_sample_fmt( swr_ctx, "internal_sample_fmt", AV_SAMPLE_FMT_FLTP,         0 );
+    if( swr_init( swr_ctx ) < 0 )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to open resampler." );
+        return -1;
+    }
+    /* Set up VapourSynth output format. */
+    int sample_type = aohp->output_sample_format == AV_SAMPLE_FMT_FLT ? stFloat : stInteger;
+    if( !vsapi->queryAudioFormat( &ai->format, sample_type, vs_bits_per_sample, aohp->output_channel_layout.u.mask, core ) )
+    {
+        vsapi->mapSetError( out, "lsmas: the output audio format is not supported." );
+        return -1;
+    }
+    ai->sampleRate = aohp->output_sample_rate;
+    return 0;
+}
+
+void vs_deinterleave_audio_samples
+(
+    VSFrame       *vs_frame,
+    int            offset,
+    const uint8_t *buf,
+    int            length,
+    const VSAPI   *vsapi
+)
+{
+    const VSAudioFormat *format = vsapi->getAudioFrameFormat( vs_frame );
+    int channels = format->numChannels;
+    if( format->bytesPerSample == 2 )
+        for( int ch = 0; ch < channels; ch++ )
+        {
+            const int16_t *src = (const int16_t *)buf + ch;
+            int16_t       *dst = (int16_t *)vsapi->getWritePtr( vs_frame, ch ) + offset;
+            for( int i = 0; i < length; i++ )
+                dst[i] = src[i * channels];
+        }
+    else
+        for( int ch = 0; ch < channels; ch++ )
+        {
+            const uint32_t *src = (const uint32_t *)buf + ch;
+            uint32_t       *dst = (uint32_t *)vsapi->getWritePtr( vs_frame, ch ) + offset;
+            for( int i = 0; i < length; i++ )
+                dst[i] = src[i * channels];
+        }
+}
+
+void vs_put_silence_audio_samples
+(
+    VSFrame     *vs_frame,
+    int          offset,
+    int          length,
+    const VSAPI *vsapi
+)
+{
+    const VSAudioFormat *format = vsapi->getAudioFrameFormat( vs_frame );
+    for( int ch = 0; ch < format->numChannels; ch++ )
+        memset( vsapi->getWritePtr( vs_frame, ch ) + offset * format->bytesPerSample, 0, (size_t)length * format->bytesPerSample );
+}
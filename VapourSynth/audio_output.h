@@ -0,0 +1,57 @@
+/*****************************************************************************
+ * audio_output.h
+ *****************************************************************************
+ * Copyright (C) 2012-2015 L-SMASH Works project
+ *
+ * Authors: Yusuke Nakamura <muken.the.vfrmaniac@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license.
+ * However, when distributing its binary file, it will be under LGPL or GPL. */
+
+#include "../common/audio_output.h"
+
+/* Set up the resampler and the output format.
+ * The samples are resampled into packed format and deinterleaved into the planes of each output frame. */
+int vs_setup_audio_rendering
+(
+    lw_audio_output_handler_t *aohp,
+    AVCodecContext            *ctx,
+    VSAudioInfo               *ai,
+    VSMap                     *out,
+    VSCore                    *core,
+    const VSAPI               *vsapi,
+    const char                *channel_layout,
+    int                        sample_rate
+);
+
+/* Copy 'length' packed samples in 'buf' into the planes of 'vs_frame' from 'offset'. */
+void vs_deinterleave_audio_samples
+(
+    VSFrame       *vs_frame,
+    int            offset,
+    const uint8_t *buf,
+    int            length,
+    const VSAPI   *vsapi
+);
+
+/* Fill 'length' samples of the planes of 'vs_frame' from 'offset' with silence. */
+void vs_put_silence_audio_samples
+(
+    VSFrame     *vs_frame,
+    int          offset,
+    int          length,
+    const VSAPI *vsapi
+);
@@ -28,21 +28,31 @@
 #include <libavformat/avformat.h>       /* Codec specific info importer */
 #include <libavcodec/avcodec.h>         /* Decoder */
 #include <libswscale/swscale.h>         /* Colorspace converter */
+#include <libswresample/swresample.h>   /* Audio resampler */
 #include <libavutil/imgutils.h>
 
 #include "lsmashsource.h"
 #include "video_output.h"
+#include "audio_output.h"
 
 #include "../common/libavsmash.h"
 #include "../common/libavsmash_video.h"
+#include "../common/libavsmash_audio.h"
+#include "../common/osdep.h"
 
 typedef struct
 {
-    VSVideoInfo                        vi[2];
+    VSVideoInfo                        vi;
     libavsmash_video_decode_handler_t *vdhp;
     libavsmash_video_output_handler_t *vohp;
     lsmash_file_parameters_t           file_param;
     AVFormatContext                   *format_ctx;
+    /* The decoder is used by one request at a time, and the output frame is made under 'output_mutex'. */
+    lw_mutex_t                        *decoder_mutex;
+    lw_cond_t                         *decoder_cond;
+    lw_mutex_t                        *output_mutex;
+    vs_waiter_t                       *waiters;
+    int                                busy;
     char preferred_decoder_names_buf[PREFERRED_DECODER_NAMES_BUFSIZE];
 } lsmas_handler_t;
 
@@ -59,6 +69,12 @@ static void free_handler
     lw_free( libavsmash_video_get_preferred_decoder_names( hp->vdhp ) );
     libavsmash_video_free_decode_handler( hp->vdhp );
     libavsmash_video_free_output_handler( hp->vohp );
+    if( hp->output_mutex )
+        lw_mutex_destroy( hp->output_mutex );
+    if( hp->decoder_cond )
+        lw_cond_destroy( hp->decoder_cond );
+    if( hp->decoder_mutex )
+        lw_mutex_destroy( hp->decoder_mutex );
     avformat_close_input( &hp->format_ctx );
     lsmash_close_file( &hp->file_param );
     lsmash_destroy_root( root );
@@ -86,16 +102,17 @@ static lsmas_handler_t *alloc_handler
         free_handler( &hp );
         return NULL;
     }
+    hp->decoder_mutex = lw_mutex_create();
+    hp->decoder_cond  = lw_cond_create();
+    hp->output_mutex  = lw_mutex_create();
+    if( !hp->decoder_mutex || !hp->decoder_cond || !hp->output_mutex )
+    {
+        free_handler( &hp );
+        return NULL;
+    }
     return hp;
 }
 
-static void VS_CC vs_filter_init( VSMap *in, VSMap *out, void **instance_data, VSNode *node, VSCore *core, const VSAPI *vsapi )
-{
-    lsmas_handler_t *hp = (lsmas_handler_t *)*instance_data;
-    AVCodecContext *ctx = libavsmash_video_get_codec_context( hp->vdhp );
-    vsapi->setVideoInfo( hp->vi, (av_pix_fmt_desc_get( ctx->pix_fmt )->flags & AV_PIX_FMT_FLAG_ALPHA) ? 2 : 1, node );
-}
-
 static int get_composition_duration
 (
     libavsmash_video_decode_handler_t *vdhp,
@@ -145,25 +162,6 @@ static void get_sample_duration
     }
 }
 
-static void set_frame_properties
-(
-    libavsmash_video_decode_handler_t *vdhp,
-    VSVideoInfo                       *vi,
-    AVFrame                           *av_frame,
-    VSFrameRef                        *vs_frame,
-    uint32_t                           sample_number,
-    int                                top,
-    int                                bottom,
-    const VSAPI                       *vsapi,
-    int                                n
-)
-{
-    int64_t duration_num;
-    int64_t duration_den;
-    get_sample_duration( vdhp, vi, sample_number, &duration_num, &duration_den );
-    vs_set_frame_properties( av_frame, NULL, duration_num, duration_den, vs_frame, top, bottom, vsapi, n );
-}
-
 static int prepare_video_decoding
 (
     lsmas_handler_t *hp,
@@ -175,7 +173,7 @@ static int prepare_video_decoding
 {
     libavsmash_video_decode_handler_t *vdhp = hp->vdhp;
     libavsmash_video_output_handler_t *vohp = hp->vohp;
-    VSVideoInfo                       *vi   = &hp->vi[0];
+    VSVideoInfo                       *vi   = &hp->vi;
     /* Initialize the video decoder configuration. */
     if( libavsmash_video_initialize_decoder_configuration( vdhp, hp->format_ctx, threads ) < 0 )
     {
@@ -185,9 +183,8 @@ static int prepare_video_decoding
     /* Set up output format. */
     AVCodecContext *ctx = libavsmash_video_get_codec_context( vdhp );
     vs_video_output_handler_t *vs_vohp = (vs_video_output_handler_t *)vohp->private_handler;
-    vs_vohp->frame_ctx = NULL;
-    vs_vohp->core      = core;
-    vs_vohp->vsapi     = vsapi;
+    vs_vohp->core  = core;
+    vs_vohp->vsapi = vsapi;
     int max_width  = libavsmash_video_get_max_width ( vdhp );
     int max_height = libavsmash_video_get_max_height( vdhp );
     if( vs_setup_video_rendering( vohp, ctx, vi, out, max_width, max_height ) < 0 )
@@ -214,16 +211,16 @@ static int prepare_video_decoding
         return -1;
     }
     /* Setup filter specific info. */
-    hp->vi[0].fpsNum    = fps_num;
-    hp->vi[0].fpsDen    = fps_den;
-    hp->vi[0].numFrames = vohp->frame_count;
+    vi->fpsNum    = fps_num;
+    vi->fpsDen    = fps_den;
+    vi->numFrames = vohp->frame_count;
+    /* The alpha plane is attached to each frame as the _Alpha property. */
     if( (av_pix_fmt_desc_get( ctx->pix_fmt )->flags & AV_PIX_FMT_FLAG_ALPHA)
-     && hp->vi[0].format )
+     && vi->format.colorFamily != cfUndefined )
     {
-        hp->vi[1] = hp->vi[0];
-        hp->vi[1].format = vsapi->registerFormat( cmGray, hp->vi[0].format->sampleType, hp->vi[0].format->bitsPerSample, 0, 0, core );
-        vs_vohp->background_frame[1] = vsapi->newVideoFrame( hp->vi[1].format, hp->vi[1].width, hp->vi[1].height, NULL, core );
-        if( !vs_vohp->background_frame[1] )
+        VSVideoFormat alpha_format;
+        if( !vsapi->queryVideoFormat( &alpha_format, cfGray, vi->format.sampleType, vi->format.bitsPerSample, 0, 0, core )
+         || !(vs_vohp->background_frame[1] = vsapi->newVideoFrame( &alpha_format, vi->width, vi->height, NULL, core )) )
         {
             set_error_on_init( out, vsapi, "lsmas: failed to allocate memory for the alpha frame data." );
             return -1;
@@ -234,20 +231,50 @@ static int prepare_video_decoding
     return 0;
 }
 
-static const VSFrameRef *VS_CC vs_filter_get_frame( int n, int activation_reason, void **instance_data, void **frame_data, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi )
+static void acquire_decoder
+(
+    lsmas_handler_t *hp,
+    uint32_t         sample_number
+)
+{
+    lw_mutex_lock( hp->decoder_mutex );
+    vs_waiter_t waiter = { sample_number, NULL };
+    vs_add_waiter( &hp->waiters, &waiter );
+    while( hp->busy || !vs_is_earliest_waiter( hp->waiters, &waiter ) )
+        lw_cond_wait( hp->decoder_cond, hp->decoder_mutex );
+    vs_remove_waiter( &hp->waiters, &waiter );
+    hp->busy = 1;
+    lw_mutex_unlock( hp->decoder_mutex );
+}
+
+static void release_decoder
+(
+    lsmas_handler_t *hp
+)
+{
+    lw_mutex_lock( hp->decoder_mutex );
+    hp->busy = 0;
+    lw_cond_broadcast( hp->decoder_cond );
+    lw_mutex_unlock( hp->decoder_mutex );
+}
+
+/* Decode the requested sample and take a reference to it.
+ * The decoded picture is held by 'av_frame', so the decoder can go on to the next request while the output frame is made.
+ * The sample duration is also got here since L-SMASH shall not be accessed concurrently. */
+static int decode_frame
+(
+    lsmas_handler_t *hp,
+    uint32_t         sample_number,
+    AVFrame         *av_frame,
+    int64_t         *duration_num,
+    int64_t         *duration_den,
+    VSFrameContext  *frame_ctx,
+    const VSAPI     *vsapi
+)
 {
-    if( activation_reason != arInitial )
-        return NULL;
-    lsmas_handler_t *hp = (lsmas_handler_t *)*instance_data;
-    VSVideoInfo     *vi = &hp->vi[0];
-    uint32_t sample_number = MIN( n + 1, vi->numFrames );   /* For L-SMASH, sample_number is 1-origin. */
     libavsmash_video_decode_handler_t *vdhp = hp->vdhp;
-    libavsmash_video_output_handler_t *vohp = hp->vohp;
     if( libavsmash_video_get_error( vdhp ) )
-    {
-        vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
-        return NULL;
-    }
+        return -1;
     /* Set up VapourSynth error handler. */
     vs_basic_handler_t vsbh = { 0 };
     vsbh.out       = NULL;
@@ -257,39 +284,61 @@ static const VSFrameRef *VS_CC vs_filter_get_frame( int n, int activation_reason
     lhp->priv     = &vsbh;
     lhp->show_log = set_error;
     /* Get and decode the desired video frame. */
-    vs_video_output_handler_t *vs_vohp = (vs_video_output_handler_t *)vohp->private_handler;
-    vs_vohp->frame_ctx = frame_ctx;
-    vs_vohp->core      = core;
-    vs_vohp->vsapi     = vsapi;
-    if( libavsmash_video_get_frame( vdhp, vohp, sample_number ) < 0 )
-    {
-        vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
-        return NULL;
-    }
-    /* Output video frame. */
-    AVFrame    *av_frame = libavsmash_video_get_frame_buffer( vdhp );
-    int output_index = vsapi->getOutputIndex( frame_ctx );
-    VSFrameRef *vs_frame = make_frame( vohp, av_frame, output_index );
+    if( libavsmash_video_decode_frame( vdhp, hp->vohp, sample_number ) < 0
+     || av_frame_ref( av_frame, libavsmash_video_get_frame_buffer( vdhp ) ) < 0 )
+        return -1;
+    get_sample_duration( vdhp, &hp->vi, sample_number, duration_num, duration_den );
+    return 0;
+}
+
+static VSFrame *output_frame
+(
+    lsmas_handler_t *hp,
+    AVFrame         *av_frame,
+    int64_t          duration_num,
+    int64_t          duration_den,
+    int              n,
+    uint32_t         sample_number,
+    VSFrameContext  *frame_ctx,
+    const VSAPI     *vsapi
+)
+{
+    libavsmash_video_output_handler_t *vohp = hp->vohp;
+    /* Set up VapourSynth error handler. */
+    vs_basic_handler_t vsbh = { 0 };
+    vsbh.out       = NULL;
+    vsbh.frame_ctx = frame_ctx;
+    vsbh.vsapi     = vsapi;
+    lw_log_handler_t lh = { 0 };
+    lh.level    = LW_LOG_FATAL;
+    lh.priv     = &vsbh;
+    lh.show_log = set_error;
+    /* Convert the decoded picture into the output frame and its alpha plane if present. */
+    int      alpha    = !!(av_pix_fmt_desc_get( av_frame->format )->flags & AV_PIX_FMT_FLAG_ALPHA);
+    VSFrame *vs_frame = NULL;
+    VSFrame *vs_alpha = NULL;
+    lw_mutex_lock( hp->output_mutex );
+    if( update_scaler_configuration_if_needed( &vohp->scaler, &lh, av_frame ) >= 0
+     && (vs_frame = make_frame( vohp, av_frame, 0 ))
+     && alpha )
+        vs_alpha = make_frame( vohp, av_frame, 1 );
+    lw_mutex_unlock( hp->output_mutex );
     if( !vs_frame )
     {
         vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
         return NULL;
     }
-    AVCodecContext *ctx = libavsmash_video_get_codec_context( vdhp );
-    if ( output_index == 0 && ( av_pix_fmt_desc_get( ctx->pix_fmt )->flags & AV_PIX_FMT_FLAG_ALPHA) )
+    if( alpha )
     {
-        /* api4 compat: save alpha clip into the _Alpha property */
-        VSFrameRef *vs_frame2 = make_frame( vohp, av_frame, 1 );
-        if( !vs_frame2 )
+        /* Save alpha clip into the _Alpha property. */
+        if( !vs_alpha )
         {
+            vsapi->freeFrame( vs_frame );
             vsapi->setFilterError( "lsmas: failed to output an alpha video frame.", frame_ctx );
             return NULL;
         }
-        VSMap *props = vsapi->getFramePropsRW( vs_frame2 );
-        vsapi->propSetInt( props, "_ColorRange", 0, paReplace ); // alpha clip always full range
-        props = vsapi->getFramePropsRW( vs_frame );
-        vsapi->propSetFrame( props, "_Alpha", vs_frame2, paAppend );
-        vsapi->freeFrame( vs_frame2 );
+        vsapi->mapSetInt( vsapi->getFramePropertiesRW( vs_alpha ), "_ColorRange", 0, maReplace );  // alpha clip always full range
+        vsapi->mapConsumeFrame( vsapi->getFramePropertiesRW( vs_frame ), "_Alpha", vs_alpha, maAppend );
     }
     int top = -1;
     if ( vohp->repeat_control && vohp->repeat_requested )
@@ -303,7 +352,39 @@ static const VSFrameRef *VS_CC vs_filter_get_frame( int n, int activation_reason
         bottom = ( vohp->frame_order_list[n].bottom == vohp->frame_order_list[sample_number].bottom ) ? vohp->frame_order_list[n - 1].bottom :
             vohp->frame_order_list[n].bottom;
     }
-    set_frame_properties( vdhp, vi, av_frame, vs_frame, sample_number, top, bottom, vsapi, n );
+    vs_set_frame_properties( av_frame, NULL, duration_num, duration_den, vs_frame, top, bottom, vsapi, n );
+    return vs_frame;
+}
+
+static const VSFrame *VS_CC vs_filter_get_frame( int n, int activation_reason, void *instance_data, void **frame_data, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi )
+{
+    if( activation_reason != arInitial )
+        return NULL;
+    lsmas_handler_t *hp = (lsmas_handler_t *)instance_data;
+    uint32_t sample_number = MIN( n + 1, hp->vi.numFrames );   /* For L-SMASH, sample_number is 1-origin. */
+    AVFrame *av_frame = av_frame_alloc();
+    if( !av_frame )
+    {
+        vsapi->setFilterError( "lsmas: failed to allocate a video frame buffer.", frame_ctx );
+        return NULL;
+    }
+    /* Only decoding holds the decoder, and the output frame is made after releasing it
+     * so that the next request can be decoded meanwhile.
+     * The frames rendered by the decoder directly are just referenced, so there is nothing to overlap. */
+    acquire_decoder( hp, sample_number );
+    int      direct       = ((vs_video_output_handler_t *)hp->vohp->private_handler)->direct_rendering;
+    int64_t  duration_num = 0;
+    int64_t  duration_den = 0;
+    VSFrame *vs_frame     = NULL;
+    int ret = decode_frame( hp, sample_number, av_frame, &duration_num, &duration_den, frame_ctx, vsapi );
+    if( ret == 0 && direct )
+        vs_frame = output_frame( hp, av_frame, duration_num, duration_den, n, sample_number, frame_ctx, vsapi );
+    release_decoder( hp );
+    if( ret == 0 && !direct )
+        vs_frame = output_frame( hp, av_frame, duration_num, duration_den, n, sample_number, frame_ctx, vsapi );
+    else if( ret < 0 )
+        vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
+    av_frame_free( &av_frame );
     return vs_frame;
 }
 
@@ -327,14 +408,39 @@ static uint32_t open_file
     return movie_param.number_of_tracks;
 }
 
+static void set_av_log_level
+(
+    int64_t level
+)
+{
+    if( level <= 0 )
+        av_log_set_level( AV_LOG_QUIET );
+    else if( level == 1 )
+        av_log_set_level( AV_LOG_PANIC );
+    else if( level == 2 )
+        av_log_set_level( AV_LOG_FATAL );
+    else if( level == 3 )
+        av_log_set_level( AV_LOG_ERROR );
+    else if( level == 4 )
+        av_log_set_level( AV_LOG_WARNING );
+    else if( level == 5 )
+        av_log_set_level( AV_LOG_INFO );
+    else if( level == 6 )
+        av_log_set_level( AV_LOG_VERBOSE );
+    else if( level == 7 )
+        av_log_set_level( AV_LOG_DEBUG );
+    else
+        av_log_set_level( AV_LOG_TRACE );
+}
+
 void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi )
 {
-    const char *file_name = vsapi->propGetData( in, "source", 0, NULL );
+    const char *file_name = vsapi->mapGetData( in, "source", 0, NULL );
     /* Allocate the handler of this plugin. */
     lsmas_handler_t *hp = alloc_handler();
     if( !hp )
     {
-        vsapi->setError( out, "lsmas: failed to allocate the handler." );
+        vsapi->mapSetError( out, "lsmas: failed to allocate the handler." );
         return;
     }
     libavsmash_video_decode_handler_t *vdhp = hp->vdhp;
@@ -343,7 +449,7 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
     if( !vs_vohp )
     {
         free_handler( &hp );
-        vsapi->setError( out, "lsmas: failed to allocate the VapourSynth video output handler." );
+        vsapi->mapSetError( out, "lsmas: failed to allocate the VapourSynth video output handler." );
         return;
     }
     /* Set up VapourSynth error handler. */
@@ -361,7 +467,7 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
     if( number_of_tracks == 0 )
     {
         free_handler( &hp );
-        vsapi->setError( out, "lsmas: failed to open file." );
+        vsapi->mapSetError( out, "lsmas: failed to open file." );
         return;
     }
     /* Get options. */
@@ -378,6 +484,7 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
     const char *format;
     const char *preferred_decoder_names;
     const char *ff_options;
+    const char *timecodes;
     set_option_int64 ( &track_number,            0,    "track",          in, vsapi );
     set_option_int64 ( &threads,                 0,    "threads",        in, vsapi );
     set_option_int64 ( &seek_mode,               0,    "seek_mode",      in, vsapi );
@@ -391,6 +498,7 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
     set_option_string( &format,                  NULL, "format",         in, vsapi );
     set_option_string( &preferred_decoder_names, NULL, "decoder",        in, vsapi );
     set_option_string( &ff_options,              NULL, "ff_options",     in, vsapi);
+    set_option_string( &timecodes,               NULL, "timecodes",      in, vsapi );
     set_preferred_decoder_names_on_buf( hp->preferred_decoder_names_buf, preferred_decoder_names );
     libavsmash_video_set_seek_mode              ( vdhp, CLIP_VALUE( seek_mode,      0, 2 ) );
     libavsmash_video_set_forward_seek_threshold ( vdhp, CLIP_VALUE( seek_threshold, 1, 999 ) );
@@ -403,24 +511,7 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
     vs_vohp->variable_info               = CLIP_VALUE( variable_info,  0, 1 );
     vs_vohp->direct_rendering            = CLIP_VALUE( direct_rendering,  0, 1 ) && !format;
     vs_vohp->vs_output_pixel_format = vs_vohp->variable_info ? pfNone : get_vs_output_pixel_format( format );
-    if( ff_loglevel <= 0 )
-        av_log_set_level( AV_LOG_QUIET );
-    else if( ff_loglevel == 1 )
-        av_log_set_level( AV_LOG_PANIC );
-    else if( ff_loglevel == 2 )
-        av_log_set_level( AV_LOG_FATAL );
-    else if( ff_loglevel == 3 )
-        av_log_set_level( AV_LOG_ERROR );
-    else if( ff_loglevel == 4 )
-        av_log_set_level( AV_LOG_WARNING );
-    else if( ff_loglevel == 5 )
-        av_log_set_level( AV_LOG_INFO );
-    else if( ff_loglevel == 6 )
-        av_log_set_level( AV_LOG_VERBOSE );
-    else if( ff_loglevel == 7 )
-        av_log_set_level( AV_LOG_DEBUG );
-    else
-        av_log_set_level( AV_LOG_TRACE );
+    set_av_log_level( ff_loglevel );
     if( track_number && track_number > number_of_tracks )
     {
         free_handler( &hp );
@@ -432,7 +523,7 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
     if( libavsmash_video_get_track( vdhp, track_number ) < 0 )
     {
         free_handler( &hp );
-        vsapi->setError( out, "lsmas: failed to get video track." );
+        vsapi->mapSetError( out, "lsmas: failed to get video track." );
         return;
     }
     /* Set up decoders for this track. */
@@ -442,6 +533,356 @@ void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_d
         free_handler( &hp );
         return;
     }
+    /* The timecodes are of the samples, which are output as they are unless converted into CFR. */
+    if( timecodes && !vohp->vfr2cfr )
+    {
+        uint32_t timestamp_count;
+        const lw_video_timestamp_t *timestamp_list = libavsmash_video_get_timestamp_list( vdhp, &timestamp_count );
+        if( lw_write_timecodes_v2( timecodes, timestamp_list, timestamp_count, vohp->frame_count,
+                                   1, libavsmash_video_get_media_timescale( vdhp ) ) < 0 )
+        {
+            free_handler( &hp );
+            set_error_on_init( out, vsapi, "lsmas: failed to write the timecodes file %s.", timecodes );
+            return;
+        }
+    }
     lsmash_discard_boxes( libavsmash_video_get_root( vdhp ) );
-    vsapi->createFilter( in, out, "LibavSMASHSource", vs_filter_init, vs_filter_get_frame, vs_filter_free, fmUnordered, nfMakeLinear, hp, core );
+    /* The requests are serialized by the decoder lock, so let VapourSynth call us in parallel. */
+    VSNode *node = vsapi->createVideoFilter2( "LibavSMASHSource", &hp->vi, vs_filter_get_frame, vs_filter_free, fmParallel, NULL, 0, hp, core );
+    vsapi->setLinearFilter( node );
+    vsapi->mapConsumeNode( out, "clip", node, maAppend );
+}
+
+typedef struct
+{
+    VSAudioInfo                        ai;
+    libavsmash_audio_decode_handler_t *adhp;
+    libavsmash_audio_output_handler_t *aohp;
+    lsmash_file_parameters_t           file_param;
+    AVFormatContext                   *format_ctx;
+    vs_basic_handler_t                 vsbh;
+    uint8_t                           *buffer;      /* packed PCM samples for an output frame */
+    char preferred_decoder_names_buf[PREFERRED_DECODER_NAMES_BUFSIZE];
+} lsmas_audio_handler_t;
+
+/* Deallocate the handler of the audio filter. */
+static void free_audio_handler
+(
+    lsmas_audio_handler_t **hpp
+)
+{
+    if( !hpp || !*hpp )
+        return;
+    lsmas_audio_handler_t *hp = *hpp;
+    lsmash_root_t *root = libavsmash_audio_get_root( hp->adhp );
+    lw_free( libavsmash_audio_get_preferred_decoder_names( hp->adhp ) );
+    libavsmash_audio_free_decode_handler( hp->adhp );
+    libavsmash_audio_free_output_handler( hp->aohp );
+    lw_free( hp->buffer );
+    avformat_close_input( &hp->format_ctx );
+    lsmash_close_file( &hp->file_param );
+    lsmash_destroy_root( root );
+    lw_free( hp );
+}
+
+/* Allocate the handler of the audio filter. */
+static lsmas_audio_handler_t *alloc_audio_handler
+(
+    void
+)
+{
+    lsmas_audio_handler_t *hp = (lsmas_audio_handler_t *)lw_malloc_zero( sizeof(lsmas_audio_handler_t) );
+    if( !hp )
+        return NULL;
+    if( !(hp->adhp = libavsmash_audio_alloc_decode_handler())
+     || !(hp->aohp = libavsmash_audio_alloc_output_handler()) )
+    {
+        free_audio_handler( &hp );
+        return NULL;
+    }
+    return hp;
+}
+
+static int64_t get_start_time
+(
+    lsmash_root_t *root,
+    uint32_t       track_id
+)
+{
+    /* Consider start time of this media if any non-empty edit is present. */
+    uint32_t edit_count = lsmash_count_explicit_timeline_map( root, track_id );
+    for( uint32_t edit_number = 1; edit_number <= edit_count; edit_number++ )
+    {
+        lsmash_edit_t edit;
+        if( lsmash_get_explicit_timeline_map( root, track_id, edit_number, &edit ) )
+            return 0;
+        if( edit.duration == 0 )
+            return 0;   /* no edits */
+        if( edit.start_time >= 0 )
+            return edit.start_time;
+    }
+    return 0;
+}
+
+static char *duplicate_as_string
+(
+    void   *src,
+    size_t  length
+)
+{
+    char *dst = (char *)lw_malloc_zero( length + 1 );
+    if( !dst )
+        return NULL;
+    memcpy( dst, src, length );
+    return dst;
+}
+
+/* Get the number of the priming samples from iTunSMPB if present. Return 0 on success. */
+static int get_itunes_priming_samples
+(
+    lsmash_root_t *root,
+    uint32_t      *priming_samples
+)
+{
+    uint32_t itunes_metadata_count = lsmash_count_itunes_metadata( root );
+    for( uint32_t i = 1; i <= itunes_metadata_count; i++ )
+    {
+        lsmash_itunes_metadata_t metadata;
+        if( lsmash_get_itunes_metadata( root, i, &metadata ) < 0 )
+            continue;
+        if( metadata.item != ITUNES_METADATA_ITEM_CUSTOM
+         || (metadata.type != ITUNES_METADATA_TYPE_STRING && metadata.type != ITUNES_METADATA_TYPE_BINARY)
+         || !metadata.meaning || !metadata.name
+         || memcmp( "com.apple.iTunes", metadata.meaning, strlen( metadata.meaning ) )
+         || memcmp( "iTunSMPB", metadata.name, strlen( metadata.name ) ) )
+        {
+            lsmash_cleanup_itunes_metadata( &metadata );
+            continue;
+        }
+        char *value = NULL;
+        if( metadata.type == ITUNES_METADATA_TYPE_STRING )
+        {
+            size_t length = strlen( metadata.value.string );
+            if( length >= 116 )
+                value = duplicate_as_string( metadata.value.string, length );
+        }
+        else    /* metadata.type == ITUNES_METADATA_TYPE_BINARY */
+        {
+            if( metadata.value.binary.size >= 116 )
+                value = duplicate_as_string( metadata.value.binary.data, metadata.value.binary.size );
+        }
+        lsmash_cleanup_itunes_metadata( &metadata );
+        if( !value )
+            continue;
+        uint32_t dummy[9];
+        uint32_t padding;
+        uint64_t duration;
+        int ret = sscanf( value, " %x %x %x %" SCNx64 " %x %x %x %x %x %x %x %x",
+                          &dummy[0], priming_samples, &padding, &duration, &dummy[1], &dummy[2],
+                          &dummy[3], &dummy[4], &dummy[5], &dummy[6], &dummy[7], &dummy[8] );
+        lw_free( value );
+        if( ret == 12 )
+            return 0;
+    }
+    return -1;
+}
+
+static int count_output_audio_samples
+(
+    lsmas_audio_handler_t *hp,
+    int                    skip_priming,
+    VSMap                 *out,
+    const VSAPI           *vsapi
+)
+{
+    libavsmash_audio_decode_handler_t *adhp = hp->adhp;
+    libavsmash_audio_output_handler_t *aohp = hp->aohp;
+    lsmash_root_t *root     = libavsmash_audio_get_root( adhp );
+    uint32_t       track_id = libavsmash_audio_get_track_id( adhp );
+    uint64_t start_time = 0;
+    if( skip_priming )
+    {
+        uint32_t media_timescale = libavsmash_audio_get_media_timescale( adhp );
+        uint32_t priming_samples;
+        if( get_itunes_priming_samples( root, &priming_samples ) == 0 )
+        {
+            libavsmash_audio_set_implicit_preroll( adhp );
+            start_time = av_rescale( priming_samples, media_timescale, aohp->output_sample_rate );
+            aohp->skip_decoded_samples = priming_samples;
+        }
+        if( aohp->skip_decoded_samples == 0 )
+        {
+            uint32_t ctd_shift;
+            if( lsmash_get_composition_to_decode_shift_from_media_timeline( root, track_id, &ctd_shift ) )
+            {
+                vsapi->mapSetError( out, "lsmas: failed to get the timeline shift." );
+                return -1;
+            }
+            start_time = ctd_shift + get_start_time( root, track_id );
+            aohp->skip_decoded_samples = av_rescale( start_time, aohp->output_sample_rate, media_timescale );
+        }
+    }
+    hp->ai.numSamples = libavsmash_audio_count_overall_pcm_samples( adhp, aohp->output_sample_rate, start_time );
+    if( hp->ai.numSamples == 0 )
+    {
+        vsapi->mapSetError( out, "lsmas: no valid audio frame." );
+        return -1;
+    }
+    hp->ai.numFrames = (int)((hp->ai.numSamples + VS_AUDIO_FRAME_SAMPLES - 1) / VS_AUDIO_FRAME_SAMPLES);
+    return 0;
+}
+
+static int prepare_audio_decoding
+(
+    lsmas_audio_handler_t *hp,
+    const char            *channel_layout,
+    int                    sample_rate,
+    int                    skip_priming,
+    VSMap                 *out,
+    VSCore                *core,
+    const VSAPI           *vsapi
+)
+{
+    libavsmash_audio_decode_handler_t *adhp = hp->adhp;
+    libavsmash_audio_output_handler_t *aohp = hp->aohp;
+    /* Initialize the audio decoder configuration. */
+    if( libavsmash_audio_initialize_decoder_configuration( adhp, hp->format_ctx, 0 ) < 0 )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to initialize the decoder configuration." );
+        return -1;
+    }
+    av_channel_layout_from_mask( &aohp->output_channel_layout, libavsmash_audio_get_best_used_channel_layout( adhp ) );
+    aohp->output_sample_format   = libavsmash_audio_get_best_used_sample_format  ( adhp );
+    aohp->output_sample_rate     = libavsmash_audio_get_best_used_sample_rate    ( adhp );
+    aohp->output_bits_per_sample = libavsmash_audio_get_best_used_bits_per_sample( adhp );
+    AVCodecContext *ctx = libavsmash_audio_get_codec_context( adhp );
+    if( vs_setup_audio_rendering( aohp, ctx, &hp->ai, out, core, vsapi, channel_layout, sample_rate ) < 0
+     || count_output_audio_samples( hp, skip_priming, out, vsapi ) < 0 )
+        return -1;
+    /* The samples are resampled into this buffer once and deinterleaved into each output frame. */
+    hp->buffer = (uint8_t *)lw_malloc_zero( (size_t)VS_AUDIO_FRAME_SAMPLES * aohp->output_block_align );
+    if( !hp->buffer )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to allocate the audio buffer." );
+        return -1;
+    }
+    /* Force seeking at the first reading. */
+    libavsmash_audio_force_seek( adhp );
+    return 0;
+}
+
+static const VSFrame *VS_CC vs_audio_get_frame( int n, int activation_reason, void *instance_data, void **frame_data, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi )
+{
+    if( activation_reason != arInitial )
+        return NULL;
+    lsmas_audio_handler_t *hp = (lsmas_audio_handler_t *)instance_data;
+    int64_t start  = (int64_t)n * VS_AUDIO_FRAME_SAMPLES;
+    int     length = (int)MIN( hp->ai.numSamples - start, VS_AUDIO_FRAME_SAMPLES );
+    VSFrame *vs_frame = vsapi->newAudioFrame( &hp->ai.format, length, NULL, core );
+    if( !vs_frame )
+    {
+        vsapi->setFilterError( "lsmas: failed to allocate an audio frame.", frame_ctx );
+        return NULL;
+    }
+    hp->vsbh.frame_ctx = frame_ctx;
+    hp->vsbh.vsapi     = vsapi;
+    int output_length = (int)MIN( libavsmash_audio_get_pcm_samples( hp->adhp, hp->aohp, hp->buffer, start, length ), length );
+    if( libavsmash_audio_get_error( hp->adhp ) )
+    {
+        vsapi->freeFrame( vs_frame );
+        vsapi->setFilterError( "lsmas: failed to output audio samples.", frame_ctx );
+        return NULL;
+    }
+    vs_deinterleave_audio_samples( vs_frame, 0, hp->buffer, output_length, vsapi );
+    vs_put_silence_audio_samples( vs_frame, output_length, length - output_length, vsapi );
+    return vs_frame;
+}
+
+static void VS_CC vs_audio_free( void *instance_data, VSCore *core, const VSAPI *vsapi )
+{
+    free_audio_handler( (lsmas_audio_handler_t **)&instance_data );
+}
+
+void VS_CC vs_libavsmashaudiosource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi )
+{
+    const char *file_name = vsapi->mapGetData( in, "source", 0, NULL );
+    /* Allocate the handler of this plugin. */
+    lsmas_audio_handler_t *hp = alloc_audio_handler();
+    if( !hp )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to allocate the audio handler." );
+        return;
+    }
+    libavsmash_audio_decode_handler_t *adhp = hp->adhp;
+    /* Set up VapourSynth error handler. */
+    hp->vsbh.out       = out;
+    hp->vsbh.frame_ctx = NULL;
+    hp->vsbh.vsapi     = vsapi;
+    /* Set up log handler. */
+    lw_log_handler_t *lhp = libavsmash_audio_get_log_handler( adhp );
+    lhp->level    = LW_LOG_FATAL;
+    lhp->priv     = &hp->vsbh;
+    lhp->show_log = set_error;
+    /* Open source file. */
+    lsmash_movie_parameters_t movie_param;
+    lsmash_root_t *root = libavsmash_open_file( &hp->format_ctx, file_name, &hp->file_param, &movie_param, lhp );
+    if( !root )
+    {
+        free_audio_handler( &hp );
+        vsapi->mapSetError( out, "lsmas: failed to open file." );
+        return;
+    }
+    libavsmash_audio_set_root( adhp, root );
+    uint32_t number_of_tracks = movie_param.number_of_tracks;
+    /* Get options. */
+    int64_t track_number;
+    int64_t skip_priming;
+    int64_t sample_rate;
+    int64_t ff_loglevel;
+    int64_t cache_mb;
+    double  drc;
+    const char *channel_layout;
+    const char *preferred_decoder_names;
+    const char *ff_options;
+    set_option_int64 ( &track_number,            0,    "track",          in, vsapi );
+    set_option_int64 ( &skip_priming,            1,    "skip_priming",   in, vsapi );
+    set_option_int64 ( &sample_rate,             0,    "rate",           in, vsapi );
+    set_option_int64 ( &ff_loglevel,             0,    "ff_loglevel",    in, vsapi );
+    set_option_int64 ( &cache_mb,                0,    "cache_mb",       in, vsapi );
+    set_option_double( &drc,                     -1.0, "drc_scale",      in, vsapi );
+    set_option_string( &channel_layout,          NULL, "layout",         in, vsapi );
+    set_option_string( &preferred_decoder_names, NULL, "decoder",        in, vsapi );
+    set_option_string( &ff_options,              NULL, "ff_options",     in, vsapi );
+    set_preferred_decoder_names_on_buf( hp->preferred_decoder_names_buf, preferred_decoder_names );
+    libavsmash_audio_set_preferred_decoder_names( adhp, tokenize_preferred_decoder_names( hp->preferred_decoder_names_buf ) );
+    libavsmash_audio_set_drc                    ( adhp, drc );
+    libavsmash_audio_set_decoder_options        ( adhp, ff_options );
+    set_av_log_level( ff_loglevel );
+    if( track_number && track_number > number_of_tracks )
+    {
+        free_audio_handler( &hp );
+        set_error_on_init( out, vsapi, "lsmas: the number of tracks equals %" PRIu32 ".", number_of_tracks );
+        return;
+    }
+    /* Get audio track. */
+    if( libavsmash_audio_get_track( adhp, track_number ) < 0 )
+    {
+        free_audio_handler( &hp );
+        vsapi->mapSetError( out, "lsmas: failed to get audio track." );
+        return;
+    }
+    /* Set up the decoder for this track. */
+    if( prepare_audio_decoding( hp, channel_layout, (int)sample_rate, CLIP_VALUE( skip_priming, 0, 1 ), out, core, vsapi ) < 0 )
+    {
+        free_audio_handler( &hp );
+        return;
+    }
+    lsmash_discard_boxes( libavsmash_audio_get_root( adhp ) );
+    hp->aohp->block_cache_budget = (size_t)MAX( cache_mb, 0 ) << 20;
+    /* The errors on reading are reported to the frame context from now on. */
+    hp->vsbh.out = NULL;
+    /* The decoder is shared by all requests, so they shall be serialized and should come in order. */
+    VSNode *node = vsapi->createAudioFilter2( "LibavSMASHAudioSource", &hp->ai, vs_audio_get_frame, vs_audio_free, fmUnordered, NULL, 0, hp, core );
+    vsapi->setLinearFilter( node );
+    vsapi->mapConsumeNode( out, "clip", node, maAppend );
 }
@@ -47,7 +47,7 @@ void set_error
     if( !eh || !eh->vsapi )
         return;
     if( eh->out )
-        eh->vsapi->setError( eh->out, message );
+        eh->vsapi->mapSetError( eh->out, message );
     else if( eh->frame_ctx )
         eh->vsapi->setFilterError( message, eh->frame_ctx );
 }
@@ -65,55 +65,79 @@ void set_error_on_init
     va_start( args, format );
     vsnprintf( message, sizeof message, format, args );
     va_end( args );
-    vsapi->setError( out, message );
+    vsapi->mapSetError( out, message );
 }
 
 extern void VS_CC vs_libavsmashsource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi );
 extern void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi );
+extern void VS_CC vs_libavsmashaudiosource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi );
+extern void VS_CC vs_lwlibavaudiosource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi );
 
 /*void VS_CC vs_version_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi )
 {
-    vsapi->propSetData(out, "version", VERSION, -1, paAppend);
-    vsapi->propSetData(out, "config", config_opts, -1, paAppend);
-    vsapi->propSetData(out, "ffmpeg_version", FFMPEG_VERSION, -1, paAppend);
-    vsapi->propSetData(out, "ffmpeg_version", LIBAVCODEC_IDENT, -1, paAppend);
-    vsapi->propSetData(out, "ffmpeg_version", LIBAVFORMAT_IDENT, -1, paAppend);
-    vsapi->propSetData(out, "ffmpeg_version", LIBAVUTIL_IDENT, -1, paAppend);
-    vsapi->propSetData(out, "ffmpeg_version", LIBSWSCALE_IDENT, -1, paAppend);
+    vsapi->mapSetData(out, "version", VERSION, -1, dtUtf8, maAppend);
+    vsapi->mapSetData(out, "config", config_opts, -1, dtUtf8, maAppend);
+    vsapi->mapSetData(out, "ffmpeg_version", FFMPEG_VERSION, -1, dtUtf8, maAppend);
+    vsapi->mapSetData(out, "ffmpeg_version", LIBAVCODEC_IDENT, -1, dtUtf8, maAppend);
+    vsapi->mapSetData(out, "ffmpeg_version", LIBAVFORMAT_IDENT, -1, dtUtf8, maAppend);
+    vsapi->mapSetData(out, "ffmpeg_version", LIBAVUTIL_IDENT, -1, dtUtf8, maAppend);
+    vsapi->mapSetData(out, "ffmpeg_version", LIBSWSCALE_IDENT, -1, dtUtf8, maAppend);
 }*/
 
-VS_EXTERNAL_API(void) VapourSynthPluginInit( VSConfigPlugin config_func, VSRegisterFunction register_func, VSPlugin *plugin )
+VS_EXTERNAL_API(void) VapourSynthPluginInit2( VSPlugin *plugin, const VSPLUGINAPI *vspapi )
 {
-    config_func
+    vspapi->configPlugin
     (
         "systems.innocent.lsmas",
         "lsmas",
         "LSMASHSource for VapourSynth",
+        VS_MAKE_VERSION( 1, 0 ),
         VAPOURSYNTH_API_VERSION,
-        1,
+        0,
         plugin
     );
 #define COMMON_OPTS "threads:int:opt;seek_mode:int:opt;seek_threshold:int:opt;dr:int:opt;fpsnum:int:opt;fpsden:int:opt;variable:int:opt;format:data:opt;decoder:data:opt;prefer_hw:int:opt;"
-    register_func
+    vspapi->registerFunction
     (
         "LibavSMASHSource",
-        "source:data;track:int:opt;" COMMON_OPTS "ff_loglevel:int:opt;ff_options:data:opt;",
+        "source:data;track:int:opt;" COMMON_OPTS "ff_loglevel:int:opt;ff_options:data:opt;timecodes:data:opt;",
+        "clip:vnode;",
         vs_libavsmashsource_create,
         NULL,
         plugin
     );
-    register_func
+    vspapi->registerFunction
     (
         "LWLibavSource",
-        "source:data;stream_index:int:opt;cache:int:opt;cachefile:data:opt;" COMMON_OPTS "repeat:int:opt;dominance:int:opt;ff_loglevel:int:opt;cachedir:data:opt;ff_options:data:opt;",
+        "source:data;stream_index:int:opt;cache:int:opt;cachefile:data:opt;" COMMON_OPTS "repeat:int:opt;dominance:int:opt;ff_loglevel:int:opt;cachedir:data:opt;ff_options:data:opt;decoders:int:opt;prefetch:int:opt;cache_mb:int:opt;seek_hint:int:opt;pipeline:int:opt;read_ahead:int:opt;direct_io:int:opt;selective_index:int:opt;range_index:int:opt;timecodes:data:opt;",
+        "clip:vnode;",
         vs_lwlibavsource_create,
         NULL,
         plugin
     );
-    /*register_func
+    vspapi->registerFunction
+    (
+        "LibavSMASHAudioSource",
+        "source:data;track:int:opt;skip_priming:int:opt;layout:data:opt;rate:int:opt;decoder:data:opt;ff_loglevel:int:opt;drc_scale:float:opt;ff_options:data:opt;cache_mb:int:opt;",
+        "clip:anode;",
+        vs_libavsmashaudiosource_create,
+        NULL,
+        plugin
+    );
+    vspapi->registerFunction
+    (
+        "LWLibavAudioSource",
+        "source:data;stream_index:int:opt;cache:int:opt;cachefile:data:opt;av_sync:int:opt;layout:data:opt;rate:int:opt;decoder:data:opt;ff_loglevel:int:opt;cachedir:data:opt;drc_scale:float:opt;ff_options:data:opt;cache_mb:int:opt;read_ahead:int:opt;direct_io:int:opt;selective_index:int:opt;range_index:int:opt;",
+        "clip:anode;",
+        vs_lwlibavaudiosource_create,
+        NULL,
+        plugin
+    );
+    /*vspapi->registerFunction
     (
         "Version",
         "",
+        "version:data;config:data;ffmpeg_version:data[];",
         vs_version_create,
         NULL,
         plugin
@@ -21,7 +21,7 @@
 /* This file is available under an ISC license.
  * However, when distributing its binary file, it will be under LGPL or GPL. */
 
-#include <VapourSynth.h>
+#include <VapourSynth4.h>
 
 #include "../common/utils.h"
 
@@ -59,7 +59,22 @@ static inline void set_option_int64
 )
 {
     int e;
-    *opt = vsapi->propGetInt( in, arg, 0, &e );
+    *opt = vsapi->mapGetInt( in, arg, 0, &e );
+    if( e )
+        *opt = default_value;
+}
+
+static inline void set_option_double
+(
+    double      *opt,
+    double       default_value,
+    const char  *arg,
+    const VSMap *in,
+    const VSAPI *vsapi
+)
+{
+    int e;
+    *opt = vsapi->mapGetFloat( in, arg, 0, &e );
     if( e )
         *opt = default_value;
 }
@@ -74,7 +89,7 @@ static inline void set_option_string
 )
 {
     int e;
-    *opt = vsapi->propGetData( in, arg, 0, &e );
+    *opt = vsapi->mapGetData( in, arg, 0, &e );
     if( e )
         *opt = default_value;
 }
@@ -100,6 +115,52 @@ static inline const char **tokenize_preferred_decoder_names
     return lw_tokenize_string( preferred_decoder_names_buf, ',', NULL );
 }
 
+/* The list of requests waiting for a decoder.
+ * The filters run in parallel mode, so the requests are handed over to a decoder in ascending order of frame number
+ * to keep decoding forward even if VapourSynth calls them out of order. */
+typedef struct vs_waiter_tag
+{
+    uint32_t              frame_number;
+    struct vs_waiter_tag *next;
+} vs_waiter_t;
+
+static inline void vs_add_waiter
+(
+    vs_waiter_t **list,
+    vs_waiter_t  *waiter
+)
+{
+    waiter->next = *list;
+    *list        = waiter;
+}
+
+static inline void vs_remove_waiter
+(
+    vs_waiter_t **list,
+    vs_waiter_t  *waiter
+)
+{
+    for( ; *list; list = &(*list)->next )
+        if( *list == waiter )
+        {
+            *list = waiter->next;
+            break;
+        }
+}
+
+/* Return 1 if no other waiter requests an earlier frame. */
+static inline int vs_is_earliest_waiter
+(
+    vs_waiter_t *list,
+    vs_waiter_t *waiter
+)
+{
+    for( ; list; list = list->next )
+        if( list->frame_number < waiter->frame_number )
+            return 0;
+    return 1;
+}
+
 #ifdef SSE2_ENABLED
 void planar_yuv_sse2(uint16_t* dstp_y, uint16_t* dstp_u, uint16_t* dstp_v, uint16_t* srcp_y, uint16_t* srcp_uv, const int dst_stride_y, const int dst_stride_uv, const int src_stride_y, const int src_stride_uv,
     const int width_y, const int width_uv, const int height_y, const int height_uv);
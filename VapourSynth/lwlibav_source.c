@@ -30,49 +30,11 @@
 #include <libswresample/swresample.h>   /* Audio resampler */
 #include <libavutil/imgutils.h>
 
-#include "../common/audio_output.h"
-#ifndef _MSC_VER
-/* Dummy definitions.
- * Audio resampler/buffer is NOT used at all in this filter. */
-typedef void AVAudioResampleContext;
-typedef void audio_samples_t;
-int flush_resampler_buffers( AVAudioResampleContext *avr ){ return 0; }
-int update_resampler_configuration( AVAudioResampleContext *avr,
-                                    uint64_t out_channel_layout, int out_sample_rate, enum AVSampleFormat out_sample_fmt,
-                                    uint64_t  in_channel_layout, int  in_sample_rate, enum AVSampleFormat  in_sample_fmt,
-                                    int *input_planes, int *input_block_align ){ return 0; }
-int resample_audio( AVAudioResampleContext *avr, audio_samples_t *out, audio_samples_t *in ){ return 0; }
-uint64_t output_pcm_samples_from_buffer
-(
-    lw_audio_output_handler_t *aohp,
-    AVFrame                   *frame_buffer,
-    uint8_t                  **output_buffer,
-    enum audio_output_flag    *output_flags
-)
-{
-    return 0;
-}
-
-uint64_t output_pcm_samples_from_packet
-(
-    lw_audio_output_handler_t *aohp,
-    AVCodecContext            *ctx,
-    AVPacket                  *pkt,
-    AVFrame                   *frame_buffer,
-    uint8_t                  **output_buffer,
-    enum audio_output_flag    *output_flags
-)
-{
-    return 0;
-}
-
-void lw_cleanup_audio_output_handler( lw_audio_output_handler_t *aohp ){ }
-#endif
-
 #include <stdio.h>
 #include <string.h>
 #include "lsmashsource.h"
 #include "video_output.h"
+#include "audio_output.h"
 
 #include "../common/progress.h"
 #include "../common/lwlibav_dec.h"
@@ -80,15 +42,35 @@ void lw_cleanup_audio_output_handler( lw_audio_output_handler_t *aohp ){ }
 #include "../common/lwlibav_video_internal.h"
 #include "../common/lwlibav_audio.h"
 #include "../common/lwindex.h"
+#include "../common/osdep.h"
+
+#define MAX_NUM_DECODERS 16
 
 typedef struct
 {
-    VSVideoInfo                     vi[2];
+    lwlibav_video_decode_handler_t *vdhp;
+    lwlibav_video_output_handler_t *vohp;
+    lw_mutex_t                     *output_mutex;       /* for the scaler and the frame makers of 'vohp' */
+    uint32_t                        last_frame_number;  /* the last requested frame number; 0 = none */
+    uint64_t                        last_used;
+    int                             busy;
+} lwlibav_decoder_t;
+
+typedef struct
+{
+    VSVideoInfo                     vi;
     lwlibav_file_handler_t          lwh;
     lwlibav_video_decode_handler_t *vdhp;
     lwlibav_video_output_handler_t *vohp;
     lwlibav_audio_decode_handler_t *adhp;
     lwlibav_audio_output_handler_t *aohp;
+    /* The pool of decoders sharing the index of 'vdhp', which is the first one. */
+    int                             number_of_decoders;
+    lwlibav_decoder_t               decoders[MAX_NUM_DECODERS];
+    lw_mutex_t                     *decoder_mutex;
+    lw_cond_t                      *decoder_cond;
+    vs_waiter_t                    *waiters;
+    uint64_t                        decoder_clock;
     char preferred_decoder_names_buf[PREFERRED_DECODER_NAMES_BUFSIZE];
 } lwlibav_handler_t;
 
@@ -101,6 +83,19 @@ static void free_handler
     if( !hpp || !*hpp )
         return;
     lwlibav_handler_t *hp = *hpp;
+    /* The duplicated decoders refer to the index owned by the first one, so free them first. */
+    for( int i = 1; i < hp->number_of_decoders; i++ )
+    {
+        lwlibav_video_free_decode_handler( hp->decoders[i].vdhp );
+        lwlibav_video_free_output_handler( hp->decoders[i].vohp );
+    }
+    for( int i = 0; i < hp->number_of_decoders; i++ )
+        if( hp->decoders[i].output_mutex )
+            lw_mutex_destroy( hp->decoders[i].output_mutex );
+    if( hp->decoder_cond )
+        lw_cond_destroy( hp->decoder_cond );
+    if( hp->decoder_mutex )
+        lw_mutex_destroy( hp->decoder_mutex );
     lw_free( lwlibav_video_get_preferred_decoder_names( hp->vdhp ) );
     lwlibav_video_free_decode_handler( hp->vdhp );
     lwlibav_video_free_output_handler( hp->vohp );
@@ -147,19 +142,12 @@ static void close_indicator( progress_handler_t *php )
     fprintf( stderr, "\n" );
 }
 
-static void VS_CC vs_filter_init( VSMap *in, VSMap *out, void **instance_data, VSNode *node, VSCore *core, const VSAPI *vsapi )
-{
-    lwlibav_handler_t *hp = (lwlibav_handler_t *)*instance_data;
-    AVCodecContext *ctx = lwlibav_video_get_codec_context( hp->vdhp );
-    vsapi->setVideoInfo( hp->vi, (av_pix_fmt_desc_get( ctx->pix_fmt )->flags & AV_PIX_FMT_FLAG_ALPHA) ? 2 : 1, node );
-}
-
 static void set_frame_properties
 (
     VSVideoInfo *vi,
     AVFrame     *av_frame,
     AVStream    *stream,
-    VSFrameRef  *vs_frame,
+    VSFrame     *vs_frame,
     int          top,
     int          bottom,
     const VSAPI *vsapi,
@@ -174,15 +162,14 @@ static void set_frame_properties
 
 static int prepare_video_decoding
 (
-    lwlibav_handler_t *hp,
-    VSMap             *out,
-    VSCore            *core,
-    const VSAPI       *vsapi
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    VSVideoInfo                    *vi,
+    VSMap                          *out,
+    VSCore                         *core,
+    const VSAPI                    *vsapi
 )
 {
-    lwlibav_video_decode_handler_t *vdhp = hp->vdhp;
-    lwlibav_video_output_handler_t *vohp = hp->vohp;
-    VSVideoInfo                    *vi   = &hp->vi[0];
     /* Import AVIndexEntrys. */
     if( lwlibav_import_av_index_entry( (lwlibav_decode_handler_t *)vdhp ) < 0 )
         return -1;
@@ -190,9 +177,8 @@ static int prepare_video_decoding
     lwlibav_video_set_initial_input_format( vdhp );
     AVCodecContext *ctx = lwlibav_video_get_codec_context( vdhp );
     vs_video_output_handler_t *vs_vohp = (vs_video_output_handler_t *)vohp->private_handler;
-    vs_vohp->frame_ctx = NULL;
-    vs_vohp->core      = core;
-    vs_vohp->vsapi     = vsapi;
+    vs_vohp->core  = core;
+    vs_vohp->vsapi = vsapi;
     int max_width  = lwlibav_video_get_max_width ( vdhp );
     int max_height = lwlibav_video_get_max_height( vdhp );
     if( vs_setup_video_rendering( vohp, ctx, vi, out, max_width, max_height ) < 0 )
@@ -204,13 +190,13 @@ static int prepare_video_decoding
         set_error_on_init( out, vsapi, "lsmas: failed to allocate the first valid video frame." );
         return -1;
     }
+    /* The alpha plane is attached to each frame as the _Alpha property. */
     if( (av_pix_fmt_desc_get( ctx->pix_fmt )->flags & AV_PIX_FMT_FLAG_ALPHA)
-     && hp->vi[0].format )
+     && vi->format.colorFamily != cfUndefined )
     {
-        hp->vi[1] = hp->vi[0];
-        hp->vi[1].format = vsapi->registerFormat( cmGray, hp->vi[0].format->sampleType, hp->vi[0].format->bitsPerSample, 0, 0, core );
-        vs_vohp->background_frame[1] = vsapi->newVideoFrame( hp->vi[1].format, hp->vi[1].width, hp->vi[1].height, NULL, core );
-        if( !vs_vohp->background_frame[1] )
+        VSVideoFormat alpha_format;
+        if( !vsapi->queryVideoFormat( &alpha_format, cfGray, vi->format.sampleType, vi->format.bitsPerSample, 0, 0, core )
+         || !(vs_vohp->background_frame[1] = vsapi->newVideoFrame( &alpha_format, vi->width, vi->height, NULL, core )) )
         {
             set_error_on_init( out, vsapi, "lsmas: failed to allocate memory for the alpha frame data." );
             return -1;
@@ -221,20 +207,130 @@ static int prepare_video_decoding
     return 0;
 }
 
-static const VSFrameRef *VS_CC vs_filter_get_frame( int n, int activation_reason, void **instance_data, void **frame_data, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi )
+static int set_up_decoder_pool
+(
+    lwlibav_handler_t *hp,
+    int                number_of_decoders,
+    VSMap             *out,
+    VSCore            *core,
+    const VSAPI       *vsapi
+)
 {
-    if( activation_reason != arInitial )
-        return NULL;
-    lwlibav_handler_t *hp = (lwlibav_handler_t *)*instance_data;
-    VSVideoInfo       *vi = &hp->vi[0];
-    uint32_t frame_number = MIN( n + 1, vi->numFrames );    /* frame_number is 1-origin. */
-    lwlibav_video_decode_handler_t *vdhp = hp->vdhp;
-    lwlibav_video_output_handler_t *vohp = hp->vohp;
-    if( lwlibav_video_get_error( vdhp ) )
+    hp->decoders[0].vdhp         = hp->vdhp;
+    hp->decoders[0].vohp         = hp->vohp;
+    hp->decoders[0].output_mutex = lw_mutex_create();
+    hp->number_of_decoders = 1;
+    hp->decoder_mutex = lw_mutex_create();
+    hp->decoder_cond  = lw_cond_create();
+    if( !hp->decoder_mutex || !hp->decoder_cond || !hp->decoders[0].output_mutex )
     {
-        vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
-        return NULL;
+        set_error_on_init( out, vsapi, "lsmas: failed to create the lock for the decoder pool." );
+        return -1;
+    }
+    vs_video_output_handler_t *vs_vohp = (vs_video_output_handler_t *)hp->vohp->private_handler;
+    for( int i = 1; i < number_of_decoders; i++ )
+    {
+        lwlibav_decoder_t *decoder = &hp->decoders[i];
+        /* Every decoder has own demuxer and decoder context, but shares the index with the first one. */
+        decoder->vdhp         = lwlibav_video_duplicate_decode_handler( hp->vdhp );
+        decoder->vohp         = lwlibav_video_duplicate_output_handler( hp->vohp );
+        decoder->output_mutex = lw_mutex_create();
+        ++ hp->number_of_decoders;
+        vs_video_output_handler_t *dup_vs_vohp = decoder->vohp ? vs_allocate_video_output_handler( decoder->vohp ) : NULL;
+        if( !decoder->vdhp || !dup_vs_vohp || !decoder->output_mutex )
+        {
+            set_error_on_init( out, vsapi, "lsmas: failed to allocate the decoder pool." );
+            return -1;
+        }
+        dup_vs_vohp->variable_info          = vs_vohp->variable_info;
+        dup_vs_vohp->direct_rendering       = vs_vohp->direct_rendering;
+        dup_vs_vohp->vs_output_pixel_format = vs_vohp->vs_output_pixel_format;
+        if( lwlibav_video_get_desired_track( hp->lwh.file_path, decoder->vdhp, hp->lwh.threads ) < 0 )
+        {
+            set_error_on_init( out, vsapi, "lsmas: failed to get video track for the decoder %d.", i );
+            return -1;
+        }
+        VSVideoInfo vi = hp->vi;
+        if( prepare_video_decoding( decoder->vdhp, decoder->vohp, &vi, out, core, vsapi ) < 0 )
+            return -1;
     }
+    return 0;
+}
+
+/* Pick up the decoder which would reach the requested frame most cheaply.
+ * The nearest decoder positioned before the requested frame can go on decoding forward,
+ * and the least recently used one is sacrificed otherwise. */
+static lwlibav_decoder_t *acquire_decoder
+(
+    lwlibav_handler_t *hp,
+    uint32_t           frame_number
+)
+{
+    lw_mutex_lock( hp->decoder_mutex );
+    vs_waiter_t waiter = { frame_number, NULL };
+    vs_add_waiter( &hp->waiters, &waiter );
+    lwlibav_decoder_t *decoder = NULL;
+    while( 1 )
+    {
+        if( vs_is_earliest_waiter( hp->waiters, &waiter ) )
+        {
+            lwlibav_decoder_t *nearest = NULL;
+            lwlibav_decoder_t *oldest  = NULL;
+            for( int i = 0; i < hp->number_of_decoders; i++ )
+            {
+                lwlibav_decoder_t *candidate = &hp->decoders[i];
+                if( candidate->busy )
+                    continue;
+                if( candidate->last_frame_number
+                 && candidate->last_frame_number <= frame_number
+                 && (!nearest || candidate->last_frame_number > nearest->last_frame_number) )
+                    nearest = candidate;
+                if( !oldest || candidate->last_used < oldest->last_used )
+                    oldest = candidate;
+            }
+            decoder = nearest ? nearest : oldest;
+            if( decoder )
+                break;
+        }
+        lw_cond_wait( hp->decoder_cond, hp->decoder_mutex );
+    }
+    vs_remove_waiter( &hp->waiters, &waiter );
+    decoder->busy              = 1;
+    decoder->last_frame_number = frame_number;
+    decoder->last_used         = ++ hp->decoder_clock;
+    /* The next waiter may be able to take another idle decoder. */
+    lw_cond_broadcast( hp->decoder_cond );
+    lw_mutex_unlock( hp->decoder_mutex );
+    return decoder;
+}
+
+static void release_decoder
+(
+    lwlibav_handler_t *hp,
+    lwlibav_decoder_t *decoder
+)
+{
+    lw_mutex_lock( hp->decoder_mutex );
+    decoder->busy = 0;
+    lw_cond_broadcast( hp->decoder_cond );
+    lw_mutex_unlock( hp->decoder_mutex );
+}
+
+/* Decode the requested frame and take a reference to it.
+ * The decoded picture is held by 'av_frame', so the decoder can go on to the next request while the output frame is made. */
+static int decode_frame
+(
+    lwlibav_decoder_t *decoder,
+    uint32_t           frame_number,
+    AVFrame           *av_frame,
+    AVStream         **stream,
+    VSFrameContext    *frame_ctx,
+    const VSAPI       *vsapi
+)
+{
+    lwlibav_video_decode_handler_t *vdhp = decoder->vdhp;
+    if( lwlibav_video_get_error( vdhp ) )
+        return -1;
     /* Set up VapourSynth error handler. */
     vs_basic_handler_t vsbh = { 0 };
     vsbh.out       = NULL;
@@ -244,39 +340,77 @@ static const VSFrameRef *VS_CC vs_filter_get_frame( int n, int activation_reason
     lhp->priv     = &vsbh;
     lhp->show_log = set_error;
     /* Get and decode the desired video frame. */
-    vs_video_output_handler_t *vs_vohp = (vs_video_output_handler_t *)vohp->private_handler;
-    vs_vohp->frame_ctx = frame_ctx;
-    vs_vohp->core      = core;
-    vs_vohp->vsapi     = vsapi;
-    if( lwlibav_video_get_frame( vdhp, vohp, frame_number ) < 0 )
+    if( lwlibav_video_decode_frame( vdhp, decoder->vohp, frame_number ) < 0
+     || av_frame_ref( av_frame, lwlibav_video_get_frame_buffer( vdhp ) ) < 0 )
+        return -1;
+    *stream = vdhp->format->streams[vdhp->stream_index];
+    return 0;
+}
+
+static VSFrame *output_frame
+(
+    lwlibav_handler_t *hp,
+    lwlibav_decoder_t *decoder,
+    AVFrame           *av_frame,
+    AVStream          *stream,
+    int                n,
+    uint32_t           frame_number,
+    VSFrameContext    *frame_ctx,
+    const VSAPI       *vsapi
+)
+{
+    lwlibav_video_output_handler_t *vohp = decoder->vohp;
+    /* Set up VapourSynth error handler. */
+    vs_basic_handler_t vsbh = { 0 };
+    vsbh.out       = NULL;
+    vsbh.frame_ctx = frame_ctx;
+    vsbh.vsapi     = vsapi;
+    lw_log_handler_t lh = { 0 };
+    lh.level    = LW_LOG_FATAL;
+    lh.priv     = &vsbh;
+    lh.show_log = set_error;
+    /* Convert the decoded picture into the output frame and its alpha plane if present. */
+    int      alpha    = !!(av_pix_fmt_desc_get( av_frame->format )->flags & AV_PIX_FMT_FLAG_ALPHA);
+    VSFrame *vs_frame = NULL;
+    VSFrame *vs_alpha = NULL;
+    lw_mutex_lock( decoder->output_mutex );
+    if( update_scaler_configuration_if_needed( &vohp->scaler, &lh, av_frame ) >= 0
+     && (vs_frame = make_frame( vohp, av_frame, 0 ))
+     && alpha )
+        vs_alpha = make_frame( vohp, av_frame, 1 );
+    if( vs_frame && vohp->scaler.output_pixel_format == AV_PIX_FMT_XYZ12LE )
     {
-        vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
-        return NULL;
+        const int pitch = vsapi->getStride( vs_frame, 0 ) / 2;
+        uint16_t* as_frame_ptr = (uint16_t*)(vsapi->getWritePtr( vs_frame, 0 ));
+        for ( int y = 0; y < vsapi->getFrameHeight( vs_frame, 0 ); ++y )
+        {
+            for ( int x = 0; x < pitch; x += 3 )
+            {
+                const uint16_t temp = as_frame_ptr[x];
+                as_frame_ptr[x] = as_frame_ptr[x + 2];
+                as_frame_ptr[x + 2] = temp;
+            }
+
+            as_frame_ptr += pitch;
+        }
     }
-    /* Output the video frame. */
-    AVFrame    *av_frame = lwlibav_video_get_frame_buffer( vdhp );
-    int output_index = vsapi->getOutputIndex( frame_ctx );
-    VSFrameRef *vs_frame = make_frame( vohp, av_frame, output_index );
+    lw_mutex_unlock( decoder->output_mutex );
     if( !vs_frame )
     {
         vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
         return NULL;
     }
-    AVCodecContext *ctx = lwlibav_video_get_codec_context( vdhp );
-    if ( output_index == 0 && ( av_pix_fmt_desc_get( ctx->pix_fmt )->flags & AV_PIX_FMT_FLAG_ALPHA ) )
+    if( alpha )
     {
-        /* api4 compat: save alpha clip into the _Alpha property */
-        VSFrameRef *vs_frame2 = make_frame( vohp, av_frame, 1 );
-        if( !vs_frame2 )
+        /* Save alpha clip into the _Alpha property. */
+        if( !vs_alpha )
         {
+            vsapi->freeFrame( vs_frame );
             vsapi->setFilterError( "lsmas: failed to output an alpha video frame.", frame_ctx );
             return NULL;
         }
-        VSMap *props = vsapi->getFramePropsRW( vs_frame2 );
-        vsapi->propSetInt( props, "_ColorRange", 0, paReplace ); // alpha clip always full range
-        props = vsapi->getFramePropsRW( vs_frame );
-        vsapi->propSetFrame( props, "_Alpha", vs_frame2, paAppend );
-        vsapi->freeFrame( vs_frame2 );
+        vsapi->mapSetInt( vsapi->getFramePropertiesRW( vs_alpha ), "_ColorRange", 0, maReplace );  // alpha clip always full range
+        vsapi->mapConsumeFrame( vsapi->getFramePropertiesRW( vs_frame ), "_Alpha", vs_alpha, maAppend );
     }
     int top = -1;
     if ( vohp->repeat_control && vohp->repeat_requested )
@@ -290,23 +424,38 @@ static const VSFrameRef *VS_CC vs_filter_get_frame( int n, int activation_reason
         bottom = ( vohp->frame_order_list[n].bottom == vohp->frame_order_list[frame_number].bottom ) ? vohp->frame_order_list[n - 1].bottom :
             vohp->frame_order_list[n].bottom;
     }
-    if ( vohp->scaler.output_pixel_format == AV_PIX_FMT_XYZ12LE )
-    {
-        const int pitch = vsapi->getStride(vs_frame, output_index) / 2;
-        uint16_t* as_frame_ptr = (uint16_t*)(vsapi->getWritePtr(vs_frame, output_index));
-        for ( int y = 0; y < vsapi->getFrameHeight(vs_frame, output_index); ++y )
-        {
-            for ( int x = 0; x < pitch; x += 3 )
-            {
-                const uint16_t temp = as_frame_ptr[x];
-                as_frame_ptr[x] = as_frame_ptr[x + 2];
-                as_frame_ptr[x + 2] = temp;
-            }
+    set_frame_properties( &hp->vi, av_frame, stream, vs_frame, top, bottom, vsapi, n );
+    return vs_frame;
+}
 
-            as_frame_ptr += pitch;
-        }
+static const VSFrame *VS_CC vs_filter_get_frame( int n, int activation_reason, void *instance_data, void **frame_data, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi )
+{
+    if( activation_reason != arInitial )
+        return NULL;
+    lwlibav_handler_t *hp = (lwlibav_handler_t *)instance_data;
+    uint32_t frame_number = MIN( n + 1, hp->vi.numFrames );    /* frame_number is 1-origin. */
+    AVFrame *av_frame = av_frame_alloc();
+    if( !av_frame )
+    {
+        vsapi->setFilterError( "lsmas: failed to allocate a video frame buffer.", frame_ctx );
+        return NULL;
     }
-    set_frame_properties( vi, av_frame, vdhp->format->streams[vdhp->stream_index], vs_frame, top, bottom, vsapi, n );
+    /* Only decoding holds the decoder, and the output frame is made after releasing it
+     * so that the next request can be decoded meanwhile.
+     * The frames rendered by the decoder directly are just referenced, so there is nothing to overlap. */
+    lwlibav_decoder_t *decoder  = acquire_decoder( hp, frame_number );
+    int                direct   = ((vs_video_output_handler_t *)decoder->vohp->private_handler)->direct_rendering;
+    AVStream          *stream   = NULL;
+    VSFrame           *vs_frame = NULL;
+    int ret = decode_frame( decoder, frame_number, av_frame, &stream, frame_ctx, vsapi );
+    if( ret == 0 && direct )
+        vs_frame = output_frame( hp, decoder, av_frame, stream, n, frame_number, frame_ctx, vsapi );
+    release_decoder( hp, decoder );
+    if( ret == 0 && !direct )
+        vs_frame = output_frame( hp, decoder, av_frame, stream, n, frame_number, frame_ctx, vsapi );
+    else if( ret < 0 )
+        vsapi->setFilterError( "lsmas: failed to output a video frame.", frame_ctx );
+    av_frame_free( &av_frame );
     return vs_frame;
 }
 
@@ -315,14 +464,39 @@ static void VS_CC vs_filter_free( void *instance_data, VSCore *core, const VSAPI
     free_handler( (lwlibav_handler_t **)&instance_data );
 }
 
+static void set_av_log_level
+(
+    int64_t level
+)
+{
+    if( level <= 0 )
+        av_log_set_level( AV_LOG_QUIET );
+    else if( level == 1 )
+        av_log_set_level( AV_LOG_PANIC );
+    else if( level == 2 )
+        av_log_set_level( AV_LOG_FATAL );
+    else if( level == 3 )
+        av_log_set_level( AV_LOG_ERROR );
+    else if( level == 4 )
+        av_log_set_level( AV_LOG_WARNING );
+    else if( level == 5 )
+        av_log_set_level( AV_LOG_INFO );
+    else if( level == 6 )
+        av_log_set_level( AV_LOG_VERBOSE );
+    else if( level == 7 )
+        av_log_set_level( AV_LOG_DEBUG );
+    else
+        av_log_set_level( AV_LOG_TRACE );
+}
+
 void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi )
 {
-    const char *file_path = vsapi->propGetData( in, "source", 0, NULL );
+    const char *file_path = vsapi->mapGetData( in, "source", 0, NULL );
     /* Allocate the handler of this filter function. */
     lwlibav_handler_t *hp = alloc_handler();
     if( !hp )
     {
-        vsapi->setError( out, "lsmas: failed to allocate the LW-Libav handler." );
+        vsapi->mapSetError( out, "lsmas: failed to allocate the LW-Libav handler." );
         return;
     }
     lwlibav_file_handler_t         *lwhp = &hp->lwh;
@@ -332,7 +506,7 @@ void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data
     if( !vs_vohp )
     {
         free_handler( &hp );
-        vsapi->setError( out, "lsmas: failed to allocate the VapourSynth video output handler." );
+        vsapi->mapSetError( out, "lsmas: failed to allocate the VapourSynth video output handler." );
         return;
     }
     /* Set up VapourSynth error handler. */
@@ -351,6 +525,7 @@ void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data
     int64_t cache_index;
     int64_t seek_mode;
     int64_t seek_threshold;
+    int64_t seek_hint;
     int64_t variable_info;
     int64_t direct_rendering;
     int64_t fps_num;
@@ -359,16 +534,26 @@ void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data
     int64_t apply_repeat_flag;
     int64_t field_dominance;
     int64_t ff_loglevel;
+    int64_t number_of_decoders;
+    int64_t prefetch;
+    int64_t cache_mb;
+    int64_t pipelined_decoding;
+    int64_t read_ahead;
+    int64_t direct_io;
+    int64_t selective_index;
+    int64_t range_index;
     const char *index_file_path;
     const char *format;
     const char *preferred_decoder_names;
     const char *cache_dir;
     const char *ff_options;
+    const char *timecodes;
     set_option_int64 ( &stream_index,           -1,    "stream_index",   in, vsapi );
     set_option_int64 ( &threads,                 0,    "threads",        in, vsapi );
     set_option_int64 ( &cache_index,             1,    "cache",          in, vsapi );
     set_option_int64 ( &seek_mode,               0,    "seek_mode",      in, vsapi );
     set_option_int64 ( &seek_threshold,          10,   "seek_threshold", in, vsapi );
+    set_option_int64 ( &seek_hint,               0,    "seek_hint",      in, vsapi );
     set_option_int64 ( &variable_info,           0,    "variable",       in, vsapi );
     set_option_int64 ( &direct_rendering,        0,    "dr",             in, vsapi );
     set_option_int64 ( &fps_num,                 0,    "fpsnum",         in, vsapi );
@@ -377,11 +562,20 @@ void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data
     set_option_int64 ( &apply_repeat_flag,       2,    "repeat",         in, vsapi );
     set_option_int64 ( &field_dominance,         0,    "dominance",      in, vsapi );
     set_option_int64 ( &ff_loglevel,             0,    "ff_loglevel",    in, vsapi );
+    set_option_int64 ( &number_of_decoders,      1,    "decoders",       in, vsapi );
+    set_option_int64 ( &prefetch,                0,    "prefetch",       in, vsapi );
+    set_option_int64 ( &cache_mb,                0,    "cache_mb",       in, vsapi );
+    set_option_int64 ( &pipelined_decoding,      0,    "pipeline",       in, vsapi );
+    set_option_int64 ( &read_ahead,              0,    "read_ahead",     in, vsapi );
+    set_option_int64 ( &direct_io,               0,    "direct_io",      in, vsapi );
+    set_option_int64 ( &selective_index,         0,    "selective_index", in, vsapi );
+    set_option_int64 ( &range_index,             0,    "range_index",    in, vsapi );
     set_option_string( &index_file_path,         NULL, "cachefile",      in, vsapi );
     set_option_string( &format,                  NULL, "format",         in, vsapi );
     set_option_string( &preferred_decoder_names, NULL, "decoder",        in, vsapi );
     set_option_string( &cache_dir,               NULL, "cachedir",       in, vsapi );
     set_option_string( &ff_options,              NULL, "ff_options",     in, vsapi);
+    set_option_string( &timecodes,               NULL, "timecodes",      in, vsapi );
     set_preferred_decoder_names_on_buf( hp->preferred_decoder_names_buf, preferred_decoder_names );
     /* Set options. */
     lwlibav_option_t opt;
@@ -391,41 +585,35 @@ void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data
     opt.av_sync           = 0;
     opt.no_create_index   = !cache_index;
     opt.index_file_path   = index_file_path;
+    opt.text_index        = 0;
     opt.force_video       = (stream_index >= 0);
     opt.force_video_index = stream_index >= 0 ? stream_index : -1;
     opt.force_audio       = 0;
     opt.force_audio_index = -2;
+    opt.parallel_index    = 1;
     opt.apply_repeat_flag = apply_repeat_flag;
     opt.field_dominance   = CLIP_VALUE( field_dominance, 0, 2 );    /* 0: Obey source flags, 1: TFF, 2: BFF */
     opt.vfr2cfr.active    = fps_num > 0 && fps_den > 0 ? 1 : 0;
     opt.vfr2cfr.fps_num   = fps_num;
     opt.vfr2cfr.fps_den   = fps_den;
+    opt.read_ahead        = CLIP_VALUE( read_ahead, 0, 4096 );
+    opt.direct_io         = CLIP_VALUE( direct_io,  0, 1 );
+    opt.selective_index   = CLIP_VALUE( selective_index, 0, 1 );
+    opt.range_index       = CLIP_VALUE( range_index, 0, 1 );
     lwlibav_video_set_seek_mode              ( vdhp, CLIP_VALUE( seek_mode,      0, 2 ) );
     lwlibav_video_set_forward_seek_threshold ( vdhp, CLIP_VALUE( seek_threshold, 1, 999 ) );
+    lwlibav_video_set_seek_hint_threshold    ( vdhp, CLIP_VALUE( seek_hint, 0, UINT32_MAX ) );
     lwlibav_video_set_preferred_decoder_names( vdhp, tokenize_preferred_decoder_names( hp->preferred_decoder_names_buf ) );
     lwlibav_video_set_prefer_hw_decoder      ( vdhp, CLIP_VALUE( prefer_hw_decoder, 0, 3 ) );
     lwlibav_video_set_decoder_options        ( vdhp, ff_options );
+    lwlibav_video_set_frame_cache_size       ( vdhp, (size_t)MAX( cache_mb, 0 ) << 20 );
+    lwlibav_video_set_pipelined_decoding     ( vdhp, CLIP_VALUE( pipelined_decoding, 0, 1 ) );
     vs_vohp->variable_info          = CLIP_VALUE( variable_info,     0, 1 );
     vs_vohp->direct_rendering       = CLIP_VALUE( direct_rendering,  0, 1 ) && !format;
+    /* The background decoder cannot allocate frame buffers through the frame context. */
+    lwlibav_video_set_prefetch               ( vdhp, vs_vohp->direct_rendering ? 0 : CLIP_VALUE( prefetch, 0, 256 ) );
     vs_vohp->vs_output_pixel_format = vs_vohp->variable_info ? pfNone : get_vs_output_pixel_format( format );
-    if( ff_loglevel <= 0 )
-        av_log_set_level( AV_LOG_QUIET );
-    else if( ff_loglevel == 1 )
-        av_log_set_level( AV_LOG_PANIC );
-    else if( ff_loglevel == 2 )
-        av_log_set_level( AV_LOG_FATAL );
-    else if( ff_loglevel == 3 )
-        av_log_set_level( AV_LOG_ERROR );
-    else if( ff_loglevel == 4 )
-        av_log_set_level( AV_LOG_WARNING );
-    else if( ff_loglevel == 5 )
-        av_log_set_level( AV_LOG_INFO );
-    else if( ff_loglevel == 6 )
-        av_log_set_level( AV_LOG_VERBOSE );
-    else if( ff_loglevel == 7 )
-        av_log_set_level( AV_LOG_DEBUG );
-    else
-        av_log_set_level( AV_LOG_TRACE );
+    set_av_log_level( ff_loglevel );
     /* Set up progress indicator. */
     progress_indicator_t indicator;
     indicator.open   = NULL;
@@ -456,19 +644,294 @@ void VS_CC vs_lwlibavsource_create( const VSMap *in, VSMap *out, void *user_data
     if( lwlibav_video_get_desired_track( lwhp->file_path, vdhp, lwhp->threads ) < 0 )
     {
         free_handler( &hp );
-        vsapi->setError( out, "lsmas: failed to get video track." );
+        vsapi->mapSetError( out, "lsmas: failed to get video track." );
         return;
     }
     /* Set average framerate. */
-    hp->vi[0].numFrames = vohp->frame_count;
-    hp->vi[0].fpsNum    = 25;
-    hp->vi[0].fpsDen    = 1;
-    lwlibav_video_setup_timestamp_info( lwhp, vdhp, vohp, &hp->vi[0].fpsNum, &hp->vi[0].fpsDen, opt.apply_repeat_flag );
-    /* Set up decoders for this stream. */
-    if( prepare_video_decoding( hp, out, core, vsapi ) < 0 )
+    hp->vi.numFrames = vohp->frame_count;
+    hp->vi.fpsNum    = 25;
+    hp->vi.fpsDen    = 1;
+    lwlibav_video_setup_timestamp_info( lwhp, vdhp, vohp, &hp->vi.fpsNum, &hp->vi.fpsDen, opt.apply_repeat_flag );
+    /* The timecodes are of the frames in presentation order, which are output as they are unless converted or repeated. */
+    if( timecodes && !vohp->vfr2cfr && !vohp->repeat_control )
+    {
+        uint32_t   timestamp_count;
+        AVRational time_base;
+        const lw_video_timestamp_t *timestamp_list = lwlibav_video_get_timestamp_list( vdhp, &timestamp_count, &time_base );
+        if( lw_write_timecodes_v2( timecodes, timestamp_list, timestamp_count, vohp->frame_count,
+                                   time_base.num, time_base.den ) < 0 )
+        {
+            free_handler( &hp );
+            set_error_on_init( out, vsapi, "lsmas: failed to write the timecodes file %s.", timecodes );
+            return;
+        }
+    }
+    /* Set up decoders for this stream.
+     * The additional decoders are set up before the first one since it hands over the AVIndexEntrys to its demuxer. */
+    if( set_up_decoder_pool( hp, CLIP_VALUE( number_of_decoders, 1, MAX_NUM_DECODERS ), out, core, vsapi ) < 0
+     || prepare_video_decoding( vdhp, vohp, &hp->vi, out, core, vsapi ) < 0 )
     {
         free_handler( &hp );
         return;
     }
-    vsapi->createFilter( in, out, "LWLibavSource", vs_filter_init, vs_filter_get_frame, vs_filter_free, fmUnordered, nfMakeLinear, hp, core );
+    /* The requests are serialized by the decoders themselves, so let VapourSynth call us in parallel. */
+    VSNode *node = vsapi->createVideoFilter2( "LWLibavSource", &hp->vi, vs_filter_get_frame, vs_filter_free, fmParallel, NULL, 0, hp, core );
+    if( hp->number_of_decoders == 1 )
+        vsapi->setLinearFilter( node );
+    vsapi->mapConsumeNode( out, "clip", node, maAppend );
+}
+
+typedef struct
+{
+    VSAudioInfo                     ai;
+    lwlibav_file_handler_t          lwh;
+    lwlibav_audio_decode_handler_t *adhp;
+    lwlibav_audio_output_handler_t *aohp;
+    vs_basic_handler_t              vsbh;
+    uint8_t                        *buffer;     /* packed PCM samples for an output frame */
+    char preferred_decoder_names_buf[PREFERRED_DECODER_NAMES_BUFSIZE];
+} lwlibav_audio_handler_t;
+
+/* Deallocate the handler of the audio filter. */
+static void free_audio_handler
+(
+    lwlibav_audio_handler_t **hpp
+)
+{
+    if( !hpp || !*hpp )
+        return;
+    lwlibav_audio_handler_t *hp = *hpp;
+    lw_free( lwlibav_audio_get_preferred_decoder_names( hp->adhp ) );
+    lwlibav_audio_free_decode_handler( hp->adhp );
+    lwlibav_audio_free_output_handler( hp->aohp );
+    lw_free( hp->buffer );
+    lw_free( hp->lwh.file_path );
+    lw_free( hp );
+}
+
+/* Allocate the handler of the audio filter. */
+static lwlibav_audio_handler_t *alloc_audio_handler
+(
+    void
+)
+{
+    lwlibav_audio_handler_t *hp = (lwlibav_audio_handler_t *)lw_malloc_zero( sizeof(lwlibav_audio_handler_t) );
+    if( !hp )
+        return NULL;
+    if( !(hp->adhp = lwlibav_audio_alloc_decode_handler())
+     || !(hp->aohp = lwlibav_audio_alloc_output_handler()) )
+    {
+        free_audio_handler( &hp );
+        return NULL;
+    }
+    return hp;
+}
+
+static int prepare_audio_decoding
+(
+    lwlibav_audio_handler_t *hp,
+    const char              *channel_layout,
+    int                      sample_rate,
+    VSMap                   *out,
+    VSCore                  *core,
+    const VSAPI             *vsapi
+)
+{
+    lwlibav_audio_decode_handler_t *adhp = hp->adhp;
+    lwlibav_audio_output_handler_t *aohp = hp->aohp;
+    /* Import AVIndexEntrys. */
+    if( lwlibav_import_av_index_entry( (lwlibav_decode_handler_t *)adhp ) < 0 )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to import AVIndexEntrys for audio." );
+        return -1;
+    }
+    AVCodecContext *ctx = lwlibav_audio_get_codec_context( adhp );
+    if( vs_setup_audio_rendering( aohp, ctx, &hp->ai, out, core, vsapi, channel_layout, sample_rate ) < 0 )
+        return -1;
+    /* Count the number of PCM audio samples. */
+    hp->ai.numSamples = lwlibav_audio_count_overall_pcm_samples( adhp, aohp->output_sample_rate );
+    if( hp->ai.numSamples == 0 )
+    {
+        vsapi->mapSetError( out, "lsmas: no valid audio frame." );
+        return -1;
+    }
+    if( hp->lwh.av_gap && aohp->output_sample_rate != ctx->sample_rate )
+        hp->lwh.av_gap = ((int64_t)hp->lwh.av_gap * aohp->output_sample_rate - 1) / ctx->sample_rate + 1;
+    hp->ai.numSamples += hp->lwh.av_gap;
+    hp->ai.numFrames   = (int)((hp->ai.numSamples + VS_AUDIO_FRAME_SAMPLES - 1) / VS_AUDIO_FRAME_SAMPLES);
+    /* The samples are resampled into this buffer once and deinterleaved into each output frame. */
+    hp->buffer = (uint8_t *)lw_malloc_zero( (size_t)VS_AUDIO_FRAME_SAMPLES * aohp->output_block_align );
+    if( !hp->buffer )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to allocate the audio buffer." );
+        return -1;
+    }
+    /* Force seeking at the first reading. */
+    lwlibav_audio_force_seek( adhp );
+    return 0;
+}
+
+static const VSFrame *VS_CC vs_audio_get_frame( int n, int activation_reason, void *instance_data, void **frame_data, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi )
+{
+    if( activation_reason != arInitial )
+        return NULL;
+    lwlibav_audio_handler_t        *hp   = (lwlibav_audio_handler_t *)instance_data;
+    lwlibav_audio_decode_handler_t *adhp = hp->adhp;
+    lwlibav_audio_output_handler_t *aohp = hp->aohp;
+    int64_t start  = (int64_t)n * VS_AUDIO_FRAME_SAMPLES;
+    int     length = (int)MIN( hp->ai.numSamples - start, VS_AUDIO_FRAME_SAMPLES );
+    VSFrame *vs_frame = vsapi->newAudioFrame( &hp->ai.format, length, NULL, core );
+    if( !vs_frame )
+    {
+        vsapi->setFilterError( "lsmas: failed to allocate an audio frame.", frame_ctx );
+        return NULL;
+    }
+    hp->vsbh.frame_ctx = frame_ctx;
+    hp->vsbh.vsapi     = vsapi;
+    /* The samples before the first audio frame are silent if the audio stream is delayed. */
+    int64_t audio_delay    = hp->lwh.av_gap;
+    int     silence_length = start < audio_delay ? (int)MIN( audio_delay - start, length ) : 0;
+    int     output_length  = silence_length;
+    if( silence_length < length )
+    {
+        int64_t wanted_length = length - silence_length;
+        output_length += (int)MIN( lwlibav_audio_get_pcm_samples( adhp, aohp, hp->buffer, start + silence_length - audio_delay, wanted_length ), wanted_length );
+        if( lwlibav_audio_get_error( adhp ) )
+        {
+            vsapi->freeFrame( vs_frame );
+            vsapi->setFilterError( "lsmas: failed to output audio samples.", frame_ctx );
+            return NULL;
+        }
+        vs_deinterleave_audio_samples( vs_frame, silence_length, hp->buffer, output_length - silence_length, vsapi );
+    }
+    else
+        lwlibav_audio_force_seek( adhp );   /* Force seeking at the next access for valid audio frame. */
+    vs_put_silence_audio_samples( vs_frame, 0, silence_length, vsapi );
+    vs_put_silence_audio_samples( vs_frame, output_length, length - output_length, vsapi );
+    return vs_frame;
+}
+
+static void VS_CC vs_audio_free( void *instance_data, VSCore *core, const VSAPI *vsapi )
+{
+    free_audio_handler( (lwlibav_audio_handler_t **)&instance_data );
+}
+
+void VS_CC vs_lwlibavaudiosource_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi )
+{
+    const char *file_path = vsapi->mapGetData( in, "source", 0, NULL );
+    /* Allocate the handler of this filter function. */
+    lwlibav_audio_handler_t *hp = alloc_audio_handler();
+    if( !hp )
+    {
+        vsapi->mapSetError( out, "lsmas: failed to allocate the LW-Libav audio handler." );
+        return;
+    }
+    lwlibav_audio_decode_handler_t *adhp = hp->adhp;
+    /* Set up VapourSynth error handler. */
+    hp->vsbh.out       = out;
+    hp->vsbh.frame_ctx = NULL;
+    hp->vsbh.vsapi     = vsapi;
+    /* Set up log handler. */
+    lw_log_handler_t *lhp = lwlibav_audio_get_log_handler( adhp );
+    lhp->level    = LW_LOG_FATAL;
+    lhp->priv     = &hp->vsbh;
+    lhp->show_log = set_error;
+    /* Get options. */
+    int64_t stream_index;
+    int64_t cache_index;
+    int64_t av_sync;
+    int64_t sample_rate;
+    int64_t ff_loglevel;
+    int64_t cache_mb;
+    int64_t read_ahead;
+    int64_t direct_io;
+    int64_t selective_index;
+    int64_t range_index;
+    double  drc;
+    const char *index_file_path;
+    const char *channel_layout;
+    const char *preferred_decoder_names;
+    const char *cache_dir;
+    const char *ff_options;
+    set_option_int64 ( &stream_index,            -1,   "stream_index",   in, vsapi );
+    set_option_int64 ( &cache_index,             1,    "cache",          in, vsapi );
+    set_option_int64 ( &av_sync,                 0,    "av_sync",        in, vsapi );
+    set_option_int64 ( &sample_rate,             0,    "rate",           in, vsapi );
+    set_option_int64 ( &ff_loglevel,             0,    "ff_loglevel",    in, vsapi );
+    set_option_int64 ( &cache_mb,                0,    "cache_mb",       in, vsapi );
+    set_option_int64 ( &read_ahead,              0,    "read_ahead",     in, vsapi );
+    set_option_int64 ( &direct_io,               0,    "direct_io",      in, vsapi );
+    set_option_int64 ( &selective_index,         0,    "selective_index", in, vsapi );
+    set_option_int64 ( &range_index,             0,    "range_index",    in, vsapi );
+    set_option_double( &drc,                     -1.0, "drc_scale",      in, vsapi );
+    set_option_string( &index_file_path,         NULL, "cachefile",      in, vsapi );
+    set_option_string( &channel_layout,          NULL, "layout",         in, vsapi );
+    set_option_string( &preferred_decoder_names, NULL, "decoder",        in, vsapi );
+    set_option_string( &cache_dir,               NULL, "cachedir",       in, vsapi );
+    set_option_string( &ff_options,              NULL, "ff_options",     in, vsapi );
+    set_preferred_decoder_names_on_buf( hp->preferred_decoder_names_buf, preferred_decoder_names );
+    /* Set options. */
+    lwlibav_option_t opt;
+    opt.file_path         = file_path;
+    opt.cache_dir         = cache_dir;
+    opt.threads           = 0;
+    opt.av_sync           = CLIP_VALUE( av_sync, 0, 1 );
+    opt.no_create_index   = !cache_index;
+    opt.index_file_path   = index_file_path;
+    opt.text_index        = 0;
+    opt.force_video       = 0;
+    opt.force_video_index = -1;
+    opt.force_audio       = (stream_index >= 0);
+    opt.force_audio_index = stream_index >= 0 ? stream_index : -1;
+    opt.parallel_index    = 1;
+    opt.apply_repeat_flag = 0;
+    opt.field_dominance   = 0;
+    opt.vfr2cfr.active    = 0;
+    opt.vfr2cfr.fps_num   = 0;
+    opt.vfr2cfr.fps_den   = 0;
+    opt.read_ahead        = CLIP_VALUE( read_ahead, 0, 4096 );
+    opt.direct_io         = CLIP_VALUE( direct_io,  0, 1 );
+    opt.selective_index   = CLIP_VALUE( selective_index, 0, 1 );
+    opt.range_index       = CLIP_VALUE( range_index, 0, 1 );
+    lwlibav_audio_set_preferred_decoder_names( adhp, tokenize_preferred_decoder_names( hp->preferred_decoder_names_buf ) );
+    lwlibav_audio_set_drc                    ( adhp, drc );
+    lwlibav_audio_set_decoder_options        ( adhp, ff_options );
+    set_av_log_level( ff_loglevel );
+    /* Set up progress indicator. */
+    progress_indicator_t indicator;
+    indicator.open   = NULL;
+    indicator.update = update_indicator;
+    indicator.close  = close_indicator;
+    /* Construct index.
+     * The video handlers are needed only to share the index with the video filter. */
+    lwlibav_video_decode_handler_t *vdhp = lwlibav_video_alloc_decode_handler();
+    lwlibav_video_output_handler_t *vohp = lwlibav_video_alloc_output_handler();
+    int ret = (vdhp && vohp) ? lwlibav_construct_index( &hp->lwh, vdhp, vohp, adhp, hp->aohp, lhp, &opt, &indicator, NULL ) : -1;
+    lwlibav_video_free_decode_handler( vdhp );
+    lwlibav_video_free_output_handler( vohp );
+    if( ret < 0 )
+    {
+        free_audio_handler( &hp );
+        set_error_on_init( out, vsapi, "lsmas: failed to construct index for %s.", opt.file_path );
+        return;
+    }
+    /* Get the desired audio track. */
+    if( lwlibav_audio_get_desired_track( hp->lwh.file_path, adhp, hp->lwh.threads ) < 0 )
+    {
+        free_audio_handler( &hp );
+        vsapi->mapSetError( out, "lsmas: failed to get audio track." );
+        return;
+    }
+    if( prepare_audio_decoding( hp, channel_layout, (int)sample_rate, out, core, vsapi ) < 0 )
+    {
+        free_audio_handler( &hp );
+        return;
+    }
+    hp->aohp->block_cache_budget = (size_t)MAX( cache_mb, 0 ) << 20;
+    /* The errors on reading are reported to the frame context from now on. */
+    hp->vsbh.out = NULL;
+    /* The decoder is shared by all requests, so they shall be serialized and should come in order. */
+    VSNode *node = vsapi->createAudioFilter2( "LWLibavAudioSource", &hp->ai, vs_audio_get_frame, vs_audio_free, fmUnordered, NULL, 0, hp, core );
+    vsapi->setLinearFilter( node );
+    vsapi->mapConsumeNode( out, "clip", node, maAppend );
 }
@@ -37,7 +37,7 @@
 
 #include "lsmashsource.h"
 #include "video_output.h"
-#include <VSHelper.h>
+#include <VSHelper4.h>
 
 typedef struct
 {
@@ -47,7 +47,7 @@ typedef struct
 
 static void make_black_background_planar_yuv8
 (
-    VSFrameRef  *vs_frame,
+    VSFrame     *vs_frame,
     const VSAPI *vsapi
 )
 {
@@ -57,11 +57,11 @@ static void make_black_background_planar_yuv8
 
 static void make_black_background_planar_yuv16
 (
-    VSFrameRef  *vs_frame,
+    VSFrame     *vs_frame,
     const VSAPI *vsapi
 )
 {
-    int shift = vsapi->getFrameFormat( vs_frame )->bitsPerSample - 8;
+    int shift = vsapi->getVideoFrameFormat( vs_frame )->bitsPerSample - 8;
     for( int i = 0; i < 3; i++ )
     {
         int v = i ? 0x00000080 << shift : 0x00000000;
@@ -79,7 +79,7 @@ static void make_black_background_planar_yuv16
 
 static void make_black_background_planar_gray
 (
-    VSFrameRef  *vs_frame,
+    VSFrame     *vs_frame,
     const VSAPI *vsapi
 )
 {
@@ -88,7 +88,7 @@ static void make_black_background_planar_gray
 
 static void make_black_background_planar_rgb
 (
-    VSFrameRef  *vs_frame,
+    VSFrame     *vs_frame,
     const VSAPI *vsapi
 )
 {
@@ -101,8 +101,7 @@ static void make_frame_planar_yuv
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 )
 {
@@ -155,8 +154,7 @@ static void make_frame_planar_gray
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 )
 {
@@ -185,8 +183,7 @@ static void make_frame_planar_rgb
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 )
 {
@@ -216,16 +213,15 @@ static void make_frame_planar_alpha
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 )
 {
-    vs_bitblt( vsapi->getWritePtr( vs_frame, 0 ),
+    vsh_bitblt( vsapi->getWritePtr( vs_frame, 0 ),
                vsapi->getStride( vs_frame, 0 ),
                av_picture->data[3],
                av_picture->linesize[3],
-               av_picture->width * vsapi->getFrameFormat( vs_frame )->bytesPerSample,
+               av_picture->width * vsapi->getVideoFrameFormat( vs_frame )->bytesPerSample,
                av_picture->height );
 }
 
@@ -234,8 +230,7 @@ static void make_frame_planar_alpha8
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 )
 {
@@ -262,8 +257,7 @@ static void make_frame_planar_alpha16
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 )
 {
@@ -286,14 +280,14 @@ static void make_frame_planar_alpha16
     }
 }
 
-VSPresetFormat get_vs_output_pixel_format( const char *format_name )
+VSPresetVideoFormat get_vs_output_pixel_format( const char *format_name )
 {
     if( !format_name )
         return pfNone;
     static const struct
     {
-        const char     *format_name;
-        VSPresetFormat  vs_output_pixel_format;
+        const char          *format_name;
+        VSPresetVideoFormat  vs_output_pixel_format;
     } format_table[] =
         {
             { "YUV420P8",  pfYUV420P8  },
@@ -331,12 +325,12 @@ VSPresetFormat get_vs_output_pixel_format( const char *format_name )
     return pfNone;
 }
 
-static enum AVPixelFormat vs_to_av_output_pixel_format( VSPresetFormat vs_output_pixel_format )
+static enum AVPixelFormat vs_to_av_output_pixel_format( VSPresetVideoFormat vs_output_pixel_format )
 {
     static const struct
     {
-        VSPresetFormat     vs_output_pixel_format;
-        enum AVPixelFormat av_output_pixel_format;
+        VSPresetVideoFormat vs_output_pixel_format;
+        enum AVPixelFormat  av_output_pixel_format;
     } format_table[] =
         {
             { pfYUV420P8,  AV_PIX_FMT_YUV420P     },
@@ -462,7 +456,7 @@ static inline int set_frame_maker
 {
     static const struct
     {
-        VSPresetFormat              vs_output_pixel_format;
+        VSPresetVideoFormat         vs_output_pixel_format;
         int                         output_index;
         func_make_black_background *func_make_black_background;
         func_make_frame            *func_make_frame;
@@ -540,7 +534,7 @@ static int determine_colorspace_conversion
     static const struct
     {
         enum AVPixelFormat  av_input_pixel_format;
-        VSPresetFormat      vs_output_pixel_format;
+        VSPresetVideoFormat vs_output_pixel_format;
         int                 fmt_conv_required;
     } conversion_table[] =
         {
@@ -688,18 +682,17 @@ static int determine_colorspace_conversion
 
 typedef struct
 {
-    VSFrameRef  *vs_frame_buffer;
+    VSFrame     *vs_frame_buffer;
     const VSAPI *vsapi;
 } vs_video_buffer_handler_t;
 
-static VSFrameRef *new_output_video_frame
+static VSFrame *new_output_video_frame
 (
     vs_video_output_handler_t *vs_vohp,
     const AVFrame             *av_frame,
     int                        output_index,
     enum AVPixelFormat        *output_pixel_format,
     int                        input_pix_fmt_change,
-    VSFrameContext            *frame_ctx,
     VSCore                    *core,
     const VSAPI               *vsapi
 )
@@ -708,25 +701,23 @@ static VSFrameRef *new_output_video_frame
     {
         if( !av_frame->opaque
          && determine_colorspace_conversion( vs_vohp, output_index, av_frame->format, output_pixel_format ) < 0 )
-            goto fail;
-        const VSFormat *vs_format = vsapi->getFormatPreset( vs_vohp->vs_output_pixel_format, core );
-        return vsapi->newVideoFrame( vs_format, av_frame->width, av_frame->height, NULL, core );
+            return NULL;
+        VSVideoFormat vs_format;
+        if( !vsapi->getVideoFormatByID( &vs_format, vs_vohp->vs_output_pixel_format, core ) )
+            return NULL;
+        return vsapi->newVideoFrame( &vs_format, av_frame->width, av_frame->height, NULL, core );
     }
     else
     {
         if( !av_frame->opaque
          && input_pix_fmt_change
          && determine_colorspace_conversion( vs_vohp, output_index, av_frame->format, output_pixel_format ) < 0 )
-            goto fail;
+            return NULL;
         return vsapi->copyFrame( vs_vohp->background_frame[output_index], core );
     }
-fail:
-    if( frame_ctx )
-        vsapi->setFilterError( "lsmas: failed to determine colorspace conversion.", frame_ctx );
-    return NULL;
 }
 
-VSFrameRef *make_frame
+VSFrame *make_frame
 (
     lw_video_output_handler_t *vohp,
     AVFrame                   *av_frame,
@@ -735,27 +726,27 @@ VSFrameRef *make_frame
 {
     vs_video_output_handler_t *vs_vohp = (vs_video_output_handler_t *)vohp->private_handler;
     lw_video_scaler_handler_t *vshp    = &vohp->scaler;
-    VSFrameContext *frame_ctx = vs_vohp->frame_ctx;
     VSCore         *core      = vs_vohp->core;
     const VSAPI    *vsapi     = vs_vohp->vsapi;
     if( av_frame->opaque )
     {
         /* Render from the decoder directly. */
         vs_video_buffer_handler_t *vs_vbhp = (vs_video_buffer_handler_t *)av_frame->opaque;
-        return vs_vbhp ? (VSFrameRef *)vs_vbhp->vsapi->cloneFrameRef( vs_vbhp->vs_frame_buffer ) : NULL;
+        return vs_vbhp ? (VSFrame *)vs_vbhp->vsapi->addFrameRef( vs_vbhp->vs_frame_buffer ) : NULL;
     }
     /* Make video frame.
      * Convert pixel format if needed. We don't change the presentation resolution. */
-    VSFrameRef *vs_frame = new_output_video_frame( vs_vohp, av_frame, output_index,
-                                                  &vshp->output_pixel_format,
-                                                  !!(vshp->frame_prop_change_flags & LW_FRAME_PROP_CHANGE_FLAG_PIXEL_FORMAT),
-                                                  frame_ctx, core, vsapi );
+    VSFrame *vs_frame = new_output_video_frame( vs_vohp, av_frame, output_index,
+                                                &vshp->output_pixel_format,
+                                                !!(vshp->frame_prop_change_flags & LW_FRAME_PROP_CHANGE_FLAG_PIXEL_FORMAT),
+                                                core, vsapi );
     if( !vs_vohp->make_frame[output_index] )
+    {
+        vsapi->freeFrame( vs_frame );
         return NULL;
+    }
     if( vs_frame )
-        vs_vohp->make_frame[output_index]( vshp, av_frame, vs_vohp->component_reorder[output_index], vs_frame, frame_ctx, vsapi );
-    else if( frame_ctx )
-        vsapi->setFilterError( "lsmas: failed to allocate a output video frame.", frame_ctx );
+        vs_vohp->make_frame[output_index]( vshp, av_frame, vs_vohp->component_reorder[output_index], vs_frame, vsapi );
     return vs_frame;
 }
 
@@ -884,8 +875,8 @@ static int vs_video_get_buffer
     }
     av_frame->opaque = vs_vbhp;
     avcodec_align_dimensions2( ctx, &av_frame->width, &av_frame->height, av_frame->linesize );
-    VSFrameRef *vs_frame_buffer = new_output_video_frame( vs_vohp, av_frame, 0, NULL, 0,
-                                                          vs_vohp->frame_ctx, vs_vohp->core, vs_vohp->vsapi );
+    VSFrame *vs_frame_buffer = new_output_video_frame( vs_vohp, av_frame, 0, NULL, 0,
+                                                       vs_vohp->core, vs_vohp->vsapi );
     if( !vs_frame_buffer )
     {
         free( vs_vbhp );
@@ -953,7 +944,7 @@ int vs_setup_video_rendering
                            ctx, dr_get_buffer );
     if( vs_vohp->variable_info )
     {
-        vi->format = NULL;
+        memset( &vi->format, 0, sizeof(VSVideoFormat) );   /* cfUndefined */
         vi->width  = 0;
         vi->height = 0;
         /* Unused */
@@ -962,10 +953,10 @@ int vs_setup_video_rendering
     }
     else
     {
-        vi->format = vsapi->getFormatPreset( vs_vohp->vs_output_pixel_format, vs_vohp->core );
+        vsapi->getVideoFormatByID( &vi->format, vs_vohp->vs_output_pixel_format, vs_vohp->core );
         vi->width  = lw_vohp->output_width;
         vi->height = lw_vohp->output_height;
-        vs_vohp->background_frame[0] = vsapi->newVideoFrame( vi->format, vi->width, vi->height, NULL, vs_vohp->core );
+        vs_vohp->background_frame[0] = vsapi->newVideoFrame( &vi->format, vi->width, vi->height, NULL, vs_vohp->core );
         if( !vs_vohp->background_frame[0] )
         {
             set_error_on_init( out, vsapi, "lsmas: failed to allocate memory for the background black frame data." );
@@ -1009,52 +1000,52 @@ void vs_set_frame_properties
     AVStream       *stream,
     int64_t         duration_num,
     int64_t         duration_den,
-    VSFrameRef     *vs_frame,
+    VSFrame     *vs_frame,
     int             top,
     int             bottom,
     const VSAPI    *vsapi,
     int             n
 )
 {
-    VSMap *props = vsapi->getFramePropsRW( vs_frame );
+    VSMap *props = vsapi->getFramePropertiesRW( vs_frame );
     /* Sample aspect ratio */
-    vsapi->propSetInt( props, "_SARNum", av_frame->sample_aspect_ratio.num, paReplace );
-    vsapi->propSetInt( props, "_SARDen", av_frame->sample_aspect_ratio.den, paReplace );
+    vsapi->mapSetInt( props, "_SARNum", av_frame->sample_aspect_ratio.num, maReplace );
+    vsapi->mapSetInt( props, "_SARDen", av_frame->sample_aspect_ratio.den, maReplace );
     /* Sample duration */
-    vsapi->propSetInt( props, "_DurationNum", duration_num, paReplace );
-    vsapi->propSetInt( props, "_DurationDen", duration_den, paReplace );
+    vsapi->mapSetInt( props, "_DurationNum", duration_num, maReplace );
+    vsapi->mapSetInt( props, "_DurationDen", duration_den, maReplace );
     if (stream)
-        vsapi->propSetFloat(props, "_AbsoluteTime", ((stream->start_time != AV_NOPTS_VALUE) ? ((double)(stream->start_time) / stream->time_base.den * stream->time_base.num) : 0.0)
-            + (double)(n * duration_num) / duration_den, paReplace);
+        vsapi->mapSetFloat(props, "_AbsoluteTime", ((stream->start_time != AV_NOPTS_VALUE) ? ((double)(stream->start_time) / stream->time_base.den * stream->time_base.num) : 0.0)
+            + (double)(n * duration_num) / duration_den, maReplace);
     else
-        vsapi->propSetFloat(props, "_AbsoluteTime", (double)(n * duration_num) / duration_den, paReplace);
+        vsapi->mapSetFloat(props, "_AbsoluteTime", (double)(n * duration_num) / duration_den, maReplace);
     /* Color format
      * The decoded color format may not match with the output. Set proper properties when
      * no YUV->RGB conversion is there. */
-    const VSFormat *vs_format = vsapi->getFrameFormat( vs_frame );
-    if( vs_format->colorFamily != cmRGB )
+    const VSVideoFormat *vs_format = vsapi->getVideoFrameFormat( vs_frame );
+    if( vs_format->colorFamily != cfRGB )
     {
         if( av_frame->color_range != AVCOL_RANGE_UNSPECIFIED )
-            vsapi->propSetInt( props, "_ColorRange", av_frame->color_range == AVCOL_RANGE_MPEG, paReplace );
-        vsapi->propSetInt( props, "_Primaries", av_frame->color_primaries, paReplace );
-        vsapi->propSetInt( props, "_Transfer",  av_frame->color_trc,       paReplace );
-        vsapi->propSetInt( props, "_Matrix",    av_frame->colorspace,      paReplace );
+            vsapi->mapSetInt( props, "_ColorRange", av_frame->color_range == AVCOL_RANGE_MPEG, maReplace );
+        vsapi->mapSetInt( props, "_Primaries", av_frame->color_primaries, maReplace );
+        vsapi->mapSetInt( props, "_Transfer",  av_frame->color_trc,       maReplace );
+        vsapi->mapSetInt( props, "_Matrix",    av_frame->colorspace,      maReplace );
         if( av_frame->chroma_location > 0 )
-            vsapi->propSetInt( props, "_ChromaLocation", av_frame->chroma_location - 1, paReplace );
+            vsapi->mapSetInt( props, "_ChromaLocation", av_frame->chroma_location - 1, maReplace );
     }
     /* Picture type */
     char pict_type = (av_frame->pict_type == 80 || av_frame->pict_type == 73) ? av_frame->pict_type
         : av_get_picture_type_char(av_frame->pict_type);
-    vsapi->propSetData( props, "_PictType", &pict_type, 1, paReplace );
+    vsapi->mapSetData( props, "_PictType", &pict_type, 1, dtUtf8, maReplace );
     /* BFF or TFF */
     int field_based = 0;
     if( av_frame->flags & AV_FRAME_FLAG_INTERLACED )
         field_based = av_frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST ? 2 : 1;
-    vsapi->propSetInt( props, "_FieldBased", field_based, paReplace );
+    vsapi->mapSetInt( props, "_FieldBased", field_based, maReplace );
     if ( top > -1 )
     {
-        vsapi->propSetInt(props, "_EncodedFrameTop", top, paReplace);
-        vsapi->propSetInt(props, "_EncodedFrameBottom", bottom, paReplace);
+        vsapi->mapSetInt(props, "_EncodedFrameTop", top, maReplace);
+        vsapi->mapSetInt(props, "_EncodedFrameBottom", bottom, maReplace);
     }
     /* Mastering display color volume */
     int frame_has_primaries = 0, frame_has_luminance = 0;
@@ -1070,15 +1061,15 @@ void vs_set_frame_properties
                 display_primaries_x[i] = av_q2d( mastering_display->display_primaries[i][0] );
                 display_primaries_y[i] = av_q2d( mastering_display->display_primaries[i][1] );
             }
-            vsapi->propSetFloatArray( props, "MasteringDisplayPrimariesX", display_primaries_x, 3 );
-            vsapi->propSetFloatArray( props, "MasteringDisplayPrimariesY", display_primaries_y, 3 );
-            vsapi->propSetFloat( props, "MasteringDisplayWhitePointX", av_q2d( mastering_display->white_point[0] ), paReplace );
-            vsapi->propSetFloat( props, "MasteringDisplayWhitePointY", av_q2d( mastering_display->white_point[1] ), paReplace );
+            vsapi->mapSetFloatArray( props, "MasteringDisplayPrimariesX", display_primaries_x, 3 );
+            vsapi->mapSetFloatArray( props, "MasteringDisplayPrimariesY", display_primaries_y, 3 );
+            vsapi->mapSetFloat( props, "MasteringDisplayWhitePointX", av_q2d( mastering_display->white_point[0] ), maReplace );
+            vsapi->mapSetFloat( props, "MasteringDisplayWhitePointY", av_q2d( mastering_display->white_point[1] ), maReplace );
         }
         if( (frame_has_luminance = mastering_display->has_luminance) )
         {
-            vsapi->propSetFloat( props, "MasteringDisplayMinLuminance", av_q2d( mastering_display->min_luminance ), paReplace );
-            vsapi->propSetFloat( props, "MasteringDisplayMaxLuminance", av_q2d( mastering_display->max_luminance ), paReplace );
+            vsapi->mapSetFloat( props, "MasteringDisplayMinLuminance", av_q2d( mastering_display->min_luminance ), maReplace );
+            vsapi->mapSetFloat( props, "MasteringDisplayMaxLuminance", av_q2d( mastering_display->max_luminance ), maReplace );
         }
     }
     if( stream && (!frame_has_primaries || !frame_has_luminance) )
@@ -1096,15 +1087,15 @@ void vs_set_frame_properties
                         display_primaries_x[i] = av_q2d( mastering_display->display_primaries[i][0] );
                         display_primaries_y[i] = av_q2d( mastering_display->display_primaries[i][1] );
                     }
-                    vsapi->propSetFloatArray( props, "MasteringDisplayPrimariesX", display_primaries_x, 3 );
-                    vsapi->propSetFloatArray( props, "MasteringDisplayPrimariesY", display_primaries_y, 3 );
-                    vsapi->propSetFloat( props, "MasteringDisplayWhitePointX", av_q2d( mastering_display->white_point[0] ), paReplace );
-                    vsapi->propSetFloat( props, "MasteringDisplayWhitePointY", av_q2d( mastering_display->white_point[1] ), paReplace );
+                    vsapi->mapSetFloatArray( props, "MasteringDisplayPrimariesX", display_primaries_x, 3 );
+                    vsapi->mapSetFloatArray( props, "MasteringDisplayPrimariesY", display_primaries_y, 3 );
+                    vsapi->mapSetFloat( props, "MasteringDisplayWhitePointX", av_q2d( mastering_display->white_point[0] ), maReplace );
+                    vsapi->mapSetFloat( props, "MasteringDisplayWhitePointY", av_q2d( mastering_display->white_point[1] ), maReplace );
                 }
                 if( mastering_display->has_luminance && !frame_has_luminance )
                 {
-                    vsapi->propSetFloat( props, "MasteringDisplayMinLuminance", av_q2d( mastering_display->min_luminance ), paReplace );
-                    vsapi->propSetFloat( props, "MasteringDisplayMaxLuminance", av_q2d( mastering_display->max_luminance ), paReplace );
+                    vsapi->mapSetFloat( props, "MasteringDisplayMinLuminance", av_q2d( mastering_display->min_luminance ), maReplace );
+                    vsapi->mapSetFloat( props, "MasteringDisplayMaxLuminance", av_q2d( mastering_display->max_luminance ), maReplace );
                 }
                 break;
             }
@@ -1118,8 +1109,8 @@ void vs_set_frame_properties
         const AVContentLightMetadata *content_light = (const AVContentLightMetadata *)content_light_side_data->data;
         if( (frame_has_light_level = content_light->MaxCLL || content_light->MaxFALL) )
         {
-            vsapi->propSetInt( props, "ContentLightLevelMax", content_light->MaxCLL, paReplace );
-            vsapi->propSetInt( props, "ContentLightLevelAverage", content_light->MaxFALL, paReplace );
+            vsapi->mapSetInt( props, "ContentLightLevelMax", content_light->MaxCLL, maReplace );
+            vsapi->mapSetInt( props, "ContentLightLevelAverage", content_light->MaxFALL, maReplace );
         }
     }
     if( stream && !frame_has_light_level )
@@ -1131,8 +1122,8 @@ void vs_set_frame_properties
                 const AVContentLightMetadata *content_light = (const AVContentLightMetadata *)stream->codecpar->coded_side_data[i].data;
                 if( content_light->MaxCLL || content_light->MaxFALL )
                 {
-                    vsapi->propSetInt( props, "ContentLightLevelMax", content_light->MaxCLL, paReplace );
-                    vsapi->propSetInt( props, "ContentLightLevelAverage", content_light->MaxFALL, paReplace );
+                    vsapi->mapSetInt( props, "ContentLightLevelMax", content_light->MaxCLL, maReplace );
+                    vsapi->mapSetInt( props, "ContentLightLevelAverage", content_light->MaxFALL, maReplace );
                 }
                 break;
             }
@@ -1144,7 +1135,7 @@ void vs_set_frame_properties
     const AVFrameSideData *rpu_side_data = av_frame_get_side_data( av_frame, AV_FRAME_DATA_DOVI_RPU_BUFFER );
     if ( rpu_side_data && rpu_side_data->size > 0 )
     {
-        vsapi->propSetData( props, "DolbyVisionRPU", (const char *)rpu_side_data->data, rpu_side_data->size, paReplace );
+        vsapi->mapSetData( props, "DolbyVisionRPU", (const char *)rpu_side_data->data, rpu_side_data->size, dtBinary, maReplace );
     }
 #endif
 }
@@ -29,7 +29,7 @@ enum { component_reorder_bigendian = 0x80 };
 
 typedef void func_make_black_background
 (
-    VSFrameRef  *vs_frame,
+    VSFrame     *vs_frame,
     const VSAPI *vsapi
 );
 
@@ -38,8 +38,7 @@ typedef void func_make_frame
     lw_video_scaler_handler_t *vshp,
     AVFrame                   *av_picture,
     const component_reorder_t *component_reorder,
-    VSFrameRef                *vs_frame,
-    VSFrameContext            *frame_ctx,
+    VSFrame                   *vs_frame,
     const VSAPI               *vsapi
 );
 
@@ -48,18 +47,20 @@ typedef struct
     int                         variable_info;
     int                         direct_rendering;
     const component_reorder_t  *component_reorder[2];
-    VSPresetFormat              vs_output_pixel_format;
-    VSFrameRef                 *background_frame[2];
+    VSPresetVideoFormat         vs_output_pixel_format;
+    VSFrame                    *background_frame[2];
     func_make_black_background *make_black_background[2];
     func_make_frame            *make_frame[2];
-    VSFrameContext             *frame_ctx;
     VSCore                     *core;
     const VSAPI                *vsapi;
 } vs_video_output_handler_t;
 
-VSPresetFormat get_vs_output_pixel_format( const char *format_name );
+VSPresetVideoFormat get_vs_output_pixel_format( const char *format_name );
 
-VSFrameRef *make_frame
+/* Make the output frame from the decoded picture.
+ * output_index 0 is the picture itself and 1 is its alpha plane.
+ * This function uses the scaler, so it shall not run concurrently for the same output handler. */
+VSFrame *make_frame
 (
     lw_video_output_handler_t *vohp,
     AVFrame                   *av_frame,
@@ -87,7 +88,7 @@ void vs_set_frame_properties
     AVStream       *stream,
     int64_t         duration_num,
     int64_t         duration_den,
-    VSFrameRef     *vs_frame,
+    VSFrame        *vs_frame,
     int             top,
     int             bottom,
     const VSAPI    *vsapi,
@@ -0,0 +1,728 @@
+/*****************************************************************************
+ * bench.c
+ *****************************************************************************
+ * Copyright (C) 2026 L-SMASH Works project
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license.
+ * However, when distributing its binary file, it will be under LGPL or GPL. */
+
+/* Measure the latency of getting video frames through the LW-Libav or the libavsmash decoder under scripted access patterns.
+ * Any input works, e.g. a synthetic one generated offline:
+ *   ffmpeg -f lavfi -i testsrc2=size=1280x720:rate=24000/1001 -t 120 -c:v libx264 -g 240 -bf 3 test.mkv
+ * With --verify, every frame returned is compared with the one obtained by decoding the whole stream in order,
+ * and the exit code tells whether all of them matched, so this is also run as the test of the frame access. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <lsmash.h>
+
+#include "../common/utils.h"
+#include "../common/osdep.h"
+#include "../common/video_output.h"
+#include "../common/audio_output.h"
+#include "../common/progress.h"
+#include "../common/lwlibav_dec.h"
+#include "../common/lwlibav_video.h"
+#include "../common/lwlibav_audio.h"
+#include "../common/lwindex.h"
+#include "../common/libavsmash.h"
+#include "../common/libavsmash_video.h"
+
+#ifndef _MSC_VER
+/* Dummy definitions.
+ * Audio resampler/buffer is NOT used at all in this tool. */
+typedef void AVAudioResampleContext;
+typedef void audio_samples_t;
+int flush_resampler_buffers( AVAudioResampleContext *avr ){ return 0; }
+int update_resampler_configuration( AVAudioResampleContext *avr,
+                                    uint64_t out_channel_layout, int out_sample_rate, enum AVSampleFormat out_sample_fmt,
+                                    uint64_t  in_channel_layout, int  in_sample_rate, enum AVSampleFormat  in_sample_fmt,
+                                    int *input_planes, int *input_block_align ){ return 0; }
+int resample_audio( AVAudioResampleContext *avr, audio_samples_t *out, audio_samples_t *in ){ return 0; }
+uint64_t output_pcm_samples_from_buffer
+(
+    lw_audio_output_handler_t *aohp,
+    AVFrame                   *frame_buffer,
+    uint8_t                  **output_buffer,
+    enum audio_output_flag    *output_flags
+)
+{
+    return 0;
+}
+
+uint64_t output_pcm_samples_from_packet
+(
+    lw_audio_output_handler_t *aohp,
+    AVCodecContext            *ctx,
+    AVPacket                  *pkt,
+    AVFrame                   *frame_buffer,
+    uint8_t                  **output_buffer,
+    enum audio_output_flag    *output_flags
+)
+{
+    return 0;
+}
+
+uint64_t lw_get_cached_pcm_samples
+(
+    lw_audio_output_handler_t *aohp,
+    lw_get_pcm_samples_func   *get_pcm_samples,
+    void                      *dhp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
+)
+{
+    return 0;
+}
+
+void lw_cleanup_audio_output_handler( lw_audio_output_handler_t *aohp ){ }
+#endif
+
+typedef enum
+{
+    PATTERN_LINEAR = 0,
+    PATTERN_REVERSE,
+    PATTERN_RANDOM,
+    PATTERN_STRIDED,
+    PATTERN_SPLICE,
+    PATTERN_COUNT
+} access_pattern_t;
+
+static const char *pattern_names[PATTERN_COUNT] = { "linear", "reverse", "random", "strided", "splice" };
+
+typedef struct
+{
+    uint32_t request_count;     /* the number of requests per pattern */
+    uint32_t stride;            /* the step of the strided access */
+    uint32_t segment_length;    /* the length of each segment spliced */
+    uint32_t seed;
+    int      verify;            /* 1 = compare every frame with the one decoded in order */
+} bench_option_t;
+
+typedef struct
+{
+    lwlibav_file_handler_t          lwh;
+    lwlibav_video_decode_handler_t *vdhp;
+    lwlibav_video_output_handler_t *vohp;
+    lwlibav_audio_decode_handler_t *adhp;
+    lwlibav_audio_output_handler_t *aohp;
+    lw_log_handler_t                lh;
+    /* libavsmash */
+    int                                libavsmash;
+    libavsmash_video_decode_handler_t *svdhp;
+    libavsmash_video_output_handler_t *svohp;
+    lsmash_file_parameters_t           file_param;
+    AVFormatContext                   *format_ctx;
+    /* verification */
+    uint32_t                           frame_count;
+    int64_t                            fps_num;
+    int64_t                            fps_den;
+    uint64_t                          *checksums;   /* the checksums of the frames decoded in order */
+} bench_handler_t;
+
+static void show_log
+(
+    lw_log_handler_t *lhp,
+    lw_log_level      level,
+    const char       *message
+)
+{
+    static const char *const level_names[] = { "Info", "Warning", "Error", "Fatal" };
+    fprintf( stderr, "lsmas-bench [%s]: %s\n", level < LW_LOG_QUIET ? level_names[level] : "Unknown", message );
+}
+
+static void free_handler
+(
+    bench_handler_t *hp
+)
+{
+    lwlibav_video_free_decode_handler_ptr( &hp->vdhp );
+    lwlibav_video_free_output_handler_ptr( &hp->vohp );
+    lwlibav_audio_free_decode_handler_ptr( &hp->adhp );
+    lwlibav_audio_free_output_handler_ptr( &hp->aohp );
+    lw_freep( &hp->lwh.file_path );
+    if( hp->svdhp )
+    {
+        lsmash_root_t *root = libavsmash_video_get_root( hp->svdhp );
+        libavsmash_video_free_decode_handler_ptr( &hp->svdhp );
+        avformat_close_input( &hp->format_ctx );
+        lsmash_close_file( &hp->file_param );
+        lsmash_destroy_root( root );
+    }
+    libavsmash_video_free_output_handler_ptr( &hp->svohp );
+    lw_freep( &hp->checksums );
+}
+
+static int get_frame
+(
+    bench_handler_t *hp,
+    uint32_t         frame_number
+)
+{
+    return hp->libavsmash ? libavsmash_video_get_frame( hp->svdhp, hp->svohp, frame_number )
+                          : lwlibav_video_get_frame( hp->vdhp, hp->vohp, frame_number );
+}
+
+static AVFrame *get_frame_buffer
+(
+    bench_handler_t *hp
+)
+{
+    return hp->libavsmash ? libavsmash_video_get_frame_buffer( hp->svdhp )
+                          : lwlibav_video_get_frame_buffer( hp->vdhp );
+}
+
+static void force_seek
+(
+    bench_handler_t *hp
+)
+{
+    if( hp->libavsmash )
+        libavsmash_video_force_seek( hp->svdhp );
+    else
+        lwlibav_video_force_seek( hp->vdhp );
+}
+
+/* The decoder statistics are collected by LW-Libav only. */
+static uint64_t get_decoded_picture_count
+(
+    bench_handler_t *hp
+)
+{
+    return hp->libavsmash ? 0 : lwlibav_video_get_decoded_picture_count( hp->vdhp );
+}
+
+static uint64_t get_seek_count
+(
+    bench_handler_t *hp
+)
+{
+    return hp->libavsmash ? 0 : lwlibav_video_get_seek_count( hp->vdhp );
+}
+
+/* Return the FNV-1a hash of the visible area of the frame. */
+static uint64_t get_frame_checksum
+(
+    const AVFrame *frame
+)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( (enum AVPixelFormat)frame->format );
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    if( !desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) )
+        return hash;
+    int planes = av_pix_fmt_count_planes( (enum AVPixelFormat)frame->format );
+    for( int i = 0; i < planes; i++ )
+    {
+        int is_chroma = !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components >= 3
+                     && i != desc->comp[0].plane && (i == desc->comp[1].plane || i == desc->comp[2].plane);
+        int height    = is_chroma ? AV_CEIL_RSHIFT( frame->height, desc->log2_chroma_h ) : frame->height;
+        int linesize  = av_image_get_linesize( (enum AVPixelFormat)frame->format, frame->width, i );
+        for( int y = 0; y < height && linesize > 0; y++ )
+        {
+            const uint8_t *line = frame->data[i] + (ptrdiff_t)y * frame->linesize[i];
+            for( int x = 0; x < linesize; x++ )
+                hash = (hash ^ line[x]) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/* Decode every frame in order and keep the checksums as the reference of the verification. */
+static int create_reference_checksums
+(
+    bench_handler_t *hp
+)
+{
+    hp->checksums = (uint64_t *)lw_malloc_zero( (hp->frame_count + 1) * sizeof(uint64_t) );
+    if( !hp->checksums )
+    {
+        fprintf( stderr, "lsmas-bench: failed to allocate memory.\n" );
+        return -1;
+    }
+    force_seek( hp );
+    for( uint32_t i = 1; i <= hp->frame_count; i++ )
+    {
+        if( get_frame( hp, i ) < 0 )
+        {
+            fprintf( stderr, "lsmas-bench: failed to get frame %" PRIu32 " in order.\n", i );
+            return -1;
+        }
+        hp->checksums[i] = get_frame_checksum( get_frame_buffer( hp ) );
+    }
+    return 0;
+}
+
+/* Return a pseudo random number by xorshift so that every run requests the same frames. */
+static uint32_t get_random
+(
+    uint32_t *state
+)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Fill the list of the requested frame numbers (1-origin) and return the number of them. */
+static uint32_t create_request_list
+(
+    uint32_t             *list,
+    access_pattern_t      pattern,
+    uint32_t              frame_count,
+    const bench_option_t *opt
+)
+{
+    uint32_t state = opt->seed ? opt->seed : 1;
+    uint32_t count = opt->request_count;
+    if( pattern == PATTERN_LINEAR || pattern == PATTERN_REVERSE )
+        count = MIN( count, frame_count );
+    for( uint32_t i = 0; i < count; )
+        switch( pattern )
+        {
+            case PATTERN_LINEAR :
+                list[i] = i + 1;
+                ++i;
+                break;
+            case PATTERN_REVERSE :
+                list[i] = count - i;
+                ++i;
+                break;
+            case PATTERN_RANDOM :
+                list[i++] = get_random( &state ) % frame_count + 1;
+                break;
+            case PATTERN_STRIDED :
+                list[i] = (uint32_t)(((uint64_t)i * opt->stride) % frame_count) + 1;
+                ++i;
+                break;
+            case PATTERN_SPLICE :
+            {
+                /* Cut a segment at a random position and append it as done in trim-and-splice editing. */
+                uint32_t length = MIN( opt->segment_length, frame_count );
+                uint32_t start  = get_random( &state ) % (frame_count - length + 1) + 1;
+                for( uint32_t j = 0; j < length && i < count; j++ )
+                    list[i++] = start + j;
+                break;
+            }
+            default :
+                return 0;
+        }
+    return count;
+}
+
+static int compare_latency( const void *a, const void *b )
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static inline double get_percentile
+(
+    const double *sorted,
+    uint32_t      count,
+    double        percentile
+)
+{
+    return sorted[ (uint32_t)(percentile * (count - 1) + 0.5) ];
+}
+
+static int run_pattern
+(
+    bench_handler_t      *hp,
+    access_pattern_t      pattern,
+    const bench_option_t *opt
+)
+{
+    uint32_t frame_count = hp->frame_count;
+    uint32_t mismatches  = 0;
+    uint32_t *list    = (uint32_t *)lw_malloc_zero( opt->request_count * sizeof(uint32_t) );
+    double   *latency = (double   *)lw_malloc_zero( opt->request_count * sizeof(double) );
+    if( !list || !latency )
+    {
+        fprintf( stderr, "lsmas-bench: failed to allocate memory.\n" );
+        goto fail;
+    }
+    uint32_t count = create_request_list( list, pattern, frame_count, opt );
+    if( count == 0 )
+        goto fail;
+    /* Start each pattern from a seek. */
+    force_seek( hp );
+    uint64_t decoded = get_decoded_picture_count( hp );
+    uint64_t seeks   = get_seek_count( hp );
+    double   start   = lw_get_time();
+    for( uint32_t i = 0; i < count; i++ )
+    {
+        double t = lw_get_time();
+        if( get_frame( hp, list[i] ) < 0 )
+        {
+            fprintf( stderr, "lsmas-bench: failed to get frame %" PRIu32 " in the %s pattern.\n", list[i], pattern_names[pattern] );
+            goto fail;
+        }
+        latency[i] = lw_get_time() - t;
+        /* The checksum is out of the measured latency. */
+        if( hp->checksums && get_frame_checksum( get_frame_buffer( hp ) ) != hp->checksums[ list[i] ] && mismatches++ < 10 )
+            fprintf( stderr, "lsmas-bench: frame %" PRIu32 " differs from the one decoded in order in the %s pattern.\n",
+                     list[i], pattern_names[pattern] );
+    }
+    double elapsed = lw_get_time() - start;
+    decoded = get_decoded_picture_count( hp ) - decoded;
+    seeks   = get_seek_count( hp ) - seeks;
+    qsort( latency, count, sizeof(double), compare_latency );
+    printf( "%-8s %8" PRIu32 " %9.3f %9.3f %9.3f %9.3f %9.3f %8.2f %7" PRIu64 "\n",
+            pattern_names[pattern], count,
+            get_percentile( latency, count, 0.50 ) * 1e3,
+            get_percentile( latency, count, 0.90 ) * 1e3,
+            get_percentile( latency, count, 0.99 ) * 1e3,
+            latency[count - 1] * 1e3,
+            elapsed, (double)decoded / count, seeks );
+    if( mismatches )
+    {
+        fprintf( stderr, "lsmas-bench: %" PRIu32 " of %" PRIu32 " frames mismatched in the %s pattern.\n",
+                 mismatches, count, pattern_names[pattern] );
+        goto fail;
+    }
+    lw_free( list );
+    lw_free( latency );
+    return 0;
+fail:
+    lw_free( list );
+    lw_free( latency );
+    return -1;
+}
+
+static int parse_pattern_list
+(
+    const char *arg,
+    int         patterns[PATTERN_COUNT]
+)
+{
+    memset( patterns, 0, PATTERN_COUNT * sizeof(int) );
+    while( *arg )
+    {
+        size_t length = strcspn( arg, "," );
+        int i;
+        for( i = 0; i < PATTERN_COUNT; i++ )
+            if( length == strlen( pattern_names[i] ) && !strncmp( arg, pattern_names[i], length ) )
+                break;
+        if( i == PATTERN_COUNT )
+            return -1;
+        patterns[i] = 1;
+        arg += length + (arg[length] == ',');
+    }
+    return 0;
+}
+
+static int is_option( const char *arg, const char *short_name, const char *long_name )
+{
+    return !strcmp( arg, short_name ) || !strcmp( arg, long_name );
+}
+
+static void print_usage( const char *program )
+{
+    fprintf(stderr, "Usage: %s [options] input\n"
+                    "  -p, --pattern LIST       comma separated access patterns (default: linear,reverse,random,strided,splice)\n"
+                    "  -n, --requests N         the number of requests per pattern (default: 500)\n"
+                    "      --stride N           the step of the strided pattern (default: 12)\n"
+                    "      --segment N          the segment length of the splice pattern (default: 24)\n"
+                    "      --seed N             the seed of the random and splice patterns (default: 1)\n"
+                    "  -i, --index FILE         the index file (default: input.lwi)\n"
+                    "      --no-index           don't write the index file\n"
+                    "      --text-index         read and write the index file in the text format instead of the binary one\n"
+                    "      --serial-index       index on a single thread\n"
+                    "      --selective-index    same as 'selective_index=1' of LWLibavSource\n"
+                    "      --range-index        same as 'range_index=1' of LWLibavSource\n"
+                    "      --pipeline           same as 'pipeline=1' of LWLibavSource\n"
+                    "      --threads N          the number of decoder threads (default: 0, auto)\n"
+                    "      --seek-mode N        same as 'seek_mode' of LWLibavSource (default: 0)\n"
+                    "      --seek-threshold N   same as 'seek_threshold' of LWLibavSource (default: 10)\n"
+                    "      --seek-hint N        same as 'seek_hint' of LWLibavSource (default: 0)\n"
+                    "      --prefetch N         same as 'prefetch' of LWLibavSource (default: 0)\n"
+                    "      --cache-mb N         same as 'cache_mb' of LWLibavSource (default: 0)\n"
+                    "      --read-ahead N       same as 'read_ahead' of LWLibavSource (default: 0)\n"
+                    "      --direct-io          same as 'direct_io=1' of LWLibavSource\n"
+                    "      --verify             compare every frame with the one decoded in order and fail on any mismatch\n"
+                    "      --libavsmash         decode by LibavSMASHSource instead, which supports the seek and threads options only\n", program );
+}
+
+typedef struct
+{
+    const char *file_path;
+    const char *index_file_path;
+    int         no_create_index;
+    int         text_index;
+    int         serial_index;
+    int         selective_index;
+    int         range_index;
+    int         threads;
+    int         seek_mode;
+    int         seek_threshold;
+    int         seek_hint;
+    int         prefetch;
+    int         cache_mb;
+    int         pipeline;
+    int         read_ahead;
+    int         direct_io;
+} bench_open_option_t;
+
+static int open_lwlibav
+(
+    bench_handler_t           *hp,
+    const bench_open_option_t *oopt,
+    double                    *index_time
+)
+{
+    if( !(hp->vdhp = lwlibav_video_alloc_decode_handler())
+     || !(hp->vohp = lwlibav_video_alloc_output_handler())
+     || !(hp->adhp = lwlibav_audio_alloc_decode_handler())
+     || !(hp->aohp = lwlibav_audio_alloc_output_handler()) )
+    {
+        fprintf( stderr, "lsmas-bench: failed to allocate the LW-Libav handlers.\n" );
+        return -1;
+    }
+    /* Get options. */
+    lwlibav_option_t opt;
+    memset( &opt, 0, sizeof(lwlibav_option_t) );
+    opt.file_path         = oopt->file_path;
+    opt.threads           = oopt->threads;
+    opt.no_create_index   = oopt->no_create_index;
+    opt.index_file_path   = oopt->index_file_path;
+    opt.text_index        = oopt->text_index;
+    opt.force_video_index = -1;
+    opt.force_audio_index = -2;
+    opt.parallel_index    = !oopt->serial_index;
+    opt.selective_index   = oopt->selective_index;
+    opt.range_index       = oopt->range_index;
+    opt.read_ahead        = oopt->read_ahead;
+    opt.direct_io         = oopt->direct_io;
+    lwlibav_video_decode_handler_t *vdhp = hp->vdhp;
+    lwlibav_video_output_handler_t *vohp = hp->vohp;
+    lwlibav_video_set_seek_mode              ( vdhp, oopt->seek_mode );
+    lwlibav_video_set_forward_seek_threshold ( vdhp, oopt->seek_threshold );
+    lwlibav_video_set_seek_hint_threshold    ( vdhp, oopt->seek_hint );
+    lwlibav_video_set_prefetch               ( vdhp, oopt->prefetch );
+    lwlibav_video_set_frame_cache_size       ( vdhp, (size_t)oopt->cache_mb << 20 );
+    lwlibav_video_set_pipelined_decoding     ( vdhp, oopt->pipeline );
+    /* Load or construct the index. */
+    double start = lw_get_time();
+    if( lwlibav_construct_index( &hp->lwh, vdhp, vohp, hp->adhp, hp->aohp, &hp->lh, &opt, NULL, NULL ) < 0 )
+    {
+        fprintf( stderr, "lsmas-bench: failed to construct index for %s.\n", oopt->file_path );
+        return -1;
+    }
+    *index_time = lw_get_time() - start;
+    /* Open the decoder. */
+    lwlibav_video_set_log_handler( vdhp, &hp->lh );
+    if( lwlibav_video_get_desired_track( hp->lwh.file_path, vdhp, hp->lwh.threads ) < 0 )
+    {
+        fprintf( stderr, "lsmas-bench: failed to get video track.\n" );
+        return -1;
+    }
+    hp->fps_num = 25;
+    hp->fps_den = 1;
+    lwlibav_video_setup_timestamp_info( &hp->lwh, vdhp, vohp, &hp->fps_num, &hp->fps_den, 0 );
+    if( lwlibav_import_av_index_entry( (lwlibav_decode_handler_t *)vdhp ) < 0 )
+        return -1;
+    lwlibav_video_set_initial_input_format( vdhp );
+    if( lwlibav_video_find_first_valid_frame( vdhp ) < 0 )
+    {
+        fprintf( stderr, "lsmas-bench: failed to find the first valid video frame.\n" );
+        return -1;
+    }
+    hp->frame_count = vohp->frame_count;
+    return 0;
+}
+
+static int open_libavsmash
+(
+    bench_handler_t           *hp,
+    const bench_open_option_t *oopt
+)
+{
+    if( !(hp->svdhp = libavsmash_video_alloc_decode_handler())
+     || !(hp->svohp = libavsmash_video_alloc_output_handler()) )
+    {
+        fprintf( stderr, "lsmas-bench: failed to allocate the libavsmash handlers.\n" );
+        return -1;
+    }
+    libavsmash_video_decode_handler_t *vdhp = hp->svdhp;
+    libavsmash_video_output_handler_t *vohp = hp->svohp;
+    lsmash_movie_parameters_t movie_param;
+    lsmash_root_t *root = libavsmash_open_file( &hp->format_ctx, oopt->file_path, &hp->file_param, &movie_param, &hp->lh );
+    if( !root )
+    {
+        fprintf( stderr, "lsmas-bench: failed to open %s.\n", oopt->file_path );
+        return -1;
+    }
+    libavsmash_video_set_root                  ( vdhp, root );
+    libavsmash_video_set_seek_mode             ( vdhp, oopt->seek_mode );
+    libavsmash_video_set_forward_seek_threshold( vdhp, oopt->seek_threshold );
+    libavsmash_video_set_log_handler           ( vdhp, &hp->lh );
+    if( libavsmash_video_get_track( vdhp, 0 ) < 0
+     || libavsmash_video_initialize_decoder_configuration( vdhp, hp->format_ctx, oopt->threads ) < 0 )
+    {
+        fprintf( stderr, "lsmas-bench: failed to get video track.\n" );
+        return -1;
+    }
+    libavsmash_video_set_get_buffer_func( vdhp );
+    hp->fps_num = 25;
+    hp->fps_den = 1;
+    libavsmash_video_setup_timestamp_info( vdhp, vohp, &hp->fps_num, &hp->fps_den );
+    libavsmash_video_clear_error( vdhp );
+    if( libavsmash_video_find_first_valid_frame( vdhp ) < 0 )
+    {
+        fprintf( stderr, "lsmas-bench: failed to find the first valid video frame.\n" );
+        return -1;
+    }
+    hp->frame_count = vohp->frame_count;
+    return 0;
+}
+
+int main (const int argc, const char* argv[])
+{
+    const char    *file_path       = NULL;
+    const char    *index_file_path = NULL;
+    int            no_create_index = 0;
+    int            text_index      = 0;
+    int            serial_index    = 0;
+    int            selective_index = 0;
+    int            range_index     = 0;
+    int            threads         = 0;
+    int            seek_mode       = 0;
+    int            seek_threshold  = 10;
+    int            seek_hint       = 0;
+    int            prefetch        = 0;
+    int            cache_mb        = 0;
+    int            pipeline        = 0;
+    int            read_ahead      = 0;
+    int            direct_io       = 0;
+    int            libavsmash      = 0;
+    int            patterns[PATTERN_COUNT] = { 1, 1, 1, 1, 1 };
+    bench_option_t bench_opt       = { 500, 12, 24, 1, 0 };
+    for (int i = 1; i < argc; i++) {
+        const char *arg   = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--no-index"))
+            no_create_index = 1;
+        else if (!strcmp(arg, "--text-index"))
+            text_index      = 1;
+        else if (!strcmp(arg, "--serial-index"))
+            serial_index    = 1;
+        else if (!strcmp(arg, "--selective-index"))
+            selective_index = 1;
+        else if (!strcmp(arg, "--range-index"))
+            range_index     = 1;
+        else if (!strcmp(arg, "--pipeline"))
+            pipeline        = 1;
+        else if (!strcmp(arg, "--direct-io"))
+            direct_io       = 1;
+        else if (!strcmp(arg, "--verify"))
+            bench_opt.verify = 1;
+        else if (!strcmp(arg, "--libavsmash"))
+            libavsmash      = 1;
+        else if (!value && arg[0] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        }
+        else if (is_option(arg, "-p", "--pattern")) {
+            if (parse_pattern_list(value, patterns) < 0) {
+                fprintf(stderr, "lsmas-bench: unknown access pattern in %s.\n", value);
+                return 1;
+            }
+            ++i;
+        }
+        else if (is_option(arg, "-n", "--requests"))
+            bench_opt.request_count  = MAX(atoi(value), 1), ++i;
+        else if (!strcmp(arg, "--stride"))
+            bench_opt.stride         = MAX(atoi(value), 1), ++i;
+        else if (!strcmp(arg, "--segment"))
+            bench_opt.segment_length = MAX(atoi(value), 1), ++i;
+        else if (!strcmp(arg, "--seed"))
+            bench_opt.seed           = (uint32_t)strtoul(value, NULL, 10), ++i;
+        else if (is_option(arg, "-i", "--index"))
+            index_file_path = value, ++i;
+        else if (!strcmp(arg, "--threads"))
+            threads        = atoi(value), ++i;
+        else if (!strcmp(arg, "--seek-mode"))
+            seek_mode      = atoi(value), ++i;
+        else if (!strcmp(arg, "--seek-threshold"))
+            seek_threshold = atoi(value), ++i;
+        else if (!strcmp(arg, "--seek-hint"))
+            seek_hint      = atoi(value), ++i;
+        else if (!strcmp(arg, "--prefetch"))
+            prefetch       = atoi(value), ++i;
+        else if (!strcmp(arg, "--cache-mb"))
+            cache_mb       = atoi(value), ++i;
+        else if (!strcmp(arg, "--read-ahead"))
+            read_ahead     = atoi(value), ++i;
+        else if (arg[0] != '-' && !file_path)
+            file_path = arg;
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!file_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    av_log_set_level( AV_LOG_QUIET );
+
+    bench_handler_t h = { { 0 } };
+    bench_handler_t *hp = &h;
+    hp->lh.name     = "lsmas-bench";
+    hp->lh.level    = LW_LOG_WARNING;
+    hp->lh.show_log = show_log;
+    hp->libavsmash  = libavsmash;
+    bench_open_option_t open_opt =
+    {
+        file_path, index_file_path, no_create_index, text_index, serial_index, selective_index, range_index, MAX( threads, 0 ),
+        CLIP_VALUE( seek_mode, 0, 2 ), CLIP_VALUE( seek_threshold, 1, 999 ), MAX( seek_hint, 0 ),
+        CLIP_VALUE( prefetch, 0, 256 ), MAX( cache_mb, 0 ), pipeline, MAX( read_ahead, 0 ), direct_io
+    };
+    double index_time = 0.0;
+    double start      = lw_get_time();
+    if( (libavsmash ? open_libavsmash( hp, &open_opt ) : open_lwlibav( hp, &open_opt, &index_time )) < 0 )
+        goto fail;
+    double open_time = lw_get_time() - start - index_time;
+    if( hp->frame_count == 0 )
+        goto fail;
+    AVCodecContext *ctx = libavsmash ? libavsmash_video_get_codec_context( hp->svdhp ) : lwlibav_video_get_codec_context( hp->vdhp );
+    printf( "%s: %s %dx%d, %" PRIu32 " frames, %" PRId64 "/%" PRId64 " fps\n",
+            file_path, ctx->codec->name, ctx->width, ctx->height, hp->frame_count, hp->fps_num, hp->fps_den );
+    printf( "index: %.3f s, open: %.3f s\n", index_time, open_time );
+    if( bench_opt.verify && create_reference_checksums( hp ) < 0 )
+        goto fail;
+    printf( "pattern  requests   p50(ms)   p90(ms)   p99(ms)   max(ms)  total(s) dec/frame   seeks\n" );
+    for( int i = 0; i < PATTERN_COUNT; i++ )
+        if( patterns[i] && run_pattern( hp, (access_pattern_t)i, &bench_opt ) < 0 )
+            goto fail;
+    free_handler( hp );
+    return 0;
+fail:
+    free_handler( hp );
+    return 1;
+}
@@ -24,9 +24,13 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <limits.h>
 
 #include "../common/utils.h"
+#include "../common/osdep.h"
 #include "../common/progress.h"
 #include "../common/lwlibav_dec.h"
 #include "../common/lwlibav_audio.h"
@@ -68,11 +72,54 @@ uint64_t output_pcm_samples_from_packet
     return 0;
 }
 
+uint64_t lw_get_cached_pcm_samples
+(
+    lw_audio_output_handler_t *aohp,
+    lw_get_pcm_samples_func   *get_pcm_samples,
+    void                      *dhp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
+)
+{
+    return 0;
+}
+
 void lw_cleanup_audio_output_handler( lw_audio_output_handler_t *aohp ){ }
 #endif
 
 #define PREFERRED_DECODER_NAMES_BUFSIZE 512
 
+typedef struct batch_tag batch_t;
+
+/* The progress of a job in the batch mode. */
+struct progress_handler_tag
+{
+    batch_t    *batch;
+    const char *file_path;
+    int         last_percent;
+};
+
+typedef struct
+{
+    const char *file_path;
+    int64_t     file_size;      /* -1 if unknown */
+} batch_job_t;
+
+struct batch_tag
+{
+    lwlibav_option_t opt;           /* the options common to every job */
+    batch_job_t     *jobs;
+    int              job_count;
+    int              next_job;
+    int              done_count;
+    int              failed_count;
+    int64_t          done_size;
+    int              json;          /* 1 = report the progress in JSON lines to stdout */
+    double           start_time;
+    lw_mutex_t      *mutex;         /* guards the job queue, the counts and the report */
+};
+
 typedef struct
 {
     lwlibav_file_handler_t          lwh;
@@ -138,46 +185,494 @@ static void close_indicator( progress_handler_t *php )
     fprintf( stderr, "\n" );
 }
 
-int main (const int argc, const char* argv[])
+/* Construct the index, and return the elapsed time in seconds or a negative value on failure. */
+static double construct_index_with_indicator
+(
+    lwlibav_option_t     *opt,
+    progress_indicator_t *indicator,
+    progress_handler_t   *php
+)
 {
-    bool has_index_path = false;
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s file.mkv [index.lwi]\n", argv[0]);
-        return 1;
-    } else if (argc == 3) {
-        has_index_path = true;
-    }
-
     /* Allocate the handler of this filter function. */
     lwlibav_handler_t *hp = alloc_handler();
     if( !hp )
     {
         fprintf(stderr, "Failed to allocate the LW-Libav handler." );
+        return -1.0;
+    }
+    double start = lw_get_time();
+    int ret = lwlibav_construct_index( &hp->lwh, hp->vdhp, hp->vohp, hp->adhp, hp->aohp, NULL, opt, indicator, php );
+    double elapsed = lw_get_time() - start;
+    free_handler( &hp );
+    return ret < 0 ? -1.0 : elapsed;
+}
+
+static double construct_index( lwlibav_option_t *opt )
+{
+    /* Set up progress indicator. */
+    progress_indicator_t indicator;
+    indicator.open   = NULL;
+    indicator.update = update_indicator;
+    indicator.close  = close_indicator;
+    return construct_index_with_indicator( opt, &indicator, NULL );
+}
+
+/*****************************************************************************
+ * Batch mode
+ *****************************************************************************/
+static void print_json_string
+(
+    FILE       *out,
+    const char *str
+)
+{
+    fputc( '"', out );
+    for( const unsigned char *p = (const unsigned char *)str; *p; p++ )
+    {
+        if( *p == '"' || *p == '\\' )
+            fprintf( out, "\\%c", *p );
+        else if( *p < 0x20 )
+            fprintf( out, "\\u%04x", *p );
+        else
+            fputc( *p, out );
+    }
+    fputc( '"', out );
+}
+
+static double get_throughput
+(
+    int64_t size,
+    double  seconds
+)
+{
+    return size > 0 && seconds > 0.0 ? size / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+/* Every report is a line of a JSON object with "event" in the JSON mode, otherwise a line of text to stderr.
+ * The caller holds the lock of the batch. */
+static void report_job_start
+(
+    batch_t           *batch,
+    const batch_job_t *job
+)
+{
+    if( !batch->json )
+        return;
+    fprintf( stdout, "{\"event\":\"start\",\"file\":" );
+    print_json_string( stdout, job->file_path );
+    fprintf( stdout, ",\"size\":%" PRId64 "}\n", job->file_size );
+    fflush( stdout );
+}
+
+static void report_job_end
+(
+    batch_t           *batch,
+    const batch_job_t *job,
+    double             elapsed
+)
+{
+    int ok = elapsed >= 0.0;
+    if( batch->json )
+    {
+        fprintf( stdout, "{\"event\":\"end\",\"file\":" );
+        print_json_string( stdout, job->file_path );
+        fprintf( stdout, ",\"size\":%" PRId64 ",\"status\":\"%s\",\"seconds\":%.3f,\"mib_per_sec\":%.2f,\"done\":%d,\"total\":%d}\n",
+                 job->file_size, ok ? "ok" : "failed", ok ? elapsed : 0.0, ok ? get_throughput( job->file_size, elapsed ) : 0.0,
+                 batch->done_count, batch->job_count );
+        fflush( stdout );
+    }
+    else if( ok )
+        fprintf( stderr, "[%d/%d] %8.3f s %9.2f MiB/s  %s\n",
+                 batch->done_count, batch->job_count, elapsed, get_throughput( job->file_size, elapsed ), job->file_path );
+    else
+        fprintf( stderr, "[%d/%d] failed                      %s\n",
+                 batch->done_count, batch->job_count, job->file_path );
+}
+
+static void report_batch_end
+(
+    batch_t *batch,
+    double   elapsed
+)
+{
+    if( batch->json )
+    {
+        fprintf( stdout, "{\"event\":\"summary\",\"files\":%d,\"failed\":%d,\"size\":%" PRId64 ",\"seconds\":%.3f,\"mib_per_sec\":%.2f}\n",
+                 batch->job_count, batch->failed_count, batch->done_size, elapsed, get_throughput( batch->done_size, elapsed ) );
+        fflush( stdout );
+    }
+    else
+        fprintf( stderr, "Indexed %d of %d files in %.3f s, %.2f MiB/s\n",
+                 batch->job_count - batch->failed_count, batch->job_count, elapsed, get_throughput( batch->done_size, elapsed ) );
+}
+
+static int update_batch_indicator( progress_handler_t *php, const char *message, int percent )
+{
+    /* Report every 10 percent at most so that the reports of many concurrent jobs stay readable. */
+    if( !php->batch->json || strcmp( message, "Creating Index file" ) || percent / 10 == php->last_percent / 10 )
+        return 0;
+    php->last_percent = percent;
+    lw_mutex_lock( php->batch->mutex );
+    fprintf( stdout, "{\"event\":\"progress\",\"file\":" );
+    print_json_string( stdout, php->file_path );
+    fprintf( stdout, ",\"percent\":%d}\n", percent );
+    fflush( stdout );
+    lw_mutex_unlock( php->batch->mutex );
+    return 0;
+}
+
+static void *batch_worker_thread( void *arg )
+{
+    batch_t *batch = (batch_t *)arg;
+    progress_indicator_t indicator;
+    indicator.open   = NULL;
+    indicator.update = update_batch_indicator;
+    indicator.close  = NULL;
+    while( 1 )
+    {
+        lw_mutex_lock( batch->mutex );
+        batch_job_t *job = batch->next_job < batch->job_count ? &batch->jobs[ batch->next_job++ ] : NULL;
+        if( job )
+            report_job_start( batch, job );
+        lw_mutex_unlock( batch->mutex );
+        if( !job )
+            break;
+        /* A failed job never stops the others. */
+        progress_handler_t ph = { batch, job->file_path, 0 };
+        lwlibav_option_t opt = batch->opt;
+        opt.file_path      = job->file_path;
+        /* The files are already indexed concurrently on the workers, so the threads per file would only oversubscribe the CPUs. */
+        opt.parallel_index = 0;
+        double elapsed = construct_index_with_indicator( &opt, &indicator, &ph );
+        lw_mutex_lock( batch->mutex );
+        ++ batch->done_count;
+        if( elapsed < 0.0 )
+            ++ batch->failed_count;
+        else if( job->file_size > 0 )
+            batch->done_size += job->file_size;
+        report_job_end( batch, job, elapsed );
+        lw_mutex_unlock( batch->mutex );
+    }
+    return NULL;
+}
+
+static int compare_job_size( const void *a, const void *b )
+{
+    int64_t size_a = ((const batch_job_t *)a)->file_size;
+    int64_t size_b = ((const batch_job_t *)b)->file_size;
+    return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+static int64_t get_file_size( const char *file_path )
+{
+    FILE *file = lw_fopen( file_path, "rb" );
+    if( !file )
+        return -1;
+    int64_t size = lw_fseek( file, 0, SEEK_END ) ? -1 : lw_ftell( file );
+    fclose( file );
+    return size;
+}
+
+/* Index the files on 'thread_count' workers, and return the number of the failed files or -1 on failure.
+ * The largest files are started first so that the last ones finishing alone are short. */
+static int run_batch( batch_t *batch, int thread_count )
+{
+    for( int i = 0; i < batch->job_count; i++ )
+        batch->jobs[i].file_size = get_file_size( batch->jobs[i].file_path );
+    qsort( batch->jobs, batch->job_count, sizeof(batch_job_t), compare_job_size );
+    if( thread_count > batch->job_count )
+        thread_count = batch->job_count;
+    lw_thread_t **threads = (lw_thread_t **)lw_malloc_zero( thread_count * sizeof(lw_thread_t *) );
+    batch->mutex = lw_mutex_create();
+    if( !threads || !batch->mutex )
+    {
+        lw_free( threads );
+        lw_mutex_destroy( batch->mutex );
+        return -1;
+    }
+    batch->start_time = lw_get_time();
+    int started = 0;
+    for( ; started < thread_count; started++ )
+        if( !(threads[started] = lw_thread_create( batch_worker_thread, batch )) )
+            break;
+    /* Run on this thread if no worker could be started. */
+    if( started == 0 )
+        batch_worker_thread( batch );
+    for( int i = 0; i < started; i++ )
+        lw_thread_join( threads[i] );
+    report_batch_end( batch, lw_get_time() - batch->start_time );
+    lw_free( threads );
+    lw_mutex_destroy( batch->mutex );
+    return batch->failed_count;
+}
+
+/* Read a whole line of any length into '*line' growing as needed.
+ * Return 0 on success, 1 at the end of the file, or -1 on error. */
+static int read_line( FILE *file, char **line, size_t *capacity )
+{
+    size_t length = 0;
+    while( 1 )
+    {
+        if( *capacity - length < 2 )
+        {
+            size_t new_capacity = *capacity ? *capacity << 1 : 4096;
+            char  *temp         = (char *)realloc( *line, new_capacity );
+            if( !temp )
+                return -1;
+            *line     = temp;
+            *capacity = new_capacity;
+        }
+        if( !fgets( *line + length, (int)MIN( *capacity - length, INT_MAX ), file ) )
+            return ferror( file ) ? -1 : length > 0 ? 0 : 1;
+        length += strlen( *line + length );
+        if( length > 0 && (*line)[length - 1] == '\n' )
+            return 0;
+    }
+}
+
+/* Append the file paths listed one per line in 'list_path', or stdin if "-", to 'paths'. */
+static int read_file_list( const char *list_path, char ***paths, int *count )
+{
+    FILE *list = strcmp( list_path, "-" ) ? lw_fopen( list_path, "r" ) : stdin;
+    if( !list )
+        return -1;
+    char  *line     = NULL;
+    size_t capacity = 0;
+    int    ret;
+    while( (ret = read_line( list, &line, &capacity )) == 0 )
+    {
+        size_t length = strcspn( line, "\r\n" );
+        line[length] = '\0';
+        if( length == 0 )
+            continue;
+        char **temp = (char **)realloc( *paths, (*count + 1) * sizeof(char *) );
+        char  *path = (char *)lw_malloc_zero( length + 1 );
+        if( temp )
+            *paths = temp;
+        if( !temp || !path )
+        {
+            lw_free( path );
+            ret = -1;
+            break;
+        }
+        memcpy( path, line, length );
+        (*paths)[ (*count)++ ] = path;
+    }
+    free( line );
+    if( list != stdin )
+        fclose( list );
+    return ret < 0 ? -1 : 0;
+}
+
+int main (const int argc, const char* argv[])
+{
+    bool        text_index      = false;
+    bool        serial          = false;
+    bool        speedup         = false;
+    bool        io_speedup      = false;
+    bool        write_speedup   = false;
+    bool        direct_io       = false;
+    bool        range_index     = false;
+    bool        batch_mode      = false;
+    bool        json            = false;
+    int         jobs            = 0;
+    int         read_ahead      = 0;
+    int         positional      = 0;
+    bool        bad_option      = false;
+    char      **list_paths      = NULL;
+    int         list_count      = 0;
+    const char **positionals    = (const char **)lw_malloc_zero( argc * sizeof(const char *) );
+    if (!positionals)
         return 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--text"))
+            text_index = true;
+        else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--serial"))
+            serial = true;
+        else if (!strcmp(argv[i], "--speedup"))
+            speedup = true;
+        else if (!strcmp(argv[i], "--io-speedup"))
+            io_speedup = true;
+        else if (!strcmp(argv[i], "--write-speedup"))
+            write_speedup = true;
+        else if (!strcmp(argv[i], "--direct-io"))
+            direct_io = true;
+        else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--ranges"))
+            range_index = true;
+        else if (!strcmp(argv[i], "--read-ahead")) {
+            if (i + 1 < argc)
+                read_ahead = atoi(argv[++i]);
+            else
+                bad_option = true;
+        }
+        else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--batch"))
+            batch_mode = true;
+        else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            if (i + 1 < argc)
+                jobs = atoi(argv[++i]);
+            else
+                bad_option = true;
+            batch_mode = true;
+        }
+        else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--list")) {
+            if (i + 1 >= argc || read_file_list(argv[++i], &list_paths, &list_count) < 0) {
+                fprintf(stderr, "lsmas: failed to read the file list.\n");
+                return 1;
+            }
+            batch_mode = true;
+        }
+        else if (!strcmp(argv[i], "--json"))
+            json = true;
+        else
+            positionals[positional++] = argv[i];
     }
-    lwlibav_file_handler_t         *lwhp = &hp->lwh;
-    lwlibav_video_decode_handler_t *vdhp = hp->vdhp;
-    lwlibav_video_output_handler_t *vohp = hp->vohp;
+    /* Every positional argument is a source file in the batch mode. */
+    const char *file_path       = !batch_mode && positional >= 1 ? positionals[0] : NULL;
+    const char *index_file_path = !batch_mode && positional >= 2 ? positionals[1] : NULL;
+    if ((!batch_mode && (positional < 1 || positional > 2)) || (batch_mode && (speedup || io_speedup || write_speedup || positional + list_count == 0)) || bad_option) {
+        fprintf(stderr, "Usage: %s [--text] [--serial] [--ranges] [--speedup] [--read-ahead N] [--direct-io] [--io-speedup] [--write-speedup] file.mkv [index.lwi]\n"
+                        "       %s --batch [-j N] [-l list.txt] [--json] [options] file1.mkv file2.mkv ...\n"
+                        "  -t, --text         write the index file in the text format instead of the binary one\n"
+                        "  -s, --serial       index on a single thread\n"
+                        "  -r, --ranges       index large MPEG-TS files in byte ranges on the other threads\n"
+                        "      --speedup      measure the speedup of the parallel indexing over the serial one\n"
+                        "      --read-ahead N read the input file through N MiB of the read-ahead buffer\n"
+                        "      --direct-io    bypass the page cache of the OS by the read-ahead I/O (Linux only)\n"
+                        "      --io-speedup   measure the speedup of the read-ahead I/O over the default one\n"
+                        "      --write-speedup\n"
+                        "                     measure the time to write the index file in the binary format and the text one\n"
+                        "  -b, --batch        index every given file next to it, the largest first, reporting the time per file\n"
+                        "  -j, --jobs N       index N files concurrently, each on a single thread, in the batch mode (default: the number of CPUs)\n"
+                        "  -l, --list FILE    add the files listed one per line in FILE, or stdin if -, in the batch mode\n"
+                        "      --json         report the progress of the batch mode in JSON lines to stdout\n", argv[0], argv[0]);
+        return 1;
+    }
+
     /* Get options. */
     lwlibav_option_t opt;
-    opt.file_path         = argv[1];
+    opt.file_path         = file_path;
     opt.cache_dir         = "";
     opt.no_create_index   = 0;
-    opt.index_file_path   = has_index_path ? argv[2] : NULL;
+    opt.index_file_path   = index_file_path;
+    opt.text_index        = text_index;
     opt.threads           = 0;
     opt.force_video       = 0;
     opt.force_video_index = -1;
     opt.force_audio       = 0;
     opt.force_audio_index = -2;
-    /* Set up progress indicator. */
-    progress_indicator_t indicator;
-    indicator.open   = NULL;
-    indicator.update = update_indicator;
-    indicator.close  = close_indicator;
-    /* Construct index. */
-    int ret = lwlibav_construct_index( lwhp, vdhp, vohp, hp->adhp, hp->aohp, NULL, &opt, &indicator, NULL );
-    free_handler( &hp );
-    if( ret < 0 )
+    opt.parallel_index    = !serial;
+    opt.read_ahead        = read_ahead > 0 ? read_ahead : 0;
+    opt.direct_io         = direct_io;
+    opt.selective_index   = 0;
+    opt.range_index       = range_index;
+    if( batch_mode )
+    {
+        batch_t batch = { 0 };
+        batch.opt       = opt;
+        batch.json      = json;
+        batch.job_count = positional + list_count;
+        batch.jobs      = (batch_job_t *)lw_malloc_zero( (batch.job_count + 1) * sizeof(batch_job_t) );
+        int failed = -1;
+        if( batch.jobs )
+        {
+            for( int i = 0; i < positional; i++ )
+                batch.jobs[i].file_path = positionals[i];
+            for( int i = 0; i < list_count; i++ )
+                batch.jobs[positional + i].file_path = list_paths[i];
+            failed = run_batch( &batch, jobs > 0 ? jobs : lw_get_cpu_count() );
+        }
+        if( failed < 0 )
+            fprintf(stderr, "lsmas: failed to run the batch.\n" );
+        lw_free( batch.jobs );
+        for( int i = 0; i < list_count; i++ )
+            lw_free( list_paths[i] );
+        free( list_paths );
+        lw_free( positionals );
+        return failed != 0;
+    }
+    lw_free( positionals );
+    if( speedup )
+    {
+        /* Parse the input file twice without reading or writing any index file. */
+        lwlibav_option_t dry_opt = opt;
+        dry_opt.no_create_index = 1;
+        dry_opt.index_file_path = "";
+        dry_opt.parallel_index  = 0;
+        double serial_time   = construct_index( &dry_opt );
+        dry_opt.parallel_index  = 1;
+        double parallel_time = serial_time >= 0.0 ? construct_index( &dry_opt ) : -1.0;
+        if( parallel_time < 0.0 )
+        {
+            fprintf(stderr, "lsmas: failed to parse %s.", opt.file_path );
+            return 1;
+        }
+        fprintf( stderr, "Serial: %.3f s, Parallel: %.3f s (%d CPUs), Speedup: %.2fx\n",
+                 serial_time, parallel_time, lw_get_cpu_count(),
+                 parallel_time > 0.0 ? serial_time / parallel_time : 0.0 );
+    }
+    if( io_speedup )
+    {
+        /* The page cache of the OS is filled by the first run, so warm it up first for a fair comparison
+         * unless the read-ahead I/O bypasses it. */
+        lwlibav_option_t dry_opt = opt;
+        dry_opt.no_create_index = 1;
+        dry_opt.index_file_path = "";
+        dry_opt.read_ahead      = 0;
+        if( !direct_io && construct_index( &dry_opt ) < 0.0 )
+        {
+            fprintf(stderr, "lsmas: failed to parse %s.", opt.file_path );
+            return 1;
+        }
+        double default_time    = construct_index( &dry_opt );
+        dry_opt.read_ahead      = opt.read_ahead > 0 ? opt.read_ahead : 64;
+        double read_ahead_time = default_time >= 0.0 ? construct_index( &dry_opt ) : -1.0;
+        if( read_ahead_time < 0.0 )
+        {
+            fprintf(stderr, "lsmas: failed to parse %s.", opt.file_path );
+            return 1;
+        }
+        fprintf( stderr, "Default I/O: %.3f s, Read-ahead I/O (%d MiB%s): %.3f s, Speedup: %.2fx\n",
+                 default_time, dry_opt.read_ahead, direct_io ? ", direct" : "", read_ahead_time,
+                 read_ahead_time > 0.0 ? default_time / read_ahead_time : 0.0 );
+    }
+    if( write_speedup )
+    {
+        /* Write a scratch index file in each format after parsing the input file without writing,
+         * which also warms the page cache up. The differences from the parsing time are the costs of writing.
+         * The scratch file is put in the temporary directory and removed right after each measurement. */
+        char *bench_path = lw_get_temp_file_path( ".bench.lwi" );
+        if( !bench_path )
+            return 1;
+        lwlibav_option_t bench_opt = opt;
+        bench_opt.no_create_index = 1;
+        bench_opt.index_file_path = "";
+        double parse_time = construct_index( &bench_opt );
+        double write_time[2] = { -1.0, -1.0 };
+        int64_t write_size[2] = { -1, -1 };
+        bench_opt.no_create_index = 0;
+        bench_opt.index_file_path = bench_path;
+        for( int text = 0; text < 2 && parse_time >= 0.0; text++ )
+        {
+            bench_opt.text_index = text;
+            lw_remove_file( bench_path );
+            write_time[text] = construct_index( &bench_opt );
+            write_size[text] = get_file_size( bench_path );
+            lw_remove_file( bench_path );
+            if( write_time[text] < 0.0 )
+                break;
+        }
+        lw_free( bench_path );
+        if( write_time[1] < 0.0 )
+        {
+            fprintf(stderr, "lsmas: failed to parse %s.", opt.file_path );
+            return 1;
+        }
+        fprintf( stderr, "Parsing only: %.3f s, Binary: %.3f s (+%.3f s, %" PRId64 " bytes), Text: %.3f s (+%.3f s, %" PRId64 " bytes)\n",
+                 parse_time,
+                 write_time[0], write_time[0] - parse_time, write_size[0],
+                 write_time[1], write_time[1] - parse_time, write_size[1] );
+    }
+    if( construct_index( &opt ) < 0.0 )
     {
         fprintf(stderr, "lsmas: failed to construct index for %s.", opt.file_path );
         return 1;
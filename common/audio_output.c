@@ -22,6 +22,9 @@
 
 #include "cpp_compat.h"
 
+#include <string.h>
+#include <limits.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -33,6 +36,7 @@ extern "C"
 }
 #endif  /* __cplusplus */
 
+#include "utils.h"
 #include "audio_output.h"
 #include "resample.h"
 #include "decode.h"
@@ -206,11 +210,148 @@ uint64_t output_pcm_samples_from_packet
     return output_length;
 }
 
+/* The resampled PCM samples are kept in blocks aligned to multiples of the block length
+ * and the least recently used ones are discarded when exceeding the budget. */
+#define AUDIO_CACHE_BLOCK_SAMPLES 65536
+
+typedef struct
+{
+    uint64_t  block_number;
+    uint64_t  length;       /* the number of the valid samples, which is less than the block length only at the end */
+    uint64_t  last_used;
+    uint8_t  *data;
+} audio_cache_block_t;
+
+struct lw_audio_block_cache_tag
+{
+    audio_cache_block_t *blocks;
+    int                  count;
+    int                  capacity;
+    uint64_t             clock;
+};
+
+static void close_block_cache
+(
+    lw_audio_output_handler_t *aohp
+)
+{
+    lw_audio_block_cache_t *bcp = aohp->block_cache;
+    if( !bcp )
+        return;
+    for( int i = 0; i < bcp->count; i++ )
+        av_free( bcp->blocks[i].data );
+    av_free( bcp->blocks );
+    av_freep( &aohp->block_cache );
+}
+
+/* Return the cached block, or load it into the least recently used slot if not found.
+ * Return NULL on failure. */
+static audio_cache_block_t *get_cached_block
+(
+    lw_audio_output_handler_t *aohp,
+    lw_get_pcm_samples_func   *get_pcm_samples,
+    void                      *dhp,
+    uint64_t                   block_number
+)
+{
+    lw_audio_block_cache_t *bcp   = aohp->block_cache;
+    audio_cache_block_t    *block = NULL;
+    for( int i = 0; i < bcp->count; i++ )
+        if( bcp->blocks[i].block_number == block_number )
+        {
+            block = &bcp->blocks[i];
+            block->last_used = ++ bcp->clock;
+            return block;
+        }
+    if( bcp->count < bcp->capacity )
+    {
+        block = &bcp->blocks[ bcp->count ];
+        block->data = (uint8_t *)av_malloc( (size_t)AUDIO_CACHE_BLOCK_SAMPLES * aohp->output_block_align );
+        if( !block->data )
+            return NULL;
+        ++ bcp->count;
+    }
+    else
+    {
+        block = &bcp->blocks[0];
+        for( int i = 1; i < bcp->count; i++ )
+            if( bcp->blocks[i].last_used < block->last_used )
+                block = &bcp->blocks[i];
+    }
+    /* The blocks are loaded in ascending order on sequential access, so the decoder continues without seeking. */
+    block->length       = get_pcm_samples( dhp, aohp, block->data, block_number * AUDIO_CACHE_BLOCK_SAMPLES, AUDIO_CACHE_BLOCK_SAMPLES );
+    block->block_number = block_number;
+    block->last_used    = ++ bcp->clock;
+    if( block->length == 0 )
+    {
+        /* Nothing is output at the end of the stream or on a failure, so don't keep it. */
+        block->block_number = UINT64_MAX;
+        block->last_used    = 0;
+    }
+    return block;
+}
+
+uint64_t lw_get_cached_pcm_samples
+(
+    lw_audio_output_handler_t *aohp,
+    lw_get_pcm_samples_func   *get_pcm_samples,
+    void                      *dhp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
+)
+{
+    size_t block_size = (size_t)AUDIO_CACHE_BLOCK_SAMPLES * aohp->output_block_align;
+    if( aohp->block_cache_budget < block_size || aohp->output_block_align == 0 )
+        return get_pcm_samples( dhp, aohp, buf, start, wanted_length );
+    if( !aohp->block_cache )
+    {
+        lw_audio_block_cache_t *bcp = (lw_audio_block_cache_t *)av_mallocz( sizeof(lw_audio_block_cache_t) );
+        if( !bcp )
+            return get_pcm_samples( dhp, aohp, buf, start, wanted_length );
+        bcp->capacity = (int)MIN( aohp->block_cache_budget / block_size, INT_MAX );
+        bcp->blocks   = (audio_cache_block_t *)av_calloc( bcp->capacity, sizeof(audio_cache_block_t) );
+        if( !bcp->blocks )
+        {
+            av_free( bcp );
+            return get_pcm_samples( dhp, aohp, buf, start, wanted_length );
+        }
+        aohp->block_cache = bcp;
+    }
+    uint8_t *out           = (uint8_t *)buf;
+    uint64_t output_length = 0;
+    if( start < 0 )
+    {
+        /* The samples before the stream are silent. */
+        uint64_t silence_length = MIN( -start, wanted_length );
+        put_silence_audio_samples( (int)(silence_length * aohp->output_block_align), aohp->output_bits_per_sample == 8, &out );
+        output_length += silence_length;
+        start         += silence_length;
+    }
+    while( output_length < (uint64_t)wanted_length )
+    {
+        uint64_t             block_number = (uint64_t)start / AUDIO_CACHE_BLOCK_SAMPLES;
+        uint64_t             offset       = (uint64_t)start % AUDIO_CACHE_BLOCK_SAMPLES;
+        audio_cache_block_t *block        = get_cached_block( aohp, get_pcm_samples, dhp, block_number );
+        if( !block || block->length <= offset )
+            break;
+        uint64_t copy_length = MIN( block->length - offset, wanted_length - output_length );
+        memcpy( out, block->data + offset * aohp->output_block_align, (size_t)(copy_length * aohp->output_block_align) );
+        out           += copy_length * aohp->output_block_align;
+        output_length += copy_length;
+        start         += copy_length;
+        if( block->length < AUDIO_CACHE_BLOCK_SAMPLES )
+            break;  /* the end of the stream */
+    }
+    return output_length;
+}
+
 void lw_cleanup_audio_output_handler
 (
     lw_audio_output_handler_t *aohp
 )
 {
+    close_block_cache( aohp );
     if( aohp->resampled_buffer )
         av_freep( &aohp->resampled_buffer );
     if( aohp->swr_ctx )
@@ -22,6 +22,8 @@
 
 #include "cpp_compat.h"
 
+typedef struct lw_audio_block_cache_tag lw_audio_block_cache_t;
+
 typedef struct
 {
     SwrContext*             swr_ctx;
@@ -41,8 +43,20 @@ typedef struct
     uint64_t                request_length;
     uint64_t                skip_decoded_samples;   /* Upsampling by the decoder is considered. */
     uint64_t                output_sample_offset;
+    size_t                  block_cache_budget;     /* the maximum bytes of the resampled blocks held in the cache */
+    lw_audio_block_cache_t *block_cache;
 } lw_audio_output_handler_t;
 
+/* Output PCM samples of the range [start, start + wanted_length) into buf and return the number of the output samples. */
+typedef uint64_t lw_get_pcm_samples_func
+(
+    void                      *dhp,
+    lw_audio_output_handler_t *aohp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
+);
+
 enum audio_output_flag
 {
     AUDIO_OUTPUT_NO_FLAGS         = 0,
@@ -54,6 +68,65 @@ enum audio_output_flag
 };
 CPP_DEFINE_OR_SUBSTITUTE_OPERATOR( enum audio_output_flag )
 
+typedef struct
+{
+    uint32_t first_frame_number;
+    int      sample_rate;
+} lw_audio_sequence_t;
+
+/* the positions of the audio frames at the output sampling rate for seeking */
+typedef struct
+{
+    int                  output_sample_rate;    /* the output sampling rate which this table is built for */
+    int                  default_sample_rate;   /* the sampling rate taken for the frames with unknown one */
+    uint64_t            *end_pos_list;          /* the number of output PCM samples up to the end of each frame */
+    lw_audio_sequence_t *sequence_list;         /* the first frames of the sequences, which are resampled individually */
+    uint32_t             sequence_count;
+} lw_audio_position_table_t;
+
+/* Return the first frame ending after a given position, or frame_count + 1 if none. */
+static inline uint32_t lw_find_audio_frame_by_position
+(
+    const lw_audio_position_table_t *table,
+    uint32_t                         frame_count,
+    uint64_t                         position
+)
+{
+    uint32_t lo = 1;
+    uint32_t hi = frame_count + 1;
+    while( lo < hi )
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if( position < table->end_pos_list[mid] )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* Return the sampling rate of the sequence containing a given frame, or 0 if no sequence precedes it. */
+static inline int lw_get_audio_sequence_sample_rate
+(
+    const lw_audio_position_table_t *table,
+    uint32_t                         frame_number
+)
+{
+    if( table->sequence_count == 0 || table->sequence_list[0].first_frame_number > frame_number )
+        return 0;
+    uint32_t lo = 0;
+    uint32_t hi = table->sequence_count;
+    while( lo + 1 < hi )
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if( table->sequence_list[mid].first_frame_number <= frame_number )
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return table->sequence_list[lo].sample_rate;
+}
+
 uint64_t output_pcm_samples_from_buffer
 (
     lw_audio_output_handler_t *aohp,
@@ -72,6 +145,18 @@ uint64_t output_pcm_samples_from_packet
     enum audio_output_flag    *output_flags
 );
 
+/* Output PCM samples through the cache of resampled blocks if 'block_cache_budget' is set.
+ * The blocks not in the cache are output by 'get_pcm_samples'. */
+uint64_t lw_get_cached_pcm_samples
+(
+    lw_audio_output_handler_t *aohp,
+    lw_get_pcm_samples_func   *get_pcm_samples,
+    void                      *dhp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
+);
+
 void lw_cleanup_audio_output_handler
 (
     lw_audio_output_handler_t *aohp
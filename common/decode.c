@@ -262,3 +262,112 @@ int decode_audio_packet
         *got_frame = 1;
     return consumed_bytes;
 }
+
+static int push_decoded_frame
+(
+    decoded_frame_queue_t *queue,
+    AVFrame               *frame
+)
+{
+    if( queue->count == queue->capacity )
+    {
+        int capacity = queue->capacity ? 2 * queue->capacity : 8;
+        AVFrame **frames = (AVFrame **)av_realloc_array( queue->frames, capacity, sizeof(AVFrame *) );
+        if( !frames )
+            return AVERROR( ENOMEM );
+        queue->frames   = frames;
+        queue->capacity = capacity;
+    }
+    /* Frames come out almost in output order, so search the position from the tail.
+     * Frames without identifier are placed at the tail. */
+    int i = queue->count;
+    if( frame->pts != AV_NOPTS_VALUE )
+        while( i > 0
+            && (queue->frames[i - 1]->pts == AV_NOPTS_VALUE || queue->frames[i - 1]->pts > frame->pts) )
+            --i;
+    memmove( &queue->frames[i + 1], &queue->frames[i], (queue->count - i) * sizeof(AVFrame *) );
+    queue->frames[i] = frame;
+    ++ queue->count;
+    return 0;
+}
+
+/* Return the number of received frames, or a negative error code. */
+static int receive_frames
+(
+    AVCodecContext        *ctx,
+    decoded_frame_queue_t *queue
+)
+{
+    int count = 0;
+    while( 1 )
+    {
+        AVFrame *frame = av_frame_alloc();
+        if( !frame )
+            return AVERROR( ENOMEM );
+        int ret = avcodec_receive_frame( ctx, frame );
+        if( ret == 0 )
+            ret = push_decoded_frame( queue, frame );
+        if( ret < 0 )
+        {
+            av_frame_free( &frame );
+            return ret == AVERROR( EAGAIN )     /* Must send new packets before receiving frames if true. */
+                || ret == AVERROR_EOF           /* No more frames can be drained if true. */
+                 ? count
+                 : ret;
+        }
+        ++count;
+    }
+}
+
+int send_packet_and_receive_frames
+(
+    AVCodecContext        *ctx,
+    decoded_frame_queue_t *queue,
+    AVPacket              *pkt
+)
+{
+    int ret;
+    while( (ret = avcodec_send_packet( ctx, pkt )) == AVERROR( EAGAIN ) )
+    {
+        /* Must receive output frames before sending new packets. */
+        int received = receive_frames( ctx, queue );
+        if( received <= 0 )
+            return received < 0 ? received : AVERROR_BUG;
+    }
+    int received = receive_frames( ctx, queue );
+    if( ret < 0 && ret != AVERROR_EOF ) /* No more packets can be sent if AVERROR_EOF. */
+        return ret;
+    return received < 0 ? received : 0;
+}
+
+AVFrame *take_decoded_frame
+(
+    decoded_frame_queue_t *queue
+)
+{
+    if( queue->count == 0 )
+        return NULL;
+    AVFrame *frame = queue->frames[0];
+    memmove( &queue->frames[0], &queue->frames[1], (-- queue->count) * sizeof(AVFrame *) );
+    return frame;
+}
+
+void clear_decoded_frame_queue
+(
+    decoded_frame_queue_t *queue
+)
+{
+    for( int i = 0; i < queue->count; i++ )
+        av_frame_free( &queue->frames[i] );
+    queue->count = 0;
+}
+
+void free_decoded_frame_queue
+(
+    decoded_frame_queue_t *queue
+)
+{
+    clear_decoded_frame_queue( queue );
+    av_freep( &queue->frames );
+    queue->capacity = 0;
+}
@@ -20,6 +20,13 @@
 
 /* This file is available under an ISC license. */
 
+typedef struct
+{
+    AVFrame **frames;       /* the decoded frames in ascending order of the output order identifier in pts */
+    int       count;
+    int       capacity;
+} decoded_frame_queue_t;
+
 static inline uint32_t get_decoder_delay
 (
     AVCodecContext *ctx
@@ -31,6 +38,22 @@ static inline uint32_t get_decoder_delay
         return ctx->has_b_frames + ((ctx->active_thread_type & FF_THREAD_FRAME) ? ctx->thread_count - 1 : 0);
 }
 
+/* Return the total bytes of the buffers referenced by the frame, or 0 if no frame. */
+static inline size_t get_frame_buffer_size
+(
+    AVFrame *frame
+)
+{
+    size_t size = 0;
+    if( !frame )
+        return 0;
+    for( int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++ )
+        size += frame->buf[i]->size;
+    for( int i = 0; i < frame->nb_extended_buf; i++ )
+        size += frame->extended_buf[i]->size;
+    return size;
+}
+
 const AVCodec *find_decoder
 (
     enum AVCodecID           codec_id,
@@ -75,3 +98,30 @@ int decode_audio_packet
     int            *got_frame,
     AVPacket       *pkt
 );
+
+/* Feed a packet to the decoder and collect all the frames which the decoder can output into the queue.
+ * If the decoder cannot accept the packet yet, its output frames are collected until it can.
+ * If pkt is NULL, the decoder is drained.
+ * Return 0 if successful, or a negative error code returned by the decoder otherwise. */
+int send_packet_and_receive_frames
+(
+    AVCodecContext        *ctx,
+    decoded_frame_queue_t *queue,
+    AVPacket              *pkt
+);
+
+/* Take out the first frame in the queue, or return NULL if empty. */
+AVFrame *take_decoded_frame
+(
+    decoded_frame_queue_t *queue
+);
+
+void clear_decoded_frame_queue
+(
+    decoded_frame_queue_t *queue
+);
+
+void free_decoded_frame_queue
+(
+    decoded_frame_queue_t *queue
+);
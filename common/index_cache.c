@@ -0,0 +1,332 @@
+/*****************************************************************************
+ * index_cache.c
+ *****************************************************************************
+ * Copyright (C) 2012-2015 L-SMASH Works project
+ *
+ * Authors: Yusuke Nakamura <muken.the.vfrmaniac@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license. */
+
+/* for st_mtim in strict C99 mode */
+#if !defined( _WIN32 ) && !defined( _POSIX_C_SOURCE ) && !defined( __APPLE__ )
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "cpp_compat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "osdep.h"
+#include "utils.h"
+#include "index_cache.h"
+
+struct lw_index_cache_tag
+{
+    lw_index_cache_t *next;
+    char             *path;             /* the real path of the index file */
+    int64_t           file_size;
+    int64_t           file_mtime;       /* in the finest unit given by the system */
+    uint8_t          *data;             /* the read-only mapping of the file */
+    size_t            data_size;
+    uint8_t           head[LW_INDEX_CACHE_HEAD_SIZE];
+    size_t            head_size;
+    char             *source_path;      /* the source file verified against the image, NULL = not verified yet */
+    int64_t           source_size;
+    int64_t           source_mtime;
+    int               ref_count;
+};
+
+/* Every access to the list and the reference counts is done with the global lock held. */
+static lw_index_cache_t *cache_list = NULL;
+
+static int get_file_stat
+(
+    const char *file_path,
+    int64_t    *file_size,
+    int64_t    *file_mtime
+)
+{
+    /* The modification time in seconds could miss the index file rewritten within the same second. */
+#ifdef _WIN32
+    wchar_t *wname = NULL;
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if( !lw_string_to_wchar( CP_UTF8, file_path, &wname ) )
+        return -1;
+    BOOL ret = GetFileAttributesExW( wname, GetFileExInfoStandard, &attributes );
+    lw_free( wname );
+    if( !ret )
+        return -1;
+    *file_size  = ((int64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    *file_mtime = ((int64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat file_stat;
+    if( stat( file_path, &file_stat ) )
+        return -1;
+    *file_size  = file_stat.st_size;
+#ifdef __APPLE__
+    *file_mtime = file_stat.st_mtimespec.tv_sec * INT64_C(1000000000) + file_stat.st_mtimespec.tv_nsec;
+#else
+    *file_mtime = file_stat.st_mtim.tv_sec * INT64_C(1000000000) + file_stat.st_mtim.tv_nsec;
+#endif
+#endif
+    return 0;
+}
+
+/* The image is a read-only mapping of the file, so the pages of the streams never requested are never read.
+ * The index file is never truncated while mapped: a re-created one is a new file at the same path,
+ * see lw_remove_file(), and the streams appended later go after the mapped range.
+ * Only the head of the file is rewritten in place, whose copy is kept apart from the mapping. */
+static int map_index_file
+(
+    lw_index_cache_t *cache
+)
+{
+    size_t size = 0;
+    cache->data = (uint8_t *)lw_map_file( cache->path, &size );
+    if( !cache->data )
+        return -1;
+    cache->data_size = size;
+    if( (uint64_t)cache->file_size != size )
+        /* Modified after getting the state. */
+        return -1;
+    cache->head_size = MIN( size, LW_INDEX_CACHE_HEAD_SIZE );
+    memcpy( cache->head, cache->data, cache->head_size );
+    return 0;
+}
+
+static void free_cache
+(
+    lw_index_cache_t *cache
+)
+{
+    lw_unmap_file( cache->data, cache->data_size );
+    lw_free( cache->source_path );
+    free( cache->path );
+    lw_free( cache );
+}
+
+lw_index_cache_t *lw_index_cache_open
+(
+    const char *index_file_path
+)
+{
+    char *path = lw_realpath( index_file_path, NULL );
+    if( !path )
+        return NULL;
+    int64_t file_size;
+    int64_t file_mtime;
+    if( get_file_stat( path, &file_size, &file_mtime ) < 0 )
+    {
+        free( path );
+        return NULL;
+    }
+    lw_global_lock();
+    for( lw_index_cache_t *cache = cache_list; cache; cache = cache->next )
+        if( cache->file_size == file_size && cache->file_mtime == file_mtime && !strcmp( cache->path, path ) )
+        {
+            ++ cache->ref_count;
+            lw_global_unlock();
+            free( path );
+            return cache;
+        }
+    lw_global_unlock();
+    /* Map the file without the lock. Another instance could map the same file concurrently,
+     * but that only costs address space until either image is released. */
+    lw_index_cache_t *cache = (lw_index_cache_t *)lw_malloc_zero( sizeof(lw_index_cache_t) );
+    if( !cache )
+    {
+        free( path );
+        return NULL;
+    }
+    cache->path       = path;
+    cache->file_size  = file_size;
+    cache->file_mtime = file_mtime;
+    cache->ref_count  = 1;
+    if( map_index_file( cache ) < 0 )
+    {
+        free_cache( cache );
+        return NULL;
+    }
+    lw_global_lock();
+    cache->next = cache_list;
+    cache_list  = cache;
+    lw_global_unlock();
+    return cache;
+}
+
+lw_index_cache_t *lw_index_cache_ref
+(
+    lw_index_cache_t *cache
+)
+{
+    if( !cache )
+        return NULL;
+    lw_global_lock();
+    ++ cache->ref_count;
+    lw_global_unlock();
+    return cache;
+}
+
+void lw_index_cache_release
+(
+    lw_index_cache_t **cache
+)
+{
+    if( !cache || !*cache )
+        return;
+    lw_global_lock();
+    if( -- (*cache)->ref_count == 0 )
+    {
+        for( lw_index_cache_t **p = &cache_list; *p; p = &(*p)->next )
+            if( *p == *cache )
+            {
+                *p = (*cache)->next;
+                break;
+            }
+        free_cache( *cache );
+    }
+    lw_global_unlock();
+    *cache = NULL;
+}
+
+uint8_t *lw_index_cache_get_data
+(
+    lw_index_cache_t *cache,
+    size_t           *data_size
+)
+{
+    *data_size = cache->data_size;
+    return cache->data;
+}
+
+int lw_index_cache_read
+(
+    lw_index_cache_t *cache,
+    size_t            offset,
+    void             *data,
+    size_t            size
+)
+{
+    if( offset + size > cache->head_size )
+        return -1;
+    lw_global_lock();
+    memcpy( data, cache->head + offset, size );
+    lw_global_unlock();
+    return 0;
+}
+
+int lw_index_cache_is_verified
+(
+    lw_index_cache_t *cache,
+    const char       *source_file_path
+)
+{
+    int64_t file_size;
+    int64_t file_mtime;
+    if( get_file_stat( source_file_path, &file_size, &file_mtime ) < 0 )
+        return 0;
+    lw_global_lock();
+    int verified = cache->source_path
+                && cache->source_size  == file_size
+                && cache->source_mtime == file_mtime
+                && !strcmp( cache->source_path, source_file_path );
+    lw_global_unlock();
+    return verified;
+}
+
+void lw_index_cache_set_verified
+(
+    lw_index_cache_t *cache,
+    const char       *source_file_path
+)
+{
+    int64_t file_size;
+    int64_t file_mtime;
+    if( get_file_stat( source_file_path, &file_size, &file_mtime ) < 0 )
+        return;
+    size_t length = strlen( source_file_path );
+    char *source_path = (char *)lw_malloc_zero( length + 1 );
+    if( !source_path )
+        return;
+    memcpy( source_path, source_file_path, length );
+    lw_global_lock();
+    lw_free( cache->source_path );
+    cache->source_path  = source_path;
+    cache->source_size  = file_size;
+    cache->source_mtime = file_mtime;
+    lw_global_unlock();
+}
+
+int lw_index_cache_write
+(
+    lw_index_cache_t *cache,
+    FILE             *index,
+    size_t            offset,
+    const void       *data,
+    size_t            size
+)
+{
+    if( offset + size > cache->head_size )
+        return -1;
+    int64_t file_size;
+    int64_t file_mtime;
+    if( lw_fseek( index, (int64_t)offset, SEEK_SET )
+     || fwrite( data, 1, size, index ) != size
+     || fflush( index )
+     || get_file_stat( cache->path, &file_size, &file_mtime ) < 0 )
+        return -1;
+    /* Only the image is swapped with the lock held. Keep it valid for the index file modified by itself. */
+    lw_global_lock();
+    memcpy( cache->head + offset, data, size );
+    cache->file_size  = file_size;
+    cache->file_mtime = file_mtime;
+    lw_global_unlock();
+    return 0;
+}
+
+int lw_index_cache_update
+(
+    lw_index_cache_t *cache,
+    size_t            offset,
+    const void       *data,
+    size_t            size
+)
+{
+    int64_t file_size;
+    int64_t file_mtime;
+    if( get_file_stat( cache->path, &file_size, &file_mtime ) < 0 )
+        return -1;
+    /* Never write into the index file re-created since the image was taken. */
+    lw_global_lock();
+    int modified = cache->file_size != file_size || cache->file_mtime != file_mtime;
+    lw_global_unlock();
+    if( modified )
+        return -1;
+    FILE *index = lw_fopen( cache->path, "r+b" );
+    if( !index )
+        return -1;
+    int ret = lw_index_cache_write( cache, index, offset, data, size );
+    fclose( index );
+    return ret;
+}
@@ -0,0 +1,116 @@
+/*****************************************************************************
+ * index_cache.h
+ *****************************************************************************
+ * Copyright (C) 2012-2015 L-SMASH Works project
+ *
+ * Authors: Yusuke Nakamura <muken.the.vfrmaniac@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license. */
+
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The images of the binary index files are shared between all the source filters in the process.
+ * An image is identified by the real path, the size and the last modification time of the index file,
+ * and is kept as long as any reference to it remains. */
+typedef struct lw_index_cache_tag lw_index_cache_t;
+
+/* The size of the head of the index file, which is the only part rewritten while the file is in use. */
+#define LW_INDEX_CACHE_HEAD_SIZE 256
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif  /* __cplusplus */
+
+/* Get a reference to the image of the index file 'index_file_path'.
+ * The file is mapped into a new image unless the cached one is still valid.
+ * Return NULL on failure. */
+lw_index_cache_t *lw_index_cache_open
+(
+    const char *index_file_path
+);
+
+lw_index_cache_t *lw_index_cache_ref
+(
+    lw_index_cache_t *cache
+);
+
+/* Release the reference and set NULL to '*cache'. The image is freed when no reference remains. */
+void lw_index_cache_release
+(
+    lw_index_cache_t **cache
+);
+
+/* Return the image. The head of the file, which lw_index_cache_write() could modify, must be read by lw_index_cache_read() instead. */
+uint8_t *lw_index_cache_get_data
+(
+    lw_index_cache_t *cache,
+    size_t           *data_size
+);
+
+/* Copy 'size' bytes at 'offset' of the head of the image with the lock against lw_index_cache_write() held. */
+int lw_index_cache_read
+(
+    lw_index_cache_t *cache,
+    size_t            offset,
+    void             *data,
+    size_t            size
+);
+
+/* Return 1 if the source file has not been modified since it was verified against the image, otherwise 0. */
+int lw_index_cache_is_verified
+(
+    lw_index_cache_t *cache,
+    const char       *source_file_path
+);
+
+/* Record the current state of the source file verified against the image. */
+void lw_index_cache_set_verified
+(
+    lw_index_cache_t *cache,
+    const char       *source_file_path
+);
+
+/* Write 'size' bytes at 'offset' in the head to both the index file and the image. */
+int lw_index_cache_write
+(
+    lw_index_cache_t *cache,
+    FILE             *index,
+    size_t            offset,
+    const void       *data,
+    size_t            size
+);
+
+/* Same as lw_index_cache_write() except that the index file is opened by itself.
+ * Nothing is written if the index file has been modified since the image was taken. */
+int lw_index_cache_update
+(
+    lw_index_cache_t *cache,
+    size_t            offset,
+    const void       *data,
+    size_t            size
+);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif
@@ -763,6 +763,8 @@ int get_sample
             return 0;
         }
     }
+    /* The packet borrows the reference to the input buffer from the decoder configuration. */
+    pkt->buf = NULL;
     av_packet_unref( pkt );
     if( config->update_pending || config->queue.delay_count )
     {
@@ -784,9 +786,22 @@ int get_sample
         pkt->size = 0;
         return 1;
     }
+    /* Reuse the input buffer unless the decoder still holds a reference to it, in which case take another one from the pool.
+     * Since the packet is reference-counted, the decoder just adds a reference instead of copying the data again. */
+    if( !config->input_ref || !av_buffer_is_writable( config->input_ref ) )
+    {
+        av_buffer_unref( &config->input_ref );
+        config->input_ref = av_buffer_pool_get( config->input_pool );
+        if( !config->input_ref )
+        {
+            lsmash_delete_sample( sample );
+            return -1;
+        }
+    }
     pkt->flags = sample->prop.ra_flags;     /* Set proper flags when feeding this packet into the decoder. */
     pkt->size  = sample->length;
-    pkt->data  = config->input_buffer;
+    pkt->buf   = config->input_ref;
+    pkt->data  = config->input_ref->data;
     pkt->pts   = sample->cts;               /* Set composition timestamp to presentation timestamp field. */
     pkt->dts   = sample->dts;
     /* Copy sample data from L-SMASH.
@@ -806,6 +821,7 @@ int get_sample
          * The current packet will be dequeued and returned after the corresponding decoder configuration is activated. */
         config->queue.sample_number = sample_number;
         config->queue.packet        = *pkt;
+        pkt->buf  = NULL;
         pkt->data = NULL;
         pkt->size = 0;
         if( config->queue.delay_count == 0 )
@@ -1063,8 +1079,8 @@ int initialize_decoder_configuration
     uint32_t input_buffer_size = lsmash_get_max_sample_size_in_media_timeline( root, track_ID );
     if( input_buffer_size == 0 )
         return -1;
-    config->input_buffer = (uint8_t *)av_mallocz( input_buffer_size + AV_INPUT_BUFFER_PADDING_SIZE );
-    if( !config->input_buffer )
+    config->input_pool = av_buffer_pool_init( input_buffer_size + AV_INPUT_BUFFER_PADDING_SIZE, av_buffer_allocz );
+    if( !config->input_pool )
         return -1;
     config->get_buffer = avcodec_default_get_buffer2;
     /* Initialize decoder configuration at the first valid sample. */
@@ -1174,6 +1190,7 @@ void cleanup_configuration
         free( config->entries );
     }
     av_freep( &config->queue.extradata );
-    av_freep( &config->input_buffer );
+    av_buffer_unref( &config->input_ref );
+    av_buffer_pool_uninit( &config->input_pool );
     avcodec_free_context( &config->ctx );
 }
@@ -45,7 +45,8 @@ typedef struct
     uint32_t              count;
     uint32_t              index;    /* index of the current decoder configuration */
     uint32_t              delay_count;
-    uint8_t              *input_buffer;
+    AVBufferPool         *input_pool;   /* pool of padded input buffers shared with the decoder by reference */
+    AVBufferRef          *input_ref;    /* input buffer the latest packet refers to */
     AVCodecContext       *ctx;
     const char          **preferred_decoder_names;
     int                   prefer_hw_decoder;
@@ -71,6 +71,17 @@ libavsmash_audio_output_handler_t *libavsmash_audio_alloc_output_handler
     return (libavsmash_audio_output_handler_t *)lw_malloc_zero( sizeof(libavsmash_audio_output_handler_t) );
 }
 
+static void free_audio_position_table
+(
+    lw_audio_position_table_t *table
+)
+{
+    lw_freep( &table->end_pos_list );
+    lw_freep( &table->sequence_list );
+    table->sequence_count     = 0;
+    table->output_sample_rate = 0;
+}
+
 void libavsmash_audio_free_decode_handler
 (
     libavsmash_audio_decode_handler_t *adhp
@@ -78,6 +89,7 @@ void libavsmash_audio_free_decode_handler
 {
     if( !adhp )
         return;
+    free_audio_position_table( &adhp->position_table );
     av_frame_free( &adhp->frame_buffer );
     cleanup_configuration( &adhp->config );
     lw_free( adhp );
@@ -590,66 +602,107 @@ static uint64_t get_preroll_samples
     return preroll_samples;
 }
 
-static int find_start_audio_frame
+/* Build the positions of all frames at the output sampling rate unless already built for it.
+ * The frames whose length is unknown are skipped, so they end at the same position as the previous one. */
+static int update_audio_position_table
 (
     libavsmash_audio_decode_handler_t *adhp,
-    int                                output_sample_rate,
-    uint64_t                           skip_decoded_samples,    /* at output sampling rate */
-    uint64_t                           start_frame_pos,         /* at output sampling rate */
-    uint64_t                          *start_offset             /* at codec sampling rate since trimming by this before sending resampler */
+    int                                output_sample_rate
 )
 {
-    uint32_t frame_number                    = 1;
-    uint64_t current_frame_pos               = 0;
-    uint64_t next_frame_pos                  = 0;
+    lw_audio_position_table_t *table = &adhp->position_table;
+    if( table->end_pos_list
+     && table->output_sample_rate  == output_sample_rate
+     && table->default_sample_rate == adhp->config.ctx->sample_rate )
+        return 0;
+    free_audio_position_table( table );
+    uint32_t sequence_capacity = 16;
+    table->end_pos_list  = (uint64_t *)lw_malloc_zero( (adhp->frame_count + 1) * sizeof(uint64_t) );
+    table->sequence_list = (lw_audio_sequence_t *)lw_malloc_zero( sequence_capacity * sizeof(lw_audio_sequence_t) );
+    if( !table->end_pos_list || !table->sequence_list )
+        goto fail;
     int      current_sample_rate             = 0;
     uint64_t current_frame_length            = 0;
     uint64_t decoded_pcm_sample_count        = 0;   /* the number of accumulated PCM samples before resampling per sequence */
     uint64_t resampled_sample_count          = 0;   /* the number of accumulated PCM samples after resampling per sequence */
     uint64_t prior_sequences_resampled_count = 0;   /* the number of accumulated PCM samples of all prior sequences */
-    do
+    for( uint32_t frame_number = 1; frame_number <= adhp->frame_count; frame_number++ )
     {
-        current_frame_pos = next_frame_pos;
         extended_summary_t *es = NULL;
         uint64_t frame_length;
         if( get_frame_length( adhp, frame_number, &frame_length, &es ) < 0 )
         {
-            ++frame_number;
+            table->end_pos_list[frame_number] = table->end_pos_list[frame_number - 1];
             continue;
         }
         if( (current_sample_rate != es->sample_rate && es->sample_rate > 0)
          || current_frame_length != frame_length )
         {
             /* Encountered a new sequence. */
+            if( table->sequence_count == sequence_capacity )
+            {
+                sequence_capacity <<= 1;
+                lw_audio_sequence_t *temp = (lw_audio_sequence_t *)realloc( table->sequence_list, sequence_capacity * sizeof(lw_audio_sequence_t) );
+                if( !temp )
+                    goto fail;
+                table->sequence_list = temp;
+            }
             prior_sequences_resampled_count += resampled_sample_count;
             decoded_pcm_sample_count = 0;
             current_sample_rate  = es->sample_rate > 0 ? es->sample_rate : adhp->config.ctx->sample_rate;
             current_frame_length = frame_length;
+            lw_audio_sequence_t *sequence = &table->sequence_list[ table->sequence_count ++ ];
+            sequence->first_frame_number = frame_number;
+            sequence->sample_rate        = current_sample_rate;
         }
         decoded_pcm_sample_count += frame_length;
         resampled_sample_count = count_sequence_output_pcm_samples( decoded_pcm_sample_count,
                                                                     current_sample_rate,
                                                                     output_sample_rate );
-        next_frame_pos = prior_sequences_resampled_count + resampled_sample_count;
-        if( start_frame_pos < next_frame_pos )
-            break;
-        ++frame_number;
-    } while( frame_number <= adhp->frame_count );
+        table->end_pos_list[frame_number] = prior_sequences_resampled_count + resampled_sample_count;
+    }
+    table->output_sample_rate  = output_sample_rate;
+    table->default_sample_rate = adhp->config.ctx->sample_rate;
+    return 0;
+fail:
+    free_audio_position_table( table );
+    return -1;
+}
+
+/* Return the frame number where decoding starts, or 0 on failure. */
+static uint32_t find_start_audio_frame
+(
+    libavsmash_audio_decode_handler_t *adhp,
+    int                                output_sample_rate,
+    uint64_t                           skip_decoded_samples,    /* at output sampling rate */
+    uint64_t                           start_frame_pos,         /* at output sampling rate */
+    uint64_t                          *start_offset             /* at codec sampling rate since trimming by this before sending resampler */
+)
+{
+    if( update_audio_position_table( adhp, output_sample_rate ) < 0 )
+        return 0;
+    const lw_audio_position_table_t *table = &adhp->position_table;
+    /* If no frame ends after the start position, the offset is measured from the start of the last frame. */
+    uint32_t frame_number        = lw_find_audio_frame_by_position( table, adhp->frame_count, start_frame_pos );
+    uint32_t found_frame_number  = MIN( frame_number, adhp->frame_count );
+    uint64_t current_frame_pos   = table->end_pos_list[found_frame_number - 1];
+    int      current_sample_rate = lw_get_audio_sequence_sample_rate( table, found_frame_number );
     *start_offset  = start_frame_pos - current_frame_pos;
     *start_offset  = av_rescale_rnd( *start_offset, current_sample_rate, output_sample_rate, AV_ROUND_UP );
     *start_offset += get_preroll_samples( adhp, av_rescale( skip_decoded_samples, current_sample_rate, output_sample_rate ), &frame_number );
     return frame_number;
 }
 
-uint64_t libavsmash_audio_get_pcm_samples
+static uint64_t get_pcm_samples
 (
-    libavsmash_audio_decode_handler_t *adhp,
-    libavsmash_audio_output_handler_t *aohp,
-    void                              *buf,
-    int64_t                            start,
-    int64_t                            wanted_length
+    void                      *dhp,
+    lw_audio_output_handler_t *aohp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
 )
 {
+    libavsmash_audio_decode_handler_t *adhp = (libavsmash_audio_decode_handler_t *)dhp;
     codec_configuration_t *config = &adhp->config;
     if( config->error )
         return 0;
@@ -697,6 +750,12 @@ uint64_t libavsmash_audio_get_pcm_samples
         }
         start_frame_pos += aohp->skip_decoded_samples;
         frame_number = find_start_audio_frame( adhp, aohp->output_sample_rate, aohp->skip_decoded_samples, start_frame_pos, &aohp->output_sample_offset );
+        if( frame_number == 0 )
+        {
+            config->error = 1;
+            lw_log_show( &config->lh, LW_LOG_FATAL, "Failed to allocate memory for the audio frame positions." );
+            return 0;
+        }
     }
     do
     {
@@ -705,7 +764,9 @@ uint64_t libavsmash_audio_get_pcm_samples
         {
             if( config->delay_count || !(output_flags & AUDIO_OUTPUT_ENOUGH) )
             {
-                /* Null packet */
+                /* Null packet
+                 * The input buffer is owned by the decoder configuration, so just drop the borrowed reference. */
+                pkt->buf = NULL;
                 av_packet_unref( pkt );
                 if( config->delay_count )
                     config->delay_count -= 1;
@@ -742,3 +803,15 @@ audio_out:
     adhp->last_frame_number      = frame_number;
     return output_length;
 }
+
+uint64_t libavsmash_audio_get_pcm_samples
+(
+    libavsmash_audio_decode_handler_t *adhp,
+    libavsmash_audio_output_handler_t *aohp,
+    void                              *buf,
+    int64_t                            start,
+    int64_t                            wanted_length
+)
+{
+    return lw_get_cached_pcm_samples( aohp, get_pcm_samples, adhp, buf, start, wanted_length );
+}
@@ -23,7 +23,6 @@
 #include "cpp_compat.h"
 
 #include <inttypes.h>
-#include <float.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -43,6 +42,19 @@ extern "C"
 #include "libavsmash_video_internal.h"
 #include "decode.h"
 
+#define REVERSE_ACCESS_THRESHOLD  2           /* the number of consecutive descending requests to enter reverse playback */
+#define REVERSE_ACCESS_MAX_STEP   4           /* the maximum step of descending requests regarded as reverse playback */
+#define REVERSE_STASH_SIZE        (256 << 20) /* the maximum bytes of the decoded frames kept for reverse playback */
+
+static void flush_reverse_stash
+(
+    libavsmash_video_decode_handler_t *vdhp
+)
+{
+    while( vdhp->stash_count )
+        av_frame_free( &vdhp->stash[ -- vdhp->stash_count ] );
+}
+
 /*****************************************************************************
  * Allocators / Deallocators
  *****************************************************************************/
@@ -78,8 +90,11 @@ void libavsmash_video_free_decode_handler
 {
     if( !vdhp )
         return;
+    flush_reverse_stash( vdhp );
+    lw_freep( &vdhp->stash );
     lw_freep( &vdhp->keyframe_list );
     lw_freep( &vdhp->order_converter );
+    lw_freep( &vdhp->timestamp_list );
     av_frame_free( &vdhp->frame_buffer );
     av_frame_free( &vdhp->first_valid_frame );
     cleanup_configuration( &vdhp->config );
@@ -325,6 +340,16 @@ uint64_t libavsmash_video_get_min_cts
     return vdhp ? vdhp->min_cts : 0;
 }
 
+const lw_video_timestamp_t *libavsmash_video_get_timestamp_list
+(
+    libavsmash_video_decode_handler_t *vdhp,
+    uint32_t                          *timestamp_count
+)
+{
+    *timestamp_count = vdhp->timestamp_list ? vdhp->sample_count : 0;
+    return vdhp->timestamp_list;
+}
+
 /*****************************************************************************
  * Fetchers
  *****************************************************************************/
@@ -500,6 +525,30 @@ void libavsmash_video_close_codec_context
     avcodec_free_context( &vdhp->config.ctx );
 }
 
+/* Compact the timestamps of the samples in composition order into a list for VFR to CFR conversion. */
+static int create_timestamp_list
+(
+    libavsmash_video_decode_handler_t *vdhp
+)
+{
+    lw_freep( &vdhp->timestamp_list );
+    vdhp->timestamp_list = (lw_video_timestamp_t *)lw_malloc_zero( vdhp->sample_count * sizeof(lw_video_timestamp_t) );
+    if( !vdhp->timestamp_list )
+        return -1;
+    for( uint32_t i = 1; i <= vdhp->sample_count; i++ )
+    {
+        uint64_t cts;
+        if( lsmash_get_cts_from_media_timeline( vdhp->root, vdhp->track_id, get_decoding_sample_number( vdhp->order_converter, i ), &cts ) < 0 )
+        {
+            lw_freep( &vdhp->timestamp_list );
+            return -1;
+        }
+        vdhp->timestamp_list[i - 1].frame_number = i;
+        vdhp->timestamp_list[i - 1].ts           = (int64_t)(cts - vdhp->min_cts);
+    }
+    return 0;
+}
+
 int libavsmash_video_setup_timestamp_info
 (
     libavsmash_video_decode_handler_t *vdhp,
@@ -613,6 +662,11 @@ setup_finish:;
         vohp->frame_count = libavsmash_video_get_sample_count( vdhp );
     uint32_t min_cts_sample_number = get_decoding_sample_number( vdhp->order_converter, 1 );
     vdhp->config.error = lsmash_get_cts_from_media_timeline( vdhp->root, vdhp->track_id, min_cts_sample_number, &vdhp->min_cts );
+    if( vdhp->config.error == 0 && create_timestamp_list( vdhp ) < 0 )
+    {
+        lw_log_show( &vdhp->config.lh, LW_LOG_ERROR, "Failed to create the list of video timestamps." );
+        return -1;
+    }
     return err;
 }
 
@@ -923,114 +977,93 @@ video_fail:
 #undef MAX_ERROR_COUNT
 }
 
-static uint32_t libavsmash_vfr2cfr
+/* Update the access pattern and return whether the requests are in reverse playback. */
+static int detect_reverse_access
 (
     libavsmash_video_decode_handler_t *vdhp,
-    libavsmash_video_output_handler_t *vohp,
     uint32_t                           sample_number
 )
 {
-    /* Convert VFR to CFR. */
-    double target_pts  = (double)((uint64_t)(sample_number - 1) * vohp->cfr_den) / vohp->cfr_num;
-    double current_pts = DBL_MAX;
-    lsmash_sample_t sample;
-    if( vdhp->last_sample_number <= vdhp->sample_count )
+    if( sample_number < vdhp->last_requested_number
+     && sample_number + REVERSE_ACCESS_MAX_STEP >= vdhp->last_requested_number )
     {
-        uint32_t last_decoding_sample_number = get_decoding_sample_number( vdhp->order_converter, vdhp->last_sample_number );
-        if( lsmash_get_sample_info_from_media_timeline( vdhp->root, vdhp->track_id, last_decoding_sample_number, &sample ) < 0 )
-            return 0;
-        current_pts = (double)(sample.cts - vdhp->min_cts) / vdhp->media_timescale;
-        if( target_pts == current_pts )
-            return vdhp->last_sample_number;
+        if( vdhp->reverse_count < REVERSE_ACCESS_THRESHOLD )
+            ++ vdhp->reverse_count;
     }
-    uint32_t composition_sample_number = vdhp->last_sample_number;
-    double   prev_pts = current_pts;
-    if( target_pts < current_pts )
+    else if( sample_number != vdhp->last_requested_number )
+        vdhp->reverse_count = 0;
+    vdhp->last_requested_number = sample_number;
+    return vdhp->reverse_count >= REVERSE_ACCESS_THRESHOLD;
+}
+
+/* In reverse playback, decode the samples preceding the requested one in a row and keep them
+ * so that each GOP is decoded once. If they don't fit in the budget, only the nearest ones are kept
+ * and the rest are decoded again from the random accessible sample on demand. */
+static int get_backward_picture
+(
+    libavsmash_video_decode_handler_t *vdhp,
+    uint32_t                           sample_number
+)
+{
+    if( sample_number >= vdhp->stash_first && sample_number < vdhp->stash_first + vdhp->stash_count )
     {
-        for( composition_sample_number--;
-             composition_sample_number;
-             composition_sample_number-- )
-        {
-            uint32_t decoding_sample_number = get_decoding_sample_number( vdhp->order_converter, composition_sample_number );
-            if( lsmash_get_sample_info_from_media_timeline( vdhp->root, vdhp->track_id, decoding_sample_number, &sample ) < 0 )
-                return 0;
-            current_pts = (double)(sample.cts - vdhp->min_cts) / vdhp->media_timescale;
-            prev_pts = current_pts;
-            if( current_pts <= target_pts )
-                break;
-        }
-        if( composition_sample_number == 0 )
-            return 0;
+        uint32_t index = sample_number - vdhp->stash_first;
+        av_frame_unref( vdhp->frame_buffer );
+        if( av_frame_ref( vdhp->frame_buffer, vdhp->stash[index] ) < 0 )
+            return -1;
+        /* The following samples have already been output. */
+        while( vdhp->stash_count > index + 1 )
+            av_frame_free( &vdhp->stash[ -- vdhp->stash_count ] );
+        /* The frame buffer no longer holds the last output from the decoder. */
+        vdhp->last_sample_number = vdhp->sample_count + 1;
+        return 0;
     }
-    double next_target_pts = (double)((uint64_t)sample_number * vohp->cfr_den) / vohp->cfr_num;
-    for( composition_sample_number++;
-         composition_sample_number <= vdhp->sample_count;
-         composition_sample_number++ )
+    flush_reverse_stash( vdhp );
+    /* The frame buffer holds the last requested picture, which is valid in reverse playback. */
+    size_t   frame_size = get_frame_buffer_size( vdhp->frame_buffer );
+    uint64_t window     = frame_size ? MAX( REVERSE_STASH_SIZE / frame_size, 1 ) : 1;
+    uint32_t start      = sample_number > window ? sample_number - (uint32_t)window + 1 : 1;
+    uint32_t stash_size = (uint32_t)MIN( window, vdhp->sample_count );
+    if( stash_size > vdhp->stash_size )
     {
-        uint32_t decoding_sample_number = get_decoding_sample_number( vdhp->order_converter, composition_sample_number );
-        if( lsmash_get_sample_info_from_media_timeline( vdhp->root, vdhp->track_id, decoding_sample_number, &sample ) < 0 )
-            return 0;
-        current_pts = (double)(sample.cts - vdhp->min_cts) / vdhp->media_timescale;
-        if( current_pts >= target_pts )
-        {
-            uint32_t prev_composition_sample_number = composition_sample_number - 1;
-            if( current_pts > next_target_pts )
-                /* Between the current target and the next target, there are no input samples.
-                 * Therefore, output the previous sample. This is absolutely correct. */
-                sample_number = prev_composition_sample_number;
-            else
-            {
-                if( current_pts > (next_target_pts + target_pts) / 2 )
-                    /* The current sample is far from the current target and should be a candidate for the next target. */
-                    sample_number = prev_composition_sample_number;
-                else
-                {
-                    /* Choose the nearest one. */
-                    if( current_pts - target_pts >= target_pts - prev_pts )
-                        sample_number = prev_composition_sample_number;
-                    else
-                        sample_number = composition_sample_number;
-                }
-            }
+        AVFrame **stash = (AVFrame **)realloc( vdhp->stash, stash_size * sizeof(AVFrame *) );
+        if( !stash )
+            return get_requested_picture( vdhp, vdhp->frame_buffer, sample_number );
+        vdhp->stash      = stash;
+        vdhp->stash_size = stash_size;
+    }
+    vdhp->stash_first = start;
+    for( uint32_t i = start; i < sample_number; i++ )
+    {
+        if( get_requested_picture( vdhp, vdhp->frame_buffer, i ) < 0 )
+            return -1;
+        AVFrame *clone = av_frame_clone( vdhp->frame_buffer );
+        if( !clone )
             break;
-        }
-        prev_pts = current_pts;
+        vdhp->stash[ vdhp->stash_count ++ ] = clone;
     }
-    if( composition_sample_number > vdhp->sample_count )
-        sample_number = vdhp->sample_count;
-    return sample_number;
+    return get_requested_picture( vdhp, vdhp->frame_buffer, sample_number );
 }
 
-/* Return 0 if successful.
- * Return 1 if the same frame was requested at the last call.
- * Return a negative value otherwise. */
-int libavsmash_video_get_frame
+static uint32_t libavsmash_vfr2cfr
 (
     libavsmash_video_decode_handler_t *vdhp,
     libavsmash_video_output_handler_t *vohp,
     uint32_t                           sample_number
 )
 {
-    if( vohp->vfr2cfr )
-    {
-        sample_number = libavsmash_vfr2cfr( vdhp, vohp, sample_number );
-        if( sample_number == 0 )
-            return -1;
-    }
-    if( sample_number == vdhp->last_sample_number )
-        return 1;
-    int ret;
-    if( (ret = get_requested_picture( vdhp, vdhp->frame_buffer, sample_number )) < 0
-     || (ret = update_scaler_configuration_if_needed( &vohp->scaler, &vdhp->config.lh, vdhp->frame_buffer )) < 0 )
-        return ret;
-    return 0;
+    /* Convert VFR to CFR. */
+    return lw_vfr2cfr_frame_number( vdhp->timestamp_list, vdhp->timestamp_list ? vdhp->sample_count : 0, vdhp->sample_count,
+                                    1, vdhp->media_timescale, vohp->cfr_num, vohp->cfr_den, sample_number );
 }
 
-int libavsmash_video_find_first_valid_frame
+/* Decode from the first sample until the decoder outputs a picture. */
+static int search_first_valid_frame
 (
     libavsmash_video_decode_handler_t *vdhp
 )
 {
+    vdhp->first_valid_frame_pending = 0;
     codec_configuration_t *config = &vdhp->config;
     for( uint32_t i = 1; i <= vdhp->sample_count + get_decoder_delay( config->ctx ); i++ )
     {
@@ -1053,6 +1086,63 @@ int libavsmash_video_find_first_valid_frame
         else if( pkt.data )
             ++ config->delay_count;
     }
+    /* The decoder went ahead of the requested sample. */
+    libavsmash_video_force_seek( vdhp );
+    return 0;
+}
+
+/* Return 0 if successful.
+ * Return 1 if the same frame was requested at the last call.
+ * Return a negative value otherwise. */
+int libavsmash_video_decode_frame
+(
+    libavsmash_video_decode_handler_t *vdhp,
+    libavsmash_video_output_handler_t *vohp,
+    uint32_t                           sample_number
+)
+{
+    if( vohp->vfr2cfr )
+    {
+        sample_number = libavsmash_vfr2cfr( vdhp, vohp, sample_number );
+        if( sample_number == 0 )
+            return -1;
+    }
+    if( vdhp->first_valid_frame_pending && search_first_valid_frame( vdhp ) < 0 )
+        return -1;
+    if( sample_number == vdhp->last_sample_number )
+        return 1;
+    if( !detect_reverse_access( vdhp, sample_number ) )
+    {
+        flush_reverse_stash( vdhp );
+        return get_requested_picture( vdhp, vdhp->frame_buffer, sample_number );
+    }
+    return get_backward_picture( vdhp, sample_number );
+}
+
+/* Return 0 if successful.
+ * Return 1 if the same frame was requested at the last call.
+ * Return a negative value otherwise. */
+int libavsmash_video_get_frame
+(
+    libavsmash_video_decode_handler_t *vdhp,
+    libavsmash_video_output_handler_t *vohp,
+    uint32_t                           sample_number
+)
+{
+    int ret;
+    if( (ret = libavsmash_video_decode_frame( vdhp, vohp, sample_number )) != 0
+     || (ret = update_scaler_configuration_if_needed( &vohp->scaler, &vdhp->config.lh, vdhp->frame_buffer )) < 0 )
+        return ret;
+    return 0;
+}
+
+int libavsmash_video_find_first_valid_frame
+(
+    libavsmash_video_decode_handler_t *vdhp
+)
+{
+    /* Decoding from the start of the stream is deferred until the first request. */
+    vdhp->first_valid_frame_pending = 1;
     return 0;
 }
 
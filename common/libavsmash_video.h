@@ -201,6 +201,14 @@ uint64_t libavsmash_video_get_min_cts
     libavsmash_video_decode_handler_t *vdhp
 );
 
+/* Return the timestamps of the samples in composition order, which are relative to the first sample in media timescale.
+ * This function must be called after a success of libavsmash_video_setup_timestamp_info(). */
+const lw_video_timestamp_t *libavsmash_video_get_timestamp_list
+(
+    libavsmash_video_decode_handler_t *vdhp,
+    uint32_t                          *timestamp_count
+);
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -268,6 +276,15 @@ int libavsmash_video_setup_timestamp_info
     int64_t                           *framerate_den
 );
 
+/* Decode the requested sample into the frame buffer without updating the scaler.
+ * The caller is responsible for calling update_scaler_configuration_if_needed() before the output conversion. */
+int libavsmash_video_decode_frame
+(
+    libavsmash_video_decode_handler_t *vdhp,
+    libavsmash_video_output_handler_t *vohp,
+    uint32_t                           sample_number
+);
+
 int libavsmash_video_get_frame
 (
     libavsmash_video_decode_handler_t *vdhp,
@@ -275,6 +292,7 @@ int libavsmash_video_get_frame
     uint32_t                           sample_number
 );
 
+/* Set up decoding for the first valid frame. The decoding itself is deferred until the first request. */
 int libavsmash_video_find_first_valid_frame
 (
     libavsmash_video_decode_handler_t *vdhp
@@ -44,7 +44,15 @@ struct libavsmash_video_decode_handler_tag
     uint32_t              last_rap_number;
     uint32_t              first_valid_frame_number;
     AVFrame              *first_valid_frame;
+    int                   first_valid_frame_pending; /* 1 = searched for at the first request */
     uint32_t              media_timescale;
     uint64_t              media_duration;
     uint64_t              min_cts;
+    lw_video_timestamp_t *timestamp_list;           /* the timestamps of the samples in composition order */
+    uint32_t              last_requested_number;    /* the number of the last sample requested by the host */
+    uint32_t              reverse_count;            /* the number of consecutive descending requests */
+    AVFrame             **stash;                    /* the decoded frames kept for reverse playback */
+    uint32_t              stash_first;              /* the number of the sample stored in stash[0] */
+    uint32_t              stash_count;
+    uint32_t              stash_size;               /* the number of the allocated entries of stash */
 };
@@ -53,7 +53,9 @@ extern "C"
 #include "progress.h"
 #include "lwindex.h"
 #include "decode.h"
+#include "index_cache.h"
 
+#include <stddef.h>
 #include <sys/stat.h>
 #include "xxhash.h"
 #ifdef _WIN32
@@ -79,6 +81,10 @@ typedef struct
                                                  * 2: either VC-1 or WMV3 encapsulated in ASF */
     int                         already_decoded;
     int (*decode)(AVCodecContext *, AVFrame *, int *, AVPacket * );
+    int                        *pix_fmt_investigated;   /* shared by all the video streams */
+    void                       *records;        /* the chunk of packet records for the binary index */
+    uint32_t                    record_count;
+    uint64_t                    record_sequence;
 } lwindex_helper_t;
 
 typedef struct
@@ -90,6 +96,8 @@ typedef struct
     const char       **preferred_audio_decoder_names;
     int                thread_count;
     char              *format_name;
+    const uint8_t     *selected;        /* nonzero for the streams to be indexed by stream index, or NULL for all the streams */
+    int                pix_fmt_investigated;    /* set when any video stream is investigated by decoding */
 } lwindex_indexer_t;
 
 typedef struct
@@ -107,6 +115,165 @@ typedef struct
     int bits_per_sample;
 } lwindex_stream_info_t;
 
+/* Binary index file
+ *   header (lwindex_binary_header_t)
+ *   sections
+ *   section table (lwindex_binary_section_t x section_count)
+ * Every field is stored in the native byte order of the machine that created the file, and
+ * every section starts at an 8-byte boundary so that records can be read directly from a mapped file.
+ * Packet records are written in chunks per stream, so one stream may have several record sections.
+ * The file indexing the selected streams only has the stream selection section, and the sections of the other streams
+ * are appended to the end of the file later followed by the new section table. */
+#define LWINDEX_BINARY_MAGIC        "LWIBINDX"
+#define LWINDEX_BINARY_BYTE_ORDER   0x01020304
+#define LWINDEX_BINARY_CHUNK_SIZE   (1 << 14)
+#define LWINDEX_BINARY_ALIGN( x )   (((x) + 7) & ~7)
+
+enum
+{
+    LWINDEX_SECTION_INPUT_FILE_PATH  = 1,
+    LWINDEX_SECTION_STREAM_INFO      = 2,
+    LWINDEX_SECTION_VIDEO_RECORDS    = 3,
+    LWINDEX_SECTION_AUDIO_RECORDS    = 4,
+    LWINDEX_SECTION_STREAM_DURATION  = 5,
+    LWINDEX_SECTION_INDEX_ENTRIES    = 6,
+    LWINDEX_SECTION_EXTRADATA_LIST   = 7,
+    LWINDEX_SECTION_STREAM_SELECTION = 8,
+};
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t lwindex_version;
+    uint32_t index_file_version;
+    uint32_t format_flags;
+    int64_t  file_size;
+    int64_t  file_last_modification_time;
+    uint64_t file_hash;
+    int32_t  raw_demuxer;
+    int32_t  active_video_index;
+    int32_t  active_audio_index;
+    int32_t  default_audio_index;
+    char     format_name[64];
+    uint64_t section_table_offset;
+    uint32_t section_count;
+    uint32_t first_valid_frame;     /* the number of the first valid frame of the active video stream, 0 = unknown */
+} lwindex_binary_header_t;
+
+typedef struct
+{
+    uint32_t type;
+    int32_t  stream_index;
+    int32_t  codec_type;
+    uint32_t count;         /* the number of records or entries */
+    uint64_t sequence;      /* the number of packets written before the first record */
+    uint64_t offset;
+    uint64_t size;
+} lwindex_binary_section_t;
+
+typedef struct
+{
+    int64_t pos;
+    int64_t pts;
+    int64_t dts;
+    int32_t extradata_index;
+    int32_t key;
+    int32_t pict_type;
+    int32_t poc;
+    int32_t repeat_pict;
+    int32_t field_info;
+    int32_t recovery;       /* the recovery frame count if a recovery point, -1 otherwise */
+    int32_t reserved;
+} lwindex_video_record_t;
+
+typedef struct
+{
+    int64_t pos;
+    int64_t pts;
+    int64_t dts;
+    int32_t extradata_index;
+    int32_t length;
+} lwindex_audio_record_t;
+
+typedef struct
+{
+    int64_t pos;
+    int64_t timestamp;
+    int32_t flags;
+    int32_t size;
+    int32_t min_distance;
+    int32_t reserved;
+} lwindex_binary_index_entry_t;
+
+typedef struct
+{
+    int32_t codec_type;
+    int32_t indexed;        /* 1 if the stream is indexed in the file, 0 otherwise */
+} lwindex_binary_stream_selection_t;
+
+typedef struct
+{
+    int32_t  extradata_size;
+    int32_t  codec_id;
+    uint32_t codec_tag;
+    int32_t  width;
+    int32_t  height;
+    int32_t  bits_per_sample;
+    uint64_t channel_layout;
+    int32_t  sample_rate;
+    int32_t  block_align;
+    char     format[32];    /* the name of the pixel format or the sample format */
+} lwindex_binary_extradata_t;
+
+/* The buffered output to the index file shared by the text and the binary formats.
+ * The bytes already written can be overwritten by patches, which are applied when closing the output
+ * so that updating the header never seeks back in the middle of writing. */
+#define LWINDEX_OUTPUT_BUFFER_SIZE  (1 << 20)
+#define LWINDEX_OUTPUT_MAX_PATCHES  4
+#define LWINDEX_OUTPUT_MAX_PATCH    256
+
+typedef struct
+{
+    int64_t offset;
+    size_t  size;
+    uint8_t data[LWINDEX_OUTPUT_MAX_PATCH];
+} lwindex_output_patch_t;
+
+typedef struct
+{
+    FILE                  *file;
+    uint8_t               *buffer;
+    size_t                 length;      /* the number of the bytes in the buffer */
+    int64_t                offset;      /* the position in the file of the beginning of the buffer */
+    int                    error;
+    int                    patch_count;
+    lwindex_output_patch_t patches[LWINDEX_OUTPUT_MAX_PATCHES];
+} lwindex_output_t;
+
+typedef struct
+{
+    lwindex_output_t         *output;
+    lwindex_binary_section_t *sections;
+    uint32_t                  section_count;
+    uint64_t                  packet_count;
+} lwindex_binary_writer_t;
+
+typedef struct
+{
+    video_frame_info_t *video_info;
+    audio_frame_info_t *audio_info;
+    uint32_t            video_info_count;
+    uint32_t            audio_info_count;
+    uint32_t            video_sample_count;
+    uint32_t            invisible_count;
+    int64_t             last_keyframe_pts;
+    uint32_t            audio_sample_count;
+    int                 audio_sample_rate;
+    int                 constant_frame_length;
+    uint64_t            audio_duration;
+} lwindex_parser_t;
+
 typedef struct
 {
     int64_t pts;
@@ -509,6 +676,32 @@ static int poc_genarate_pts
     return 0;
 }
 
+/* Compact the timestamps of the frames in presentation order into a list for VFR to CFR conversion. */
+static int create_video_timestamp_list
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        sample_count
+)
+{
+    vdhp->timestamp_count = 0;
+    if( !(vdhp->lw_seek_flags & (SEEK_PTS_GENERATED | SEEK_PTS_BASED | SEEK_DTS_BASED)) )
+        return 0;
+    vdhp->timestamp_list = (lw_video_timestamp_t *)lw_malloc_zero( sample_count * sizeof(lw_video_timestamp_t) );
+    if( !vdhp->timestamp_list )
+        return -1;
+    video_frame_info_t *info = vdhp->frame_list;
+    for( uint32_t i = 1; i <= sample_count; i++ )
+    {
+        int64_t ts = (vdhp->lw_seek_flags & (SEEK_PTS_GENERATED | SEEK_PTS_BASED)) ? info[i].pts : info[i].dts;
+        if( ts == AV_NOPTS_VALUE )
+            continue;
+        lw_video_timestamp_t *timestamp = &vdhp->timestamp_list[ vdhp->timestamp_count ++ ];
+        timestamp->frame_number = i;
+        timestamp->ts           = ts - vdhp->min_ts;
+    }
+    return 0;
+}
+
 static int decide_video_seek_method
 (
     lwlibav_file_handler_t         *lwhp,
@@ -626,61 +819,66 @@ static int decide_video_seek_method
     vdhp->min_ts = (vdhp->lw_seek_flags & (SEEK_PTS_GENERATED | SEEK_PTS_BASED)) ? info[1].pts
                  : (vdhp->lw_seek_flags & SEEK_DTS_BASED)                        ? info[1].dts
                  : AV_NOPTS_VALUE;
-    /* Treat video frames with unique value as keyframe. */
+    /* Treat video frames with unique value as keyframe or recovery point. */
     if( vdhp->lw_seek_flags & SEEK_POS_BASED )
     {
         if( info[ info[1].sample_number ].file_offset == -1 )
-            info[ info[1].sample_number ].flags &= ~LW_VFRAME_FLAG_KEY;
+            info[ info[1].sample_number ].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
         for( uint32_t i = 2; i <= sample_count; i++ )
         {
             uint32_t j = info[i    ].sample_number;
             uint32_t k = info[i - 1].sample_number;
             if( info[j].file_offset == -1 )
-                info[j].flags &= ~LW_VFRAME_FLAG_KEY;
+                info[j].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
             else if( info[j].file_offset == info[k].file_offset )
             {
-                info[j].flags &= ~LW_VFRAME_FLAG_KEY;
-                info[k].flags &= ~LW_VFRAME_FLAG_KEY;
+                info[j].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
+                info[k].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
             }
         }
     }
     else if( vdhp->lw_seek_flags & SEEK_PTS_BASED )
     {
         if( info[ info[1].sample_number ].pts == AV_NOPTS_VALUE )
-            info[ info[1].sample_number ].flags &= ~LW_VFRAME_FLAG_KEY;
+            info[ info[1].sample_number ].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
         for( uint32_t i = 2; i <= sample_count; i++ )
         {
             uint32_t j = info[i    ].sample_number;
             uint32_t k = info[i - 1].sample_number;
             if( info[j].pts == AV_NOPTS_VALUE )
-                info[j].flags &= ~LW_VFRAME_FLAG_KEY;
+                info[j].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
             else if( info[j].pts == info[k].pts )
             {
-                info[j].flags &= ~LW_VFRAME_FLAG_KEY;
-                info[k].flags &= ~LW_VFRAME_FLAG_KEY;
+                info[j].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
+                info[k].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
             }
         }
     }
     else if( vdhp->lw_seek_flags & SEEK_DTS_BASED )
     {
         if( info[ info[1].sample_number ].dts == AV_NOPTS_VALUE )
-            info[ info[1].sample_number ].flags &= ~LW_VFRAME_FLAG_KEY;
+            info[ info[1].sample_number ].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
         for( uint32_t i = 2; i <= sample_count; i++ )
         {
             uint32_t j = info[i    ].sample_number;
             uint32_t k = info[i - 1].sample_number;
             if( info[j].dts == AV_NOPTS_VALUE )
-                info[j].flags &= ~LW_VFRAME_FLAG_KEY;
+                info[j].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
             else if( info[j].dts == info[k].dts )
             {
-                info[j].flags &= ~LW_VFRAME_FLAG_KEY;
-                info[k].flags &= ~LW_VFRAME_FLAG_KEY;
+                info[j].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
+                info[k].flags &= ~(LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_RECOVERY);
             }
         }
     }
     /* Set up keyframe list: presentation order (info) -> decoding order (keyframe_list) */
     for( uint32_t i = 1; i <= sample_count; i++ )
         vdhp->keyframe_list[ info[i].sample_number ] = !!(info[i].flags & LW_VFRAME_FLAG_KEY);
+    if( create_video_timestamp_list( vdhp, sample_count ) < 0 )
+    {
+        lw_log_show( &vdhp->lh, LW_LOG_FATAL, "Failed to allocate memory of video timestamps." );
+        return -1;
+    }
     return 0;
 }
 
@@ -1150,6 +1348,171 @@ static inline int check_vp8_invisible_frame( const AVPacket *pkt )
     return !(pkt->data[0] & 0x10);
 }
 
+/* Read an unsigned Exp-Golomb code from the head of an RBSP. Return -1 if broken. */
+static int64_t read_exp_golomb_code
+(
+    const uint8_t *data,
+    int            size
+)
+{
+    int bit_pos = 0;
+    int leading_zero_bits = 0;
+#define READ_BIT( x ) \
+    do \
+    { \
+        if( bit_pos >= (size << 3) ) \
+            return -1; \
+        x = (data[bit_pos >> 3] >> (7 - (bit_pos & 7))) & 1; \
+        ++bit_pos; \
+    } while( 0 )
+    for( int bit = 0; !bit; ++leading_zero_bits )
+    {
+        if( leading_zero_bits > 31 )
+            return -1;
+        READ_BIT( bit );
+    }
+    --leading_zero_bits;
+    int64_t code_num = 0;
+    for( int i = 0; i < leading_zero_bits; i++ )
+    {
+        int bit;
+        READ_BIT( bit );
+        code_num = (code_num << 1) | bit;
+    }
+#undef READ_BIT
+    return code_num + (INT64_C(1) << leading_zero_bits) - 1;
+}
+
+/* Return the number of the frames required to recover from the recovery point SEI in a NAL unit,
+ * or -1 if not present. */
+static int get_recovery_frame_count_in_nal_unit
+(
+    enum AVCodecID codec_id,
+    const uint8_t *nalu,
+    int            nalu_size
+)
+{
+    /* Remove the emulation prevention bytes.
+     * Recovery point SEI messages are tiny, so the first part of a NAL unit is enough. */
+    uint8_t rbsp[256];
+    int     rbsp_size  = 0;
+    int     zero_count = 0;
+    for( int i = 0; i < nalu_size && rbsp_size < (int)sizeof(rbsp); i++ )
+    {
+        if( zero_count >= 2 && nalu[i] == 0x03 )
+        {
+            zero_count = 0;
+            continue;
+        }
+        zero_count = nalu[i] ? 0 : zero_count + 1;
+        rbsp[rbsp_size++] = nalu[i];
+    }
+    int header_size = codec_id == AV_CODEC_ID_HEVC ? 2 : 1;
+    const uint8_t *p   = rbsp + header_size;
+    const uint8_t *end = rbsp + rbsp_size;
+    while( p < end && *p != 0x80 )
+    {
+        /* sei_message() */
+        int payload_type = 0;
+        int payload_size = 0;
+        while( p < end && *p == 0xff )
+            payload_type += *p++;
+        if( p >= end )
+            break;
+        payload_type += *p++;
+        while( p < end && *p == 0xff )
+            payload_size += *p++;
+        if( p >= end )
+            break;
+        payload_size += *p++;
+        if( payload_type == 6 )
+        {
+            /* recovery_point()
+             * H.264 : recovery_frame_cnt ue(v)
+             * HEVC  : recovery_poc_cnt   se(v), which is treated as the number of frames.
+             *         A negative value means that the pictures are correct from the recovery point. */
+            int64_t code_num = read_exp_golomb_code( p, (int)MIN( payload_size, end - p ) );
+            if( code_num < 0 )
+                return -1;
+            if( codec_id == AV_CODEC_ID_HEVC )
+                code_num = (code_num & 1) ? (code_num + 1) / 2 : 0;
+            return (int)MIN( code_num, INT_MAX );
+        }
+        p += payload_size;
+    }
+    return -1;
+}
+
+/* Find a recovery point SEI in a H.264 or HEVC packet.
+ * Return its recovery frame count, or -1 if the packet is not a recovery point. */
+static int get_recovery_frame_count
+(
+    AVCodecContext *ctx,
+    const AVPacket *pkt
+)
+{
+    if( ctx->codec_id != AV_CODEC_ID_H264 && ctx->codec_id != AV_CODEC_ID_HEVC )
+        return -1;
+    int is_hevc = ctx->codec_id == AV_CODEC_ID_HEVC;
+    /* Length prefixed NAL units follow the configuration record, while Annex B byte stream has no such header. */
+    int length_size = 0;
+    if( ctx->extradata_size > 0 && ctx->extradata[0] == 1 )
+    {
+        if( is_hevc && ctx->extradata_size >= 23 )
+            length_size = (ctx->extradata[21] & 0x03) + 1;
+        else if( !is_hevc && ctx->extradata_size >= 7 )
+            length_size = (ctx->extradata[4] & 0x03) + 1;
+        else
+            return -1;
+    }
+    const uint8_t *p   = pkt->data;
+    const uint8_t *end = pkt->data + pkt->size;
+    while( p < end )
+    {
+        int nalu_size;
+        if( length_size )
+        {
+            if( end - p < length_size )
+                break;
+            nalu_size = 0;
+            for( int i = 0; i < length_size; i++ )
+                nalu_size = (nalu_size << 8) | *p++;
+            if( nalu_size <= 0 || nalu_size > end - p )
+                break;
+        }
+        else
+        {
+            /* Skip the start code and find the next one. */
+            while( end - p >= 3 && !(p[0] == 0x00 && p[1] == 0x00 && p[2] == 0x01) )
+                ++p;
+            if( end - p < 3 )
+                break;
+            p += 3;
+            const uint8_t *next = p;
+            while( end - next >= 3 && !(next[0] == 0x00 && next[1] == 0x00 && (next[2] == 0x01 || next[2] == 0x00)) )
+                ++next;
+            nalu_size = (int)((end - next >= 3 ? next : end) - p);
+            if( nalu_size <= 0 )
+                continue;
+        }
+        if( nalu_size > (is_hevc ? 2 : 1) )
+        {
+            int nal_unit_type = is_hevc ? (p[0] >> 1) & 0x3f : p[0] & 0x1f;
+            /* SEI shall precede the first VCL NAL unit of the access unit. */
+            if( is_hevc ? nal_unit_type < 32 : (nal_unit_type >= 1 && nal_unit_type <= 5) )
+                break;
+            if( nal_unit_type == (is_hevc ? 39 : 6) )
+            {
+                int count = get_recovery_frame_count_in_nal_unit( ctx->codec_id, p, nalu_size );
+                if( count >= 0 )
+                    return count;
+            }
+        }
+        p += nalu_size;
+    }
+    return -1;
+}
+
 static void create_video_visible_frame_list
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -1307,6 +1670,15 @@ static int make_vc1_ebdu
     return av_packet_ref( out_pkt, &helper->pkt );
 }
 
+static inline int is_selected_index_stream
+(
+    const lwindex_indexer_t *indexer,
+    int                      stream_index
+)
+{
+    return !indexer->selected || indexer->selected[stream_index];
+}
+
 static lwindex_helper_t *get_index_helper
 (
     lwindex_indexer_t *indexer,
@@ -1332,6 +1704,7 @@ static lwindex_helper_t *get_index_helper
         if( !helper )
             return NULL;
         indexer->helpers[ stream->index ] = helper;
+        helper->pix_fmt_investigated = &indexer->pix_fmt_investigated;
         /* Set up the decoder. */
         AVCodecParameters *codecpar = stream->codecpar;
         const char **preferred_decoder_names = codecpar->codec_type == AVMEDIA_TYPE_VIDEO
@@ -1892,63 +2265,279 @@ static enum AVSampleFormat select_better_sample_format
     return a;
 }
 
+static int open_index_output
+(
+    lwindex_output_t *out,
+    FILE             *file
+)
+{
+    memset( out, 0, sizeof(lwindex_output_t) );
+    out->offset = lw_ftell( file );
+    out->buffer = (uint8_t *)lw_malloc_zero( LWINDEX_OUTPUT_BUFFER_SIZE );
+    if( out->offset < 0 || !out->buffer )
+    {
+        lw_freep( &out->buffer );
+        return -1;
+    }
+    out->file = file;
+    return 0;
+}
+
+static void flush_index_output
+(
+    lwindex_output_t *out
+)
+{
+    if( out->length && fwrite( out->buffer, 1, out->length, out->file ) != out->length )
+        out->error = 1;
+    out->offset += out->length;
+    out->length  = 0;
+}
+
+static void write_index_output
+(
+    lwindex_output_t *out,
+    const void       *data,
+    size_t            size
+)
+{
+    if( out->length + size > LWINDEX_OUTPUT_BUFFER_SIZE )
+    {
+        flush_index_output( out );
+        if( size > LWINDEX_OUTPUT_BUFFER_SIZE )
+        {
+            /* Write a large block directly. */
+            if( fwrite( data, 1, size, out->file ) != size )
+                out->error = 1;
+            out->offset += size;
+            return;
+        }
+    }
+    memcpy( out->buffer + out->length, data, size );
+    out->length += size;
+}
+
+static inline int64_t tell_index_output
+(
+    lwindex_output_t *out
+)
+{
+    return out->offset + out->length;
+}
+
+/* Overwrite the bytes at 'offset' when closing the output. A later patch at the same offset replaces the earlier one. */
+static void patch_index_output
+(
+    lwindex_output_t *out,
+    int64_t           offset,
+    const void       *data,
+    size_t            size
+)
+{
+    int i = 0;
+    while( i < out->patch_count && out->patches[i].offset != offset )
+        ++i;
+    if( size > LWINDEX_OUTPUT_MAX_PATCH || i == LWINDEX_OUTPUT_MAX_PATCHES )
+    {
+        out->error = 1;
+        return;
+    }
+    if( i == out->patch_count )
+        ++ out->patch_count;
+    out->patches[i].offset = offset;
+    out->patches[i].size   = size;
+    memcpy( out->patches[i].data, data, size );
+}
+
+/* Write out everything including the patches. Return 0 on success, otherwise -1. */
+static int close_index_output
+(
+    lwindex_output_t *out
+)
+{
+    if( !out->buffer )
+        return out->error ? -1 : 0;
+    flush_index_output( out );
+    for( int i = 0; i < out->patch_count; i++ )
+        if( lw_fseek( out->file, out->patches[i].offset, SEEK_SET )
+         || fwrite( out->patches[i].data, 1, out->patches[i].size, out->file ) != out->patches[i].size )
+            out->error = 1;
+    if( out->patch_count && lw_fseek( out->file, out->offset, SEEK_SET ) )
+        out->error = 1;
+    out->patch_count = 0;
+    lw_freep( &out->buffer );
+    return out->error ? -1 : 0;
+}
+
+static inline void print_index_string
+(
+    lwindex_output_t *out,
+    const char       *str
+)
+{
+    write_index_output( out, str, strlen( str ) );
+}
+
+/* Print an integer in decimal without the printf family, which is the most of the text of the index file. */
+static void print_index_int
+(
+    lwindex_output_t *out,
+    int64_t           value
+)
+{
+    char     buf[24];
+    char    *p = buf + sizeof(buf);
+    uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do
+        *--p = '0' + u % 10;
+    while( u /= 10 );
+    if( value < 0 )
+        *--p = '-';
+    write_index_output( out, p, buf + sizeof(buf) - p );
+}
+
+static void print_index_hex
+(
+    lwindex_output_t *out,
+    uint64_t          value
+)
+{
+    static const char digits[] = "0123456789abcdef";
+    char  buf[16];
+    char *p = buf + sizeof(buf);
+    do
+        *--p = digits[value & 0xf];
+    while( value >>= 4 );
+    write_index_output( out, p, buf + sizeof(buf) - p );
+}
+
 static inline void print_index
 (
-    FILE       *index,
-    const char *format,
+    lwindex_output_t *out,
+    const char       *format,
     ...
 )
 {
-    if( !index )
+    if( !out )
         return;
+    char    buf[1024];
     va_list args;
     va_start( args, format );
-    vfprintf( index, format, args );
+    int length = vsnprintf( buf, sizeof(buf), format, args );
     va_end( args );
+    if( length < 0 || length >= (int)sizeof(buf) )
+        out->error = 1;
+    else
+        write_index_output( out, buf, length );
 }
 
 static inline void write_av_index_entry
 (
-    FILE         *index,
+    lwindex_output_t   *out,
     const AVIndexEntry *ie
 )
 {
-    print_index( index, "POS=%" PRId64 ",TS=%" PRId64 ",Flags=%x,Size=%d,Distance=%d\n",
-                 ie->pos, ie->timestamp, ie->flags, ie->size, ie->min_distance );
+    if( !out )
+        return;
+    print_index_string( out, "POS=" );
+    print_index_int( out, ie->pos );
+    print_index_string( out, ",TS=" );
+    print_index_int( out, ie->timestamp );
+    print_index_string( out, ",Flags=" );
+    print_index_hex( out, (unsigned int)ie->flags );
+    print_index_string( out, ",Size=" );
+    print_index_int( out, ie->size );
+    print_index_string( out, ",Distance=" );
+    print_index_int( out, ie->min_distance );
+    print_index_string( out, "\n" );
+}
+
+static inline void write_video_record_text
+(
+    lwindex_output_t             *out,
+    int                           stream_index,
+    const lwindex_video_record_t *record
+)
+{
+    print_index_string( out, "Index=" );
+    print_index_int( out, stream_index );
+    print_index_string( out, ",POS=" );
+    print_index_int( out, record->pos );
+    print_index_string( out, ",PTS=" );
+    print_index_int( out, record->pts );
+    print_index_string( out, ",DTS=" );
+    print_index_int( out, record->dts );
+    print_index_string( out, ",EDI=" );
+    print_index_int( out, record->extradata_index );
+    print_index_string( out, "\nKey=" );
+    print_index_int( out, record->key );
+    print_index_string( out, ",Pic=" );
+    print_index_int( out, record->pict_type );
+    print_index_string( out, ",POC=" );
+    print_index_int( out, record->poc );
+    print_index_string( out, ",Repeat=" );
+    print_index_int( out, record->repeat_pict );
+    print_index_string( out, ",Field=" );
+    print_index_int( out, record->field_info );
+    print_index_string( out, ",Recovery=" );
+    print_index_int( out, record->recovery );
+    print_index_string( out, "\n" );
+}
+
+static inline void write_audio_record_text
+(
+    lwindex_output_t             *out,
+    int                           stream_index,
+    const lwindex_audio_record_t *record
+)
+{
+    print_index_string( out, "Index=" );
+    print_index_int( out, stream_index );
+    print_index_string( out, ",POS=" );
+    print_index_int( out, record->pos );
+    print_index_string( out, ",PTS=" );
+    print_index_int( out, record->pts );
+    print_index_string( out, ",DTS=" );
+    print_index_int( out, record->dts );
+    print_index_string( out, ",EDI=" );
+    print_index_int( out, record->extradata_index );
+    print_index_string( out, "\nLength=" );
+    print_index_int( out, record->length );
+    print_index_string( out, "\n" );
 }
 
 static void write_video_extradata
 (
-    FILE                *index,
+    lwindex_output_t    *out,
     lwlibav_extradata_t *entry
 )
 {
-    if( !index )
+    if( !out )
         return;
-    fprintf( index, "Size=%d,Codec=%d,4CC=0x%x,Width=%d,Height=%d,Format=%s,BPS=%d\n",
-             entry->extradata_size, entry->codec_id, entry->codec_tag, entry->width, entry->height,
-             av_get_pix_fmt_name( entry->pixel_format ) ? av_get_pix_fmt_name( entry->pixel_format ) : "none",
-             entry->bits_per_sample );
+    print_index( out, "Size=%d,Codec=%d,4CC=0x%x,Width=%d,Height=%d,Format=%s,BPS=%d\n",
+                 entry->extradata_size, entry->codec_id, entry->codec_tag, entry->width, entry->height,
+                 av_get_pix_fmt_name( entry->pixel_format ) ? av_get_pix_fmt_name( entry->pixel_format ) : "none",
+                 entry->bits_per_sample );
     if( entry->extradata_size > 0 )
-        fwrite( entry->extradata, 1, entry->extradata_size, index );
-    fprintf( index, "\n" );
+        write_index_output( out, entry->extradata, entry->extradata_size );
+    print_index_string( out, "\n" );
 }
 
 static void write_audio_extradata
 (
-    FILE                *index,
+    lwindex_output_t    *out,
     lwlibav_extradata_t *entry
 )
 {
-    if( !index )
+    if( !out )
         return;
-    fprintf( index, "Size=%d,Codec=%d,4CC=0x%x,Layout=0x%" PRIx64 ",Rate=%d,Format=%s,BPS=%d,Align=%d\n",
-             entry->extradata_size, entry->codec_id, entry->codec_tag, entry->channel_layout, entry->sample_rate,
-             av_get_sample_fmt_name( entry->sample_format ) ? av_get_sample_fmt_name( entry->sample_format ) : "none",
-             entry->bits_per_sample, entry->block_align );
+    print_index( out, "Size=%d,Codec=%d,4CC=0x%x,Layout=0x%" PRIx64 ",Rate=%d,Format=%s,BPS=%d,Align=%d\n",
+                 entry->extradata_size, entry->codec_id, entry->codec_tag, entry->channel_layout, entry->sample_rate,
+                 av_get_sample_fmt_name( entry->sample_format ) ? av_get_sample_fmt_name( entry->sample_format ) : "none",
+                 entry->bits_per_sample, entry->block_align );
     if( entry->extradata_size > 0 )
-        fwrite( entry->extradata, 1, entry->extradata_size, index );
-    fprintf( index, "\n" );
+        write_index_output( out, entry->extradata, entry->extradata_size );
+    print_index_string( out, "\n" );
 }
 
 static void disable_video_stream( lwlibav_video_decode_handler_t *vdhp )
@@ -1957,8 +2546,9 @@ static void disable_video_stream( lwlibav_video_decode_handler_t *vdhp )
     lw_freep( &vdhp->keyframe_list );
     lw_freep( &vdhp->order_converter );
     av_freep( &vdhp->index_entries );
-    vdhp->stream_index        = -1;
-    vdhp->index_entries_count = 0;
+    vdhp->mapped_index_entries = NULL;
+    vdhp->stream_index         = -1;
+    vdhp->index_entries_count  = 0;
     vdhp->frame_count         = 0;
 }
 
@@ -1981,10 +2571,12 @@ static void cleanup_index_helpers( lwindex_indexer_t *indexer, AVFormatContext *
                 av_freep( &list->entries[i].extradata );
             free( list->entries );
         }
+        lw_free( helper->records );
         /* Free an index helper. */
         lw_free( helper );
     }
     av_freep( &indexer->helpers );
+    indexer->number_of_helpers = 0;
 }
 
 /* Hash the first and last mebibytes. */
@@ -1997,8 +2589,9 @@ static uint64_t xxhash_file( const char *file_path, int64_t file_size )
     size_t buffer_len = fread( file_buffer, 1, read_len, fp );
     if( file_size > (1 << 21) )
     {
-        /* Only if file is larger than 2 mebibytes */
-        fseek( fp, -(1 << 20), SEEK_END );
+        /* Only if file is larger than 2 mebibytes
+         * Hash the last mebibyte up to the given size so that the beginning of a grown file can be verified. */
+        lw_fseek( fp, file_size - (1 << 20), SEEK_SET );
         buffer_len += fread( file_buffer + buffer_len, 1, read_len, fp );
     }
     fclose( fp );
@@ -2016,8 +2609,9 @@ static unsigned xxhash32_file( const char *file_path, int64_t file_size )
     size_t buffer_len = fread( file_buffer, 1, read_len, fp );
     if( file_size > (1 << 21) )
     {
-        /* Only if file is larger than 2 mebibytes */
-        fseek( fp, -(1 << 20), SEEK_END );
+        /* Only if file is larger than 2 mebibytes
+         * Hash the last mebibyte up to the given size so that the beginning of a grown file can be verified. */
+        lw_fseek( fp, file_size - (1 << 20), SEEK_SET );
         buffer_len += fread( file_buffer + buffer_len, 1, read_len, fp );
     }
     fclose( fp );
@@ -2026,6 +2620,21 @@ static unsigned xxhash32_file( const char *file_path, int64_t file_size )
     return hash;
 }
 
+/* Open the index file to append the new sections to it, or to create it.
+ * The old file may be mapped by the index cache, so it is never truncated but replaced by a new file. */
+static FILE *open_index_file
+(
+    const char *index_file_path,
+    int         append
+)
+{
+    if( append )
+        return lw_fopen( index_file_path, "r+b" );
+    if( lw_remove_file( index_file_path ) < 0 )
+        return NULL;
+    return lw_fopen( index_file_path, "wb" );
+}
+
 static char *create_lwi_path
 (
     lwlibav_option_t *opt
@@ -2071,37 +2680,1775 @@ static char *create_lwi_path
     return buf;
 }
 
-static int create_index
+static int write_binary_index_section
 (
-    lwlibav_file_handler_t         *lwhp,
-    lwlibav_video_decode_handler_t *vdhp,
-    lwlibav_video_output_handler_t *vohp,
-    lwlibav_audio_decode_handler_t *adhp,
-    lwlibav_audio_output_handler_t *aohp,
-    AVFormatContext                *format_ctx,
-    lwlibav_option_t               *opt,
-    progress_indicator_t           *indicator,
-    progress_handler_t             *php
+    lwindex_binary_writer_t *writer,
+    uint32_t                 type,
+    int                      stream_index,
+    int                      codec_type,
+    uint32_t                 count,
+    uint64_t                 sequence,
+    const void              *data,
+    size_t                   size
 )
 {
-    uint32_t video_info_count = 1 << 16;
-    uint32_t audio_info_count = 1 << 16;
-    video_frame_info_t *video_info = (video_frame_info_t *)malloc( video_info_count * sizeof(video_frame_info_t) );
-    if( !video_info )
+    if( !writer->output )
+        return 0;
+    static const uint8_t padding[8] = { 0 };
+    int64_t offset = tell_index_output( writer->output );
+    write_index_output( writer->output, data, size );
+    write_index_output( writer->output, padding, LWINDEX_BINARY_ALIGN( size ) - size );
+    if( writer->output->error )
         return -1;
-    audio_frame_info_t *audio_info = (audio_frame_info_t *)malloc( audio_info_count * sizeof(audio_frame_info_t) );
-    if( !audio_info )
+    lwindex_binary_section_t *temp = (lwindex_binary_section_t *)realloc( writer->sections, (writer->section_count + 1) * sizeof(lwindex_binary_section_t) );
+    if( !temp )
+        return -1;
+    writer->sections = temp;
+    lwindex_binary_section_t *section = &writer->sections[ writer->section_count++ ];
+    section->type         = type;
+    section->stream_index = stream_index;
+    section->codec_type   = codec_type;
+    section->count        = count;
+    section->sequence     = sequence;
+    section->offset       = offset;
+    section->size         = size;
+    return 0;
+}
+
+static int flush_binary_index_records
+(
+    lwindex_binary_writer_t *writer,
+    lwindex_helper_t        *helper,
+    int                      stream_index,
+    enum AVMediaType         codec_type
+)
+{
+    if( !writer->output || helper->record_count == 0 )
+        return 0;
+    int ret = codec_type == AVMEDIA_TYPE_VIDEO
+            ? write_binary_index_section( writer, LWINDEX_SECTION_VIDEO_RECORDS, stream_index, codec_type,
+                                          helper->record_count, helper->record_sequence,
+                                          helper->records, helper->record_count * sizeof(lwindex_video_record_t) )
+            : write_binary_index_section( writer, LWINDEX_SECTION_AUDIO_RECORDS, stream_index, codec_type,
+                                          helper->record_count, helper->record_sequence,
+                                          helper->records, helper->record_count * sizeof(lwindex_audio_record_t) );
+    helper->record_count = 0;
+    return ret;
+}
+
+/* Append a packet record to the chunk of the stream, and write the chunk out when it gets full. */
+static int append_binary_index_record
+(
+    lwindex_binary_writer_t *writer,
+    lwindex_helper_t        *helper,
+    int                      stream_index,
+    enum AVMediaType         codec_type,
+    const void              *record
+)
+{
+    if( !writer->output )
+        return 0;
+    size_t record_size = codec_type == AVMEDIA_TYPE_VIDEO ? sizeof(lwindex_video_record_t) : sizeof(lwindex_audio_record_t);
+    if( !helper->records )
     {
-        free( video_info );
+        helper->records = lw_malloc_zero( LWINDEX_BINARY_CHUNK_SIZE * record_size );
+        if( !helper->records )
+            return -1;
+    }
+    if( helper->record_count == 0 )
+        helper->record_sequence = writer->packet_count;
+    memcpy( (uint8_t *)helper->records + helper->record_count * record_size, record, record_size );
+    ++ writer->packet_count;
+    if( ++ helper->record_count == LWINDEX_BINARY_CHUNK_SIZE )
+        return flush_binary_index_records( writer, helper, stream_index, codec_type );
+    return 0;
+}
+
+static int write_binary_index_entries
+(
+    lwindex_binary_writer_t *writer,
+    AVStream                *stream
+)
+{
+    if( !writer->output )
+        return 0;
+    int count = avformat_index_get_entries_count( stream );
+    lwindex_binary_index_entry_t *entries = NULL;
+    if( count > 0 )
+    {
+        entries = (lwindex_binary_index_entry_t *)lw_malloc_zero( count * sizeof(lwindex_binary_index_entry_t) );
+        if( !entries )
+            return -1;
+        for( int i = 0; i < count; i++ )
+        {
+            const AVIndexEntry *ie = avformat_index_get_entry( stream, i );
+            entries[i].pos          = ie->pos;
+            entries[i].timestamp    = ie->timestamp;
+            entries[i].flags        = ie->flags;
+            entries[i].size         = ie->size;
+            entries[i].min_distance = ie->min_distance;
+        }
+    }
+    int ret = write_binary_index_section( writer, LWINDEX_SECTION_INDEX_ENTRIES, stream->index, stream->codecpar->codec_type,
+                                          count, 0, entries, count * sizeof(lwindex_binary_index_entry_t) );
+    lw_free( entries );
+    return ret;
+}
+
+static int write_binary_extradata_list
+(
+    lwindex_binary_writer_t     *writer,
+    AVStream                    *stream,
+    lwlibav_extradata_handler_t *list
+)
+{
+    if( !writer->output )
+        return 0;
+    size_t size = 0;
+    for( int i = 0; i < list->entry_count; i++ )
+        size += sizeof(lwindex_binary_extradata_t) + LWINDEX_BINARY_ALIGN( list->entries[i].extradata_size );
+    uint8_t *data = size ? (uint8_t *)lw_malloc_zero( size ) : NULL;
+    if( size && !data )
         return -1;
+    uint8_t *p = data;
+    for( int i = 0; i < list->entry_count; i++ )
+    {
+        lwlibav_extradata_t       *entry  = &list->entries[i];
+        lwindex_binary_extradata_t header = { 0 };
+        const char *format_name = stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO
+                                ? av_get_pix_fmt_name( entry->pixel_format )
+                                : av_get_sample_fmt_name( entry->sample_format );
+        header.extradata_size  = entry->extradata_size;
+        header.codec_id        = entry->codec_id;
+        header.codec_tag       = entry->codec_tag;
+        header.width           = entry->width;
+        header.height          = entry->height;
+        header.bits_per_sample = entry->bits_per_sample;
+        header.channel_layout  = entry->channel_layout;
+        header.sample_rate     = entry->sample_rate;
+        header.block_align     = entry->block_align;
+        snprintf( header.format, sizeof(header.format), "%s", format_name ? format_name : "none" );
+        memcpy( p, &header, sizeof(lwindex_binary_extradata_t) );
+        p += sizeof(lwindex_binary_extradata_t);
+        if( entry->extradata_size > 0 )
+            memcpy( p, entry->extradata, entry->extradata_size );
+        p += LWINDEX_BINARY_ALIGN( entry->extradata_size );
     }
-    /*
-        # Structure of Libav reader index file
-        <LibavReaderIndexFile=17>
-        <InputFilePath>foobar.omo</InputFilePath>
-        <FileSize=1048576>
-        <FileLastModificationTime=000>
-        <FileHash=0x0123456789abcdef>
+    int ret = write_binary_index_section( writer, LWINDEX_SECTION_EXTRADATA_LIST, stream->index, stream->codecpar->codec_type,
+                                          list->entry_count, 0, data, size );
+    lw_free( data );
+    return ret;
+}
+
+/* Write the section table, and then complete the header when closing the output. */
+static int finish_binary_index
+(
+    lwindex_binary_writer_t *writer,
+    lwindex_binary_header_t *header
+)
+{
+    if( !writer->output )
+        return 0;
+    int64_t offset = tell_index_output( writer->output );
+    write_index_output( writer->output, writer->sections, writer->section_count * sizeof(lwindex_binary_section_t) );
+    memcpy( header->magic, LWINDEX_BINARY_MAGIC, sizeof(header->magic) );
+    header->section_table_offset = offset;
+    header->section_count        = writer->section_count;
+    patch_index_output( writer->output, 0, header, sizeof(lwindex_binary_header_t) );
+    return writer->output->error ? -1 : 0;
+}
+
+/* Validate the header and the section table of the binary index file, and get the section table.
+ * The contents of each section are not touched until the section is actually needed. */
+/* The header is given separately since the one of the shared image is read via the index cache. */
+static const lwindex_binary_section_t *get_binary_index_sections
+(
+    const uint8_t                 *data,
+    size_t                         data_size,
+    const lwindex_binary_header_t *header
+)
+{
+    if( data_size < sizeof(lwindex_binary_header_t)
+     || memcmp( header->magic, LWINDEX_BINARY_MAGIC, sizeof(header->magic) )
+     || header->byte_order         != LWINDEX_BINARY_BYTE_ORDER
+     || header->lwindex_version    != LWINDEX_VERSION
+     || header->index_file_version != LWINDEX_INDEX_FILE_VERSION
+     || header->section_table_offset > data_size
+     || header->section_count > (data_size - header->section_table_offset) / sizeof(lwindex_binary_section_t) )
+        return NULL;
+    const lwindex_binary_section_t *sections = (const lwindex_binary_section_t *)(data + header->section_table_offset);
+    for( uint32_t i = 0; i < header->section_count; i++ )
+        if( sections[i].offset > data_size || sections[i].size > data_size - sections[i].offset )
+            return NULL;
+    return sections;
+}
+
+static const lwindex_binary_section_t *find_binary_index_section
+(
+    const lwindex_binary_section_t *sections,
+    uint32_t                        section_count,
+    uint32_t                        type,
+    int                             stream_index,
+    int                             codec_type
+)
+{
+    for( uint32_t i = 0; i < section_count; i++ )
+        if( sections[i].type         == type
+         && sections[i].stream_index == stream_index
+         && sections[i].codec_type   == codec_type )
+            return &sections[i];
+    return NULL;
+}
+
+static const lwindex_stream_info_t *get_binary_index_stream_info
+(
+    const uint8_t                  *data,
+    const lwindex_binary_section_t *sections,
+    uint32_t                        section_count,
+    int                             stream_index
+)
+{
+    for( uint32_t i = 0; i < section_count; i++ )
+        if( sections[i].type         == LWINDEX_SECTION_STREAM_INFO
+         && sections[i].stream_index == stream_index
+         && sections[i].size         >= sizeof(lwindex_stream_info_t) )
+            return (const lwindex_stream_info_t *)(data + sections[i].offset);
+    return NULL;
+}
+
+/* Return 1 if the stream is indexed in the binary index file, otherwise 0. */
+static int is_binary_index_stream_indexed
+(
+    const uint8_t                  *data,
+    const lwindex_binary_section_t *sections,
+    uint32_t                        section_count,
+    int                             stream_index,
+    int                             codec_type
+)
+{
+    const lwindex_binary_section_t *section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_STREAM_SELECTION, -1, AVMEDIA_TYPE_UNKNOWN );
+    if( !section )
+        /* Every stream is indexed except for audio streams if disabled. */
+        return codec_type != AVMEDIA_TYPE_AUDIO || ((const lwindex_binary_header_t *)data)->active_audio_index != -2;
+    const lwindex_binary_stream_selection_t *selection = (const lwindex_binary_stream_selection_t *)(data + section->offset);
+    return stream_index >= 0 && (uint32_t)stream_index < section->count
+        && section->size / sizeof(lwindex_binary_stream_selection_t) >= section->count
+        && selection[stream_index].codec_type == codec_type
+        && selection[stream_index].indexed;
+}
+
+/* Write which streams are indexed, including the ones indexed in the image of the old index file 'image' if specified. */
+static int write_binary_stream_selection
+(
+    lwindex_binary_writer_t *writer,
+    AVFormatContext         *format_ctx,
+    const uint8_t           *selected,
+    const uint8_t           *image
+)
+{
+    if( !writer->output )
+        return 0;
+    const lwindex_binary_header_t  *header   = image ? (const lwindex_binary_header_t *)image : NULL;
+    const lwindex_binary_section_t *sections = image ? (const lwindex_binary_section_t *)(image + header->section_table_offset) : NULL;
+    size_t size = format_ctx->nb_streams * sizeof(lwindex_binary_stream_selection_t);
+    lwindex_binary_stream_selection_t *selection = (lwindex_binary_stream_selection_t *)lw_malloc_zero( size );
+    if( !selection )
+        return -1;
+    for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+    {
+        int codec_type = format_ctx->streams[stream_index]->codecpar->codec_type;
+        selection[stream_index].codec_type = codec_type;
+        selection[stream_index].indexed    = selected[stream_index]
+                                          || (image && is_binary_index_stream_indexed( image, sections, header->section_count, stream_index, codec_type ));
+    }
+    int ret = write_binary_index_section( writer, LWINDEX_SECTION_STREAM_SELECTION, -1, AVMEDIA_TYPE_UNKNOWN,
+                                          format_ctx->nb_streams, 0, selection, size );
+    lw_free( selection );
+    return ret;
+}
+
+/* If 'mapped' is set, the extradata are left in the image 'data', which has to outlive the entries,
+ * and copied only when the decoder is configured with them. */
+static int import_binary_extradata_list
+(
+    const uint8_t                  *data,
+    const lwindex_binary_section_t *section,
+    lwlibav_extradata_handler_t    *exhp,
+    int                             mapped
+)
+{
+    if( !section || section->count == 0 )
+        return 0;
+    if( section->count > INT_MAX || !alloc_extradata_entries( exhp, section->count ) )
+        return -1;
+    exhp->mapped = mapped;
+    const uint8_t *p   = data + section->offset;
+    const uint8_t *end = p + section->size;
+    for( int i = 0; i < exhp->entry_count; i++ )
+    {
+        lwlibav_extradata_t *entry = &exhp->entries[i];
+        lwindex_binary_extradata_t header;
+        if( (size_t)(end - p) < sizeof(lwindex_binary_extradata_t) )
+            return -1;
+        memcpy( &header, p, sizeof(lwindex_binary_extradata_t) );
+        p += sizeof(lwindex_binary_extradata_t);
+        header.format[ sizeof(header.format) - 1 ] = '\0';
+        if( header.extradata_size < 0 || end - p < header.extradata_size )
+            return -1;
+        entry->codec_id        = (enum AVCodecID)header.codec_id;
+        entry->codec_tag       = header.codec_tag;
+        entry->bits_per_sample = header.bits_per_sample;
+        if( section->codec_type == AVMEDIA_TYPE_VIDEO )
+        {
+            entry->width        = header.width;
+            entry->height       = header.height;
+            entry->pixel_format = av_get_pix_fmt( header.format );
+        }
+        else
+        {
+            entry->channel_layout = header.channel_layout;
+            entry->sample_rate    = header.sample_rate;
+            entry->block_align    = header.block_align;
+            entry->sample_format  = av_get_sample_fmt( header.format );
+        }
+        if( header.extradata_size > 0 && mapped )
+        {
+            entry->extradata      = (uint8_t *)p;
+            entry->extradata_size = header.extradata_size;
+        }
+        else if( header.extradata_size > 0 )
+        {
+            entry->extradata = (uint8_t *)av_malloc( header.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE );
+            if( !entry->extradata )
+                return -1;
+            entry->extradata_size = header.extradata_size;
+            memcpy( entry->extradata, p, header.extradata_size );
+            memset( entry->extradata + entry->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE );
+        }
+        p += MIN( LWINDEX_BINARY_ALIGN( header.extradata_size ), end - p );
+    }
+    return 0;
+}
+
+/* Indexing pipeline
+ * In the parallel mode, one thread demuxes packets, one worker thread per stream analyzes the packets of the stream
+ * by the index helper in the demuxed order, and the calling thread merges the results in the demuxed order.
+ * All the video streams share one worker since the investigation of the pixel format by decoding is done once
+ * for all of them. Since the analysis depends only on the index helper of the stream and this shared state,
+ * the merged results are identical to the ones obtained on the calling thread only. */
+#define LWINDEX_PIPELINE_DEPTH 256
+
+/* Byte range mode
+ * A large MPEG-2 transport stream is split into byte ranges, and each range is demuxed by its own format context and
+ * analyzed by its own index helpers on its own thread. Each range except for the first one starts at the first
+ * keyframe of the sync video stream found in the range, and ends just before the start of the following non-empty
+ * range. Therefore, the packets are partitioned by their file offsets, and the ranges can be merged in order.
+ * The index helpers of a range know nothing about the preceding ranges. To carry the states of the parsers and the
+ * ones of the PES packets over a boundary, each range keeps analyzing the following range up to its second keyframe
+ * of the sync video stream, and the results are compared with the ones of the following range field by field. If any
+ * of them differs, or audio decoders delay the output, the ranges are discarded and the file is indexed again by the
+ * usual pipeline. Thus the index file never depends on the number of the ranges.
+ * This mode is used only if requested by 'range_index'. */
+#define LWINDEX_RANGE_MIN_SIZE  ((int64_t)256 << 20)
+#define LWINDEX_RANGE_ALIGNMENT 9024                /* the least common multiple of 188 and 192 */
+#define LWINDEX_RANGE_OVERLAP   ((int64_t)8 << 20)  /* for the PES packets completed after the end of the range */
+#define LWINDEX_MAX_RANGES      16
+
+typedef struct lwindex_packet_tag lwindex_packet_t;
+
+struct lwindex_packet_tag
+{
+    AVPacket           pkt;
+    AVStream          *stream;
+    lwindex_helper_t  *helper;
+    int64_t            io_pos;              /* the file offset of the I/O context after reading this packet */
+    int                error;
+    int                done;
+    lwindex_packet_t  *next;                /* the next packet in the queue of the worker */
+    /* the results of the analysis */
+    enum AVCodecID     codec_id;
+    int                extradata_index;
+    int                width_before_parsing;
+    int                height_before_parsing;
+    enum AVColorSpace  colorspace;
+    int                width;
+    int                height;
+    enum AVPixelFormat pix_fmt;
+    int                pict_type;
+    int                poc;
+    int                repeat_pict;
+    lw_field_info_t    field_info;
+    int                recovery;            /* the recovery frame count if a recovery point, -1 otherwise */
+    int                invisible;           /* VPx invisible altref frame */
+    int                bits_per_sample;
+    int                frame_length;
+    uint32_t           delay_count;
+    int                sample_rate;
+    enum AVSampleFormat sample_fmt;
+    AVChannelLayout    ch_layout;
+};
+
+typedef struct lwindex_pipeline_tag lwindex_pipeline_t;
+
+typedef struct
+{
+    lwindex_pipeline_t *pipeline;
+    lw_thread_t        *thread;
+    lw_cond_t          *cond;       /* signalled when a packet is queued or the worker is asked to quit */
+    lwindex_packet_t   *first;
+    lwindex_packet_t   *last;
+    int                 quit;
+} lwindex_worker_t;
+
+typedef struct
+{
+    lwindex_pipeline_t *pipeline;
+    AVFormatContext    *format_ctx;
+    lwindex_indexer_t  *indexer;
+    lwindex_indexer_t   range_indexer;  /* for the ranges except for the first one */
+    lw_thread_t        *thread;
+    int64_t             start;          /* the nominal boundaries of this range */
+    int64_t             end;
+    int64_t             sync_pos;       /* the file offset of the first packet, or -1 if this range is empty */
+    int                 sync_resolved;
+    int64_t             io_pos;
+    int                 done;
+    int                 error;
+    int                 delayed;        /* Some audio frame lengths are unknown until the following range is decoded. */
+    lwindex_packet_t   *packets;        /* the analyzed packets without their payloads */
+    uint32_t            packet_count;
+    uint32_t            packet_capacity;
+    lwindex_packet_t   *check;          /* the packets of the following range analyzed by this range */
+    uint32_t            check_count;
+    uint32_t            check_capacity;
+    int64_t             check_end;      /* the second keyframe of the sync stream in the following range */
+} lwindex_range_t;
+
+struct lwindex_pipeline_tag
+{
+    AVFormatContext   *format_ctx;
+    lwindex_indexer_t *indexer;
+    int                audio_disabled;
+    lwindex_packet_t  *packets;         /* the ring buffer of the packets in flight */
+    uint32_t           capacity;
+    uint32_t           head;            /* the oldest packet not merged yet */
+    uint32_t           count;           /* the number of the packets in flight */
+    int                eof;
+    int                abort;
+    int                error;
+    /* for the parallel mode only */
+    lw_mutex_t        *mutex;
+    lw_cond_t         *demux_cond;      /* signalled when a slot gets free or demuxing is aborted */
+    lw_cond_t         *merge_cond;      /* signalled when the oldest packet is analyzed or demuxing is finished */
+    lw_thread_t       *demuxer;
+    lwindex_worker_t **workers;         /* indexed by stream index + 1, and the first one for all the video streams */
+    int                number_of_workers;
+    /* for the byte range mode only */
+    lwindex_range_t   *ranges;
+    int                number_of_ranges;
+    int                current_range;   /* the range being merged */
+    uint32_t           range_packet;    /* the next packet to be merged in the current range */
+    int                sync_stream_index;
+    uint64_t           range_progress;  /* incremented whenever range_cond is signalled */
+    lw_cond_t         *range_cond;      /* signalled when a range finds its start, makes progress or finishes */
+};
+
+static int get_audio_bits_per_sample
+(
+    AVCodecContext *ctx
+)
+{
+    return ctx->bits_per_raw_sample   > 0 ? ctx->bits_per_raw_sample
+         : ctx->bits_per_coded_sample > 0 ? ctx->bits_per_coded_sample
+         : av_get_bytes_per_sample( ctx->sample_fmt ) << 3;
+}
+
+/* Set the properties of the stream not set yet for the current extradata. */
+static void update_extradata_properties
+(
+    lwindex_helper_t *helper,
+    AVCodecContext   *ctx,
+    int               bits_per_sample
+)
+{
+    lwlibav_extradata_handler_t *list = &helper->exh;
+    lwlibav_extradata_t *entry = &list->entries[ list->current_index ];
+    if( ctx->codec_type == AVMEDIA_TYPE_VIDEO )
+    {
+        if( entry->width < ctx->width )
+            entry->width = ctx->width;
+        if( entry->height < ctx->height )
+            entry->height = ctx->height;
+        if( entry->pixel_format == AV_PIX_FMT_NONE )
+            entry->pixel_format = ctx->pix_fmt;
+    }
+    else
+    {
+        if( entry->channel_layout == 0 )
+            entry->channel_layout = ctx->ch_layout.u.mask;
+        if( entry->sample_rate == 0 )
+            entry->sample_rate = ctx->sample_rate;
+        if( entry->sample_format == AV_SAMPLE_FMT_NONE )
+            entry->sample_format = ctx->sample_fmt;
+        if( entry->block_align == 0 )
+            entry->block_align = ctx->block_align;
+    }
+    if( entry->bits_per_sample == 0 )
+        entry->bits_per_sample = bits_per_sample;
+    if( entry->codec_id == AV_CODEC_ID_NONE )
+        entry->codec_id = ctx->codec_id;
+    if( entry->codec_tag == 0 )
+        entry->codec_tag = ctx->codec_tag;
+}
+
+static void analyze_index_packet
+(
+    lwindex_helper_t *helper,
+    lwindex_packet_t *packet
+)
+{
+    AVCodecContext *ctx = helper->codec_ctx;
+    AVPacket       *pkt = &packet->pkt;
+    packet->codec_id        = ctx->codec_id;
+    packet->extradata_index = append_extradata_if_new( helper, ctx, pkt );
+    if( packet->extradata_index < 0 )
+    {
+        packet->error = 1;
+        return;
+    }
+    if( ctx->codec_type == AVMEDIA_TYPE_VIDEO )
+    {
+        if( ctx->pix_fmt == AV_PIX_FMT_NONE
+         || (ctx->codec->wrapper_name && !*helper->pix_fmt_investigated) )
+        {
+            if( !helper->picture && !(helper->picture = av_frame_alloc()) )
+            {
+                packet->error = 1;
+                return;
+            }
+            investigate_pix_fmt_by_decoding( ctx, pkt, helper->picture );
+            *helper->pix_fmt_investigated = 1;
+        }
+        packet->width_before_parsing  = ctx->width;
+        packet->height_before_parsing = ctx->height;
+        packet->colorspace            = ctx->colorspace;
+        /* Get picture type. */
+        packet->pict_type = get_picture_type( helper, ctx, pkt );
+        if( packet->pict_type < 0 )
+        {
+            packet->error = 1;
+            return;
+        }
+        /* Get Picture Order Count. */
+        packet->poc = helper->parser_ctx ? helper->parser_ctx->output_picture_number : 0;
+        /* Get field information. */
+        if( helper->parser_ctx )
+        {
+            if( helper->parser_ctx->picture_structure == AV_PICTURE_STRUCTURE_TOP_FIELD
+             || helper->parser_ctx->picture_structure == AV_PICTURE_STRUCTURE_BOTTOM_FIELD )
+            {
+                /* field coded picture */
+                if( helper->parser_ctx->picture_structure == AV_PICTURE_STRUCTURE_TOP_FIELD )
+                    packet->field_info = LW_FIELD_INFO_TOP;
+                else
+                    packet->field_info = LW_FIELD_INFO_BOTTOM;
+                packet->repeat_pict = helper->parser_ctx->repeat_pict;
+            }
+            else
+            {
+                /* frame coded picture */
+                if( helper->parser_ctx->field_order == AV_FIELD_TT
+                 || helper->parser_ctx->field_order == AV_FIELD_TB )
+                    packet->field_info = LW_FIELD_INFO_TOP;
+                else if( helper->parser_ctx->field_order == AV_FIELD_BB
+                      || helper->parser_ctx->field_order == AV_FIELD_BT )
+                    packet->field_info = LW_FIELD_INFO_BOTTOM;
+                else
+                    packet->field_info = helper->last_field_info;
+                if( get_ticks_per_frame( ctx ) == 2 && helper->parser_ctx->repeat_pict != 0 )
+                    packet->repeat_pict = helper->parser_ctx->repeat_pict;
+                else
+                    packet->repeat_pict = 2 * helper->parser_ctx->repeat_pict + 1;
+            }
+            helper->last_field_info = packet->field_info;
+        }
+        else
+        {
+            packet->repeat_pict = 1;
+            packet->field_info  = helper->last_field_info;
+        }
+        packet->width     = ctx->width;
+        packet->height    = ctx->height;
+        packet->pix_fmt   = ctx->pix_fmt;
+        packet->invisible = ctx->codec_id == AV_CODEC_ID_VP8 && check_vp8_invisible_frame( pkt );
+        /* Keyframes need no recovery point since decoding can start from them anyway. */
+        packet->recovery  = (pkt->flags & AV_PKT_FLAG_KEY) ? -1 : get_recovery_frame_count( ctx, pkt );
+        update_extradata_properties( helper, ctx, ctx->bits_per_coded_sample );
+    }
+    else
+    {
+        packet->bits_per_sample = get_audio_bits_per_sample( ctx );
+        /* Get audio frame_length. */
+        packet->frame_length = get_audio_frame_length( helper, ctx, pkt );
+        packet->delay_count  = helper->delay_count;
+        packet->sample_rate  = ctx->sample_rate;
+        packet->sample_fmt   = ctx->sample_fmt;
+        if( av_channel_layout_copy( &packet->ch_layout, &ctx->ch_layout ) < 0 )
+        {
+            packet->error = 1;
+            return;
+        }
+        update_extradata_properties( helper, ctx, packet->bits_per_sample );
+    }
+}
+
+/* Read the next packet to be indexed.
+ * Return 1 if got, 0 if reached the end of the file, or -1 on error. */
+static int read_index_packet
+(
+    AVFormatContext   *format_ctx,
+    lwindex_indexer_t *indexer,
+    int                audio_disabled,
+    lwindex_packet_t  *packet
+)
+{
+    while( read_av_frame( format_ctx, &packet->pkt ) >= 0 )
+    {
+        AVStream          *stream   = format_ctx->streams[ packet->pkt.stream_index ];
+        AVCodecParameters *codecpar = stream->codecpar;
+        if( (codecpar->codec_type != AVMEDIA_TYPE_VIDEO && codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+         || (codecpar->codec_type == AVMEDIA_TYPE_AUDIO && audio_disabled)
+         || codecpar->codec_id == AV_CODEC_ID_NONE
+         || !is_selected_index_stream( indexer, stream->index ) )
+        {
+            stream->discard = AVDISCARD_ALL;
+            av_packet_unref( &packet->pkt );
+            continue;
+        }
+        lwindex_helper_t *helper = get_index_helper( indexer, stream );
+        if( !helper )
+        {
+            av_packet_unref( &packet->pkt );
+            return -1;
+        }
+        if( !helper->codec_ctx )
+        {
+            stream->discard = AVDISCARD_ALL;
+            av_packet_unref( &packet->pkt );
+            continue;
+        }
+        packet->stream = stream;
+        packet->helper = helper;
+        packet->io_pos = format_ctx->pb->pos;
+        packet->error  = 0;
+        packet->done   = 0;
+        packet->next   = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+static void *index_worker_thread
+(
+    void *arg
+)
+{
+    lwindex_worker_t   *worker   = (lwindex_worker_t *)arg;
+    lwindex_pipeline_t *pipeline = worker->pipeline;
+    lw_mutex_lock( pipeline->mutex );
+    while( 1 )
+    {
+        while( !worker->first && !worker->quit )
+            lw_cond_wait( worker->cond, pipeline->mutex );
+        lwindex_packet_t *packet = worker->first;
+        if( !packet )
+            break;
+        worker->first = packet->next;
+        if( !worker->first )
+            worker->last = NULL;
+        /* Don't waste time on the packets which will be never merged. */
+        int skip = pipeline->abort;
+        lw_mutex_unlock( pipeline->mutex );
+        if( !skip )
+            analyze_index_packet( packet->helper, packet );
+        lw_mutex_lock( pipeline->mutex );
+        packet->done = 1;
+        if( packet == &pipeline->packets[ pipeline->head ] )
+            lw_cond_signal( pipeline->merge_cond );
+    }
+    lw_mutex_unlock( pipeline->mutex );
+    return NULL;
+}
+
+/* Get the worker for the stream, and start it if not started yet.
+ * This is called by the demuxer thread only. */
+static lwindex_worker_t *get_index_worker
+(
+    lwindex_pipeline_t *pipeline,
+    AVStream           *stream
+)
+{
+    int slot = stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? 0 : stream->index + 1;
+    if( pipeline->number_of_workers <= slot )
+    {
+        lwindex_worker_t **temp = (lwindex_worker_t **)realloc( pipeline->workers, (slot + 1) * sizeof(lwindex_worker_t *) );
+        if( !temp )
+            return NULL;
+        memset( temp + pipeline->number_of_workers, 0, (slot + 1 - pipeline->number_of_workers) * sizeof(lwindex_worker_t *) );
+        pipeline->workers           = temp;
+        pipeline->number_of_workers = slot + 1;
+    }
+    lwindex_worker_t *worker = pipeline->workers[slot];
+    if( !worker )
+    {
+        worker = (lwindex_worker_t *)lw_malloc_zero( sizeof(lwindex_worker_t) );
+        if( !worker )
+            return NULL;
+        worker->pipeline = pipeline;
+        worker->cond     = lw_cond_create();
+        if( worker->cond )
+            worker->thread = lw_thread_create( index_worker_thread, worker );
+        if( !worker->thread )
+        {
+            lw_cond_destroy( worker->cond );
+            lw_free( worker );
+            return NULL;
+        }
+        pipeline->workers[slot] = worker;
+    }
+    return worker;
+}
+
+static void *index_demuxer_thread
+(
+    void *arg
+)
+{
+    lwindex_pipeline_t *pipeline = (lwindex_pipeline_t *)arg;
+    lw_mutex_lock( pipeline->mutex );
+    while( 1 )
+    {
+        while( pipeline->count == pipeline->capacity && !pipeline->abort )
+            lw_cond_wait( pipeline->demux_cond, pipeline->mutex );
+        if( pipeline->abort )
+            break;
+        /* The free slot is invisible to the other threads until queued. */
+        lwindex_packet_t *packet = &pipeline->packets[ (pipeline->head + pipeline->count) % pipeline->capacity ];
+        lw_mutex_unlock( pipeline->mutex );
+        int ret = read_index_packet( pipeline->format_ctx, pipeline->indexer, pipeline->audio_disabled, packet );
+        lwindex_worker_t *worker = NULL;
+        if( ret > 0 && !(worker = get_index_worker( pipeline, packet->stream )) )
+        {
+            av_packet_unref( &packet->pkt );
+            ret = -1;
+        }
+        lw_mutex_lock( pipeline->mutex );
+        if( ret <= 0 )
+        {
+            pipeline->error = (ret < 0);
+            break;
+        }
+        if( worker->last )
+            worker->last->next = packet;
+        else
+            worker->first = packet;
+        worker->last = packet;
+        ++ pipeline->count;
+        lw_cond_signal( worker->cond );
+    }
+    pipeline->eof = 1;
+    lw_cond_signal( pipeline->merge_cond );
+    lw_mutex_unlock( pipeline->mutex );
+    return NULL;
+}
+
+/* Drop the payload of the analyzed packet but keep the properties referred on merging. */
+static void strip_index_packet
+(
+    AVPacket *pkt
+)
+{
+    int64_t pts          = pkt->pts;
+    int64_t dts          = pkt->dts;
+    int64_t pos          = pkt->pos;
+    int     flags        = pkt->flags;
+    int     stream_index = pkt->stream_index;
+    av_packet_unref( pkt );
+    pkt->pts          = pts;
+    pkt->dts          = dts;
+    pkt->pos          = pos;
+    pkt->flags        = flags;
+    pkt->stream_index = stream_index;
+}
+
+static void resolve_index_range_sync
+(
+    lwindex_range_t *range,
+    int64_t          sync_pos
+)
+{
+    lwindex_pipeline_t *pipeline = range->pipeline;
+    lw_mutex_lock( pipeline->mutex );
+    range->sync_pos      = sync_pos;
+    range->sync_resolved = 1;
+    ++ pipeline->range_progress;
+    lw_cond_broadcast( pipeline->range_cond );
+    lw_mutex_unlock( pipeline->mutex );
+}
+
+/* Get the file offset where the following non-empty range starts.
+ * Return INT64_MAX if no following non-empty range, or -1 if aborted. */
+static int64_t get_following_index_range_sync
+(
+    lwindex_range_t *range
+)
+{
+    lwindex_pipeline_t *pipeline = range->pipeline;
+    int64_t             sync_pos = INT64_MAX;
+    lw_mutex_lock( pipeline->mutex );
+    for( lwindex_range_t *next = range + 1; next < pipeline->ranges + pipeline->number_of_ranges; next++ )
+    {
+        while( !next->sync_resolved && !pipeline->abort )
+            lw_cond_wait( pipeline->range_cond, pipeline->mutex );
+        if( pipeline->abort )
+        {
+            sync_pos = -1;
+            break;
+        }
+        if( next->sync_pos >= 0 )
+        {
+            sync_pos = next->sync_pos;
+            break;
+        }
+    }
+    lw_mutex_unlock( pipeline->mutex );
+    return sync_pos;
+}
+
+static int append_index_range_packet
+(
+    lwindex_range_t  *range,
+    lwindex_packet_t *packet,
+    int               check
+)
+{
+    lwindex_packet_t **packets  = check ? &range->check          : &range->packets;
+    uint32_t          *count    = check ? &range->check_count    : &range->packet_count;
+    uint32_t          *capacity = check ? &range->check_capacity : &range->packet_capacity;
+    if( *count == *capacity )
+    {
+        uint32_t          new_capacity = *capacity ? *capacity << 1 : 1 << 16;
+        lwindex_packet_t *temp         = (lwindex_packet_t *)realloc( *packets, new_capacity * sizeof(lwindex_packet_t) );
+        if( !temp )
+            return -1;
+        *packets  = temp;
+        *capacity = new_capacity;
+    }
+    (*packets)[ (*count) ++ ] = *packet;
+    return 0;
+}
+
+static void *index_range_thread
+(
+    void *arg
+)
+{
+    lwindex_range_t    *range          = (lwindex_range_t *)arg;
+    lwindex_pipeline_t *pipeline       = range->pipeline;
+    lwindex_packet_t    packet         = { { 0 } };
+    int64_t             limit          = INT64_MAX;
+    int                 limit_resolved = 0;
+    int                 synced         = range->sync_resolved;
+    int                 aborted        = 0;
+    int                 ret            = 0;
+    while( !aborted && (ret = read_index_packet( range->format_ctx, range->indexer, pipeline->audio_disabled, &packet )) > 0 )
+    {
+        AVPacket *pkt = &packet.pkt;
+        int64_t   pos = pkt->pos;
+        if( !synced )
+        {
+            /* Start from the first keyframe of the sync video stream in this range. */
+            if( pos >= range->end )
+                break;
+            if( pos < range->start || pkt->stream_index != pipeline->sync_stream_index || !(pkt->flags & AV_PKT_FLAG_KEY) )
+            {
+                av_packet_unref( pkt );
+                continue;
+            }
+            synced = 1;
+            resolve_index_range_sync( range, pos );
+        }
+        else if( pos >= 0 && pos < range->sync_pos )
+        {
+            /* This packet belongs to the preceding range. */
+            av_packet_unref( pkt );
+            continue;
+        }
+        if( pos >= range->end && !limit_resolved )
+        {
+            limit          = get_following_index_range_sync( range );
+            limit_resolved = 1;
+            if( limit < 0 )
+                break;
+        }
+        int check = 0;
+        if( pos >= limit )
+        {
+            /* This packet belongs to the following range. The packets of the following range up to its second keyframe
+             * of the sync stream are analyzed here too for the verification, and the packets of this range may still
+             * follow. */
+            if( range->check_end == INT64_MAX && pos > limit
+             && pkt->stream_index == pipeline->sync_stream_index && (pkt->flags & AV_PKT_FLAG_KEY) )
+                range->check_end = pos;
+            if( pos >= range->check_end )
+            {
+                av_packet_unref( pkt );
+                if( pos >= range->check_end + LWINDEX_RANGE_OVERLAP )
+                    break;
+                continue;
+            }
+            check = 1;
+        }
+        analyze_index_packet( packet.helper, &packet );
+        if( packet.error )
+        {
+            ret = -1;
+            break;
+        }
+        if( packet.stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && packet.frame_length == -1 )
+        {
+            range->delayed = 1;
+            break;
+        }
+        strip_index_packet( pkt );
+        if( append_index_range_packet( range, &packet, check ) < 0 )
+        {
+            ret = -1;
+            break;
+        }
+        /* The channel layout is owned by the appended packet now. */
+        memset( &packet, 0, sizeof(lwindex_packet_t) );
+        if( (range->packet_count & 0xff) == 0 )
+        {
+            lw_mutex_lock( pipeline->mutex );
+            range->io_pos = range->format_ctx->pb->pos;
+            aborted       = pipeline->abort;
+            ++ pipeline->range_progress;
+            lw_cond_broadcast( pipeline->range_cond );
+            lw_mutex_unlock( pipeline->mutex );
+        }
+    }
+    av_packet_unref( &packet.pkt );
+    av_channel_layout_uninit( &packet.ch_layout );
+    lw_mutex_lock( pipeline->mutex );
+    if( !range->sync_resolved )
+    {
+        range->sync_pos      = -1;
+        range->sync_resolved = 1;
+    }
+    range->error = (ret < 0);
+    range->done  = 1;
+    ++ pipeline->range_progress;
+    lw_cond_broadcast( pipeline->range_cond );
+    lw_mutex_unlock( pipeline->mutex );
+    return NULL;
+}
+
+static void close_index_ranges
+(
+    lwindex_pipeline_t *pipeline
+)
+{
+    if( !pipeline->ranges )
+        return;
+    if( pipeline->range_cond )
+    {
+        lw_mutex_lock( pipeline->mutex );
+        pipeline->abort = 1;
+        lw_cond_broadcast( pipeline->range_cond );
+        lw_mutex_unlock( pipeline->mutex );
+    }
+    for( int i = 0; i < pipeline->number_of_ranges; i++ )
+    {
+        lwindex_range_t *range = &pipeline->ranges[i];
+        if( range->thread )
+            lw_thread_join( range->thread );
+        for( uint32_t j = 0; j < range->packet_count; j++ )
+            av_channel_layout_uninit( &range->packets[j].ch_layout );
+        for( uint32_t j = 0; j < range->check_count; j++ )
+            av_channel_layout_uninit( &range->check[j].ch_layout );
+        lw_free( range->packets );
+        lw_free( range->check );
+        if( range->indexer == &range->range_indexer && range->format_ctx )
+        {
+            if( range->range_indexer.helpers )
+                cleanup_index_helpers( &range->range_indexer, range->format_ctx );
+            lavf_close_file( &range->format_ctx );
+        }
+    }
+    lw_freep( &pipeline->ranges );
+    pipeline->number_of_ranges = 0;
+    pipeline->current_range    = 0;
+    pipeline->range_packet     = 0;
+    lw_cond_destroy( pipeline->range_cond );
+    pipeline->range_cond = NULL;
+}
+
+/* Ranges are synchronized with the first video stream which can be indexed.
+ * Return the stream index, or -1 if not found. */
+static int find_index_sync_stream
+(
+    AVFormatContext   *format_ctx,
+    lwindex_indexer_t *indexer
+)
+{
+    for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+    {
+        AVStream *stream = format_ctx->streams[stream_index];
+        if( stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO || stream->codecpar->codec_id == AV_CODEC_ID_NONE
+         || !is_selected_index_stream( indexer, stream_index ) )
+            continue;
+        lwindex_helper_t *helper = get_index_helper( indexer, stream );
+        if( helper && helper->codec_ctx )
+            return stream_index;
+    }
+    return -1;
+}
+
+static int open_index_range_context
+(
+    lwindex_range_t        *range,
+    const char             *file_path,
+    AVFormatContext        *format_ctx,
+    const lwlibav_option_t *opt
+)
+{
+    if( lavf_open_file( &range->format_ctx, file_path, opt->read_ahead, opt->direct_io, NULL ) < 0 )
+        return -1;
+    /* The streams must be identical to the ones of the first range since the results are merged by stream index. */
+    if( range->format_ctx->nb_streams != format_ctx->nb_streams )
+        return -1;
+    for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+    {
+        AVCodecParameters *codecpar       = format_ctx->streams[stream_index]->codecpar;
+        AVCodecParameters *range_codecpar = range->format_ctx->streams[stream_index]->codecpar;
+        if( range_codecpar->codec_type != codecpar->codec_type
+         || range_codecpar->codec_id   != codecpar->codec_id )
+            return -1;
+    }
+    return av_seek_frame( range->format_ctx, -1, range->start, AVSEEK_FLAG_BYTE ) < 0 ? -1 : 0;
+}
+
+/* Split the file into byte ranges and start to analyze them in parallel.
+ * Return 0 if started, 1 if the byte range mode is not applicable, or -1 on error.
+ * Unless started, the caller shall close the pipeline. */
+static int open_index_ranges
+(
+    lwindex_pipeline_t     *pipeline,
+    const char             *file_path,
+    AVFormatContext        *format_ctx,
+    lwindex_indexer_t      *indexer,
+    int                     audio_disabled,
+    int64_t                 filesize,
+    const lwlibav_option_t *opt
+)
+{
+    if( sizeof(void *) < 8 || !format_ctx->pb || !(format_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL) )
+        /* Every range keeps its packet properties until merged, so don't try on address space limited environments. */
+        return 1;
+    int number_of_ranges = MIN( lw_get_cpu_count(), LWINDEX_MAX_RANGES );
+    if( filesize / LWINDEX_RANGE_MIN_SIZE < number_of_ranges )
+        number_of_ranges = (int)(filesize / LWINDEX_RANGE_MIN_SIZE);
+    if( number_of_ranges < 2 )
+        return 1;
+    pipeline->sync_stream_index = find_index_sync_stream( format_ctx, indexer );
+    if( pipeline->sync_stream_index < 0 )
+        return 1;
+    pipeline->format_ctx     = format_ctx;
+    pipeline->indexer        = indexer;
+    pipeline->audio_disabled = audio_disabled;
+    pipeline->abort          = 0;
+    pipeline->range_progress = 0;
+    pipeline->ranges         = (lwindex_range_t *)lw_malloc_zero( number_of_ranges * sizeof(lwindex_range_t) );
+    if( !pipeline->ranges )
+        return -1;
+    pipeline->number_of_ranges = number_of_ranges;
+    pipeline->mutex            = lw_mutex_create();
+    pipeline->range_cond       = lw_cond_create();
+    if( !pipeline->mutex || !pipeline->range_cond )
+        return -1;
+    int64_t range_size = filesize / number_of_ranges;
+    for( int i = 0; i < number_of_ranges; i++ )
+    {
+        lwindex_range_t *range = &pipeline->ranges[i];
+        range->pipeline  = pipeline;
+        range->start     = i * (range_size - range_size % LWINDEX_RANGE_ALIGNMENT);
+        range->end       = i + 1 < number_of_ranges ? (i + 1) * (range_size - range_size % LWINDEX_RANGE_ALIGNMENT) : INT64_MAX;
+        range->check_end = INT64_MAX;
+        if( i == 0 )
+        {
+            /* The first range is indexed by the format context and the index helpers given from the caller. */
+            range->format_ctx    = format_ctx;
+            range->indexer       = indexer;
+            range->sync_pos      = 0;
+            range->sync_resolved = 1;
+            continue;
+        }
+        range->range_indexer                   = *indexer;
+        range->range_indexer.number_of_helpers = 0;
+        range->range_indexer.helpers           = NULL;
+        range->indexer                         = &range->range_indexer;
+        if( open_index_range_context( range, file_path, format_ctx, opt ) < 0 )
+            return 1;
+    }
+    for( int i = 0; i < number_of_ranges; i++ )
+    {
+        lwindex_range_t *range = &pipeline->ranges[i];
+        range->thread = lw_thread_create( index_range_thread, range );
+        if( !range->thread )
+            return -1;
+    }
+    return 0;
+}
+
+/* Find the extradata in the list, or append it if not found.
+ * Return the index of the entry in the list, or -1 on error. */
+static int merge_extradata_entry
+(
+    lwlibav_extradata_handler_t *list,
+    const lwlibav_extradata_t   *src
+)
+{
+    for( int i = 0; i < list->entry_count; i++ )
+    {
+        lwlibav_extradata_t *entry = &list->entries[i];
+        if( src->extradata_size != entry->extradata_size
+         || (src->extradata_size > 0 && memcmp( src->extradata, entry->extradata, src->extradata_size )) )
+            continue;
+        if( entry->width < src->width )
+            entry->width = src->width;
+        if( entry->height < src->height )
+            entry->height = src->height;
+        if( entry->pixel_format == AV_PIX_FMT_NONE )
+            entry->pixel_format = src->pixel_format;
+        if( entry->channel_layout == 0 )
+            entry->channel_layout = src->channel_layout;
+        if( entry->sample_rate == 0 )
+            entry->sample_rate = src->sample_rate;
+        if( entry->sample_format == AV_SAMPLE_FMT_NONE )
+            entry->sample_format = src->sample_format;
+        if( entry->bits_per_sample == 0 )
+            entry->bits_per_sample = src->bits_per_sample;
+        if( entry->block_align == 0 )
+            entry->block_align = src->block_align;
+        if( entry->codec_id == AV_CODEC_ID_NONE )
+            entry->codec_id = src->codec_id;
+        if( entry->codec_tag == 0 )
+            entry->codec_tag = src->codec_tag;
+        return i;
+    }
+    lwlibav_extradata_t *entry = alloc_extradata_entries( list, list->entry_count + 1 );
+    if( !entry )
+        return -1;
+    *entry = *src;
+    entry->extradata = NULL;
+    if( src->extradata_size > 0 )
+    {
+        entry->extradata = (uint8_t *)av_malloc( src->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE );
+        if( !entry->extradata )
+            return -1;
+        memcpy( entry->extradata, src->extradata, src->extradata_size );
+        memset( entry->extradata + src->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE );
+    }
+    return list->entry_count - 1;
+}
+
+/* Make the packets of the range refer to the streams, the index helpers and the extradata of the first range. */
+static int rebase_index_range
+(
+    lwindex_pipeline_t *pipeline,
+    lwindex_range_t    *range
+)
+{
+    for( int stream_index = 0; stream_index < range->indexer->number_of_helpers; stream_index++ )
+    {
+        lwindex_helper_t *range_helper = range->indexer->helpers[stream_index];
+        if( !range_helper || !range_helper->codec_ctx )
+            continue;
+        AVStream         *stream = pipeline->format_ctx->streams[stream_index];
+        lwindex_helper_t *helper = get_index_helper( pipeline->indexer, stream );
+        if( !helper || !helper->codec_ctx )
+            return -1;
+        lwlibav_extradata_handler_t *range_list = &range_helper->exh;
+        int *map = (int *)lw_malloc_zero( (range_list->entry_count + 1) * sizeof(int) );
+        if( !map )
+            return -1;
+        for( int i = 0; i < range_list->entry_count; i++ )
+            if( (map[i] = merge_extradata_entry( &helper->exh, &range_list->entries[i] )) < 0 )
+            {
+                lw_free( map );
+                return -1;
+            }
+        for( uint32_t i = 0; i < range->packet_count + range->check_count; i++ )
+        {
+            lwindex_packet_t *packet = i < range->packet_count ? &range->packets[i] : &range->check[ i - range->packet_count ];
+            if( packet->pkt.stream_index != stream_index )
+                continue;
+            packet->stream          = stream;
+            packet->helper          = helper;
+            packet->extradata_index = map[ packet->extradata_index ];
+        }
+        lw_free( map );
+    }
+    return 0;
+}
+
+/* Check if two analyses of the same packet give the same record in the index file.
+ * Return 1 if so, otherwise 0. */
+static int match_index_range_packet
+(
+    const lwindex_packet_t *a,
+    const lwindex_packet_t *b
+)
+{
+    if( a->pkt.pos != b->pkt.pos
+     || a->pkt.pts != b->pkt.pts
+     || a->pkt.dts != b->pkt.dts
+     || (a->pkt.flags & AV_PKT_FLAG_KEY) != (b->pkt.flags & AV_PKT_FLAG_KEY)
+     || a->extradata_index != b->extradata_index )
+        return 0;
+    if( a->stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO )
+        return a->pict_type   == b->pict_type
+            && a->poc         == b->poc
+            && a->repeat_pict == b->repeat_pict
+            && a->field_info  == b->field_info
+            && a->recovery    == b->recovery
+            && a->invisible   == b->invisible;
+    return a->frame_length == b->frame_length;
+}
+
+/* Compare the first GOP of the range with the one analyzed by the preceding range with the states carried over.
+ * Return 0 if identical, otherwise -1. */
+static int verify_index_range
+(
+    const lwindex_range_t *prev,
+    const lwindex_range_t *range,
+    unsigned int           nb_streams
+)
+{
+    for( unsigned int stream_index = 0; stream_index < nb_streams; stream_index++ )
+    {
+        uint32_t k = 0;
+        for( uint32_t i = 0; i < range->packet_count; i++ )
+        {
+            const lwindex_packet_t *packet = &range->packets[i];
+            if( prev->check_end != INT64_MAX && packet->pkt.pos >= prev->check_end + LWINDEX_RANGE_OVERLAP )
+                break;
+            if( packet->pkt.stream_index != (int)stream_index || packet->pkt.pos >= prev->check_end )
+                continue;
+            while( k < prev->check_count && prev->check[k].pkt.stream_index != (int)stream_index )
+                ++k;
+            if( k == prev->check_count || !match_index_range_packet( &prev->check[k], packet ) )
+                return -1;
+            ++k;
+        }
+        while( k < prev->check_count && prev->check[k].pkt.stream_index != (int)stream_index )
+            ++k;
+        if( k < prev->check_count )
+            return -1;
+    }
+    return 0;
+}
+
+/* Wait for all the ranges analyzed with reporting the progress, and get ready to merge them.
+ * Return 0 on success, 1 if the results of the ranges are unusable, or -1 if aborted. */
+static int wait_for_index_ranges
+(
+    lwindex_pipeline_t   *pipeline,
+    progress_indicator_t *indicator,
+    progress_handler_t   *php,
+    const char           *message,
+    int64_t               filesize
+)
+{
+    int ret = 0;
+    lw_mutex_lock( pipeline->mutex );
+    while( 1 )
+    {
+        int     done      = 1;
+        int64_t processed = 0;
+        for( int i = 0; i < pipeline->number_of_ranges; i++ )
+        {
+            lwindex_range_t *range = &pipeline->ranges[i];
+            int64_t          end   = MIN( range->end, filesize );
+            if( range->error || range->delayed )
+                ret = 1;
+            done      &= range->done;
+            processed += range->done ? end - range->start : MAX( MIN( range->io_pos, end ) - range->start, 0 );
+        }
+        if( ret || done )
+            break;
+        uint64_t progress = pipeline->range_progress;
+        lw_mutex_unlock( pipeline->mutex );
+        if( indicator->update && indicator->update( php, message, (int)(100.0 * ((double)processed / filesize) + 0.5) ) )
+            ret = -1;
+        lw_mutex_lock( pipeline->mutex );
+        if( ret )
+            break;
+        while( progress == pipeline->range_progress )
+            lw_cond_wait( pipeline->range_cond, pipeline->mutex );
+    }
+    if( ret )
+    {
+        pipeline->abort = 1;
+        lw_cond_broadcast( pipeline->range_cond );
+    }
+    lw_mutex_unlock( pipeline->mutex );
+    if( ret )
+        return ret;
+    for( int i = 1; i < pipeline->number_of_ranges; i++ )
+        if( pipeline->ranges[i].indexer != pipeline->indexer
+         && rebase_index_range( pipeline, &pipeline->ranges[i] ) < 0 )
+            return 1;
+    /* Each non-empty range shall match the analysis by the preceding non-empty range. */
+    lwindex_range_t *prev = &pipeline->ranges[0];
+    for( int i = 1; i < pipeline->number_of_ranges; i++ )
+    {
+        lwindex_range_t *range = &pipeline->ranges[i];
+        if( range->sync_pos < 0 )
+            continue;
+        if( verify_index_range( prev, range, pipeline->format_ctx->nb_streams ) < 0 )
+            return 1;
+        prev = range;
+    }
+    return 0;
+}
+
+/* Index resumption
+ * When the source file has only grown since the binary index file was created, the packets before the second last
+ * keyframe of the sync video stream far enough from the old end of the file are taken from the old index file instead
+ * of demuxing them again, and the rest of the file is indexed as a byte range starting at that keyframe. The GOP up to
+ * the last such keyframe is indexed again and compared with the old records field by field as well as the boundaries
+ * of the byte range mode. If any of them differs, the file is indexed from the start. */
+typedef struct
+{
+    uint8_t *data;      /* the whole old index file */
+    size_t   data_size;
+    int      append;    /* 1 = append the selected streams to the old index file instead of resuming */
+} lwindex_resume_t;
+
+/* Convert the records of the stream before the resume point into the analyzed packets, and the ones up to the end of
+ * the verification into the packets to be compared.
+ * Return 0 on success, or -1 if the records are unusable. */
+static int replay_index_records
+(
+    lwindex_range_t                *range,
+    lwindex_range_t                *check_range,
+    const lwindex_resume_t         *resume,
+    const lwindex_binary_section_t *sections,
+    uint32_t                        section_count,
+    AVStream                       *stream,
+    int64_t                         resume_pos,
+    int64_t                         check_end
+)
+{
+    lwindex_helper_t *helper = get_index_helper( range->indexer, stream );
+    if( !helper || !helper->codec_ctx )
+        return -1;
+    enum AVMediaType codec_type = stream->codecpar->codec_type;
+    const lwindex_stream_info_t *info = get_binary_index_stream_info( resume->data, sections, section_count, stream->index );
+    const lwindex_binary_section_t *section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_EXTRADATA_LIST, stream->index, codec_type );
+    if( !info || import_binary_extradata_list( resume->data, section, &helper->exh, 0 ) < 0 )
+        return -1;
+    int64_t last_pos = 0;
+    for( uint32_t i = 0; i < section_count; i++ )
+    {
+        section = &sections[i];
+        if( section->stream_index != stream->index
+         || section->type != (codec_type == AVMEDIA_TYPE_VIDEO ? LWINDEX_SECTION_VIDEO_RECORDS : LWINDEX_SECTION_AUDIO_RECORDS) )
+            continue;
+        const uint8_t *data = resume->data + section->offset;
+        for( uint32_t j = 0; j < section->count; j++ )
+        {
+            lwindex_packet_t packet = { { 0 } };
+            AVPacket        *pkt    = &packet.pkt;
+            if( codec_type == AVMEDIA_TYPE_VIDEO )
+            {
+                const lwindex_video_record_t *record = &((const lwindex_video_record_t *)data)[j];
+                pkt->pos               = record->pos;
+                pkt->pts               = record->pts;
+                pkt->dts               = record->dts;
+                pkt->flags             = record->key ? AV_PKT_FLAG_KEY : 0;
+                packet.extradata_index = record->extradata_index;
+                packet.pict_type       = record->pict_type;
+                packet.poc             = record->poc;
+                packet.repeat_pict     = record->repeat_pict;
+                packet.field_info      = (lw_field_info_t)record->field_info;
+                packet.recovery        = record->recovery;
+            }
+            else
+            {
+                const lwindex_audio_record_t *record = &((const lwindex_audio_record_t *)data)[j];
+                pkt->pos               = record->pos;
+                pkt->pts               = record->pts;
+                pkt->dts               = record->dts;
+                packet.extradata_index = record->extradata_index;
+                packet.frame_length    = record->length;
+            }
+            if( pkt->pos >= check_end )
+                return 0;
+            int check = pkt->pos >= resume_pos;
+            if( packet.extradata_index < 0 || packet.extradata_index >= helper->exh.entry_count )
+                return -1;
+            /* Taking the properties of the extradata as the ones of the packet is enough to merge. */
+            const lwlibav_extradata_t *entry = &helper->exh.entries[ packet.extradata_index ];
+            pkt->stream_index = stream->index;
+            packet.stream     = stream;
+            packet.helper     = helper;
+            packet.io_pos     = pkt->pos >= 0 ? pkt->pos : last_pos;
+            packet.codec_id   = helper->codec_ctx->codec_id;
+            if( codec_type == AVMEDIA_TYPE_VIDEO )
+            {
+                packet.width_before_parsing  = entry->width;
+                packet.height_before_parsing = entry->height;
+                packet.colorspace            = (enum AVColorSpace)info->colorspace;
+                packet.width                 = entry->width;
+                packet.height                = entry->height;
+                packet.pix_fmt               = entry->pixel_format;
+            }
+            else
+            {
+                packet.bits_per_sample = entry->bits_per_sample;
+                packet.sample_rate     = entry->sample_rate;
+                packet.sample_fmt      = entry->sample_format;
+                if( entry->channel_layout )
+                    av_channel_layout_from_mask( &packet.ch_layout, entry->channel_layout );
+                else
+                    av_channel_layout_default( &packet.ch_layout, info->channels );
+            }
+            if( append_index_range_packet( check ? check_range : range, &packet, check ) < 0 )
+            {
+                av_channel_layout_uninit( &packet.ch_layout );
+                return -1;
+            }
+            if( check )
+                continue;
+            last_pos                   = packet.io_pos;
+            helper->exh.current_index = packet.extradata_index;
+        }
+    }
+    return 0;
+}
+
+/* Start to resume indexing from the old index file.
+ * Return 0 if started, 1 if not resumable, or -1 on error.
+ * Unless started, the caller shall close the pipeline and index the file from the start. */
+static int start_index_resume
+(
+    lwindex_pipeline_t     *pipeline,
+    const lwindex_resume_t *resume,
+    const char             *file_path,
+    AVFormatContext        *format_ctx,
+    lwindex_indexer_t      *indexer,
+    int                     audio_disabled,
+    int64_t                 filesize
+)
+{
+    const lwindex_binary_header_t  *header        = (const lwindex_binary_header_t *)resume->data;
+    const lwindex_binary_section_t *sections      = (const lwindex_binary_section_t *)(resume->data + header->section_table_offset);
+    uint32_t                        section_count = header->section_count;
+    if( filesize <= header->file_size || xxhash_file( file_path, header->file_size ) != header->file_hash )
+        return 1;
+    int sync_stream_index = find_index_sync_stream( format_ctx, indexer );
+    if( sync_stream_index < 0 )
+        return 1;
+    /* The streams must be identical to the ones when the old index file was created.
+     * Resume from the second last keyframe of the sync stream which is far enough from the old end of the file. */
+    int64_t resume_pos = -1;
+    int64_t check_end  = -1;
+    for( uint32_t i = 0; i < section_count; i++ )
+    {
+        const lwindex_binary_section_t *section = &sections[i];
+        if( section->type != LWINDEX_SECTION_VIDEO_RECORDS && section->type != LWINDEX_SECTION_AUDIO_RECORDS )
+            continue;
+        size_t record_size = section->type == LWINDEX_SECTION_VIDEO_RECORDS ? sizeof(lwindex_video_record_t) : sizeof(lwindex_audio_record_t);
+        if( section->stream_index < 0 || (unsigned int)section->stream_index >= format_ctx->nb_streams
+         || section->size / record_size < section->count )
+            return 1;
+        AVStream                    *stream = format_ctx->streams[ section->stream_index ];
+        const lwindex_stream_info_t *info   = get_binary_index_stream_info( resume->data, sections, section_count, section->stream_index );
+        lwindex_helper_t            *helper = get_index_helper( indexer, stream );
+        if( !helper )
+            return -1;
+        if( !info || !helper->codec_ctx
+         || stream->codecpar->codec_type != section->codec_type
+         || info->codec_id != helper->codec_ctx->codec_id )
+            return 1;
+        if( section->stream_index != sync_stream_index )
+            continue;
+        const lwindex_video_record_t *record = (const lwindex_video_record_t *)(resume->data + section->offset);
+        for( uint32_t j = 0; j < section->count; j++ )
+            if( record[j].key && record[j].pos > 0 && record[j].pos <= header->file_size - LWINDEX_RANGE_OVERLAP )
+            {
+                resume_pos = check_end;
+                check_end  = record[j].pos;
+            }
+    }
+    if( resume_pos <= 0 )
+        return 1;
+    pipeline->format_ctx        = format_ctx;
+    pipeline->indexer           = indexer;
+    pipeline->audio_disabled    = audio_disabled;
+    pipeline->abort             = 0;
+    pipeline->range_progress    = 0;
+    pipeline->sync_stream_index = sync_stream_index;
+    pipeline->ranges            = (lwindex_range_t *)lw_malloc_zero( 2 * sizeof(lwindex_range_t) );
+    if( !pipeline->ranges )
+        return -1;
+    pipeline->number_of_ranges = 2;
+    pipeline->mutex            = lw_mutex_create();
+    pipeline->range_cond       = lw_cond_create();
+    if( !pipeline->mutex || !pipeline->range_cond )
+        return -1;
+    /* The first range is replayed from the old index file. Each stream is merged in the order of file offsets. */
+    lwindex_range_t *streams = (lwindex_range_t *)lw_malloc_zero( format_ctx->nb_streams * sizeof(lwindex_range_t) );
+    uint32_t        *merged  = (uint32_t *)lw_malloc_zero( format_ctx->nb_streams * sizeof(uint32_t) );
+    if( !streams || !merged )
+    {
+        lw_free( streams );
+        lw_free( merged );
+        return -1;
+    }
+    lwindex_range_t *range = &pipeline->ranges[0];
+    range->pipeline      = pipeline;
+    range->format_ctx    = format_ctx;
+    range->indexer       = indexer;
+    range->end           = resume_pos;
+    range->sync_resolved = 1;
+    range->done          = 1;
+    range->check_end     = check_end;
+    int ret = 0;
+    for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+    {
+        streams[stream_index].indexer = indexer;
+        if( find_binary_index_section( sections, section_count, LWINDEX_SECTION_STREAM_INFO, stream_index, format_ctx->streams[stream_index]->codecpar->codec_type )
+         && replay_index_records( &streams[stream_index], range, resume, sections, section_count,
+                                  format_ctx->streams[stream_index], resume_pos, check_end ) < 0 )
+            ret = 1;
+    }
+    while( ret == 0 )
+    {
+        lwindex_packet_t *packet = NULL;
+        for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+            if( merged[stream_index] < streams[stream_index].packet_count
+             && (!packet || streams[stream_index].packets[ merged[stream_index] ].io_pos < packet->io_pos) )
+                packet = &streams[stream_index].packets[ merged[stream_index] ];
+        if( !packet )
+            break;
+        if( append_index_range_packet( range, packet, 0 ) < 0 )
+            ret = -1;
+        else
+            ++ merged[ packet->pkt.stream_index ];
+    }
+    for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+    {
+        for( uint32_t i = merged[stream_index]; i < streams[stream_index].packet_count; i++ )
+            av_channel_layout_uninit( &streams[stream_index].packets[i].ch_layout );
+        lw_free( streams[stream_index].packets );
+    }
+    lw_free( streams );
+    lw_free( merged );
+    if( ret != 0 )
+        return ret;
+    /* The second range is the rest of the file. */
+    range = &pipeline->ranges[1];
+    range->pipeline   = pipeline;
+    range->format_ctx = format_ctx;
+    range->indexer    = indexer;
+    range->start      = resume_pos;
+    range->end        = INT64_MAX;
+    range->check_end  = INT64_MAX;
+    if( av_seek_frame( format_ctx, -1, resume_pos, AVSEEK_FLAG_BYTE ) < 0 )
+        return 1;
+    range->thread = lw_thread_create( index_range_thread, range );
+    return range->thread ? 0 : -1;
+}
+
+static void close_index_pipeline
+(
+    lwindex_pipeline_t *pipeline
+)
+{
+    if( pipeline->demuxer )
+    {
+        lw_mutex_lock( pipeline->mutex );
+        pipeline->abort = 1;
+        lw_cond_signal( pipeline->demux_cond );
+        lw_mutex_unlock( pipeline->mutex );
+        lw_thread_join( pipeline->demuxer );
+        pipeline->demuxer = NULL;
+    }
+    for( int i = 0; i < pipeline->number_of_workers; i++ )
+    {
+        lwindex_worker_t *worker = pipeline->workers[i];
+        if( !worker )
+            continue;
+        lw_mutex_lock( pipeline->mutex );
+        worker->quit = 1;
+        lw_cond_signal( worker->cond );
+        lw_mutex_unlock( pipeline->mutex );
+        lw_thread_join( worker->thread );
+        lw_cond_destroy( worker->cond );
+        lw_free( worker );
+    }
+    lw_freep( &pipeline->workers );
+    pipeline->number_of_workers = 0;
+    close_index_ranges( pipeline );
+    /* Release the packets not merged. */
+    for( uint32_t i = 0; i < pipeline->capacity; i++ )
+    {
+        av_packet_unref( &pipeline->packets[i].pkt );
+        av_channel_layout_uninit( &pipeline->packets[i].ch_layout );
+    }
+    lw_freep( &pipeline->packets );
+    pipeline->capacity = 0;
+    pipeline->count    = 0;
+    lw_cond_destroy( pipeline->demux_cond );
+    lw_cond_destroy( pipeline->merge_cond );
+    lw_mutex_destroy( pipeline->mutex );
+    pipeline->demux_cond = NULL;
+    pipeline->merge_cond = NULL;
+    pipeline->mutex      = NULL;
+}
+
+static int open_index_pipeline
+(
+    lwindex_pipeline_t *pipeline,
+    AVFormatContext    *format_ctx,
+    lwindex_indexer_t  *indexer,
+    int                 audio_disabled,
+    int                 parallel
+)
+{
+    pipeline->format_ctx     = format_ctx;
+    pipeline->indexer        = indexer;
+    pipeline->audio_disabled = audio_disabled;
+    pipeline->eof            = 0;
+    pipeline->abort          = 0;
+    pipeline->error          = 0;
+    pipeline->capacity       = parallel ? LWINDEX_PIPELINE_DEPTH : 1;
+    pipeline->packets        = (lwindex_packet_t *)lw_malloc_zero( pipeline->capacity * sizeof(lwindex_packet_t) );
+    if( !pipeline->packets )
+        return -1;
+    if( !parallel )
+        return 0;
+    pipeline->mutex      = lw_mutex_create();
+    pipeline->demux_cond = lw_cond_create();
+    pipeline->merge_cond = lw_cond_create();
+    if( !pipeline->mutex || !pipeline->demux_cond || !pipeline->merge_cond )
+        return -1;
+    pipeline->demuxer = lw_thread_create( index_demuxer_thread, pipeline );
+    return pipeline->demuxer ? 0 : -1;
+}
+
+/* Get the next analyzed packet in the demuxed order.
+ * Return NULL if no more packets or on error. */
+static lwindex_packet_t *get_index_packet
+(
+    lwindex_pipeline_t *pipeline
+)
+{
+    if( pipeline->ranges )
+    {
+        /* Byte range mode: all the ranges have been analyzed already. */
+        while( pipeline->current_range < pipeline->number_of_ranges )
+        {
+            lwindex_range_t *range = &pipeline->ranges[ pipeline->current_range ];
+            if( pipeline->range_packet < range->packet_count )
+                return &range->packets[ pipeline->range_packet ++ ];
+            ++ pipeline->current_range;
+            pipeline->range_packet = 0;
+        }
+        return NULL;
+    }
+    if( !pipeline->demuxer )
+    {
+        /* Serial mode */
+        lwindex_packet_t *packet = &pipeline->packets[0];
+        int ret = pipeline->eof ? 0 : read_index_packet( pipeline->format_ctx, pipeline->indexer, pipeline->audio_disabled, packet );
+        if( ret <= 0 )
+        {
+            pipeline->eof   = 1;
+            pipeline->error = (ret < 0);
+            return NULL;
+        }
+        analyze_index_packet( packet->helper, packet );
+        return packet;
+    }
+    lwindex_packet_t *packet = NULL;
+    lw_mutex_lock( pipeline->mutex );
+    while( pipeline->count == 0 && !pipeline->eof )
+        lw_cond_wait( pipeline->merge_cond, pipeline->mutex );
+    if( pipeline->count > 0 )
+    {
+        packet = &pipeline->packets[ pipeline->head ];
+        while( !packet->done )
+            lw_cond_wait( pipeline->merge_cond, pipeline->mutex );
+    }
+    lw_mutex_unlock( pipeline->mutex );
+    return packet;
+}
+
+static void release_index_packet
+(
+    lwindex_pipeline_t *pipeline,
+    lwindex_packet_t   *packet
+)
+{
+    av_packet_unref( &packet->pkt );
+    av_channel_layout_uninit( &packet->ch_layout );
+    if( !pipeline->demuxer )
+        return;
+    lw_mutex_lock( pipeline->mutex );
+    pipeline->head = (pipeline->head + 1) % pipeline->capacity;
+    -- pipeline->count;
+    lw_cond_signal( pipeline->demux_cond );
+    lw_mutex_unlock( pipeline->mutex );
+}
+
+static int create_index
+(
+    lwlibav_file_handler_t         *lwhp,
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    lwlibav_audio_decode_handler_t *adhp,
+    lwlibav_audio_output_handler_t *aohp,
+    AVFormatContext                *format_ctx,
+    lwlibav_option_t               *opt,
+    progress_indicator_t           *indicator,
+    progress_handler_t             *php,
+    const lwindex_resume_t         *resume,
+    const uint8_t                  *selected
+)
+{
+    uint32_t video_info_count = 1 << 16;
+    uint32_t audio_info_count = 1 << 16;
+    video_frame_info_t *video_info = (video_frame_info_t *)malloc( video_info_count * sizeof(video_frame_info_t) );
+    if( !video_info )
+        return -1;
+    audio_frame_info_t *audio_info = (audio_frame_info_t *)malloc( audio_info_count * sizeof(audio_frame_info_t) );
+    if( !audio_info )
+    {
+        free( video_info );
+        return -1;
+    }
+    /*
+        # Structure of Libav reader index file
+        <LibavReaderIndexFile=17>
+        <InputFilePath>foobar.omo</InputFilePath>
+        <FileSize=1048576>
+        <FileLastModificationTime=000>
+        <FileHash=0x0123456789abcdef>
         <LibavReaderIndex=0x00000208,0,marumoska>
         <ActiveVideoStreamIndex>+0000000000</ActiveVideoStreamIndex>
         <ActiveAudioStreamIndex>-0000000001</ActiveAudioStreamIndex>
@@ -2121,18 +4468,28 @@ static int create_index
         ... binary string ...
         </ExtraDataList>
         </LibavReaderIndexFile>
+        The binary index file holds the same information in sections. See lwindex_binary_header_t.
      */
-    FILE *index = NULL;
+    FILE *index  = NULL;
+    int   append = resume && resume->append;
     if( opt->index_file_path )
-        index = !opt->no_create_index ? lw_fopen( opt->index_file_path, "wb" ) : NULL;
+        index = !opt->no_create_index ? open_index_file( opt->index_file_path, append ) : NULL;
     else if ( !opt->no_create_index )
     {
         char *index_path = create_lwi_path( opt );
-        index = lw_fopen( index_path, "wb" );
+        index = open_index_file( index_path, append );
         if ( !index )
             fprintf(stderr, "lsmas: unable to create index file %s\n", index_path);
         lw_free( index_path );
     }
+    /* Every write to the index file goes through the buffered output.
+     * The new sections are written to the end of the file when appending. */
+    lwindex_output_t output = { 0 };
+    if( index && ((append && lw_fseek( index, 0, SEEK_END )) || open_index_output( &output, index ) < 0) )
+    {
+        fclose( index );
+        index = NULL;
+    }
     if( !index && !opt->no_create_index )
     {
         free( video_info );
@@ -2147,12 +4504,17 @@ static int create_index
     vdhp->format       = format_ctx;
     adhp->format       = format_ctx;
     adhp->dv_in_avi    = !strcmp( lwhp->format_name, "avi" ) ? -1 : 0;
-    int32_t video_index_pos = 0;
-    int32_t audio_index_pos = 0;
+    int64_t video_index_pos = 0;
+    int64_t audio_index_pos = 0;
+    /* 'text' is used for the text index file only, and 'writer' for the binary one only. */
+    lwindex_output_t       *text          = index && opt->text_index ? &output : NULL;
+    lwindex_binary_writer_t writer        = { 0 };
+    lwindex_binary_header_t binary_header = { { 0 } };
+    writer.output = index && !opt->text_index ? &output : NULL;
 #ifdef _WIN32
     wchar_t* wname = NULL;
 #endif // _WIN32
-    if( index )
+    if( text )
     {
         /* Write Index file header. */
         uint8_t lwindex_version[4] =
@@ -2162,10 +4524,43 @@ static int create_index
             (LWINDEX_VERSION >>  8) & 0xff,
              LWINDEX_VERSION        & 0xff
         };
-        fprintf( index, "<LSMASHWorksIndexVersion=%" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8 ">\n",
-                 lwindex_version[0], lwindex_version[1], lwindex_version[2], lwindex_version[3] );
-        fprintf( index, "<LibavReaderIndexFile=%d>\n", LWINDEX_INDEX_FILE_VERSION );
-        fprintf( index, "<InputFilePath>%s</InputFilePath>\n", lwhp->file_path );
+        print_index( text, "<LSMASHWorksIndexVersion=%" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8 ">\n",
+                     lwindex_version[0], lwindex_version[1], lwindex_version[2], lwindex_version[3] );
+        print_index( text, "<LibavReaderIndexFile=%d>\n", LWINDEX_INDEX_FILE_VERSION );
+        print_index_string( text, "<InputFilePath>" );
+        print_index_string( text, lwhp->file_path );
+        print_index_string( text, "</InputFilePath>\n" );
+    }
+    if( index && append )
+    {
+        /* Keep the old sections except for the stream selection and the streams to be indexed again,
+         * and append the new ones to the end of the file.
+         * The old header and section table stay valid until the new ones are completed. */
+        const lwindex_binary_header_t  *header   = (const lwindex_binary_header_t *)resume->data;
+        const lwindex_binary_section_t *sections = (const lwindex_binary_section_t *)(resume->data + header->section_table_offset);
+        binary_header   = *header;
+        writer.sections = (lwindex_binary_section_t *)malloc( (header->section_count + 1) * sizeof(lwindex_binary_section_t) );
+        if( !writer.sections )
+        {
+            close_index_output( &output );
+            free( video_info );
+            free( audio_info );
+            fclose( index );
+            return -1;
+        }
+        for( uint32_t i = 0; i < header->section_count; i++ )
+        {
+            if( sections[i].type == LWINDEX_SECTION_STREAM_SELECTION
+             || (sections[i].stream_index >= 0 && (unsigned int)sections[i].stream_index < format_ctx->nb_streams
+              && selected[ sections[i].stream_index ]) )
+                continue;
+            if( sections[i].type == LWINDEX_SECTION_VIDEO_RECORDS || sections[i].type == LWINDEX_SECTION_AUDIO_RECORDS )
+                writer.packet_count = MAX( writer.packet_count, sections[i].sequence + sections[i].count );
+            writer.sections[ writer.section_count ++ ] = sections[i];
+        }
+    }
+    else if( index )
+    {
 #ifdef _WIN32
         struct _stat64 file_stat;
         if( lw_string_to_wchar( CP_UTF8, lwhp->file_path, &wname ) )
@@ -2176,18 +4571,50 @@ static int create_index
         struct stat file_stat;
         stat( lwhp->file_path, &file_stat );
 #endif
-        fprintf( index, "<FileSize=%" PRId64 ">\n", file_stat.st_size );
-        fprintf( index, "<FileLastModificationTime=%" PRId64 ">\n", file_stat.st_mtime );
-        fprintf( index, "<FileHash=0x%016" PRIx64 ">\n", xxhash_file( lwhp->file_path, file_stat.st_size ) );
-        fprintf( index, "<LibavReaderIndex=0x%08x,%d,%s>\n", lwhp->format_flags, lwhp->raw_demuxer, lwhp->format_name );
-        video_index_pos = ftell( index );
-        fprintf( index, "<ActiveVideoStreamIndex>%+011d</ActiveVideoStreamIndex>\n", -1 );
-        audio_index_pos = ftell( index );
-        fprintf( index, "<ActiveAudioStreamIndex>%+011d</ActiveAudioStreamIndex>\n", adhp->stream_index );
-        fprintf(index, "<DefaultAudioStreamIndex>%+011d</DefaultAudioStreamIndex>\n", -1);
-    }
-    AVPacket pkt = { 0 };
-    int       pix_fmt_investigated  = 0;
+        uint64_t file_hash = xxhash_file( lwhp->file_path, file_stat.st_size );
+        if( text )
+        {
+            print_index( text, "<FileSize=%" PRId64 ">\n", (int64_t)file_stat.st_size );
+            print_index( text, "<FileLastModificationTime=%" PRId64 ">\n", (int64_t)file_stat.st_mtime );
+            print_index( text, "<FileHash=0x%016" PRIx64 ">\n", file_hash );
+            print_index( text, "<LibavReaderIndex=0x%08x,%d,%s>\n", lwhp->format_flags, lwhp->raw_demuxer, lwhp->format_name );
+            video_index_pos = tell_index_output( text );
+            print_index( text, "<ActiveVideoStreamIndex>%+011d</ActiveVideoStreamIndex>\n", -1 );
+            audio_index_pos = tell_index_output( text );
+            print_index( text, "<ActiveAudioStreamIndex>%+011d</ActiveAudioStreamIndex>\n", adhp->stream_index );
+            print_index( text, "<DefaultAudioStreamIndex>%+011d</DefaultAudioStreamIndex>\n", -1 );
+        }
+        else
+        {
+            /* The magic is written when completing the index file so that an incomplete one is never accepted. */
+            binary_header.byte_order                  = LWINDEX_BINARY_BYTE_ORDER;
+            binary_header.lwindex_version             = LWINDEX_VERSION;
+            binary_header.index_file_version          = LWINDEX_INDEX_FILE_VERSION;
+            binary_header.format_flags                = lwhp->format_flags;
+            binary_header.file_size                   = file_stat.st_size;
+            binary_header.file_last_modification_time = file_stat.st_mtime;
+            binary_header.file_hash                   = file_hash;
+            binary_header.raw_demuxer                 = lwhp->raw_demuxer;
+            binary_header.active_video_index          = -1;
+            binary_header.active_audio_index          = adhp->stream_index;
+            binary_header.default_audio_index         = -1;
+            snprintf( binary_header.format_name, sizeof(binary_header.format_name), "%s", lwhp->format_name );
+            write_index_output( &output, &binary_header, sizeof(lwindex_binary_header_t) );
+            if( write_binary_index_section( &writer, LWINDEX_SECTION_INPUT_FILE_PATH, -1, AVMEDIA_TYPE_UNKNOWN,
+                                            strlen( lwhp->file_path ), 0, lwhp->file_path, strlen( lwhp->file_path ) ) < 0 )
+            {
+#ifdef _WIN32
+                lw_free(wname);
+#endif // _WIN32
+                close_index_output( &output );
+                free( writer.sections );
+                free( video_info );
+                free( audio_info );
+                fclose( index );
+                return -1;
+            }
+        }
+    }
     int       video_resolution      = 0;
     int       is_attached_pic       = 0;
     uint32_t  video_sample_count    = 0;
@@ -2211,197 +4638,186 @@ static int create_index
         vdhp->prefer_hw_decoder,        /* prefer_video_hw_decoder */
         adhp->preferred_decoder_names,  /* preferred_audio_decoder_names */
         lwhp->threads,                  /* thread_count */
-        lwhp->format_name               /* format_name */
+        lwhp->format_name,              /* format_name */
+        selected                        /* selected */
     };
+    lwindex_pipeline_t pipeline = { 0 };
     for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
     {
         AVStream *stream = format_ctx->streams[stream_index];
         enum AVMediaType codec_type = stream->codecpar->codec_type;
-        if( codec_type != AVMEDIA_TYPE_VIDEO
-         && (codec_type != AVMEDIA_TYPE_AUDIO || adhp->stream_index == -2) )
+        if( (codec_type != AVMEDIA_TYPE_VIDEO
+          && (codec_type != AVMEDIA_TYPE_AUDIO || adhp->stream_index == -2))
+         || !is_selected_index_stream( &indexer, stream_index ) )
+        {
+            stream->discard = AVDISCARD_ALL;
             continue;
+        }
         lwindex_helper_t *helper = get_index_helper( &indexer, stream );
         if( !helper || !helper->codec_ctx )
             continue;
         AVCodecContext *pkt_ctx = helper->codec_ctx;
-        print_index( index, "<StreamInfo=%d,%d>\n", stream_index, codec_type );
+        lwindex_stream_info_t info = { 0 };
+        info.codec_type = codec_type;
+        info.codec_id   = pkt_ctx->codec_id;
+        info.time_base  = stream->time_base;
+        print_index( text, "<StreamInfo=%d,%d>\n", stream_index, codec_type );
         if( codec_type == AVMEDIA_TYPE_VIDEO )
-            print_index( index, "Codec=%d,TimeBase=%d/%d,Width=%d,Height=%d,Format=%s,ColorSpace=%d\n",
+        {
+            const char *pix_fmt = av_get_pix_fmt_name( pkt_ctx->pix_fmt );
+            print_index( text, "Codec=%d,TimeBase=%d/%d,Width=%d,Height=%d,Format=%s,ColorSpace=%d\n",
                          pkt_ctx->codec_id, stream->time_base.num, stream->time_base.den,
                          pkt_ctx->width, pkt_ctx->height,
-                         av_get_pix_fmt_name( pkt_ctx->pix_fmt ) ? av_get_pix_fmt_name( pkt_ctx->pix_fmt ) : "none",
+                         pix_fmt ? pix_fmt : "none",
                          pkt_ctx->colorspace );
+            info.width      = pkt_ctx->width;
+            info.height     = pkt_ctx->height;
+            info.colorspace = pkt_ctx->colorspace;
+            snprintf( info.fmt, sizeof(info.fmt), "%s", pix_fmt ? pix_fmt : "none" );
+        }
         else
         {
             if (pkt_ctx->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
                 av_channel_layout_default(&pkt_ctx->ch_layout, pkt_ctx->ch_layout.nb_channels);
-            int bits_per_sample = pkt_ctx->bits_per_raw_sample   > 0 ? pkt_ctx->bits_per_raw_sample
-                                : pkt_ctx->bits_per_coded_sample > 0 ? pkt_ctx->bits_per_coded_sample
-                                : av_get_bytes_per_sample( pkt_ctx->sample_fmt ) << 3;
-            print_index( index, "Codec=%d,TimeBase=%d/%d,Channels=%d:0x%" PRIx64 ",Rate=%d,Format=%s,BPS=%d\n",
+            int bits_per_sample = get_audio_bits_per_sample( pkt_ctx );
+            const char *sample_fmt = av_get_sample_fmt_name( pkt_ctx->sample_fmt );
+            print_index( text, "Codec=%d,TimeBase=%d/%d,Channels=%d:0x%" PRIx64 ",Rate=%d,Format=%s,BPS=%d\n",
                          pkt_ctx->codec_id, stream->time_base.num, stream->time_base.den,
                          pkt_ctx->ch_layout.nb_channels, pkt_ctx->ch_layout.u.mask, pkt_ctx->sample_rate,
-                         av_get_sample_fmt_name( pkt_ctx->sample_fmt ) ? av_get_sample_fmt_name( pkt_ctx->sample_fmt ) : "none",
+                         sample_fmt ? sample_fmt : "none",
                          bits_per_sample );
+            info.channels        = pkt_ctx->ch_layout.nb_channels;
+            info.layout          = pkt_ctx->ch_layout.u.mask;
+            info.sample_rate     = pkt_ctx->sample_rate;
+            info.bits_per_sample = bits_per_sample;
+            snprintf( info.fmt, sizeof(info.fmt), "%s", sample_fmt ? sample_fmt : "none" );
         }
-        print_index( index, "</StreamInfo>\n" );
+        print_index( text, "</StreamInfo>\n" );
+        if( write_binary_index_section( &writer, LWINDEX_SECTION_STREAM_INFO, stream_index, codec_type,
+                                        1, 0, &info, sizeof(lwindex_stream_info_t) ) < 0 )
+            goto fail_index;
     }
-    while( read_av_frame( format_ctx, &pkt ) >= 0 )
+    /* Demux and analyze packets on the other threads if possible, and merge the results here in the demuxed order. */
+    int parallel = opt->parallel_index && lw_get_cpu_count() > 1;
+    int ret      = 1;
+    int restart  = 0;
+    if( resume && !append && filesize > 0 )
     {
-        AVStream          *stream   = format_ctx->streams[ pkt.stream_index ];
-        AVCodecParameters *codecpar = stream->codecpar;
-        if( codecpar->codec_type != AVMEDIA_TYPE_VIDEO
-         && codecpar->codec_type != AVMEDIA_TYPE_AUDIO )
-        {
-            stream->discard = AVDISCARD_ALL;
-            continue;
-        }
-        if( codecpar->codec_id == AV_CODEC_ID_NONE )
-        {
-            stream->discard = AVDISCARD_ALL;
-            continue;
-        }
-        lwindex_helper_t *helper = get_index_helper( &indexer, stream );
-        if( !helper )
-        {
-            av_packet_unref( &pkt );
+        restart = 1;
+        ret     = start_index_resume( &pipeline, resume, lwhp->file_path, format_ctx, &indexer, adhp->stream_index == -2, filesize );
+    }
+    else if( parallel && opt->range_index && filesize > 0 && !strcmp( lwhp->format_name, "mpegts" ) )
+        ret = open_index_ranges( &pipeline, lwhp->file_path, format_ctx, &indexer, adhp->stream_index == -2, filesize, opt );
+    if( ret == 0 )
+    {
+        restart = 1;
+        ret     = wait_for_index_ranges( &pipeline, indicator, php, index ? "Creating Index file" : "Parsing input file", filesize );
+    }
+    if( ret != 0 )
+    {
+        close_index_pipeline( &pipeline );
+        if( ret < 0 )
             goto fail_index;
-        }
-        AVCodecContext *pkt_ctx = helper->codec_ctx;
-        if( !pkt_ctx )
+        if( restart )
         {
-            stream->discard = AVDISCARD_ALL;
-            continue;
+            /* Index the file from the start again. */
+            cleanup_index_helpers( &indexer, format_ctx );
+            if( av_seek_frame( format_ctx, -1, 0, AVSEEK_FLAG_BYTE ) < 0 )
+                goto fail_index;
         }
-        int extradata_index = append_extradata_if_new( helper, pkt_ctx, &pkt );
-        if( extradata_index < 0 )
-        {
-            av_packet_unref( &pkt );
+        if( open_index_pipeline( &pipeline, format_ctx, &indexer, adhp->stream_index == -2, parallel ) < 0 )
             goto fail_index;
-        }
+    }
+    lwindex_packet_t *packet;
+    while( (packet = get_index_packet( &pipeline )) )
+    {
+        if( packet->error )
+            goto fail_index;
+        AVPacket         *pkt             = &packet->pkt;
+        AVStream         *stream          = packet->stream;
+        lwindex_helper_t *helper          = packet->helper;
+        AVCodecContext   *pkt_ctx         = helper->codec_ctx;
+        int               extradata_index = packet->extradata_index;
         if( pkt_ctx->codec_type == AVMEDIA_TYPE_VIDEO )
         {
-            if( pkt_ctx->pix_fmt == AV_PIX_FMT_NONE
-             || (pkt_ctx->codec->wrapper_name && !pix_fmt_investigated) )
-            {
-                investigate_pix_fmt_by_decoding( pkt_ctx, &pkt, vdhp->frame_buffer );
-                pix_fmt_investigated = 1;
-            }
             int dv_in_avi_init = 0;
             if( adhp->dv_in_avi    == -1
              && vdhp->stream_index == -1
-             && pkt_ctx->codec_id  == AV_CODEC_ID_DVVIDEO
+             && packet->codec_id   == AV_CODEC_ID_DVVIDEO
              && opt->force_audio   == 0 )
             {
                 dv_in_avi_init     = 1;
                 adhp->dv_in_avi    = 1;
-                vdhp->stream_index = pkt.stream_index;
+                vdhp->stream_index = pkt->stream_index;
             }
             /* Replace lower resolution stream with higher. Override attached picture. */
-            int higher_priority = ((pkt_ctx->width * pkt_ctx->height > video_resolution)
+            int higher_priority = ((packet->width_before_parsing * packet->height_before_parsing > video_resolution)
                                 || (is_attached_pic && !(stream->disposition & AV_DISPOSITION_ATTACHED_PIC)));
             if( dv_in_avi_init
-             || (!opt->force_video && (vdhp->stream_index == -1 || (pkt.stream_index != vdhp->stream_index && higher_priority)))
-             || (opt->force_video && vdhp->stream_index == -1 && pkt.stream_index == opt->force_video_index) )
+             || (!opt->force_video && (vdhp->stream_index == -1 || (pkt->stream_index != vdhp->stream_index && higher_priority)))
+             || (opt->force_video && vdhp->stream_index == -1 && pkt->stream_index == opt->force_video_index) )
             {
                 /* Update active video stream. */
-                if( index )
+                if( text )
                 {
-                    int32_t current_pos = ftell( index );
-                    fseek( index, video_index_pos, SEEK_SET );
-                    fprintf( index, "<ActiveVideoStreamIndex>%+011d</ActiveVideoStreamIndex>\n", pkt.stream_index );
-                    fseek( index, current_pos, SEEK_SET );
+                    char line[LWINDEX_OUTPUT_MAX_PATCH];
+                    int  length = snprintf( line, sizeof(line), "<ActiveVideoStreamIndex>%+011d</ActiveVideoStreamIndex>\n", pkt->stream_index );
+                    patch_index_output( text, video_index_pos, line, length );
                 }
+                binary_header.active_video_index = pkt->stream_index;
                 memset( video_info, 0, (video_sample_count + 1) * sizeof(video_frame_info_t) );
                 vdhp->ctx                = pkt_ctx;
-                vdhp->codec_id           = pkt_ctx->codec_id;
-                vdhp->stream_index       = pkt.stream_index;
-                video_resolution         = pkt_ctx->width * pkt_ctx->height;
+                vdhp->codec_id           = packet->codec_id;
+                vdhp->stream_index       = pkt->stream_index;
+                video_resolution         = packet->width_before_parsing * packet->height_before_parsing;
                 is_attached_pic          = !!(stream->disposition & AV_DISPOSITION_ATTACHED_PIC);
                 video_sample_count       = 0;
                 last_keyframe_pts        = AV_NOPTS_VALUE;
-                vdhp->max_width          = pkt_ctx->width;
-                vdhp->max_height         = pkt_ctx->height;
-                vdhp->initial_width      = pkt_ctx->width;
-                vdhp->initial_height     = pkt_ctx->height;
-                vdhp->initial_colorspace = pkt_ctx->colorspace;
-            }
-            /* Get picture type. */
-            int pict_type = get_picture_type( helper, pkt_ctx, &pkt );
-            if( pict_type < 0 )
-            {
-                av_packet_unref( &pkt );
-                goto fail_index;
-            }
-            /* Get Picture Order Count. */
-            int poc = helper->parser_ctx ? helper->parser_ctx->output_picture_number : 0;
-            /* Get field information. */
-            int             repeat_pict;
-            lw_field_info_t field_info;
-            if( helper->parser_ctx )
-            {
-                if( helper->parser_ctx->picture_structure == AV_PICTURE_STRUCTURE_TOP_FIELD
-                 || helper->parser_ctx->picture_structure == AV_PICTURE_STRUCTURE_BOTTOM_FIELD )
-                {
-                    /* field coded picture */
-                    if( helper->parser_ctx->picture_structure == AV_PICTURE_STRUCTURE_TOP_FIELD )
-                        field_info = LW_FIELD_INFO_TOP;
-                    else
-                        field_info = LW_FIELD_INFO_BOTTOM;
-                    repeat_pict = helper->parser_ctx->repeat_pict;
-                }
-                else
-                {
-                    /* frame coded picture */
-                    if( helper->parser_ctx->field_order == AV_FIELD_TT
-                     || helper->parser_ctx->field_order == AV_FIELD_TB )
-                        field_info = LW_FIELD_INFO_TOP;
-                    else if( helper->parser_ctx->field_order == AV_FIELD_BB
-                          || helper->parser_ctx->field_order == AV_FIELD_BT )
-                        field_info = LW_FIELD_INFO_BOTTOM;
-                    else
-                        field_info = helper->last_field_info;
-                    if( get_ticks_per_frame( pkt_ctx ) == 2 && helper->parser_ctx->repeat_pict != 0 )
-                        repeat_pict = helper->parser_ctx->repeat_pict;
-                    else
-                        repeat_pict = 2 * helper->parser_ctx->repeat_pict + 1;
-                }
-                helper->last_field_info = field_info;
-            }
-            else
-            {
-                repeat_pict = 1;
-                field_info = helper->last_field_info;
+                vdhp->max_width          = packet->width_before_parsing;
+                vdhp->max_height         = packet->height_before_parsing;
+                vdhp->initial_width      = packet->width_before_parsing;
+                vdhp->initial_height     = packet->height_before_parsing;
+                vdhp->initial_colorspace = packet->colorspace;
             }
+            int             pict_type   = packet->pict_type;
+            int             poc         = packet->poc;
+            int             repeat_pict = packet->repeat_pict;
+            lw_field_info_t field_info  = packet->field_info;
+            int             recovery    = packet->recovery;
             /* Set video frame info if this stream is active. */
-            if( pkt.stream_index == vdhp->stream_index )
+            if( pkt->stream_index == vdhp->stream_index )
             {
                 ++video_sample_count;
                 video_frame_info_t *info = &video_info[video_sample_count];
                 memset( info, 0, sizeof(video_frame_info_t) );
-                info->pts             = pkt.pts;
-                info->dts             = pkt.dts;
-                info->file_offset     = pkt.pos;
+                info->pts             = pkt->pts;
+                info->dts             = pkt->dts;
+                info->file_offset     = pkt->pos;
                 info->sample_number   = video_sample_count;
                 info->extradata_index = extradata_index;
                 info->pict_type       = pict_type;
                 info->poc             = poc;
                 info->repeat_pict     = repeat_pict;
                 info->field_info      = field_info;
-                if( pkt.pts != AV_NOPTS_VALUE && last_keyframe_pts != AV_NOPTS_VALUE && pkt.pts < last_keyframe_pts )
+                if( pkt->pts != AV_NOPTS_VALUE && last_keyframe_pts != AV_NOPTS_VALUE && pkt->pts < last_keyframe_pts )
                     info->flags |= LW_VFRAME_FLAG_LEADING;
-                if( pkt.flags & AV_PKT_FLAG_KEY )
+                if( pkt->flags & AV_PKT_FLAG_KEY )
                 {
                     /* For the present, treat this frame as a keyframe. */
                     info->flags |= LW_VFRAME_FLAG_KEY;
-                    last_keyframe_pts = pkt.pts;
+                    last_keyframe_pts = pkt->pts;
                     ++video_keyframe_count;
                 }
-                if( repeat_pict == 0 && field_info == LW_FIELD_INFO_UNKNOWN && pkt_ctx->pix_fmt == AV_PIX_FMT_NONE
-                 && (pkt_ctx->codec_id == AV_CODEC_ID_H264 || pkt_ctx->codec_id == AV_CODEC_ID_HEVC)
-                 && (pkt_ctx->width == 0 || pkt_ctx->height == 0) )
+                else if( recovery >= 0 )
+                {
+                    info->flags              |= LW_VFRAME_FLAG_RECOVERY;
+                    info->recovery_frame_count = recovery;
+                }
+                if( repeat_pict == 0 && field_info == LW_FIELD_INFO_UNKNOWN && packet->pix_fmt == AV_PIX_FMT_NONE
+                 && (packet->codec_id == AV_CODEC_ID_H264 || packet->codec_id == AV_CODEC_ID_HEVC)
+                 && (packet->width == 0 || packet->height == 0) )
                     info->flags |= LW_VFRAME_FLAG_CORRUPT;
-                if( pkt_ctx->codec_id == AV_CODEC_ID_VP8 && check_vp8_invisible_frame( &pkt ) )
+                if( packet->invisible )
                 {
                     /* VPx invisible altref frame. */
                     info->pts         = AV_NOPTS_VALUE;
@@ -2410,9 +4826,9 @@ static int create_index
                     info->flags      |= LW_VFRAME_FLAG_INVISIBLE;
                     ++invisible_count;
                     /* backward compatible hack for the index */
-                    pkt.pts = AV_NOPTS_VALUE;
-                    pkt.dts = AV_NOPTS_VALUE;
-                    pkt.pos = -1;
+                    pkt->pts = AV_NOPTS_VALUE;
+                    pkt->dts = AV_NOPTS_VALUE;
+                    pkt->pos = -1;
                 }
                 if( vdhp->time_base.num == 0 || vdhp->time_base.den == 0 )
                 {
@@ -2420,70 +4836,53 @@ static int create_index
                     vdhp->time_base.den = stream->time_base.den;
                 }
                 /* Set maximum resolution. */
-                if( vdhp->max_width  < pkt_ctx->width )
-                    vdhp->max_width  = pkt_ctx->width;
-                if( vdhp->max_height < pkt_ctx->height )
-                    vdhp->max_height = pkt_ctx->height;
+                if( vdhp->max_width  < packet->width )
+                    vdhp->max_width  = packet->width;
+                if( vdhp->max_height < packet->height )
+                    vdhp->max_height = packet->height;
                 if( video_sample_count + 1 == video_info_count )
                 {
                     video_info_count <<= 1;
                     video_frame_info_t *temp = (video_frame_info_t *)realloc( video_info, video_info_count * sizeof(video_frame_info_t) );
                     if( !temp )
-                    {
-                        av_packet_unref( &pkt );
                         goto fail_index;
-                    }
                     video_info = temp;
                 }
             }
-            /* Set width, height and pixel_format for the current extradata. */
-            if( extradata_index >= 0 )
-            {
-                lwlibav_extradata_handler_t *list = &helper->exh;
-                lwlibav_extradata_t *entry = &list->entries[ list->current_index ];
-                if( entry->width < pkt_ctx->width )
-                    entry->width = pkt_ctx->width;
-                if( entry->height < pkt_ctx->height )
-                    entry->height = pkt_ctx->height;
-                if( entry->pixel_format == AV_PIX_FMT_NONE )
-                    entry->pixel_format = pkt_ctx->pix_fmt;
-                if( entry->bits_per_sample == 0 )
-                    entry->bits_per_sample = pkt_ctx->bits_per_coded_sample;
-                if( entry->codec_id == AV_CODEC_ID_NONE )
-                    entry->codec_id = pkt_ctx->codec_id;
-                if( entry->codec_tag == 0 )
-                    entry->codec_tag = pkt_ctx->codec_tag;
-            }
             /* Write a video packet info to the index file. */
-            print_index( index, "Index=%d,POS=%" PRId64 ",PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=%d\n"
-                         "Key=%d,Pic=%d,POC=%d,Repeat=%d,Field=%d\n",
-                         pkt.stream_index, pkt.pos, pkt.pts, pkt.dts, extradata_index,
-                         !!(pkt.flags & AV_PKT_FLAG_KEY), pict_type, poc, repeat_pict, field_info );
+            lwindex_video_record_t record =
+            {
+                pkt->pos, pkt->pts, pkt->dts, extradata_index,
+                !!(pkt->flags & AV_PKT_FLAG_KEY), pict_type, poc, repeat_pict, field_info, recovery, 0
+            };
+            if( text )
+                write_video_record_text( text, pkt->stream_index, &record );
+            if( append_binary_index_record( &writer, helper, pkt->stream_index, AVMEDIA_TYPE_VIDEO, &record ) < 0 )
+                goto fail_index;
         }
-        else if( adhp->stream_index != -2 )
+        else
         {
-            if( adhp->stream_index == -1 && (!opt->force_audio || (opt->force_audio && pkt.stream_index == opt->force_audio_index)) )
+            if( adhp->stream_index == -1 && (!opt->force_audio || (opt->force_audio && pkt->stream_index == opt->force_audio_index)) )
             {
                 /* Update active audio stream. */
-                if( index )
+                if( text )
                 {
-                    int32_t current_pos = ftell( index );
-                    fseek( index, audio_index_pos, SEEK_SET );
-                    fprintf( index, "<ActiveAudioStreamIndex>%+011d</ActiveAudioStreamIndex>\n", pkt.stream_index );
-                    fprintf(index, "<DefaultAudioStreamIndex>%+011d</DefaultAudioStreamIndex>\n", pkt.stream_index);
-                    fseek( index, current_pos, SEEK_SET );
+                    char line[LWINDEX_OUTPUT_MAX_PATCH];
+                    int  length = snprintf( line, sizeof(line), "<ActiveAudioStreamIndex>%+011d</ActiveAudioStreamIndex>\n"
+                                                                "<DefaultAudioStreamIndex>%+011d</DefaultAudioStreamIndex>\n",
+                                            pkt->stream_index, pkt->stream_index );
+                    patch_index_output( text, audio_index_pos, line, length );
                 }
+                binary_header.active_audio_index  = pkt->stream_index;
+                binary_header.default_audio_index = pkt->stream_index;
                 adhp->ctx          = pkt_ctx;
-                adhp->codec_id     = pkt_ctx->codec_id;
-                adhp->stream_index = pkt.stream_index;
-            }
-            int bits_per_sample = pkt_ctx->bits_per_raw_sample   > 0 ? pkt_ctx->bits_per_raw_sample
-                                : pkt_ctx->bits_per_coded_sample > 0 ? pkt_ctx->bits_per_coded_sample
-                                : av_get_bytes_per_sample( pkt_ctx->sample_fmt ) << 3;
-            /* Get audio frame_length. */
-            int frame_length = get_audio_frame_length( helper, pkt_ctx, &pkt );
+                adhp->codec_id     = packet->codec_id;
+                adhp->stream_index = pkt->stream_index;
+            }
+            int bits_per_sample = packet->bits_per_sample;
+            int frame_length    = packet->frame_length;
             /* Set audio frame info if this stream is active. */
-            if( pkt.stream_index == adhp->stream_index )
+            if( pkt->stream_index == adhp->stream_index )
             {
                 if( frame_length != -1 )
                     audio_duration += frame_length;
@@ -2493,35 +4892,32 @@ static int create_index
                     ++audio_sample_count;
                     audio_frame_info_t *info = &audio_info[audio_sample_count];
                     memset( info, 0, sizeof(audio_frame_info_t) );
-                    info->pts             = pkt.pts;
-                    info->dts             = pkt.dts;
-                    info->file_offset     = pkt.pos;
+                    info->pts             = pkt->pts;
+                    info->dts             = pkt->dts;
+                    info->file_offset     = pkt->pos;
                     info->sample_number   = audio_sample_count;
                     info->extradata_index = extradata_index;
-                    info->sample_rate     = pkt_ctx->sample_rate;
-                    if( frame_length != -1 && audio_sample_count > helper->delay_count )
+                    info->sample_rate     = packet->sample_rate;
+                    if( frame_length != -1 && audio_sample_count > packet->delay_count )
                     {
-                        uint32_t audio_frame_number = audio_sample_count - helper->delay_count;
+                        uint32_t audio_frame_number = audio_sample_count - packet->delay_count;
                         audio_info[audio_frame_number].length = frame_length;
                         if( audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length )
                             constant_frame_length = 0;
                     }
                     if( audio_sample_rate == 0 )
-                        audio_sample_rate = pkt_ctx->sample_rate;
+                        audio_sample_rate = packet->sample_rate;
                     if( audio_sample_count + 1 == audio_info_count )
                     {
                         audio_info_count <<= 1;
                         audio_frame_info_t *temp = (audio_frame_info_t *)realloc( audio_info, audio_info_count * sizeof(audio_frame_info_t) );
                         if( !temp )
-                        {
-                            av_packet_unref( &pkt );
                             goto fail_index;
-                        }
                         audio_info = temp;
                     }
-                    if (pkt_ctx->ch_layout.nb_channels > aohp->output_channel_layout.nb_channels)
-                        av_channel_layout_copy(&aohp->output_channel_layout, &pkt_ctx->ch_layout);
-                    aohp->output_sample_format   = select_better_sample_format( aohp->output_sample_format, pkt_ctx->sample_fmt );
+                    if (packet->ch_layout.nb_channels > aohp->output_channel_layout.nb_channels)
+                        av_channel_layout_copy(&aohp->output_channel_layout, &packet->ch_layout);
+                    aohp->output_sample_format   = select_better_sample_format( aohp->output_sample_format, packet->sample_fmt );
                     aohp->output_sample_rate     = MAX( aohp->output_sample_rate, audio_sample_rate );
                     aohp->output_bits_per_sample = MAX( aohp->output_bits_per_sample, bits_per_sample );
                 }
@@ -2531,64 +4927,46 @@ static int create_index
                     adhp->time_base.den = stream->time_base.den;
                 }
             }
-            /* Set channel_layout, sample_rate, sample_format and bits_per_sample for the current extradata. */
-            if( extradata_index >= 0 )
-            {
-                lwlibav_extradata_handler_t *list = &helper->exh;
-                lwlibav_extradata_t *entry = &list->entries[ list->current_index ];
-                if( entry->channel_layout == 0 )
-                    entry->channel_layout = pkt_ctx->ch_layout.u.mask;
-                if( entry->sample_rate == 0 )
-                    entry->sample_rate = pkt_ctx->sample_rate;
-                if( entry->sample_format == AV_SAMPLE_FMT_NONE )
-                    entry->sample_format = pkt_ctx->sample_fmt;
-                if( entry->bits_per_sample == 0 )
-                    entry->bits_per_sample = bits_per_sample;
-                if( entry->block_align == 0 )
-                    entry->block_align = pkt_ctx->block_align;
-                if( entry->codec_id == AV_CODEC_ID_NONE )
-                    entry->codec_id = pkt_ctx->codec_id;
-                if( entry->codec_tag == 0 )
-                    entry->codec_tag = pkt_ctx->codec_tag;
-            }
             /* Write an audio packet info to the index file. */
-            print_index( index, "Index=%d,POS=%" PRId64 ",PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=%d\n"
-                         "Length=%d\n",
-                         pkt.stream_index, pkt.pos, pkt.pts, pkt.dts, extradata_index,
-                         frame_length );
+            lwindex_audio_record_t record = { pkt->pos, pkt->pts, pkt->dts, extradata_index, frame_length };
+            if( text )
+                write_audio_record_text( text, pkt->stream_index, &record );
+            if( append_binary_index_record( &writer, helper, pkt->stream_index, AVMEDIA_TYPE_AUDIO, &record ) < 0 )
+                goto fail_index;
         }
-        else
-            stream->discard = AVDISCARD_ALL;
         if( indicator->update )
         {
             /* Update progress dialog. */
             int percent = 0;
             if( first_dts == AV_NOPTS_VALUE )
-                first_dts = pkt.dts;
-            if( filesize > 0 && format_ctx->pb->pos > 0 )
+                first_dts = pkt->dts;
+            if( filesize > 0 && packet->io_pos > 0 )
                 /* Update if I/O context's file offset is valid. */
-                percent = (int)(100.0 * ((double)format_ctx->pb->pos / filesize) + 0.5);
-            else if( format_ctx->duration > 0 && first_dts != AV_NOPTS_VALUE && pkt.dts != AV_NOPTS_VALUE )
+                percent = (int)(100.0 * ((double)packet->io_pos / filesize) + 0.5);
+            else if( format_ctx->duration > 0 && first_dts != AV_NOPTS_VALUE && pkt->dts != AV_NOPTS_VALUE )
                 /* Update if packet's DTS is valid. */
                 percent = (int)(100.0
-                             * (pkt.dts - first_dts) * (stream->time_base.num / (double)stream->time_base.den)
+                             * (pkt->dts - first_dts) * (stream->time_base.num / (double)stream->time_base.den)
                              / (format_ctx->duration / AV_TIME_BASE)
                              + 0.5);
             const char *message = index ? "Creating Index file" : "Parsing input file";
-            int abort = indicator->update( php, message, percent );
-            av_packet_unref( &pkt );
-            if( abort )
+            if( indicator->update( php, message, percent ) )
                 goto fail_index;
         }
-        else
-            av_packet_unref( &pkt );
+        release_index_packet( &pipeline, packet );
     }
+    if( pipeline.error )
+        goto fail_index;
+    close_index_pipeline( &pipeline );
     /* Handle delay derived from the audio decoder. */
     for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
     {
-        AVStream         *stream = format_ctx->streams[stream_index];
+        AVStream *stream = format_ctx->streams[stream_index];
+        if( stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO || adhp->stream_index == -2
+         || !is_selected_index_stream( &indexer, stream_index ) )
+            continue;
         lwindex_helper_t *helper = get_index_helper( &indexer, stream );
-        if( !helper || !helper->codec_ctx || !helper->decode || stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO || adhp->stream_index == -2 )
+        if( !helper || !helper->codec_ctx || !helper->decode )
             continue;
         AVCodecContext *pkt_ctx = helper->codec_ctx;
         /* Flush if decoding is delayed. */
@@ -2610,13 +4988,23 @@ static int create_index
                      && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length )
                         constant_frame_length = 0;
                 }
-                print_index( index, "Index=%d,POS=-1,PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=-1\n"
-                             "Length=%d\n",
-                             stream_index, AV_NOPTS_VALUE, AV_NOPTS_VALUE, frame_length );
+                lwindex_audio_record_t record = { -1, AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1, frame_length };
+                if( text )
+                    write_audio_record_text( text, stream_index, &record );
+                if( append_binary_index_record( &writer, helper, stream_index, AVMEDIA_TYPE_AUDIO, &record ) < 0 )
+                    goto fail_index;
             }
         }
     }
-    print_index( index, "</LibavReaderIndex>\n" );
+    print_index( text, "</LibavReaderIndex>\n" );
+    /* Write out the packet records remaining in the chunks. */
+    for( int stream_index = 0; stream_index < indexer.number_of_helpers; stream_index++ )
+    {
+        lwindex_helper_t *helper = indexer.helpers[stream_index];
+        if( helper
+         && flush_binary_index_records( &writer, helper, stream_index, format_ctx->streams[stream_index]->codecpar->codec_type ) < 0 )
+            goto fail_index;
+    }
     /* Deallocate video frame info if no active video stream. */
     if( vdhp->stream_index < 0 )
         lw_freep( &video_info );
@@ -2654,10 +5042,18 @@ static int create_index
     for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
     {
         AVStream *stream = format_ctx->streams[stream_index];
+        if( !is_selected_index_stream( &indexer, stream_index ) )
+            continue;
         if( stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO
          || (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && adhp->stream_index != -2) )
-            print_index( index, "<StreamDuration=%d,%d>%" PRId64 "</StreamDuration>\n",
+        {
+            print_index( text, "<StreamDuration=%d,%d>%" PRId64 "</StreamDuration>\n",
                          stream_index, stream->codecpar->codec_type, stream->duration );
+            int64_t duration = stream->duration;
+            if( write_binary_index_section( &writer, LWINDEX_SECTION_STREAM_DURATION, stream_index, stream->codecpar->codec_type,
+                                            1, 0, &duration, sizeof(int64_t) ) < 0 )
+                goto fail_index;
+        }
     }
     if( !strcmp( lwhp->format_name, "asf" ) )
     {
@@ -2715,12 +5111,16 @@ static int create_index
     for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
     {
         AVStream *stream = format_ctx->streams[stream_index];
+        if( !is_selected_index_stream( &indexer, stream_index ) )
+            continue;
         if( stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO )
         {
-            print_index( index, "<StreamIndexEntries=%d,%d,%d>\n", stream_index, AVMEDIA_TYPE_VIDEO, avformat_index_get_entries_count(stream) );
+            print_index( text, "<StreamIndexEntries=%d,%d,%d>\n", stream_index, AVMEDIA_TYPE_VIDEO, avformat_index_get_entries_count(stream) );
+            if( write_binary_index_entries( &writer, stream ) < 0 )
+                goto fail_index;
             if( vdhp->stream_index != stream_index )
                 for( int i = 0; i < avformat_index_get_entries_count(stream); i++ )
-                    write_av_index_entry( index, avformat_index_get_entry(stream, i) );
+                    write_av_index_entry( text, avformat_index_get_entry(stream, i) );
             else if(avformat_index_get_entries_count(stream) > 0 )
             {
                 vdhp->index_entries = (AVIndexEntry *)av_malloc( avformat_index_get_entries_count(stream) * sizeof(AVIndexEntry) );
@@ -2730,18 +5130,20 @@ static int create_index
                 {
                     const AVIndexEntry *ie = avformat_index_get_entry(stream, i);
                     vdhp->index_entries[i] = *ie;
-                    write_av_index_entry( index, ie );
+                    write_av_index_entry( text, ie );
                 }
                 vdhp->index_entries_count = avformat_index_get_entries_count(stream);
             }
-            print_index( index, "</StreamIndexEntries>\n" );
+            print_index( text, "</StreamIndexEntries>\n" );
         }
         else if( stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && adhp->stream_index != -2 )
         {
-            print_index( index, "<StreamIndexEntries=%d,%d,%d>\n", stream_index, AVMEDIA_TYPE_AUDIO, avformat_index_get_entries_count(stream) );
+            print_index( text, "<StreamIndexEntries=%d,%d,%d>\n", stream_index, AVMEDIA_TYPE_AUDIO, avformat_index_get_entries_count(stream) );
+            if( write_binary_index_entries( &writer, stream ) < 0 )
+                goto fail_index;
             if( adhp->stream_index != stream_index )
                 for( int i = 0; i < avformat_index_get_entries_count(stream); i++ )
-                    write_av_index_entry( index, avformat_index_get_entry(stream, i) );
+                    write_av_index_entry( text, avformat_index_get_entry(stream, i) );
             else if(avformat_index_get_entries_count(stream) > 0 )
             {
                 /* Audio stream in matroska container requires index_entries for seeking.
@@ -2753,17 +5155,19 @@ static int create_index
                 {
                     const AVIndexEntry *ie = avformat_index_get_entry(stream, i);
                     adhp->index_entries[i] = *ie;
-                    write_av_index_entry( index, ie );
+                    write_av_index_entry( text, ie );
                 }
                 adhp->index_entries_count = avformat_index_get_entries_count(stream);
             }
-            print_index( index, "</StreamIndexEntries>\n" );
+            print_index( text, "</StreamIndexEntries>\n" );
         }
     }
     for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
     {
         AVStream          *stream   = format_ctx->streams[stream_index];
         AVCodecParameters *codecpar = stream->codecpar;
+        if( !is_selected_index_stream( &indexer, stream_index ) )
+            continue;
         if( codecpar->codec_type == AVMEDIA_TYPE_VIDEO
          || (codecpar->codec_type == AVMEDIA_TYPE_AUDIO && adhp->stream_index != -2) )
         {
@@ -2771,15 +5175,17 @@ static int create_index
             if( !helper || !helper->codec_ctx )
                 continue;
             lwlibav_extradata_handler_t *list = &helper->exh;
-            void (*write_av_extradata)( FILE *, lwlibav_extradata_t * ) = codecpar->codec_type == AVMEDIA_TYPE_VIDEO
-                                                                        ? write_video_extradata
-                                                                        : write_audio_extradata;
-            print_index( index, "<ExtraDataList=%d,%d,%d>\n", stream_index, codecpar->codec_type, list->entry_count );
+            void (*write_av_extradata)( lwindex_output_t *, lwlibav_extradata_t * ) = codecpar->codec_type == AVMEDIA_TYPE_VIDEO
+                                                                                    ? write_video_extradata
+                                                                                    : write_audio_extradata;
+            print_index( text, "<ExtraDataList=%d,%d,%d>\n", stream_index, codecpar->codec_type, list->entry_count );
+            if( write_binary_extradata_list( &writer, stream, list ) < 0 )
+                goto fail_index;
             if( (codecpar->codec_type == AVMEDIA_TYPE_VIDEO && stream_index == vdhp->stream_index)
              || (codecpar->codec_type == AVMEDIA_TYPE_AUDIO && stream_index == adhp->stream_index) )
             {
                 for( int i = 0; i < list->entry_count; i++ )
-                    write_av_extradata( index, &list->entries[i] );
+                    write_av_extradata( text, &list->entries[i] );
                 lwlibav_extradata_handler_t *exhp = codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? &vdhp->exh : &adhp->exh;
                 exhp->entry_count   = list->entry_count;
                 exhp->entries       = list->entries;
@@ -2792,11 +5198,28 @@ static int create_index
             }
             else
                 for( int i = 0; i < list->entry_count; i++ )
-                    write_av_extradata( index, &list->entries[i] );
-            print_index( index, "</ExtraDataList>\n" );
+                    write_av_extradata( text, &list->entries[i] );
+            print_index( text, "</ExtraDataList>\n" );
+        }
+    }
+    if( append )
+    {
+        /* The active streams of the old index file stay active. */
+        const lwindex_binary_header_t *header = (const lwindex_binary_header_t *)resume->data;
+        if( header->active_video_index >= 0 )
+            binary_header.active_video_index = header->active_video_index;
+        if( header->active_audio_index >= 0 )
+        {
+            binary_header.active_audio_index  = header->active_audio_index;
+            binary_header.default_audio_index = header->default_audio_index;
         }
     }
-    print_index( index, "</LibavReaderIndexFile>\n" );
+    if( selected && write_binary_stream_selection( &writer, format_ctx, selected, append ? resume->data : NULL ) < 0 )
+        goto fail_index;
+    print_index( text, "</LibavReaderIndexFile>\n" );
+    if( finish_binary_index( &writer, &binary_header ) < 0
+     || (index && close_index_output( &output ) < 0) )
+        goto fail_index;
     if( vdhp->stream_index >= 0 )
     {
         vdhp->keyframe_list = (uint8_t *)lw_malloc_zero( (video_sample_count + 1) * sizeof(uint8_t) );
@@ -2827,6 +5250,7 @@ static int create_index
     lw_free(wname);
 #endif // _WIN32
     cleanup_index_helpers( &indexer, format_ctx );
+    free( writer.sections );
     if( index )
         fclose( index );
     if( indicator->close )
@@ -2838,7 +5262,11 @@ fail_index:
 #ifdef _WIN32
     lw_free(wname);
 #endif // _WIN32
+    /* Stop the threads before cleaning up the index helpers used by them. */
+    close_index_pipeline( &pipeline );
     cleanup_index_helpers( &indexer, format_ctx );
+    close_index_output( &output );
+    free( writer.sections );
     free( video_info );
     free( audio_info );
     if( index )
@@ -2850,21 +5278,286 @@ fail_index:
     return -1;
 }
 
-static int parse_index
+static int import_video_record
+(
+    lwindex_parser_t               *parser,
+    lwlibav_video_decode_handler_t *vdhp,
+    const lwindex_stream_info_t    *stream_info,
+    const lwindex_video_record_t   *record
+)
+{
+    int         codec_id   = stream_info->codec_id;
+    int         width      = stream_info->width;
+    int         height     = stream_info->height;
+    const char *pix_fmt    = stream_info->fmt;
+    int         colorspace = stream_info->colorspace;
+    if( vdhp->codec_id == AV_CODEC_ID_NONE )
+        vdhp->codec_id = (enum AVCodecID)codec_id;
+    if( (record->key | width | height) || record->pict_type == -1 || colorspace != AVCOL_SPC_NB )
+    {
+        if( vdhp->initial_width == 0 || vdhp->initial_height == 0 )
+        {
+            vdhp->initial_width  = width;
+            vdhp->initial_height = height;
+            vdhp->max_width      = width;
+            vdhp->max_height     = height;
+        }
+        else
+        {
+            if( vdhp->max_width  < width )
+                vdhp->max_width  = width;
+            if( vdhp->max_height < width )
+                vdhp->max_height = height;
+        }
+        if( vdhp->initial_pix_fmt == AV_PIX_FMT_NONE )
+            vdhp->initial_pix_fmt = av_get_pix_fmt( pix_fmt );
+        if( vdhp->initial_colorspace == AVCOL_SPC_NB )
+            vdhp->initial_colorspace = (enum AVColorSpace)colorspace;
+        if( vdhp->time_base.num == 0 || vdhp->time_base.den == 0 )
+        {
+            vdhp->time_base.num = stream_info->time_base.num;
+            vdhp->time_base.den = stream_info->time_base.den;
+        }
+        ++ parser->video_sample_count;
+        video_frame_info_t *info = &parser->video_info[ parser->video_sample_count ];
+        memset( info, 0, sizeof(video_frame_info_t) );
+        info->pts             = record->pts;
+        info->dts             = record->dts;
+        info->file_offset     = record->pos;
+        info->sample_number   = parser->video_sample_count;
+        info->extradata_index = record->extradata_index;
+        info->pict_type       = record->pict_type;
+        info->poc             = record->poc;
+        info->repeat_pict     = record->repeat_pict;
+        info->field_info      = (lw_field_info_t)record->field_info;
+        if( record->pts != AV_NOPTS_VALUE && parser->last_keyframe_pts != AV_NOPTS_VALUE && record->pts < parser->last_keyframe_pts )
+            info->flags |= LW_VFRAME_FLAG_LEADING;
+        if( record->key )
+        {
+            info->flags |= LW_VFRAME_FLAG_KEY;
+            parser->last_keyframe_pts = record->pts;
+        }
+        else if( record->recovery >= 0 )
+        {
+            info->flags              |= LW_VFRAME_FLAG_RECOVERY;
+            info->recovery_frame_count = record->recovery;
+        }
+        if( record->repeat_pict == 0 && record->field_info == LW_FIELD_INFO_UNKNOWN
+         && av_get_pix_fmt( pix_fmt ) == AV_PIX_FMT_NONE
+         && ((enum AVCodecID)codec_id == AV_CODEC_ID_H264 || (enum AVCodecID)codec_id == AV_CODEC_ID_HEVC)
+         && (width == 0 || height == 0) )
+            info->flags |= LW_VFRAME_FLAG_CORRUPT;
+        if( (enum AVCodecID)codec_id == AV_CODEC_ID_VP8
+         && record->pts == AV_NOPTS_VALUE && record->dts == AV_NOPTS_VALUE && record->pos == -1 )
+        {
+            /* VPx invisible altref frame. */
+            info->flags |= LW_VFRAME_FLAG_INVISIBLE;
+            ++ parser->invisible_count;
+        }
+    }
+    if( parser->video_sample_count + 1 == parser->video_info_count )
+    {
+        parser->video_info_count <<= 1;
+        video_frame_info_t *temp = (video_frame_info_t *)realloc( parser->video_info, parser->video_info_count * sizeof(video_frame_info_t) );
+        if( !temp )
+            return -1;
+        parser->video_info = temp;
+    }
+    return 0;
+}
+
+static int import_audio_record
+(
+    lwindex_parser_t               *parser,
+    lwlibav_audio_decode_handler_t *adhp,
+    lwlibav_audio_output_handler_t *aohp,
+    const lwindex_stream_info_t    *stream_info,
+    const lwindex_audio_record_t   *record
+)
+{
+    uint64_t    layout          = stream_info->layout;
+    int         channels        = stream_info->channels;
+    int         sample_rate     = stream_info->sample_rate;
+    const char *sample_fmt      = stream_info->fmt;
+    int         bits_per_sample = stream_info->bits_per_sample;
+    int         frame_length    = record->length;
+    audio_frame_info_t *audio_info = parser->audio_info;
+    if( adhp->codec_id == AV_CODEC_ID_NONE )
+        adhp->codec_id = (enum AVCodecID)stream_info->codec_id;
+    if( (channels | layout | sample_rate | bits_per_sample) && record->extradata_index != -1 && parser->audio_duration <= INT32_MAX )
+    {
+        if( parser->audio_sample_rate == 0 )
+            parser->audio_sample_rate = sample_rate;
+        if( adhp->time_base.num == 0 || adhp->time_base.den == 0 )
+        {
+            adhp->time_base.num = stream_info->time_base.num;
+            adhp->time_base.den = stream_info->time_base.den;
+        }
+        if (channels > aohp->output_channel_layout.nb_channels)
+            av_channel_layout_from_mask(&aohp->output_channel_layout, layout);
+        aohp->output_sample_format   = select_better_sample_format( aohp->output_sample_format,
+                                                                    av_get_sample_fmt( sample_fmt ) );
+        aohp->output_sample_rate     = MAX( aohp->output_sample_rate, parser->audio_sample_rate );
+        aohp->output_bits_per_sample = MAX( aohp->output_bits_per_sample, bits_per_sample );
+        ++ parser->audio_sample_count;
+        audio_frame_info_t *info = &audio_info[ parser->audio_sample_count ];
+        memset( info, 0, sizeof(audio_frame_info_t) );
+        info->pts             = record->pts;
+        info->dts             = record->dts;
+        info->file_offset     = record->pos;
+        info->sample_number   = parser->audio_sample_count;
+        info->extradata_index = record->extradata_index;
+        info->sample_rate     = sample_rate;
+    }
+    else
+        for( uint32_t i = 1; i <= adhp->exh.delay_count; i++ )
+        {
+            uint32_t audio_frame_number = parser->audio_sample_count - adhp->exh.delay_count + i;
+            if( audio_frame_number > parser->audio_sample_count )
+                return -1;
+            audio_info[audio_frame_number].length = frame_length;
+            if( audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length )
+                parser->constant_frame_length = 0;
+            parser->audio_duration += frame_length;
+        }
+    if( parser->audio_sample_count + 1 == parser->audio_info_count )
+    {
+        parser->audio_info_count <<= 1;
+        audio_frame_info_t *temp = (audio_frame_info_t *)realloc( audio_info, parser->audio_info_count * sizeof(audio_frame_info_t) );
+        if( !temp )
+            return -1;
+        parser->audio_info = audio_info = temp;
+    }
+    if( frame_length == -1 )
+        ++ adhp->exh.delay_count;
+    else if( parser->audio_sample_count > adhp->exh.delay_count )
+    {
+        uint32_t audio_frame_number = parser->audio_sample_count - adhp->exh.delay_count;
+        audio_info[audio_frame_number].length = frame_length;
+        if( audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length )
+            parser->constant_frame_length = 0;
+        parser->audio_duration += frame_length;
+    }
+    return 0;
+}
+
+/* Set up the decode handlers by the frame info obtained from the index file. */
+static int finish_index_parsing
 (
+    lwindex_parser_t               *parser,
     lwlibav_file_handler_t         *lwhp,
     lwlibav_video_decode_handler_t *vdhp,
     lwlibav_video_output_handler_t *vohp,
     lwlibav_audio_decode_handler_t *adhp,
     lwlibav_audio_output_handler_t *aohp,
     lwlibav_option_t               *opt,
-    FILE                           *index
+    int                             active_video_index
 )
 {
-    /* Test to open the target file. */
-    char file_path[512] = { 0 };
-    if( fscanf( index, "<InputFilePath>%[^\n<]</InputFilePath>\n", file_path ) != 1 )
+    video_frame_info_t *video_info = parser->video_info;
+    audio_frame_info_t *audio_info = parser->audio_info;
+    if( vdhp->stream_index >= 0 )
+    {
+        vdhp->keyframe_list = (uint8_t *)lw_malloc_zero( (parser->video_sample_count + 1) * sizeof(uint8_t) );
+        if( !vdhp->keyframe_list )
+            return -1;
+        vdhp->frame_list  = video_info;
+        vdhp->frame_count = parser->video_sample_count;
+        if( decide_video_seek_method( lwhp, vdhp, parser->video_sample_count ) )
+            return -1;
+        /* Compute the stream duration. */
+        compute_stream_duration( lwhp, vdhp, vdhp->stream_duration );
+        /* Create the repeat control info. */
+        create_video_frame_order_list( vdhp, vohp, opt );
+        /* Exclude invisible frames from the output handler. */
+        create_video_visible_frame_list( vdhp, vohp, parser->invisible_count );
+    }
+    if( adhp->stream_index >= 0 )
+    {
+        uint32_t audio_sample_count = parser->audio_sample_count;
+        if( adhp->dv_in_avi == 1 && adhp->index_entries_count == 0 )
+        {
+            /* DV in AVI Type-1 */
+            audio_sample_count = MIN( parser->video_sample_count, audio_sample_count );
+            for( uint32_t i = 0; i <= audio_sample_count; i++ )
+            {
+                audio_info[i].keyframe        = !!(video_info[i].flags & LW_VFRAME_FLAG_KEY);
+                audio_info[i].sample_number   = video_info[i].sample_number;
+                audio_info[i].pts             = video_info[i].pts;
+                audio_info[i].dts             = video_info[i].dts;
+                audio_info[i].file_offset     = video_info[i].file_offset;
+                audio_info[i].extradata_index = video_info[i].extradata_index;
+            }
+        }
+        else
+        {
+            if( adhp->dv_in_avi == 1 && ((!opt->force_video && active_video_index == -1) || (opt->force_video && opt->force_video_index == -1)) )
+            {
+                /* Disable DV video stream. */
+                disable_video_stream( vdhp );
+                parser->video_info = NULL;
+            }
+            adhp->dv_in_avi = 0;
+        }
+        adhp->frame_list   = audio_info;
+        adhp->frame_count  = audio_sample_count;
+        adhp->frame_length = parser->constant_frame_length ? audio_info[1].length : 0;
+        decide_audio_seek_method( lwhp, adhp, audio_sample_count );
+        if( opt->av_sync && vdhp->stream_index >= 0 )
+            lwhp->av_gap = calculate_av_gap( vdhp, vohp, adhp, parser->audio_sample_rate );
+    }
+    return 0;
+}
+
+static int check_file_stat
+(
+    const char *file_path,
+    int64_t     file_size,
+    int64_t     file_last_modification_time,
+    uint64_t    file_hash,
+    unsigned    file_hash_32
+)
+{
+#ifdef _WIN32
+    wchar_t *wname = NULL;
+    struct _stat64 file_stat;
+    int ret;
+    if( lw_string_to_wchar( CP_UTF8, file_path, &wname ) )
+        ret = _wstat64( wname, &file_stat );
+    else
+        ret = _stat64( file_path, &file_stat );
+    lw_free( wname );
+    if( ret )
+        return -1;
+#else
+    struct stat file_stat;
+    if( stat( file_path, &file_stat ) )
+        return -1;
+#endif
+    if( file_size != file_stat.st_size )
         return -1;
+    if( file_last_modification_time != file_stat.st_mtime )
+    {
+        // Also check hashsum
+        if( ( !file_hash
+             || file_hash != xxhash_file( file_path, file_stat.st_size ) )
+         &&
+            ( !file_hash_32
+             || file_hash_32 != xxhash32_file( file_path, file_stat.st_size ) ) )
+            return -1;
+    }
+    return 0;
+}
+
+/* Set the file path of the source from the one recorded in the index file
+ * if the index file itself is specified as the source. */
+static int set_source_file_path
+(
+    lwlibav_file_handler_t *lwhp,
+    lwlibav_option_t       *opt,
+    const char             *file_path
+)
+{
     size_t file_path_length = strlen( opt->file_path );
     const char *ext = file_path_length >= 5 ? &opt->file_path[file_path_length - 4] : NULL;
     if( ext && !strncmp( ext, ".lwi", strlen( ".lwi" ) ) )
@@ -2886,6 +5579,50 @@ static int parse_index
             return -1;
         memcpy( lwhp->file_path, opt->file_path, file_path_length );
     }
+    return 0;
+}
+
+static void cleanup_index_parser
+(
+    lwindex_parser_t               *parser,
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_audio_decode_handler_t *adhp
+)
+{
+    vdhp->frame_list = NULL;
+    adhp->frame_list = NULL;
+    lw_freep( &parser->video_info );
+    lw_freep( &parser->audio_info );
+    /* Nothing may refer to the image of the binary index file which is going to be released. */
+    vdhp->mapped_index_entries = NULL;
+    adhp->mapped_index_entries = NULL;
+    lwlibav_extradata_handler_t *exh[2] = { &vdhp->exh, &adhp->exh };
+    for( int i = 0; i < 2; i++ )
+        if( exh[i]->mapped )
+        {
+            lw_freep( &exh[i]->entries );
+            exh[i]->entry_count = 0;
+            exh[i]->mapped      = 0;
+        }
+}
+
+static int parse_index
+(
+    lwlibav_file_handler_t         *lwhp,
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    lwlibav_audio_decode_handler_t *adhp,
+    lwlibav_audio_output_handler_t *aohp,
+    lwlibav_option_t               *opt,
+    FILE                           *index
+)
+{
+    /* Test to open the target file. */
+    char file_path[512] = { 0 };
+    if( fscanf( index, "<InputFilePath>%[^\n<]</InputFilePath>\n", file_path ) != 1 )
+        return -1;
+    if( set_source_file_path( lwhp, opt, file_path ) < 0 )
+        return -1;
     /* Parse the index file. */
     int64_t file_size;
     int64_t file_last_modification_time;
@@ -2895,48 +5632,17 @@ static int parse_index
     int active_video_index;
     int active_audio_index;
     int default_audio;
-#ifdef _WIN32
-    wchar_t *wname = NULL;
-    struct _stat64 file_stat;
-    if( lw_string_to_wchar( CP_UTF8, lwhp->file_path, &wname ) )
-    {
-        if (_wstat64(wname, &file_stat))
-        {
-            lw_free(wname);
-            return -1;
-        }
-    }
-    else
-    {
-        if( _stat64( lwhp->file_path, &file_stat ) )
-            return -1;
-    }
-#else
-    struct stat file_stat;
-    if( stat( lwhp->file_path, &file_stat ) )
-        return -1;
-#endif
     if( fscanf( index, "<FileSize=%" SCNd64 ">\n", &file_size ) != 1
      || fscanf( index, "<FileLastModificationTime=%" SCNd64 ">\n", &file_last_modification_time ) != 1 )
         return -1;
-    if( file_size != file_stat.st_size )
-        return -1;
     int32_t pos = ftell( index );
     if( fscanf( index, "<FileHash=0x%" SCNx64 ">\n", &file_hash ) != 1 )
         fseek( index, pos, SEEK_SET);
     pos = ftell( index );
     if( fscanf( index, "<FileHash=0x%x>\n", &file_hash_32 ) != 1 )
         fseek( index, pos, SEEK_SET);
-    if( file_last_modification_time != file_stat.st_mtime )
-    {
-        // Also check hashsum
-        if( ( !file_hash
-             || file_hash != xxhash_file( lwhp->file_path, file_stat.st_size ) )
-         &&
-            ( !file_hash_32
-             || file_hash_32 != xxhash32_file( lwhp->file_path, file_stat.st_size ) ) )
-            return -1;
-    }
+    if( check_file_stat( lwhp->file_path, file_size, file_last_modification_time, file_hash, file_hash_32 ) < 0 )
+        return -1;
     if( fscanf( index, "<LibavReaderIndex=0x%x,%d,%[^>]>\n",
                 (unsigned int *)&lwhp->format_flags, &lwhp->raw_demuxer, format_name ) != 3 )
         return -1;
@@ -2955,31 +5661,27 @@ static int parse_index
         case -1:
         {
             if (default_audio != active_audio_index)
-            {
-#ifdef _WIN32
-                lw_free(wname);
-#endif // _WIN32
                 return -1;
-            }
         }
         case -2: adhp->stream_index = active_audio_index; break;
         default: adhp->stream_index = opt->force_audio_index; break;
     }
-    uint32_t video_info_count = 1 << 16;
-    uint32_t audio_info_count = 1 << 16;
-    video_frame_info_t *video_info = NULL;
-    audio_frame_info_t *audio_info = NULL;
+    lwindex_parser_t parser = { 0 };
+    parser.video_info_count      = 1 << 16;
+    parser.audio_info_count      = 1 << 16;
+    parser.last_keyframe_pts     = AV_NOPTS_VALUE;
+    parser.constant_frame_length = 1;
     lwindex_stream_info_t *stream_info = NULL;
     if( vdhp->stream_index >= 0 )
     {
-        video_info = (video_frame_info_t *)malloc( video_info_count * sizeof(video_frame_info_t) );
-        if( !video_info )
+        parser.video_info = (video_frame_info_t *)malloc( parser.video_info_count * sizeof(video_frame_info_t) );
+        if( !parser.video_info )
             goto fail_parsing;
     }
     if( adhp->stream_index >= 0 )
     {
-        audio_info = (audio_frame_info_t *)malloc( audio_info_count * sizeof(audio_frame_info_t) );
-        if( !audio_info )
+        parser.audio_info = (audio_frame_info_t *)malloc( parser.audio_info_count * sizeof(audio_frame_info_t) );
+        if( !parser.audio_info )
             goto fail_parsing;
     }
     if( active_audio_index == -2 && opt->force_audio_index != -2 )
@@ -2989,13 +5691,6 @@ static int parse_index
     vdhp->initial_pix_fmt      = AV_PIX_FMT_NONE;
     vdhp->initial_colorspace   = AVCOL_SPC_NB;
     aohp->output_sample_format = AV_SAMPLE_FMT_NONE;
-    uint32_t video_sample_count    = 0;
-    uint32_t invisible_count       = 0;
-    int64_t  last_keyframe_pts     = AV_NOPTS_VALUE;
-    uint32_t audio_sample_count    = 0;
-    int      audio_sample_rate     = 0;
-    int      constant_frame_length = 1;
-    uint64_t audio_duration        = 0;
     char buf[1024];
     if( !fgets( buf, sizeof(buf), index ) )
         goto fail_parsing;
@@ -3044,9 +5739,8 @@ static int parse_index
             goto fail_parsing;
         if( !fgets( buf, sizeof(buf), index ) )
             goto fail_parsing;
-        int        codec_type = stream_info[stream_index].codec_type;
-        int        codec_id   = stream_info[stream_index].codec_id;
-        AVRational time_base  = stream_info[stream_index].time_base;
+        int codec_type = stream_info[stream_index].codec_type;
+        int codec_id   = stream_info[stream_index].codec_id;
         if( codec_type == AVMEDIA_TYPE_VIDEO )
         {
             if( adhp->dv_in_avi == -1 && codec_id == AV_CODEC_ID_DVVIDEO && !opt->force_audio )
@@ -3054,172 +5748,48 @@ static int parse_index
                 adhp->dv_in_avi = 1;
                 if( vdhp->stream_index == -1 )
                 {
-                    vdhp->stream_index = stream_index;
-                    video_info = (video_frame_info_t *)malloc( video_info_count * sizeof(video_frame_info_t) );
-                    if( !video_info )
-                        goto fail_parsing;
-                }
-            }
-            if( stream_index == vdhp->stream_index )
-            {
-                int   width      = stream_info[stream_index].width;
-                int   height     = stream_info[stream_index].height;
-                char *pix_fmt    = stream_info[stream_index].fmt;
-                int   colorspace = stream_info[stream_index].colorspace;
-                int   key;
-                int   pict_type;
-                int   poc;
-                int   repeat_pict;
-                int   field_info;
-                if( sscanf( buf, "Key=%d,Pic=%d,POC=%d,Repeat=%d,Field=%d",
-                            &key, &pict_type, &poc, &repeat_pict, &field_info ) != 5 )
-                    goto fail_parsing;
-                if( vdhp->codec_id == AV_CODEC_ID_NONE )
-                    vdhp->codec_id = (enum AVCodecID)codec_id;
-                if( (key | width | height) || pict_type == -1 || colorspace != AVCOL_SPC_NB )
-                {
-                    if( vdhp->initial_width == 0 || vdhp->initial_height == 0 )
-                    {
-                        vdhp->initial_width  = width;
-                        vdhp->initial_height = height;
-                        vdhp->max_width      = width;
-                        vdhp->max_height     = height;
-                    }
-                    else
-                    {
-                        if( vdhp->max_width  < width )
-                            vdhp->max_width  = width;
-                        if( vdhp->max_height < width )
-                            vdhp->max_height = height;
-                    }
-                    if( vdhp->initial_pix_fmt == AV_PIX_FMT_NONE )
-                        vdhp->initial_pix_fmt = av_get_pix_fmt( pix_fmt );
-                    if( vdhp->initial_colorspace == AVCOL_SPC_NB )
-                        vdhp->initial_colorspace = (enum AVColorSpace)colorspace;
-                    if( vdhp->time_base.num == 0 || vdhp->time_base.den == 0 )
-                    {
-                        vdhp->time_base.num = time_base.num;
-                        vdhp->time_base.den = time_base.den;
-                    }
-                    ++video_sample_count;
-                    video_frame_info_t *info = &video_info[video_sample_count];
-                    memset( info, 0, sizeof(video_frame_info_t) );
-                    info->pts             = pts;
-                    info->dts             = dts;
-                    info->file_offset     = pos;
-                    info->sample_number   = video_sample_count;
-                    info->extradata_index = extradata_index;
-                    info->pict_type       = pict_type;
-                    info->poc             = poc;
-                    info->repeat_pict     = repeat_pict;
-                    info->field_info      = (lw_field_info_t)field_info;
-                    if( pts != AV_NOPTS_VALUE && last_keyframe_pts != AV_NOPTS_VALUE && pts < last_keyframe_pts )
-                        info->flags |= LW_VFRAME_FLAG_LEADING;
-                    if( key )
-                    {
-                        info->flags |= LW_VFRAME_FLAG_KEY;
-                        last_keyframe_pts = pts;
-                    }
-                    if( repeat_pict == 0 && field_info == LW_FIELD_INFO_UNKNOWN
-                     && av_get_pix_fmt( pix_fmt ) == AV_PIX_FMT_NONE
-                     && ((enum AVCodecID)codec_id == AV_CODEC_ID_H264 || (enum AVCodecID)codec_id == AV_CODEC_ID_HEVC)
-                     && (width == 0 || height == 0) )
-                        info->flags |= LW_VFRAME_FLAG_CORRUPT;
-                    if( (enum AVCodecID)codec_id == AV_CODEC_ID_VP8
-                     && pts == AV_NOPTS_VALUE && dts == AV_NOPTS_VALUE && pos == -1 )
-                    {
-                        /* VPx invisible altref frame. */
-                        info->flags |= LW_VFRAME_FLAG_INVISIBLE;
-                        ++invisible_count;
-                    }
-                }
-                if( video_sample_count + 1 == video_info_count )
-                {
-                    video_info_count <<= 1;
-                    video_frame_info_t *temp = (video_frame_info_t *)realloc( video_info, video_info_count * sizeof(video_frame_info_t) );
-                    if( !temp )
-                        goto fail_parsing;
-                    video_info = temp;
-                }
-            }
-        }
-        else if( codec_type == AVMEDIA_TYPE_AUDIO )
-        {
-            if( stream_index == adhp->stream_index )
-            {
-                uint64_t layout          = stream_info[stream_index].layout;
-                int      channels        = stream_info[stream_index].channels;
-                int      sample_rate     = stream_info[stream_index].sample_rate;
-                char    *sample_fmt      = stream_info[stream_index].fmt;
-                int      bits_per_sample = stream_info[stream_index].bits_per_sample;
-                int      frame_length;
-                if( sscanf( buf, "Length=%d", &frame_length ) != 1 )
-                    goto fail_parsing;
-                if( adhp->codec_id == AV_CODEC_ID_NONE )
-                    adhp->codec_id = (enum AVCodecID)codec_id;
-                if( (channels | layout | sample_rate | bits_per_sample) && extradata_index != -1 && audio_duration <= INT32_MAX )
-                {
-                    if( audio_sample_rate == 0 )
-                        audio_sample_rate = sample_rate;
-                    if( adhp->time_base.num == 0 || adhp->time_base.den == 0 )
-                    {
-                        adhp->time_base.num = time_base.num;
-                        adhp->time_base.den = time_base.den;
-                    }
-                    if (channels > aohp->output_channel_layout.nb_channels)
-                        av_channel_layout_from_mask(&aohp->output_channel_layout, layout);
-                    aohp->output_sample_format   = select_better_sample_format( aohp->output_sample_format,
-                                                                                av_get_sample_fmt( sample_fmt ) );
-                    aohp->output_sample_rate     = MAX( aohp->output_sample_rate, audio_sample_rate );
-                    aohp->output_bits_per_sample = MAX( aohp->output_bits_per_sample, bits_per_sample );
-                    ++audio_sample_count;
-                    audio_frame_info_t *info = &audio_info[audio_sample_count];
-                    memset( info, 0, sizeof(audio_frame_info_t) );
-                    info->pts             = pts;
-                    info->dts             = dts;
-                    info->file_offset     = pos;
-                    info->sample_number   = audio_sample_count;
-                    info->extradata_index = extradata_index;
-                    info->sample_rate     = sample_rate;
-                }
-                else
-                    for( uint32_t i = 1; i <= adhp->exh.delay_count; i++ )
-                    {
-                        uint32_t audio_frame_number = audio_sample_count - adhp->exh.delay_count + i;
-                        if( audio_frame_number > audio_sample_count )
-                            goto fail_parsing;
-                        audio_info[audio_frame_number].length = frame_length;
-                        if( audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length )
-                            constant_frame_length = 0;
-                        audio_duration += frame_length;
-                    }
-                if( audio_sample_count + 1 == audio_info_count )
-                {
-                    audio_info_count <<= 1;
-                    audio_frame_info_t *temp = (audio_frame_info_t *)realloc( audio_info, audio_info_count * sizeof(audio_frame_info_t) );
-                    if( !temp )
-                        goto fail_parsing;
-                    audio_info = temp;
-                }
-                if( frame_length == -1 )
-                    ++ adhp->exh.delay_count;
-                else if( audio_sample_count > adhp->exh.delay_count )
-                {
-                    uint32_t audio_frame_number = audio_sample_count - adhp->exh.delay_count;
-                    audio_info[audio_frame_number].length = frame_length;
-                    if( audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length )
-                        constant_frame_length = 0;
-                    audio_duration += frame_length;
+                    vdhp->stream_index = stream_index;
+                    parser.video_info = (video_frame_info_t *)malloc( parser.video_info_count * sizeof(video_frame_info_t) );
+                    if( !parser.video_info )
+                        goto fail_parsing;
                 }
             }
+            if( stream_index == vdhp->stream_index )
+            {
+                lwindex_video_record_t record;
+                if( sscanf( buf, "Key=%d,Pic=%d,POC=%d,Repeat=%d,Field=%d,Recovery=%d",
+                            &record.key, &record.pict_type, &record.poc, &record.repeat_pict, &record.field_info, &record.recovery ) != 6 )
+                    goto fail_parsing;
+                record.pos             = pos;
+                record.pts             = pts;
+                record.dts             = dts;
+                record.extradata_index = extradata_index;
+                if( import_video_record( &parser, vdhp, &stream_info[stream_index], &record ) < 0 )
+                    goto fail_parsing;
+            }
+        }
+        else if( codec_type == AVMEDIA_TYPE_AUDIO )
+        {
+            if( stream_index == adhp->stream_index )
+            {
+                lwindex_audio_record_t record;
+                if( sscanf( buf, "Length=%d", &record.length ) != 1 )
+                    goto fail_parsing;
+                record.pos             = pos;
+                record.pts             = pts;
+                record.dts             = dts;
+                record.extradata_index = extradata_index;
+                if( import_audio_record( &parser, adhp, aohp, &stream_info[stream_index], &record ) < 0 )
+                    goto fail_parsing;
+            }
         }
         if( !fgets( buf, sizeof(buf), index ) )
             goto fail_parsing;
     }
     if( video_present && opt->force_video && opt->force_video_index != -1
-     && (video_sample_count == 0 || vdhp->initial_pix_fmt == AV_PIX_FMT_NONE || vdhp->initial_width == 0 || vdhp->initial_height == 0) )
+     && (parser.video_sample_count == 0 || vdhp->initial_pix_fmt == AV_PIX_FMT_NONE || vdhp->initial_width == 0 || vdhp->initial_height == 0) )
         goto fail_parsing;  /* Need to re-create the index file. */
-    if( audio_present && opt->force_audio && opt->force_audio_index != -1 && (audio_sample_count == 0 || audio_duration == 0) )
+    if( audio_present && opt->force_audio && opt->force_audio_index != -1 && (parser.audio_sample_count == 0 || parser.audio_duration == 0) )
         goto fail_parsing;  /* Need to re-create the index file. */
     if( strncmp( buf, "</LibavReaderIndex>", strlen( "</LibavReaderIndex>" ) ) )
         goto fail_parsing;
@@ -3321,8 +5891,8 @@ static int parse_index
                 if( !alloc_extradata_entries( exhp, entry_count ) )
                     goto fail_parsing;
                 exhp->current_index = codec_type == AVMEDIA_TYPE_VIDEO
-                                    ? video_info[1].extradata_index
-                                    : audio_info[1].extradata_index;
+                                    ? parser.video_info[1].extradata_index
+                                    : parser.audio_info[1].extradata_index;
                 for( int i = 0; i < exhp->entry_count; i++ )
                 {
                     lwlibav_extradata_t *entry = &exhp->entries[i];
@@ -3390,55 +5960,8 @@ static int parse_index
     }
     if( !strncmp( buf, "</LibavReaderIndexFile>", strlen( "</LibavReaderIndexFile>" ) ) )
     {
-        if( vdhp->stream_index >= 0 )
-        {
-            vdhp->keyframe_list = (uint8_t *)lw_malloc_zero( (video_sample_count + 1) * sizeof(uint8_t) );
-            if( !vdhp->keyframe_list )
-                goto fail_parsing;
-            vdhp->frame_list  = video_info;
-            vdhp->frame_count = video_sample_count;
-            if( decide_video_seek_method( lwhp, vdhp, video_sample_count ) )
-                goto fail_parsing;
-            /* Compute the stream duration. */
-            compute_stream_duration( lwhp, vdhp, vdhp->stream_duration );
-            /* Create the repeat control info. */
-            create_video_frame_order_list( vdhp, vohp, opt );
-            /* Exclude invisible frames from the output handler. */
-            create_video_visible_frame_list( vdhp, vohp, invisible_count );
-        }
-        if( adhp->stream_index >= 0 )
-        {
-            if( adhp->dv_in_avi == 1 && adhp->index_entries_count == 0 )
-            {
-                /* DV in AVI Type-1 */
-                audio_sample_count = MIN( video_sample_count, audio_sample_count );
-                for( uint32_t i = 0; i <= audio_sample_count; i++ )
-                {
-                    audio_info[i].keyframe        = !!(video_info[i].flags & LW_VFRAME_FLAG_KEY);
-                    audio_info[i].sample_number   = video_info[i].sample_number;
-                    audio_info[i].pts             = video_info[i].pts;
-                    audio_info[i].dts             = video_info[i].dts;
-                    audio_info[i].file_offset     = video_info[i].file_offset;
-                    audio_info[i].extradata_index = video_info[i].extradata_index;
-                }
-            }
-            else
-            {
-                if( adhp->dv_in_avi == 1 && ((!opt->force_video && active_video_index == -1) || (opt->force_video && opt->force_video_index == -1)) )
-                {
-                    /* Disable DV video stream. */
-                    disable_video_stream( vdhp );
-                    video_info = NULL;
-                }
-                adhp->dv_in_avi = 0;
-            }
-            adhp->frame_list   = audio_info;
-            adhp->frame_count  = audio_sample_count;
-            adhp->frame_length = constant_frame_length ? audio_info[1].length : 0;
-            decide_audio_seek_method( lwhp, adhp, audio_sample_count );
-            if( opt->av_sync && vdhp->stream_index >= 0 )
-                lwhp->av_gap = calculate_av_gap( vdhp, vohp, adhp, audio_sample_rate );
-        }
+        if( finish_index_parsing( &parser, lwhp, vdhp, vohp, adhp, aohp, opt, active_video_index ) < 0 )
+            goto fail_parsing;
         if( vdhp->stream_index != active_video_index || adhp->stream_index != active_audio_index )
         {
             /* Update the active stream indexes when specifying different stream indexes. */
@@ -3446,26 +5969,452 @@ static int parse_index
             fprintf( index, "<ActiveVideoStreamIndex>%+011d</ActiveVideoStreamIndex>\n", vdhp->stream_index );
             fprintf( index, "<ActiveAudioStreamIndex>%+011d</ActiveAudioStreamIndex>\n", adhp->stream_index );
         }
-#ifdef _WIN32
-        lw_free(wname);
-#endif // _WIN32
         free( stream_info );
         return 0;
     }
 fail_parsing:
-#ifdef _WIN32
-    lw_free(wname);
-#endif // _WIN32
-    vdhp->frame_list = NULL;
-    adhp->frame_list = NULL;
-    if( video_info )
-        free( video_info );
-    if( audio_info )
-        free( audio_info );
+    cleanup_index_parser( &parser, vdhp, adhp );
     free( stream_info );
     return -1;
 }
 
+/* The entries are left in the image until lwlibav_import_av_index_entry() adds them to the opened stream. */
+static int import_binary_index_entries
+(
+    const uint8_t                  *data,
+    const lwindex_binary_section_t *section,
+    const void                    **mapped_index_entries,
+    int                            *index_entries_count
+)
+{
+    if( !section || section->count == 0 )
+        return 0;
+    if( section->count > INT_MAX || section->size / sizeof(lwindex_binary_index_entry_t) < section->count )
+        return -1;
+    *mapped_index_entries = data + section->offset;
+    *index_entries_count  = section->count;
+    return 0;
+}
+
+/* Return 1 if the stream may be requested to be output with the options, otherwise 0.
+ * Every stream of the type is regarded as requested unless forced since the active one is decided by indexing. */
+static int is_requested_index_stream
+(
+    lwlibav_option_t *opt,
+    int               stream_index,
+    int               codec_type
+)
+{
+    if( codec_type == AVMEDIA_TYPE_VIDEO )
+        return !opt->force_video || stream_index == opt->force_video_index;
+    if( codec_type == AVMEDIA_TYPE_AUDIO )
+        return opt->force_audio_index != -2 && (!opt->force_audio || stream_index == opt->force_audio_index);
+    return 0;
+}
+
+static int parse_binary_index
+(
+    lwlibav_file_handler_t         *lwhp,
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    lwlibav_audio_decode_handler_t *adhp,
+    lwlibav_audio_output_handler_t *aohp,
+    lwlibav_option_t               *opt,
+    lw_index_cache_t               *cache,
+    const lwindex_binary_header_t  *header_copy
+)
+{
+    size_t                          data_size;
+    const uint8_t                  *data     = lw_index_cache_get_data( cache, &data_size );
+    const lwindex_binary_section_t *sections = get_binary_index_sections( data, data_size, header_copy );
+    if( !sections )
+        return -1;
+    lwindex_binary_header_t header        = *header_copy;
+    uint32_t                section_count = header.section_count;
+    /* Test to open the target file. */
+    const lwindex_binary_section_t *path = find_binary_index_section( sections, section_count, LWINDEX_SECTION_INPUT_FILE_PATH, -1, AVMEDIA_TYPE_UNKNOWN );
+    if( !path || path->count == 0 || path->count > path->size )
+        return -1;
+    char *file_path = (char *)lw_malloc_zero( path->count + 1 );
+    if( !file_path )
+        return -1;
+    memcpy( file_path, data + path->offset, path->count );
+    int ret = set_source_file_path( lwhp, opt, file_path );
+    lw_free( file_path );
+    if( ret < 0 )
+        return -1;
+    /* The index file indexing the selected streams only has to be appended with the requested streams if not indexed yet. */
+    const lwindex_binary_section_t *selection = find_binary_index_section( sections, section_count, LWINDEX_SECTION_STREAM_SELECTION, -1, AVMEDIA_TYPE_UNKNOWN );
+    if( selection )
+    {
+        const lwindex_binary_stream_selection_t *entry = (const lwindex_binary_stream_selection_t *)(data + selection->offset);
+        if( selection->size / sizeof(lwindex_binary_stream_selection_t) < selection->count )
+            return -1;
+        for( uint32_t i = 0; i < selection->count; i++ )
+            if( !entry[i].indexed && is_requested_index_stream( opt, i, entry[i].codec_type ) )
+                return -1;
+    }
+    /* Another instance has already checked the source file unless it has been modified since then,
+     * which skips hashing the whole file on the changed last modification time. */
+    if( !lw_index_cache_is_verified( cache, lwhp->file_path ) )
+    {
+        if( check_file_stat( lwhp->file_path, header.file_size, header.file_last_modification_time, header.file_hash, 0 ) < 0 )
+            return -1;
+        lw_index_cache_set_verified( cache, lwhp->file_path );
+    }
+    /* Parse the index file. */
+    char format_name[sizeof(header.format_name)];
+    memcpy( format_name, header.format_name, sizeof(format_name) );
+    format_name[ sizeof(format_name) - 1 ] = '\0';
+    lwhp->format_flags = header.format_flags;
+    lwhp->raw_demuxer  = header.raw_demuxer;
+    lwhp->format_name  = format_name;
+    adhp->dv_in_avi = !strcmp( lwhp->format_name, "avi" ) ? -1 : 0;
+    int active_video_index = header.active_video_index;
+    int active_audio_index = header.active_audio_index;
+    int video_present = (active_video_index >= 0);
+    int audio_present = (active_audio_index >= 0);
+    vdhp->stream_index = opt->force_video ? opt->force_video_index : active_video_index;
+    switch (opt->force_audio_index)
+    {
+        case -1:
+        {
+            if (header.default_audio_index != active_audio_index)
+                return -1;
+        }
+        case -2: adhp->stream_index = active_audio_index; break;
+        default: adhp->stream_index = opt->force_audio_index; break;
+    }
+    if( active_audio_index == -2 && opt->force_audio_index != -2 )
+        return -1;
+    if( adhp->dv_in_avi == -1 && !opt->force_audio )
+    {
+        /* Pick the DV stream whose first packet comes first in the file as the text index does. */
+        const lwindex_binary_section_t *dv = NULL;
+        for( uint32_t i = 0; i < section_count; i++ )
+        {
+            if( sections[i].type != LWINDEX_SECTION_VIDEO_RECORDS || sections[i].count == 0
+             || (dv && dv->sequence <= sections[i].sequence) )
+                continue;
+            const lwindex_stream_info_t *info = get_binary_index_stream_info( data, sections, section_count, sections[i].stream_index );
+            if( info && info->codec_id == AV_CODEC_ID_DVVIDEO )
+                dv = &sections[i];
+        }
+        if( dv )
+        {
+            adhp->dv_in_avi = 1;
+            if( vdhp->stream_index == -1 )
+                vdhp->stream_index = dv->stream_index;
+        }
+    }
+    lwindex_parser_t parser = { 0 };
+    parser.video_info_count      = 1 << 16;
+    parser.audio_info_count      = 1 << 16;
+    parser.last_keyframe_pts     = AV_NOPTS_VALUE;
+    parser.constant_frame_length = 1;
+    if( vdhp->stream_index >= 0 )
+    {
+        parser.video_info = (video_frame_info_t *)malloc( parser.video_info_count * sizeof(video_frame_info_t) );
+        if( !parser.video_info )
+            goto fail_parsing;
+    }
+    if( adhp->stream_index >= 0 )
+    {
+        parser.audio_info = (audio_frame_info_t *)malloc( parser.audio_info_count * sizeof(audio_frame_info_t) );
+        if( !parser.audio_info )
+            goto fail_parsing;
+    }
+    vdhp->codec_id             = AV_CODEC_ID_NONE;
+    adhp->codec_id             = AV_CODEC_ID_NONE;
+    vdhp->initial_pix_fmt      = AV_PIX_FMT_NONE;
+    vdhp->initial_colorspace   = AVCOL_SPC_NB;
+    aohp->output_sample_format = AV_SAMPLE_FMT_NONE;
+    /* Import the records of the active streams only. The others are never touched. */
+    const lwindex_stream_info_t *video_stream_info = vdhp->stream_index >= 0
+                                                   ? get_binary_index_stream_info( data, sections, section_count, vdhp->stream_index )
+                                                   : NULL;
+    const lwindex_stream_info_t *audio_stream_info = adhp->stream_index >= 0
+                                                   ? get_binary_index_stream_info( data, sections, section_count, adhp->stream_index )
+                                                   : NULL;
+    for( uint32_t i = 0; i < section_count; i++ )
+    {
+        const lwindex_binary_section_t *section = &sections[i];
+        if( section->type == LWINDEX_SECTION_VIDEO_RECORDS
+         && section->stream_index == vdhp->stream_index
+         && video_stream_info && video_stream_info->codec_type == AVMEDIA_TYPE_VIDEO )
+        {
+            if( section->size / sizeof(lwindex_video_record_t) < section->count )
+                goto fail_parsing;
+            const lwindex_video_record_t *record = (const lwindex_video_record_t *)(data + section->offset);
+            for( uint32_t j = 0; j < section->count; j++ )
+                if( import_video_record( &parser, vdhp, video_stream_info, &record[j] ) < 0 )
+                    goto fail_parsing;
+        }
+        else if( section->type == LWINDEX_SECTION_AUDIO_RECORDS
+              && section->stream_index == adhp->stream_index
+              && audio_stream_info && audio_stream_info->codec_type == AVMEDIA_TYPE_AUDIO )
+        {
+            if( section->size / sizeof(lwindex_audio_record_t) < section->count )
+                goto fail_parsing;
+            const lwindex_audio_record_t *record = (const lwindex_audio_record_t *)(data + section->offset);
+            for( uint32_t j = 0; j < section->count; j++ )
+                if( import_audio_record( &parser, adhp, aohp, audio_stream_info, &record[j] ) < 0 )
+                    goto fail_parsing;
+        }
+    }
+    if( video_present && opt->force_video && opt->force_video_index != -1
+     && (parser.video_sample_count == 0 || vdhp->initial_pix_fmt == AV_PIX_FMT_NONE || vdhp->initial_width == 0 || vdhp->initial_height == 0) )
+        goto fail_parsing;  /* Need to re-create the index file. */
+    if( audio_present && opt->force_audio && opt->force_audio_index != -1 && (parser.audio_sample_count == 0 || parser.audio_duration == 0) )
+        goto fail_parsing;  /* Need to re-create the index file. */
+    const lwindex_binary_section_t *section;
+    section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_STREAM_DURATION, vdhp->stream_index, AVMEDIA_TYPE_VIDEO );
+    if( section && section->size >= sizeof(int64_t) )
+        memcpy( &vdhp->stream_duration, data + section->offset, sizeof(int64_t) );
+    section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_INDEX_ENTRIES, vdhp->stream_index, AVMEDIA_TYPE_VIDEO );
+    if( import_binary_index_entries( data, section, &vdhp->mapped_index_entries, &vdhp->index_entries_count ) < 0 )
+        goto fail_parsing;
+    section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_INDEX_ENTRIES, adhp->stream_index, AVMEDIA_TYPE_AUDIO );
+    if( import_binary_index_entries( data, section, &adhp->mapped_index_entries, &adhp->index_entries_count ) < 0 )
+        goto fail_parsing;
+    section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_EXTRADATA_LIST, vdhp->stream_index, AVMEDIA_TYPE_VIDEO );
+    if( section && section->count > 0 )
+    {
+        if( import_binary_extradata_list( data, section, &vdhp->exh, 1 ) < 0 )
+            goto fail_parsing;
+        vdhp->exh.current_index = parser.video_info[1].extradata_index;
+    }
+    section = find_binary_index_section( sections, section_count, LWINDEX_SECTION_EXTRADATA_LIST, adhp->stream_index, AVMEDIA_TYPE_AUDIO );
+    if( section && section->count > 0 )
+    {
+        if( import_binary_extradata_list( data, section, &adhp->exh, 1 ) < 0 )
+            goto fail_parsing;
+        adhp->exh.current_index = parser.audio_info[1].extradata_index;
+    }
+    if( finish_index_parsing( &parser, lwhp, vdhp, vohp, adhp, aohp, opt, active_video_index ) < 0 )
+        goto fail_parsing;
+    return 0;
+fail_parsing:
+    cleanup_index_parser( &parser, vdhp, adhp );
+    return -1;
+}
+
+static int load_binary_index
+(
+    lwlibav_file_handler_t         *lwhp,
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    lwlibav_audio_decode_handler_t *adhp,
+    lwlibav_audio_output_handler_t *aohp,
+    lwlibav_option_t               *opt,
+    const char                     *index_file_path,
+    FILE                           *index
+)
+{
+    /* The image of the index file is shared with the other instances opening the same file. */
+    lw_index_cache_t *cache = lw_index_cache_open( index_file_path );
+    if( !cache )
+        return -1;
+    /* Another instance could rewrite the active stream indexes in the header of the shared image.
+     * The handlers refer to the image once parsed, so nothing may fail after parsing. */
+    lwindex_binary_header_t header;
+    if( lw_index_cache_read( cache, 0, &header, sizeof(header) ) < 0
+     || parse_binary_index( lwhp, vdhp, vohp, adhp, aohp, opt, cache, &header ) < 0 )
+    {
+        lw_index_cache_release( &cache );
+        return -1;
+    }
+    /* The first valid frame found by the previous instance saves searching for it again. */
+    if( vdhp->stream_index == header.active_video_index )
+        vdhp->first_valid_frame_number = header.first_valid_frame;
+    else if( header.first_valid_frame )
+    {
+        /* The first valid frame recorded belongs to the previous active video stream. */
+        uint32_t first_valid_frame = 0;
+        lw_index_cache_write( cache, index, offsetof( lwindex_binary_header_t, first_valid_frame ), &first_valid_frame, sizeof(first_valid_frame) );
+    }
+    if( vdhp->stream_index != header.active_video_index || adhp->stream_index != header.active_audio_index )
+    {
+        /* Update the active stream indexes when specifying different stream indexes. */
+        int32_t active_index[2] = { vdhp->stream_index, adhp->stream_index };
+        lw_index_cache_write( cache, index, offsetof( lwindex_binary_header_t, active_video_index ), active_index, sizeof(active_index) );
+    }
+    /* Keep the image while either handler is alive. */
+    lw_index_cache_release( &vdhp->index_cache );
+    lw_index_cache_release( &adhp->index_cache );
+    vdhp->index_cache = cache;
+    adhp->index_cache = lw_index_cache_ref( cache );
+    return 0;
+}
+
+static uint8_t *read_index_data
+(
+    FILE   *index,
+    size_t *data_size
+)
+{
+    if( lw_fseek( index, 0, SEEK_END ) )
+        return NULL;
+    int64_t size = lw_ftell( index );
+    if( size <= 0 || (uint64_t)size > SIZE_MAX )
+        return NULL;
+    uint8_t *data = (uint8_t *)lw_malloc_zero( size );
+    if( data && (lw_fseek( index, 0, SEEK_SET ) || fread( data, 1, size, index ) != (size_t)size) )
+        lw_freep( &data );
+    *data_size = size;
+    return data;
+}
+
+/* Keep the binary index file in memory if indexing may be resumed from it.
+ * Return 0 if kept, otherwise -1. The source file itself is checked when resuming. */
+static int open_index_resume
+(
+    lwindex_resume_t       *resume,
+    lwlibav_file_handler_t *lwhp,
+    lwlibav_option_t       *opt,
+    FILE                   *index
+)
+{
+    size_t   data_size;
+    uint8_t *data = lwhp->file_path ? read_index_data( index, &data_size ) : NULL;
+    if( !data )
+        return -1;
+    const lwindex_binary_header_t  *header   = (const lwindex_binary_header_t *)data;
+    const lwindex_binary_section_t *sections = get_binary_index_sections( data, data_size, header );
+    if( !sections
+     || strncmp( header->format_name, "mpegts", sizeof(header->format_name) )
+     || (header->active_audio_index == -2) != (opt->force_audio_index == -2)
+     || find_binary_index_section( sections, header->section_count, LWINDEX_SECTION_STREAM_SELECTION, -1, AVMEDIA_TYPE_UNKNOWN ) )
+        goto fail;
+    /* The audio frames whose lengths were settled by flushing the decoder can't be continued. */
+    for( uint32_t i = 0; i < header->section_count; i++ )
+    {
+        if( sections[i].type != LWINDEX_SECTION_AUDIO_RECORDS )
+            continue;
+        if( sections[i].size / sizeof(lwindex_audio_record_t) < sections[i].count )
+            goto fail;
+        const lwindex_audio_record_t *record = (const lwindex_audio_record_t *)(data + sections[i].offset);
+        for( uint32_t j = 0; j < sections[i].count; j++ )
+            if( record[j].extradata_index < 0 || record[j].length == -1 )
+                goto fail;
+    }
+    resume->data      = data;
+    resume->data_size = data_size;
+    return 0;
+fail:
+    lw_free( data );
+    return -1;
+}
+
+/* Keep the binary index file in memory if the requested streams not indexed yet may be appended to it.
+ * Return 0 if kept, otherwise -1. */
+static int open_index_append
+(
+    lwindex_resume_t       *resume,
+    lwlibav_file_handler_t *lwhp,
+    FILE                   *index
+)
+{
+    size_t   data_size;
+    uint8_t *data = lwhp->file_path ? read_index_data( index, &data_size ) : NULL;
+    if( !data )
+        return -1;
+    const lwindex_binary_header_t *header = (const lwindex_binary_header_t *)data;
+    if( !get_binary_index_sections( data, data_size, header )
+     || check_file_stat( lwhp->file_path, header->file_size, header->file_last_modification_time, header->file_hash, 0 ) < 0 )
+    {
+        lw_free( data );
+        return -1;
+    }
+    resume->data      = data;
+    resume->data_size = data_size;
+    resume->append    = 1;
+    return 0;
+}
+
+/* Select the requested streams to be indexed, excluding the ones already indexed in the binary index file 'image' if specified.
+ * Return the number of the selected streams, or -1 on failure. */
+static int select_index_streams
+(
+    uint8_t               **selected,
+    AVFormatContext        *format_ctx,
+    lwlibav_option_t       *opt,
+    const lwindex_resume_t *image
+)
+{
+    *selected = (uint8_t *)lw_malloc_zero( format_ctx->nb_streams );
+    if( !*selected )
+        return -1;
+    const lwindex_binary_header_t  *header   = image ? (const lwindex_binary_header_t *)image->data : NULL;
+    const lwindex_binary_section_t *sections = image ? (const lwindex_binary_section_t *)(image->data + header->section_table_offset) : NULL;
+    int count = 0;
+    for( unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++ )
+    {
+        int codec_type = format_ctx->streams[stream_index]->codecpar->codec_type;
+        if( !is_requested_index_stream( opt, stream_index, codec_type )
+         || (image && is_binary_index_stream_indexed( image->data, sections, header->section_count, stream_index, codec_type )) )
+            continue;
+        (*selected)[stream_index] = 1;
+        ++count;
+    }
+    return count;
+}
+
+/* Index the requested streams not indexed in the binary index file yet, and append them to the file.
+ * Return 0 on success, otherwise -1. */
+static int append_index
+(
+    lwlibav_file_handler_t         *lwhp,
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_audio_decode_handler_t *adhp,
+    lw_log_handler_t               *lhp,
+    lwlibav_option_t               *opt,
+    progress_indicator_t           *indicator,
+    progress_handler_t             *php,
+    lwindex_resume_t               *resume
+)
+{
+    AVFormatContext *format_ctx = NULL;
+    if( lavf_open_file( &format_ctx, lwhp->file_path, opt->read_ahead, opt->direct_io, lhp ) )
+    {
+        if( format_ctx )
+            lavf_close_file( &format_ctx );
+        return -1;
+    }
+    uint8_t *selected = NULL;
+    int      ret      = -1;
+    if( select_index_streams( &selected, format_ctx, opt, resume ) > 0 )
+    {
+        /* The handlers are set up by loading the completed index file, so the results of indexing are discarded. */
+        lwlibav_video_decode_handler_t *temp_vdhp = lwlibav_video_alloc_decode_handler();
+        lwlibav_video_output_handler_t *temp_vohp = lwlibav_video_alloc_output_handler();
+        lwlibav_audio_decode_handler_t *temp_adhp = lwlibav_audio_alloc_decode_handler();
+        lwlibav_audio_output_handler_t *temp_aohp = lwlibav_audio_alloc_output_handler();
+        if( temp_vdhp && temp_vohp && temp_adhp && temp_aohp )
+        {
+            temp_vdhp->lh                      = vdhp->lh;
+            temp_vdhp->preferred_decoder_names = vdhp->preferred_decoder_names;
+            temp_vdhp->prefer_hw_decoder       = vdhp->prefer_hw_decoder;
+            temp_vdhp->stream_index            = -1;
+            temp_adhp->lh                      = adhp->lh;
+            temp_adhp->preferred_decoder_names = adhp->preferred_decoder_names;
+            temp_adhp->stream_index            = opt->force_audio_index;
+            lwhp->threads = opt->threads;
+            ret = create_index( lwhp, temp_vdhp, temp_vohp, temp_adhp, temp_aohp, format_ctx, opt, indicator, php, resume, selected );
+            /* The decoder contexts are owned by the index helpers. */
+            temp_vdhp->ctx = NULL;
+            temp_adhp->ctx = NULL;
+        }
+        lwlibav_video_free_decode_handler( temp_vdhp );
+        lwlibav_video_free_output_handler( temp_vohp );
+        lwlibav_audio_free_decode_handler( temp_adhp );
+        lwlibav_audio_free_output_handler( temp_aohp );
+    }
+    lw_free( selected );
+    lavf_close_file( &format_ctx );
+    return ret;
+}
+
 int lwlibav_construct_index
 (
     lwlibav_file_handler_t         *lwhp,
@@ -3479,41 +6428,87 @@ int lwlibav_construct_index
     progress_handler_t             *php
 )
 {
+    /* The decoders open the file with the same I/O as the indexer. */
+    vdhp->read_ahead = opt->read_ahead;
+    vdhp->direct_io  = opt->direct_io;
+    adhp->read_ahead = opt->read_ahead;
+    adhp->direct_io  = opt->direct_io;
     /* Try to open the index file. */
     size_t file_path_length = strlen( opt->file_path );
     const char *ext = file_path_length >= 5 ? &opt->file_path[file_path_length - 4] : NULL;
     int has_lwi_ext = ext && !strncmp( ext, ".lwi", strlen( ".lwi" ) );
-    FILE *index;
-    if( has_lwi_ext )
-        index = lw_fopen( opt->file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb" );
-    else if( opt->index_file_path )
-        index = lw_fopen( opt->index_file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb" );
-    else
-    {
-        char *index_file_path = create_lwi_path ( opt );
-        if( !index_file_path )
-            return -1;
-        index = lw_fopen( index_file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb" );
-        free( index_file_path );
-    }
+    char       *lwi_path        = !has_lwi_ext && !opt->index_file_path ? create_lwi_path( opt ) : NULL;
+    const char *index_file_path = has_lwi_ext          ? opt->file_path
+                                : opt->index_file_path ? opt->index_file_path
+                                :                        lwi_path;
+    if( !index_file_path )
+        return -1;
+    FILE *index = lw_fopen( index_file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb" );
+    lwindex_resume_t resume     = { 0 };
+    int              resumable  = 0;
+    int              appendable = 0;
     if( index )
     {
+        /* The index file in the format other than the requested one is regarded as stale. */
+        char magic[8] = { 0 };
+        int is_binary = fread( magic, 1, sizeof(magic), index ) == sizeof(magic)
+                     && !memcmp( magic, LWINDEX_BINARY_MAGIC, sizeof(magic) );
         uint8_t lwindex_version[4] = { 0 };
         int index_file_version = 0;
-        if( 4 == fscanf( index, "<LSMASHWorksIndexVersion=%" SCNu8 ".%" SCNu8 ".%" SCNu8 ".%" SCNu8 ">\n",
+        int ret = -1;
+        if( is_binary && !opt->text_index )
+            ret = load_binary_index( lwhp, vdhp, vohp, adhp, aohp, opt, index_file_path, index );
+        else if( !is_binary && opt->text_index
+         && fseek( index, 0, SEEK_SET ) == 0
+         && 4 == fscanf( index, "<LSMASHWorksIndexVersion=%" SCNu8 ".%" SCNu8 ".%" SCNu8 ".%" SCNu8 ">\n",
                          &lwindex_version[0], &lwindex_version[1], &lwindex_version[2], &lwindex_version[3] )
          && ((lwindex_version[0] << 24) | (lwindex_version[1] << 16) | (lwindex_version[2] << 8) | lwindex_version[3]) == LWINDEX_VERSION
          && 1 == fscanf( index, "<LibavReaderIndexFile=%d>\n", &index_file_version )
-         && index_file_version == LWINDEX_INDEX_FILE_VERSION
-         && parse_index( lwhp, vdhp, vohp, adhp, aohp, opt, index ) == 0 )
+         && index_file_version == LWINDEX_INDEX_FILE_VERSION )
+            ret = parse_index( lwhp, vdhp, vohp, adhp, aohp, opt, index );
+        /* The binary index file of the file which has only grown can be resumed.
+         * In the selective mode, the requested streams not indexed yet are appended to the binary index file instead. */
+        if( ret != 0 && is_binary && !opt->text_index && !opt->no_create_index )
+        {
+            if( opt->selective_index )
+                appendable = !has_lwi_ext && open_index_append( &resume, lwhp, index ) == 0;
+            else
+                resumable = open_index_resume( &resume, lwhp, opt, index ) == 0;
+        }
+        fclose( index );
+        if( ret == 0 )
         {
             /* Opening and parsing the index file succeeded. */
-            fclose( index );
+            free( lwi_path );
             lwhp->threads = opt->threads;
             return 0;
         }
-        fclose( index );
     }
+    if( appendable )
+    {
+        if( append_index( lwhp, vdhp, adhp, lhp, opt, indicator, php, &resume ) == 0 )
+        {
+            /* Load the completed index file as usual. The file path is set again by parsing it. */
+            char *file_path = lwhp->file_path;
+            lwhp->file_path = NULL;
+            index = lw_fopen( index_file_path, "r+b" );
+            int ret = index ? load_binary_index( lwhp, vdhp, vohp, adhp, aohp, opt, index_file_path, index ) : -1;
+            if( index )
+                fclose( index );
+            if( ret == 0 )
+            {
+                lw_free( file_path );
+                lw_free( resume.data );
+                free( lwi_path );
+                return 0;
+            }
+            lw_free( lwhp->file_path );
+            lwhp->file_path = file_path;
+        }
+        /* Fall back to creating the index file from scratch. */
+        lw_freep( &resume.data );
+    }
+    free( lwi_path );
     /* Open file. */
     if( !lwhp->file_path )
     {
@@ -3525,7 +6520,7 @@ int lwlibav_construct_index
             lwhp->file_path[file_path_length - 4] = '\0';
     }
     AVFormatContext *format_ctx = NULL;
-    if( lavf_open_file( &format_ctx, lwhp->file_path, lhp ) )
+    if( lavf_open_file( &format_ctx, lwhp->file_path, opt->read_ahead, opt->direct_io, lhp ) )
     {
         if( format_ctx )
             lavf_close_file( &format_ctx );
@@ -3535,7 +6530,12 @@ int lwlibav_construct_index
     vdhp->stream_index = -1;
     adhp->stream_index = opt->force_audio_index;
     /* Create the index file. */
-    int err = create_index( lwhp, vdhp, vohp, adhp, aohp, format_ctx, opt, indicator, php );
+    uint8_t *selected = NULL;
+    if( opt->selective_index && !opt->text_index && select_index_streams( &selected, format_ctx, opt, NULL ) <= 0 )
+        lw_freep( &selected );
+    int err = create_index( lwhp, vdhp, vohp, adhp, aohp, format_ctx, opt, indicator, php, resumable ? &resume : NULL, selected );
+    lw_free( selected );
+    lw_free( resume.data );
     /* Close file.
      * By opening file for video and audio separately, indecent work about frame reading can be avoidable. */
     lavf_close_file( &format_ctx );
@@ -3543,6 +6543,7 @@ int lwlibav_construct_index
     adhp->ctx = NULL;
     return err;
 fail:
+    lw_free( resume.data );
     if( lwhp->file_path )
         lw_freep( &lwhp->file_path );
     return -1;
@@ -3553,7 +6554,17 @@ int lwlibav_import_av_index_entry
     lwlibav_decode_handler_t *dhp
 )
 {
-    if( dhp->index_entries )
+    if( dhp->mapped_index_entries )
+    {
+        /* Read the entries from the image of the binary index file for the first time. */
+        AVStream *stream = dhp->format->streams[ dhp->stream_index ];
+        const lwindex_binary_index_entry_t *entry = (const lwindex_binary_index_entry_t *)dhp->mapped_index_entries;
+        for( int i = 0; i < dhp->index_entries_count; i++ )
+            av_add_index_entry( stream, entry[i].pos, entry[i].timestamp, entry[i].size, entry[i].min_distance, entry[i].flags );
+        dhp->mapped_index_entries = NULL;
+        dhp->index_entries_count  = 0;
+    }
+    else if( dhp->index_entries )
     {
         AVStream *stream = dhp->format->streams[ dhp->stream_index ];
         for (int i = 0; i < dhp->index_entries_count; i++) {
@@ -3564,3 +6575,18 @@ int lwlibav_import_av_index_entry
     }
     return 0;
 }
+
+void lwlibav_record_first_valid_frame
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    if( !vdhp->index_cache || vdhp->first_valid_frame_number == 0 )
+        return;
+    lwindex_binary_header_t header;
+    if( lw_index_cache_read( vdhp->index_cache, 0, &header, sizeof(header) ) < 0 )
+        return;
+    uint32_t first_valid_frame = vdhp->first_valid_frame_number;
+    if( header.active_video_index == vdhp->stream_index && header.first_valid_frame != first_valid_frame )
+        lw_index_cache_update( vdhp->index_cache, offsetof( lwindex_binary_header_t, first_valid_frame ), &first_valid_frame, sizeof(first_valid_frame) );
+}
@@ -27,7 +27,7 @@
 /* index file version
  * This version is bumped when its structure changed so that the lwindex invokes
  * reindexing opened file immediately. */
-#define LWINDEX_INDEX_FILE_VERSION 17
+#define LWINDEX_INDEX_FILE_VERSION 18
 
 typedef struct
 {
@@ -37,10 +37,16 @@ typedef struct
     int         av_sync;
     int         no_create_index;
     const char *index_file_path;
+    int         text_index;         /* 1 = use the text index file instead of the binary one */
     int         force_video;
     int         force_video_index;
     int         force_audio;
     int         force_audio_index;
+    int         parallel_index;     /* 1 = demux and analyze packets on the other threads while indexing */
+    int         read_ahead;         /* the size of the read-ahead buffer in MiB, 0 = the default I/O of libavformat */
+    int         direct_io;          /* 1 = bypass the page cache of the OS by the read-ahead I/O */
+    int         selective_index;    /* 1 = index the requested streams only, and append the others to the binary index file when requested */
+    int         range_index;        /* 1 = index large MPEG-2 transport streams in byte ranges on the other threads */
     int         apply_repeat_flag;
     int         field_dominance;
     struct
@@ -74,6 +80,14 @@ int lwlibav_import_av_index_entry
     lwlibav_decode_handler_t *dhp
 );
 
+/* Record the first valid frame of the active video stream into the binary index file the handler was loaded from
+ * so that the next instances can skip searching for it.
+ * Call this only where no frame is being decoded, i.e. when closing the handler. */
+void lwlibav_record_first_valid_frame
+(
+    lwlibav_video_decode_handler_t *vdhp
+);
+
 #ifdef __cplusplus
 }
 #endif  /* __cplusplus */
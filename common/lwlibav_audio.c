@@ -71,6 +71,17 @@ lwlibav_audio_output_handler_t *lwlibav_audio_alloc_output_handler
     return (lwlibav_audio_output_handler_t *)lw_malloc_zero( sizeof(lwlibav_audio_output_handler_t) );
 }
 
+static void free_audio_position_table
+(
+    lw_audio_position_table_t *table
+)
+{
+    lw_freep( &table->end_pos_list );
+    lw_freep( &table->sequence_list );
+    table->sequence_count     = 0;
+    table->output_sample_rate = 0;
+}
+
 void lwlibav_audio_free_decode_handler
 (
     lwlibav_audio_decode_handler_t *adhp
@@ -81,18 +92,22 @@ void lwlibav_audio_free_decode_handler
     lwlibav_extradata_handler_t *exhp = &adhp->exh;
     if( exhp->entries )
     {
-        for( int i = 0; i < exhp->entry_count; i++ )
-            if( exhp->entries[i].extradata )
-                av_free( exhp->entries[i].extradata );
+        if( !exhp->mapped )
+            for( int i = 0; i < exhp->entry_count; i++ )
+                if( exhp->entries[i].extradata )
+                    av_free( exhp->entries[i].extradata );
         lw_free( exhp->entries );
     }
     av_packet_unref( &adhp->packet );
     lw_free( adhp->frame_list );
+    free_audio_position_table( &adhp->position_table );
     av_free( adhp->index_entries );
     av_frame_free( &adhp->frame_buffer );
+    lwlibav_free_decoder_pool( &adhp->exh );
     avcodec_free_context( &adhp->ctx );
     if( adhp->format )
         lavf_close_file( &adhp->format );
+    lw_index_cache_release( &adhp->index_cache );
     lw_free( adhp );
 }
 
@@ -195,6 +210,14 @@ AVCodecContext *lwlibav_audio_get_codec_context
     return adhp ? adhp->ctx : NULL;
 }
 
+int lwlibav_audio_get_error
+(
+    lwlibav_audio_decode_handler_t *adhp
+)
+{
+    return adhp ? adhp->error : -1;
+}
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -217,7 +240,7 @@ int lwlibav_audio_get_desired_track
     AVCodecContext *ctx = NULL;
     if( adhp->stream_index < 0
      || adhp->frame_count == 0
-     || lavf_open_file( &adhp->format, file_path, &adhp->lh ) < 0
+     || lavf_open_file( &adhp->format, file_path, adhp->read_ahead, adhp->direct_io, &adhp->lh ) < 0
      || find_and_open_decoder( &ctx, adhp->format->streams[ adhp->stream_index ]->codecpar,
                                adhp->preferred_decoder_names, 0, threads, adhp->drc, adhp->ff_options ) < 0 )
     {
@@ -267,44 +290,86 @@ uint64_t lwlibav_audio_count_overall_pcm_samples
     return overall_pcm_sample_count;
 }
 
-static int find_start_audio_frame
+/* Build the positions of all frames at the output sampling rate unless already built for it.
+ * Each sequence is resampled individually, so the number of output PCM samples is rounded up per sequence. */
+static int update_audio_position_table
 (
     lwlibav_audio_decode_handler_t *adhp,
-    int                             output_sample_rate,
-    uint64_t                        start_frame_pos,
-    uint64_t                       *start_offset
+    int                             output_sample_rate
 )
 {
+    lw_audio_position_table_t *table = &adhp->position_table;
+    if( table->end_pos_list
+     && table->output_sample_rate  == output_sample_rate
+     && table->default_sample_rate == adhp->ctx->sample_rate )
+        return 0;
+    free_audio_position_table( table );
+    uint32_t sequence_capacity = 16;
+    table->end_pos_list  = (uint64_t *)lw_malloc_zero( (adhp->frame_count + 1) * sizeof(uint64_t) );
+    table->sequence_list = (lw_audio_sequence_t *)lw_malloc_zero( sequence_capacity * sizeof(lw_audio_sequence_t) );
+    if( !table->end_pos_list || !table->sequence_list )
+        goto fail;
     audio_frame_info_t *frame_list = adhp->frame_list;
-    uint32_t frame_number                    = 1;
-    uint64_t current_frame_pos               = 0;
-    uint64_t next_frame_pos                  = 0;
-    int      current_sample_rate             = frame_list[frame_number].sample_rate > 0 ? frame_list[frame_number].sample_rate : adhp->ctx->sample_rate;
-    int      current_frame_length            = frame_list[frame_number].length;
+    int      current_sample_rate             = 0;
+    int      current_frame_length            = 0;
     uint64_t resampled_sample_count          = 0;   /* the number of accumulated PCM samples after resampling per sequence */
     uint64_t pcm_sample_count                = 0;   /* the number of accumulated PCM samples before resampling per sequence */
     uint64_t prior_sequences_resampled_count = 0;   /* the number of accumulated PCM samples of all prior sequences */
-    do
+    for( uint32_t i = 1; i <= adhp->frame_count; i++ )
     {
-        current_frame_pos = next_frame_pos;
-        if( (current_sample_rate != frame_list[frame_number].sample_rate && frame_list[frame_number].sample_rate > 0)
-         || current_frame_length != frame_list[frame_number].length )
+        if( i == 1
+         || (current_sample_rate != frame_list[i].sample_rate && frame_list[i].sample_rate > 0)
+         || current_frame_length != frame_list[i].length )
         {
             /* Encountered a new sequence. */
+            if( table->sequence_count == sequence_capacity )
+            {
+                sequence_capacity <<= 1;
+                lw_audio_sequence_t *temp = (lw_audio_sequence_t *)realloc( table->sequence_list, sequence_capacity * sizeof(lw_audio_sequence_t) );
+                if( !temp )
+                    goto fail;
+                table->sequence_list = temp;
+            }
             prior_sequences_resampled_count += resampled_sample_count;
             pcm_sample_count = 0;
-            current_sample_rate  = frame_list[frame_number].sample_rate > 0 ? frame_list[frame_number].sample_rate : adhp->ctx->sample_rate;
-            current_frame_length = frame_list[frame_number].length;
+            current_sample_rate  = frame_list[i].sample_rate > 0 ? frame_list[i].sample_rate : adhp->ctx->sample_rate;
+            current_frame_length = frame_list[i].length;
+            lw_audio_sequence_t *sequence = &table->sequence_list[ table->sequence_count ++ ];
+            sequence->first_frame_number = i;
+            sequence->sample_rate        = current_sample_rate;
         }
         pcm_sample_count += (uint64_t)current_frame_length;
         resampled_sample_count = output_sample_rate == current_sample_rate || pcm_sample_count == 0
                                ? pcm_sample_count
                                : (pcm_sample_count * output_sample_rate - 1) / current_sample_rate + 1;
-        next_frame_pos = prior_sequences_resampled_count + resampled_sample_count;
-        if( start_frame_pos < next_frame_pos )
-            break;
-        ++frame_number;
-    } while( frame_number <= adhp->frame_count );
+        table->end_pos_list[i] = prior_sequences_resampled_count + resampled_sample_count;
+    }
+    table->output_sample_rate  = output_sample_rate;
+    table->default_sample_rate = adhp->ctx->sample_rate;
+    return 0;
+fail:
+    free_audio_position_table( table );
+    return -1;
+}
+
+/* Return the frame number where decoding starts, or 0 on failure. */
+static uint32_t find_start_audio_frame
+(
+    lwlibav_audio_decode_handler_t *adhp,
+    int                             output_sample_rate,
+    uint64_t                        start_frame_pos,
+    uint64_t                       *start_offset
+)
+{
+    if( update_audio_position_table( adhp, output_sample_rate ) < 0 )
+        return 0;
+    const lw_audio_position_table_t *table = &adhp->position_table;
+    audio_frame_info_t *frame_list = adhp->frame_list;
+    /* If no frame ends after the start position, the offset is measured from the start of the last frame. */
+    uint32_t frame_number        = lw_find_audio_frame_by_position( table, adhp->frame_count, start_frame_pos );
+    uint32_t found_frame_number  = MIN( frame_number, adhp->frame_count );
+    uint64_t current_frame_pos   = table->end_pos_list[found_frame_number - 1];
+    int      current_sample_rate = lw_get_audio_sequence_sample_rate( table, found_frame_number );
     *start_offset = start_frame_pos - current_frame_pos;
     if( *start_offset && current_sample_rate != output_sample_rate )
         *start_offset = (*start_offset * current_sample_rate - 1) / output_sample_rate + 1;
@@ -501,15 +566,16 @@ retry_seek:;
 #undef MAX_ERROR_COUNT
 }
 
-uint64_t lwlibav_audio_get_pcm_samples
+static uint64_t get_pcm_samples
 (
-    lwlibav_audio_decode_handler_t *adhp,
-    lwlibav_audio_output_handler_t *aohp,
-    void                           *buf,
-    int64_t                         start,
-    int64_t                         wanted_length
+    void                      *dhp,
+    lw_audio_output_handler_t *aohp,
+    void                      *buf,
+    int64_t                    start,
+    int64_t                    wanted_length
 )
 {
+    lwlibav_audio_decode_handler_t *adhp = (lwlibav_audio_decode_handler_t *)dhp;
     if( adhp->error )
         return 0;
     uint32_t               frame_number;
@@ -550,6 +616,12 @@ uint64_t lwlibav_audio_get_pcm_samples
             start_frame_pos = 0;
         }
         frame_number = find_start_audio_frame( adhp, aohp->output_sample_rate, start_frame_pos, &aohp->output_sample_offset );
+        if( frame_number == 0 )
+        {
+            adhp->error = 1;
+            lw_log_show( &adhp->lh, LW_LOG_FATAL, "Failed to allocate memory for the audio frame positions." );
+            return 0;
+        }
 retry_seek:
         av_packet_unref( pkt );
         /* Flush audio resampler buffers. */
@@ -718,3 +790,15 @@ abort:
     av_frame_free( &picture );
     return err;
 }
+
+uint64_t lwlibav_audio_get_pcm_samples
+(
+    lwlibav_audio_decode_handler_t *adhp,
+    lwlibav_audio_output_handler_t *aohp,
+    void                           *buf,
+    int64_t                         start,
+    int64_t                         wanted_length
+)
+{
+    return lw_get_cached_pcm_samples( aohp, get_pcm_samples, adhp, buf, start, wanted_length );
+}
@@ -104,6 +104,11 @@ AVCodecContext *lwlibav_audio_get_codec_context
     lwlibav_audio_decode_handler_t *adhp
 );
 
+int lwlibav_audio_get_error
+(
+    lwlibav_audio_decode_handler_t *adhp
+);
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -39,10 +39,12 @@ struct lwlibav_audio_decode_handler_tag
     int                 stream_index;
     int                 error;
     lw_log_handler_t    lh;
+    lw_log_handler_t   *decoder_lh;
     lwlibav_extradata_handler_t exh;
     AVCodecContext     *ctx;
     AVIndexEntry       *index_entries;
     int                 index_entries_count;
+    const void         *mapped_index_entries;
     int                 lw_seek_flags;
     int                 av_seek_flags;  /* unused */
     int                 dv_in_avi;      /* 1 = 'DV in AVI Type-1', 0 = otherwise */
@@ -56,10 +58,14 @@ struct lwlibav_audio_decode_handler_tag
     const char         *ff_options;
     double              drc;
     /* */
+    int                 read_ahead;     /* the size of the read-ahead buffer in MiB, 0 = the default I/O of libavformat */
+    int                 direct_io;
+    lw_index_cache_t   *index_cache;    /* the image of the index file shared with the other instances */
     AVPacket            packet;         /* for getting and freeing */
     AVPacket            alter_packet;   /* for consumed by the decoder instead of 'packet'. */
     uint32_t            frame_length;
     uint32_t            last_frame_number;
     uint64_t            pcm_sample_count;
     uint64_t            next_pcm_sample_number;
+    lw_audio_position_table_t position_table;
 };
@@ -61,7 +61,7 @@ void lwlibav_flush_buffers
         {
             avcodec_flush_buffers(dhp->ctx);
             dhp->error = 1;
-            lw_log_show(&dhp->lh, LW_LOG_FATAL,
+            lw_log_show(lwlibav_decoder_log_handler(dhp), LW_LOG_FATAL,
                 "Failed to flush buffers by a reliable way.\n"
                 "It is recommended you reopen the file.");
         }
@@ -77,6 +77,75 @@ void lwlibav_flush_buffers
     dhp->exh.delay_count = 0;
 }
 
+static void free_pooled_decoder
+(
+    AVCodecContext **ctx
+)
+{
+    (*ctx)->opaque = NULL;
+    avcodec_free_context( ctx );
+}
+
+/* Keep an idle decoder for an extradata entry.
+ * If the pool is full, the least recently used one is closed. */
+static void put_pooled_decoder
+(
+    lwlibav_extradata_handler_t *exhp,
+    AVCodecContext             **ctx,
+    int                          extradata_index
+)
+{
+    if( extradata_index < 0 )
+    {
+        free_pooled_decoder( ctx );
+        return;
+    }
+    lwlibav_pooled_decoder_t *pooled;
+    if( exhp->pool_count < LWLIBAV_MAX_POOLED_DECODERS )
+        pooled = &exhp->pool[ exhp->pool_count ++ ];
+    else
+    {
+        pooled = &exhp->pool[0];
+        for( int i = 1; i < exhp->pool_count; i++ )
+            if( exhp->pool[i].last_used < pooled->last_used )
+                pooled = &exhp->pool[i];
+        free_pooled_decoder( &pooled->ctx );
+    }
+    /* Release the reference frames held by the decoder while idle. */
+    avcodec_flush_buffers( *ctx );
+    pooled->ctx             = *ctx;
+    pooled->extradata_index = extradata_index;
+    pooled->last_used       = ++ exhp->pool_clock;
+    *ctx = NULL;
+}
+
+/* Take out the idle decoder for an extradata entry if any. */
+static AVCodecContext *get_pooled_decoder
+(
+    lwlibav_extradata_handler_t *exhp,
+    int                          extradata_index
+)
+{
+    for( int i = 0; i < exhp->pool_count; i++ )
+        if( exhp->pool[i].extradata_index == extradata_index )
+        {
+            AVCodecContext *ctx = exhp->pool[i].ctx;
+            exhp->pool[i] = exhp->pool[ -- exhp->pool_count ];
+            return ctx;
+        }
+    return NULL;
+}
+
+void lwlibav_free_decoder_pool
+(
+    lwlibav_extradata_handler_t *exhp
+)
+{
+    for( int i = 0; i < exhp->pool_count; i++ )
+        free_pooled_decoder( &exhp->pool[i].ctx );
+    exhp->pool_count = 0;
+}
+
 void lwlibav_update_configuration
 (
     lwlibav_decode_handler_t *dhp,
@@ -97,12 +166,14 @@ void lwlibav_update_configuration
     AVCodecParameters *codecpar          = dhp->format->streams[ dhp->stream_index ]->codecpar;
     void              *app_specific      = dhp->ctx->opaque;
     const int          thread_count      = dhp->ctx->thread_count;
-    /* Close the decoder here. */
-    dhp->ctx->opaque = NULL;
-    avcodec_free_context( &dhp->ctx );
+    /* Keep the current decoder so that switching back costs only a flush. */
+    put_pooled_decoder( exhp, &dhp->ctx, exhp->current_index );
+    AVCodecContext *pooled_ctx = get_pooled_decoder( exhp, extradata_index );
     /* Find an appropriate decoder. */
     const lwlibav_extradata_t *entry = &exhp->entries[extradata_index];
-    const AVCodec *codec = find_decoder( entry->codec_id, codecpar, dhp->preferred_decoder_names, dhp->prefer_hw_decoder );
+    const AVCodec *codec = pooled_ctx
+                         ? pooled_ctx->codec
+                         : find_decoder( entry->codec_id, codecpar, dhp->preferred_decoder_names, dhp->prefer_hw_decoder );
     if( !codec )
     {
         strcpy( error_string, "Failed to find the decoder.\n" );
@@ -130,6 +201,14 @@ void lwlibav_update_configuration
     }
     /* This is needed by some CODECs such as UtVideo and raw video. */
     codecpar->codec_tag = entry->codec_tag;
+    if( pooled_ctx )
+    {
+        /* The decoder has been set up already. */
+        dhp->ctx = pooled_ctx;
+        exhp->current_index = extradata_index;
+        exhp->delay_count   = 0;
+        goto flush;
+    }
     /* Open an appropriate decoder.
      * Here, we force single threaded decoding since some decoder doesn't do its proper initialization with multi-threaded decoding. */
     if( open_decoder( &dhp->ctx, codecpar, codec, 1, dhp->drc, dhp->ff_options ) < 0 )
@@ -146,6 +225,7 @@ void lwlibav_update_configuration
         goto fail;
     /* Reopen/flush with the requested number of threads. */
     dhp->ctx->thread_count = thread_count;
+flush:;
     int width  = dhp->ctx->width;
     int height = dhp->ctx->height;
     lwlibav_flush_buffers( dhp );   /* Note that dhp->ctx could change here. */
@@ -156,9 +236,11 @@ void lwlibav_update_configuration
     dhp->ctx->height      = height;
     return;
 fail:
+    if( pooled_ctx )
+        free_pooled_decoder( &pooled_ctx );
     exhp->delay_count = 0;
     dhp->error = 1;
-    lw_log_show( &dhp->lh, LW_LOG_FATAL,
+    lw_log_show( lwlibav_decoder_log_handler( dhp ), LW_LOG_FATAL,
                  "%sIt is recommended you reopen the file.", error_string );
 }
 
@@ -25,12 +25,17 @@
 #include "osdep.h"
 #endif // _WIN32
 
+#include "index_cache.h"
+#include "read_ahead.h"
+
 #define SEEK_DTS_BASED      0x00000001
 #define SEEK_PTS_BASED      0x00000002
 #define SEEK_POS_BASED      0x00000004
 #define SEEK_POS_CORRECTION 0x00000008
 #define SEEK_PTS_GENERATED  0x00000010
 
+#define LWLIBAV_MAX_POOLED_DECODERS 4
+
 typedef struct
 {
     char   *file_path;
@@ -60,6 +65,13 @@ typedef struct
     int                 block_align;
 } lwlibav_extradata_t;
 
+typedef struct
+{
+    AVCodecContext *ctx;
+    int             extradata_index;
+    uint64_t        last_used;
+} lwlibav_pooled_decoder_t;
+
 typedef struct
 {
     int                  current_index;
@@ -67,6 +79,11 @@ typedef struct
     lwlibav_extradata_t *entries;
     uint32_t             delay_count;
     int (*get_buffer)( struct AVCodecContext *, AVFrame *, int );
+    /* the idle decoders opened for the other entries, which are reused when switching back to them */
+    lwlibav_pooled_decoder_t pool[LWLIBAV_MAX_POOLED_DECODERS];
+    int                  pool_count;
+    uint64_t             pool_clock;
+    int                  mapped;    /* 1 = the extradata of the entries point into the image of the binary index file */
 } lwlibav_extradata_handler_t;
 
 typedef struct
@@ -76,10 +93,12 @@ typedef struct
     int                         stream_index;
     int                         error;
     lw_log_handler_t            lh;
+    lw_log_handler_t           *decoder_lh;     /* the log handler of the thread decoding now; NULL = lh */
     lwlibav_extradata_handler_t exh;
     AVCodecContext             *ctx;
     AVIndexEntry               *index_entries;
     int                         index_entries_count;
+    const void                 *mapped_index_entries;   /* the entries in the image of the binary index file, imported instead of 'index_entries' */
     int                         lw_seek_flags;
     int                         av_seek_flags;
     int                         dv_in_avi;
@@ -94,17 +113,35 @@ typedef struct
     double                      drc;
 } lwlibav_decode_handler_t;
 
-static inline int lavf_open_file
+/* Open the file without probing the streams. */
+static inline int lavf_open_input
 (
     AVFormatContext **format_ctx,
     const char       *file_path,
+    int               read_ahead,   /* the size of the read-ahead buffer in MiB, 0 = the default I/O of libavformat */
+    int               direct_io,
     lw_log_handler_t *lhp
 )
 {
+    AVIOContext *pb = NULL;
+    if( read_ahead > 0 )
+    {
+        /* Fall back to the default I/O if the read-ahead I/O is unavailable, e.g. for URLs. */
+        pb = lw_read_ahead_open( file_path, read_ahead, direct_io );
+        if( pb && !(*format_ctx = avformat_alloc_context()) )
+            lw_read_ahead_close( &pb );
+        if( pb )
+        {
+            (*format_ctx)->pb     = pb;
+            (*format_ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+        }
+    }
     AVDictionary* prob_size = NULL;
     av_dict_set( &prob_size, "probesize", "6000000", 0 );
     if( avformat_open_input( format_ctx, file_path, NULL, &prob_size) )
     {
+        /* The I/O context given by the caller is not closed by libavformat. */
+        lw_read_ahead_close( &pb );
 #ifdef _WIN32
         wchar_t* wname;
         if (lw_string_to_wchar(CP_ACP, file_path, &wname))
@@ -128,22 +165,46 @@ static inline int lavf_open_file
 #endif // _WIN32
         goto fail_open;
     }
+    av_dict_free( &prob_size );
+    return 0;
+
+fail_open:
+    lw_log_show(lhp, LW_LOG_FATAL, "Failed to avformat_open_input.");
+    return -1;
+}
+
+static inline int lavf_open_file
+(
+    AVFormatContext **format_ctx,
+    const char       *file_path,
+    int               read_ahead,   /* the size of the read-ahead buffer in MiB, 0 = the default I/O of libavformat */
+    int               direct_io,
+    lw_log_handler_t *lhp
+)
+{
+    if( lavf_open_input( format_ctx, file_path, read_ahead, direct_io, lhp ) < 0 )
+        return -1;
     if( avformat_find_stream_info( *format_ctx, NULL ) < 0 )
     {
         lw_log_show( lhp, LW_LOG_FATAL, "Failed to avformat_find_stream_info." );
         return -1;
     }
-    av_dict_free( &prob_size );
     return 0;
+}
 
-fail_open:
-    lw_log_show(lhp, LW_LOG_FATAL, "Failed to avformat_open_input.");
-    return -1;
+static inline lw_log_handler_t *lwlibav_decoder_log_handler
+(
+    lwlibav_decode_handler_t *dhp
+)
+{
+    return dhp->decoder_lh ? dhp->decoder_lh : &dhp->lh;
 }
 
 static inline void lavf_close_file( AVFormatContext **format_ctx )
 {
+    AVIOContext *pb = *format_ctx && ((*format_ctx)->flags & AVFMT_FLAG_CUSTOM_IO) ? (*format_ctx)->pb : NULL;
     avformat_close_input( format_ctx );
+    lw_read_ahead_close( &pb );
 }
 
 static inline int read_av_frame
@@ -193,6 +254,11 @@ void lwlibav_update_configuration
     int64_t                   rap_pos
 );
 
+void lwlibav_free_decoder_pool
+(
+    lwlibav_extradata_handler_t *exhp
+);
+
 void set_video_basic_settings
 (
     lwlibav_decode_handler_t *dhp,
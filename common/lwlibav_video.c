@@ -22,8 +22,6 @@
 
 #include "cpp_compat.h"
 
-#include <float.h>
-
 #ifdef __cplusplus
 extern "C"
 {
@@ -37,19 +35,140 @@ extern "C"
 
 #include "utils.h"
 #include "video_output.h"
+#include "audio_output.h"
+#include "progress.h"
 #include "lwlibav_dec.h"
 #include "lwlibav_video.h"
 #include "lwlibav_video_internal.h"
+#include "lwlibav_audio.h"
+#include "lwindex.h"
 #include "decode.h"
+#include "osdep.h"
 
 #define SEEK_MODE_NORMAL     0
 #define SEEK_MODE_UNSAFE     1
 #define SEEK_MODE_AGGRESSIVE 2
 
+#define FIRST_VALID_FRAME_FOUND   0
+#define FIRST_VALID_FRAME_PENDING 1     /* searched for at the first request */
+#define FIRST_VALID_FRAME_MISSING 2     /* the search failed */
+
+#define REVERSE_ACCESS_THRESHOLD  2           /* the number of consecutive descending requests to enter reverse playback */
+#define REVERSE_ACCESS_MAX_STEP   4           /* the maximum step of descending requests regarded as reverse playback */
+#define REVERSE_FRAME_CACHE_SIZE  (256 << 20) /* the frame cache budget for reverse playback if not specified */
+
 #if LIBAVCODEC_VERSION_MICRO < 100
 #define avcodec_find_best_pix_fmt_of_list( _0, _1, _2, _3 ) avcodec_find_best_pix_fmt2( (enum AVPixelFormat *)(_0), _1, _2, _3 )
 #endif
 
+/* The background decoder keeps decoding the pictures following the last requested one
+ * and stores them into the ring buffer in presentation order.
+ * Any access to the decoder state from the requesting side is done while the thread is not decoding. */
+struct lwlibav_video_prefetcher_tag
+{
+    lw_thread_t *thread;
+    lw_mutex_t  *mutex;
+    lw_cond_t   *cond;
+    AVFrame     *decode_frame;  /* the frame buffer the decoder outputs into */
+    AVFrame    **ring;
+    uint32_t     size;
+    uint32_t     head;          /* the position of the picture 'first' in the ring */
+    uint32_t     count;
+    uint32_t     first;         /* the number of the oldest picture in the ring */
+    uint32_t     next;          /* the number of the picture decoded next; 0 = stopped */
+    uint32_t     last_output;   /* the number of the last requested picture; 0 = none */
+    lw_log_handler_t lh;        /* the quiet log handler used while decoding on this thread */
+    int          decoding;
+    int          exit;
+};
+
+static void close_prefetcher
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    lwlibav_video_prefetcher_t *pfp = vdhp->prefetcher;
+    if( !pfp )
+        return;
+    if( pfp->thread )
+    {
+        lw_mutex_lock( pfp->mutex );
+        pfp->exit = 1;
+        lw_cond_broadcast( pfp->cond );
+        lw_mutex_unlock( pfp->mutex );
+        lw_thread_join( pfp->thread );
+    }
+    if( pfp->ring )
+    {
+        for( uint32_t i = 0; i < pfp->size; i++ )
+            av_frame_free( &pfp->ring[i] );
+        lw_free( pfp->ring );
+    }
+    av_frame_free( &pfp->decode_frame );
+    if( pfp->cond )
+        lw_cond_destroy( pfp->cond );
+    if( pfp->mutex )
+        lw_mutex_destroy( pfp->mutex );
+    lw_freep( &vdhp->prefetcher );
+}
+
+/* The decoded frames are kept by reference with their presentation picture numbers
+ * and the least recently used ones are discarded when exceeding the budget. */
+typedef struct
+{
+    uint32_t picture_number;
+    AVFrame *frame;
+    size_t   size;
+    uint64_t last_used;
+} frame_cache_entry_t;
+
+struct lwlibav_video_frame_cache_tag
+{
+    frame_cache_entry_t *entries;
+    uint32_t             count;
+    uint32_t             capacity;
+    size_t               size;      /* the total bytes of the cached frames */
+    uint64_t             clock;
+    AVFrame             *stash;     /* the last output from the decoder displaced by a cached frame */
+    int                  stashed;
+};
+
+static void close_frame_cache
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    lwlibav_video_frame_cache_t *fcp = vdhp->frame_cache;
+    if( !fcp )
+        return;
+    for( uint32_t i = 0; i < fcp->count; i++ )
+        av_frame_free( &fcp->entries[i].frame );
+    lw_free( fcp->entries );
+    av_frame_free( &fcp->stash );
+    lw_freep( &vdhp->frame_cache );
+}
+
+/* The pipelined decoding keeps feeding packets while the decoder accepts them and
+ * collects output pictures identified by their output order identifiers. */
+struct lwlibav_video_pipeline_tag
+{
+    decoded_frame_queue_t queue;    /* the output pictures not requested yet */
+    int                   active;   /* 1 = the decoder state continues from the last access */
+    int                   pending;  /* 1 = the packet read by the seek is not fed yet */
+};
+
+static void close_pipeline
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    lwlibav_video_pipeline_t *plp = vdhp->pipeline;
+    if( !plp )
+        return;
+    free_decoded_frame_queue( &plp->queue );
+    lw_freep( &vdhp->pipeline );
+}
+
 /*****************************************************************************
  * Allocators / Deallocators
  *****************************************************************************/
@@ -85,28 +204,117 @@ void lwlibav_video_free_decode_handler
 {
     if( !vdhp )
         return;
+    /* Stop the background decoder before freeing anything it touches. */
+    close_prefetcher( vdhp );
+    /* Not recorded at the search since the frame requests can be served on any thread of the host. */
+    lwlibav_record_first_valid_frame( vdhp );
+    close_frame_cache( vdhp );
+    close_pipeline( vdhp );
     lwlibav_extradata_handler_t *exhp = &vdhp->exh;
     if( exhp->entries )
     {
-        for( int i = 0; i < exhp->entry_count; i++ )
-            if( exhp->entries[i].extradata )
-                av_free( exhp->entries[i].extradata );
+        if( !vdhp->shared_index && !exhp->mapped )
+            for( int i = 0; i < exhp->entry_count; i++ )
+                if( exhp->entries[i].extradata )
+                    av_free( exhp->entries[i].extradata );
         lw_free( exhp->entries );
     }
     av_packet_unref( &vdhp->packet );
-    lw_free( vdhp->frame_list );
-    lw_free( vdhp->order_converter );
-    lw_free( vdhp->keyframe_list );
-    av_free( vdhp->index_entries );
+    if( !vdhp->shared_index )
+    {
+        lw_free( vdhp->frame_list );
+        lw_free( vdhp->order_converter );
+        lw_free( vdhp->keyframe_list );
+        lw_free( vdhp->timestamp_list );
+        av_free( vdhp->index_entries );
+    }
     av_frame_free( &vdhp->frame_buffer );
     av_frame_free( &vdhp->first_valid_frame );
     av_frame_free( &vdhp->movable_frame_buffer );
+    lwlibav_free_decoder_pool( &vdhp->exh );
     avcodec_free_context( &vdhp->ctx );
     if( vdhp->format )
         lavf_close_file( &vdhp->format );
+    lw_index_cache_release( &vdhp->index_cache );
     lw_free( vdhp );
 }
 
+lwlibav_video_decode_handler_t *lwlibav_video_duplicate_decode_handler
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    lwlibav_video_decode_handler_t *dup = lwlibav_video_alloc_decode_handler();
+    if( !dup )
+        return NULL;
+    AVFrame *frame_buffer = dup->frame_buffer;
+    *dup = *vdhp;
+    /* Nothing owned by the original handler except for the index is taken over. */
+    dup->frame_buffer         = frame_buffer;
+    dup->format               = NULL;
+    dup->ctx                  = NULL;
+    dup->first_valid_frame    = NULL;
+    dup->movable_frame_buffer = NULL;
+    dup->last_req_frame       = NULL;
+    dup->last_dec_frame       = NULL;
+    dup->prefetcher           = NULL;
+    dup->decoder_lh           = NULL;
+    dup->frame_cache          = NULL;
+    dup->pipeline             = NULL;
+    dup->index_cache          = NULL;
+    dup->shared_index         = 1;
+    memset( &dup->packet, 0, sizeof(AVPacket) );
+    /* The extradata are shared, but the list is not since the current index is per decoder. */
+    dup->exh.entries    = NULL;
+    dup->exh.pool_count = 0;
+    if( vdhp->exh.entry_count > 0 )
+    {
+        dup->exh.entries = (lwlibav_extradata_t *)lw_memdup( vdhp->exh.entries, vdhp->exh.entry_count * sizeof(lwlibav_extradata_t) );
+        if( !dup->exh.entries )
+        {
+            lwlibav_video_free_decode_handler( dup );
+            return NULL;
+        }
+    }
+    return dup;
+}
+
+lwlibav_video_output_handler_t *lwlibav_video_duplicate_output_handler
+(
+    lwlibav_video_output_handler_t *vohp
+)
+{
+    lwlibav_video_output_handler_t *dup = lwlibav_video_alloc_output_handler();
+    if( !dup )
+        return NULL;
+    *dup = *vohp;
+    /* The scaler and the private handler are set up for each output. */
+    memset( &dup->scaler, 0, sizeof(lw_video_scaler_handler_t) );
+    memset( dup->frame_cache_buffers, 0, sizeof(dup->frame_cache_buffers) );
+    dup->private_handler      = NULL;
+    dup->free_private_handler = NULL;
+    dup->frame_order_list     = NULL;
+    if( vohp->frame_order_list )
+    {
+        /* The list is 1-origin and may be terminated by a zeroed entry. */
+        dup->frame_order_list = (lw_video_frame_order_t *)lw_malloc_zero( (vohp->frame_order_count + 2) * sizeof(lw_video_frame_order_t) );
+        if( !dup->frame_order_list )
+            goto fail;
+        memcpy( dup->frame_order_list, vohp->frame_order_list, (vohp->frame_order_count + 1) * sizeof(lw_video_frame_order_t) );
+    }
+    for( int i = 0; i < REPEAT_CONTROL_CACHE_NUM; i++ )
+        if( vohp->frame_cache_buffers[i] )
+        {
+            dup->frame_cache_buffers[i] = av_frame_alloc();
+            if( !dup->frame_cache_buffers[i] )
+                goto fail;
+        }
+    return dup;
+fail:
+    lwlibav_video_free_output_handler( dup );
+    return NULL;
+}
+
 void lwlibav_video_free_output_handler
 (
     lwlibav_video_output_handler_t *vohp
@@ -161,6 +369,15 @@ void lwlibav_video_set_seek_mode
     vdhp->seek_mode = seek_mode;
 }
 
+void lwlibav_video_set_seek_hint_threshold
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        seek_hint_threshold
+)
+{
+    vdhp->seek_hint_threshold = seek_hint_threshold;
+}
+
 void lwlibav_video_set_preferred_decoder_names
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -188,6 +405,33 @@ void lwlibav_video_set_decoder_options
     vdhp->ff_options = ff_options;
 }
 
+void lwlibav_video_set_frame_cache_size
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    size_t                          budget
+)
+{
+    vdhp->frame_cache_budget = budget;
+}
+
+void lwlibav_video_set_prefetch
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        prefetch
+)
+{
+    vdhp->prefetch = prefetch;
+}
+
+void lwlibav_video_set_pipelined_decoding
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    int                             pipelined_decoding
+)
+{
+    vdhp->pipelined_decoding = pipelined_decoding;
+}
+
 void lwlibav_video_set_log_handler
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -264,6 +508,34 @@ AVFrame *lwlibav_video_get_frame_buffer
     return vdhp ? vdhp->frame_buffer : NULL;
 }
 
+uint64_t lwlibav_video_get_decoded_picture_count
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    return vdhp->decoded_picture_count;
+}
+
+uint64_t lwlibav_video_get_seek_count
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    return vdhp->seek_count;
+}
+
+const lw_video_timestamp_t *lwlibav_video_get_timestamp_list
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                       *timestamp_count,
+    AVRational                     *time_base
+)
+{
+    *timestamp_count = vdhp->timestamp_count;
+    *time_base       = vdhp->format->streams[ vdhp->stream_index ]->time_base;
+    return vdhp->timestamp_list;
+}
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -274,6 +546,67 @@ void lwlibav_video_force_seek
 {
     /* Force seek before the next reading. */
     vdhp->last_frame_number = vdhp->frame_count + 1;
+    if( vdhp->pipeline )
+        vdhp->pipeline->active = 0;
+}
+
+/* Take the parameters of the stream, which libavformat gets by decoding in avformat_find_stream_info(), from the index.
+ * Return 0 if the stream needs no probing, i.e. the container header describes the rest. */
+static int import_stream_parameters
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    AVFormatContext *format_ctx = vdhp->format;
+    if( (format_ctx->ctx_flags & AVFMTCTX_NOHEADER)
+     || (unsigned int)vdhp->stream_index >= format_ctx->nb_streams
+     || vdhp->initial_pix_fmt == AV_PIX_FMT_NONE )
+        return -1;
+    AVStream          *stream   = format_ctx->streams[ vdhp->stream_index ];
+    AVCodecParameters *codecpar = stream->codecpar;
+    int                index    = vdhp->frame_list[1].extradata_index;
+    if( codecpar->codec_type != AVMEDIA_TYPE_VIDEO
+     || codecpar->codec_id   != vdhp->codec_id
+     || index < 0 || index >= vdhp->exh.entry_count
+     || !(stream->avg_frame_rate.num && stream->avg_frame_rate.den)
+     || !(stream->r_frame_rate.num   && stream->r_frame_rate.den) )
+        return -1;
+    lwlibav_extradata_t *entry = &vdhp->exh.entries[index];
+    if( codecpar->extradata_size == 0 && entry->extradata_size > 0 )
+    {
+        codecpar->extradata = (uint8_t *)av_mallocz( entry->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE );
+        if( !codecpar->extradata )
+            return -1;
+        memcpy( codecpar->extradata, entry->extradata, entry->extradata_size );
+        codecpar->extradata_size = entry->extradata_size;
+    }
+    if( codecpar->width == 0 || codecpar->height == 0 )
+    {
+        codecpar->width  = vdhp->initial_width;
+        codecpar->height = vdhp->initial_height;
+    }
+    if( codecpar->format == AV_PIX_FMT_NONE )
+        codecpar->format = vdhp->initial_pix_fmt;
+    return 0;
+}
+
+static int open_video_file
+(
+    const char                     *file_path,
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    if( lavf_open_input( &vdhp->format, file_path, vdhp->read_ahead, vdhp->direct_io, &vdhp->lh ) < 0 )
+        return -1;
+    /* Probing the streams reads and decodes the head of the file, which is done for every instance. */
+    if( import_stream_parameters( vdhp ) == 0 )
+        return 0;
+    if( avformat_find_stream_info( vdhp->format, NULL ) < 0 )
+    {
+        lw_log_show( &vdhp->lh, LW_LOG_FATAL, "Failed to avformat_find_stream_info." );
+        return -1;
+    }
+    return 0;
 }
 
 int lwlibav_video_get_desired_track
@@ -286,14 +619,18 @@ int lwlibav_video_get_desired_track
     AVCodecContext *ctx = NULL;
     if( vdhp->stream_index < 0
      || vdhp->frame_count == 0
-     || lavf_open_file( &vdhp->format, file_path, &vdhp->lh ) < 0
+     || open_video_file( file_path, vdhp ) < 0
      || find_and_open_decoder( &ctx, vdhp->format->streams[ vdhp->stream_index ]->codecpar,
                                vdhp->preferred_decoder_names, vdhp->prefer_hw_decoder, threads, -1.0, vdhp->ff_options ) < 0 )
     {
-        av_freep( &vdhp->index_entries );
-        lw_freep( &vdhp->frame_list );
-        lw_freep( &vdhp->order_converter );
-        lw_freep( &vdhp->keyframe_list );
+        if( !vdhp->shared_index )
+        {
+            av_freep( &vdhp->index_entries );
+            lw_freep( &vdhp->frame_list );
+            lw_freep( &vdhp->order_converter );
+            lw_freep( &vdhp->keyframe_list );
+            lw_freep( &vdhp->timestamp_list );
+        }
         if( vdhp->format )
             lavf_close_file( &vdhp->format );
         return -1;
@@ -525,6 +862,7 @@ static int decode_video_picture
     set_output_order_id( vdhp, pkt, picture_number );
     ret = decode_video_packet( vdhp->ctx, mov_frame, got_picture, pkt );
     vdhp->last_fed_picture_number = picture_number;
+    ++ vdhp->decoded_picture_count;
     /* We can't get the requested frame by feeding a picture if that picture is field coded.
      * This branch avoids putting empty data on the frame buffer. */
     if( *got_picture )
@@ -536,12 +874,44 @@ static int decode_video_picture
     *pkt_pts = pkt->pts;
     if( ret < 0 )
     {
-        lw_log_show( &vdhp->lh, LW_LOG_ERROR, "Failed to decode a video frame." );
+        lw_log_show( lwlibav_decoder_log_handler( (lwlibav_decode_handler_t *)vdhp ), LW_LOG_ERROR, "Failed to decode a video frame." );
         return -1;
     }
     return 0;
 }
 
+static inline uint32_t get_presentation_picture_number
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        decoding_picture_number
+)
+{
+    return vdhp->order_converter
+         ? vdhp->order_converter[decoding_picture_number].decoding_to_presentation
+         : decoding_picture_number;
+}
+
+/* Return 1 if decoding starts from a recovery point instead of a keyframe. */
+static inline int is_recovery_point
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        rap_number
+)
+{
+    return !!(vdhp->frame_list[ get_presentation_picture_number( vdhp, rap_number ) ].flags & LW_VFRAME_FLAG_RECOVERY);
+}
+
+/* Return the number of the first picture in decoding order which is correct when decoding starts from the point. */
+static inline uint64_t get_recovered_picture_number
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        rap_number
+)
+{
+    const video_frame_info_t *info = &vdhp->frame_list[ get_presentation_picture_number( vdhp, rap_number ) ];
+    return (info->flags & LW_VFRAME_FLAG_RECOVERY) ? rap_number + (uint64_t)info->recovery_frame_count : rap_number;
+}
+
 static void find_random_accessible_point
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -554,6 +924,7 @@ static void find_random_accessible_point
     if( decoding_picture_number == 0 )
         decoding_picture_number = vdhp->frame_list[presentation_picture_number].sample_number;
     *rap_number = decoding_picture_number;
+    uint32_t hint_number = 0;
     while( *rap_number )
     {
         if( vdhp->keyframe_list[ *rap_number ] )
@@ -563,10 +934,24 @@ static void find_random_accessible_point
             /* Shall be decoded from more past random access point. */
             is_leading = 0;
         }
+        else if( hint_number == 0 && vdhp->seek_hint_threshold )
+        {
+            /* The requested picture is correct if it follows the recovery point in output order and
+             * the recovery completes in decoding order before it. */
+            uint32_t hint_presentation_number = get_presentation_picture_number( vdhp, *rap_number );
+            const video_frame_info_t *hint = &vdhp->frame_list[hint_presentation_number];
+            if( (hint->flags & LW_VFRAME_FLAG_RECOVERY)
+             && hint_presentation_number <= presentation_picture_number
+             && *rap_number + (uint64_t)hint->recovery_frame_count <= vdhp->frame_list[presentation_picture_number].sample_number )
+                hint_number = *rap_number;
+        }
         --(*rap_number);
     }
     if( *rap_number == 0 )
         *rap_number = 1;
+    /* Start from the recovery point instead of the distant keyframe. */
+    if( hint_number && hint_number - *rap_number > vdhp->seek_hint_threshold )
+        *rap_number = hint_number;
 }
 
 static int64_t get_random_accessible_point_position
@@ -575,9 +960,7 @@ static int64_t get_random_accessible_point_position
     uint32_t                        rap_number
 )
 {
-    uint32_t presentation_rap_number = vdhp->order_converter
-                                     ? vdhp->order_converter[rap_number].decoding_to_presentation
-                                     : rap_number;
+    uint32_t presentation_rap_number = get_presentation_picture_number( vdhp, rap_number );
     return (vdhp->lw_seek_flags & SEEK_POS_BASED) ? vdhp->frame_list[presentation_rap_number].file_offset
          : (vdhp->lw_seek_flags & SEEK_PTS_BASED) ? vdhp->frame_list[presentation_rap_number].pts
          : (vdhp->lw_seek_flags & SEEK_DTS_BASED) ? vdhp->frame_list[presentation_rap_number].dts
@@ -678,6 +1061,7 @@ static uint32_t seek_video
         return 0;
     if( lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags ) < 0 )
         lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags | AVSEEK_FLAG_ANY );
+    ++ vdhp->seek_count;
     int      got_picture  = 0;
     int      output_ready = 0;
     int64_t  rap_pts = AV_NOPTS_VALUE;
@@ -756,7 +1140,7 @@ static uint32_t seek_video
             rap_pts = pkt_pts;
         if( ret == -1 && (pkt_pts == AV_NOPTS_VALUE || pkt_pts >= rap_pts) && !error_ignorance )
         {
-            lw_log_show( &vdhp->lh, LW_LOG_ERROR, "Failed to decode a video frame." );
+            lw_log_show( lwlibav_decoder_log_handler( (lwlibav_decode_handler_t *)vdhp ), LW_LOG_ERROR, "Failed to decode a video frame." );
             return 0;
         }
     }
@@ -766,6 +1150,170 @@ static uint32_t seek_video
     return current;
 }
 
+static frame_cache_entry_t *find_cached_picture
+(
+    lwlibav_video_frame_cache_t *fcp,
+    uint32_t                     picture_number
+)
+{
+    for( uint32_t i = 0; i < fcp->count; i++ )
+        if( fcp->entries[i].picture_number == picture_number )
+            return &fcp->entries[i];
+    return NULL;
+}
+
+static inline size_t get_frame_cache_budget
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    if( vdhp->frame_cache_budget == 0 && vdhp->reverse_access )
+        return REVERSE_FRAME_CACHE_SIZE;
+    return vdhp->frame_cache_budget;
+}
+
+/* Discard the least recently used frames until the total size gets within the limit. */
+static void evict_cached_pictures
+(
+    lwlibav_video_frame_cache_t *fcp,
+    size_t                       limit
+)
+{
+    while( fcp->count && fcp->size > limit )
+    {
+        uint32_t lru = 0;
+        for( uint32_t i = 1; i < fcp->count; i++ )
+            if( fcp->entries[i].last_used < fcp->entries[lru].last_used )
+                lru = i;
+        fcp->size -= fcp->entries[lru].size;
+        av_frame_free( &fcp->entries[lru].frame );
+        fcp->entries[lru] = fcp->entries[ -- fcp->count ];
+    }
+}
+
+/* Discard the cached pictures from the specified picture onward. */
+static void discard_cached_pictures
+(
+    lwlibav_video_frame_cache_t *fcp,
+    uint32_t                     picture_number
+)
+{
+    for( uint32_t i = 0; i < fcp->count; )
+        if( fcp->entries[i].picture_number >= picture_number )
+        {
+            fcp->size -= fcp->entries[i].size;
+            av_frame_free( &fcp->entries[i].frame );
+            fcp->entries[i] = fcp->entries[ -- fcp->count ];
+        }
+        else
+            ++i;
+}
+
+static void cache_decoded_picture
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    AVFrame                        *frame,
+    uint32_t                        picture_number
+)
+{
+    size_t budget = get_frame_cache_budget( vdhp );
+    if( budget == 0 )
+    {
+        /* The frames cached for reverse playback are no longer needed. */
+        if( vdhp->frame_cache )
+            evict_cached_pictures( vdhp->frame_cache, 0 );
+        return;
+    }
+    if( !frame->buf[0] )
+        return;
+    if( !vdhp->frame_cache )
+    {
+        lwlibav_video_frame_cache_t *fcp = (lwlibav_video_frame_cache_t *)lw_malloc_zero( sizeof(lwlibav_video_frame_cache_t) );
+        if( !fcp )
+            return;
+        if( !(fcp->stash = av_frame_alloc()) )
+        {
+            lw_free( fcp );
+            return;
+        }
+        vdhp->frame_cache = fcp;
+    }
+    lwlibav_video_frame_cache_t *fcp   = vdhp->frame_cache;
+    frame_cache_entry_t         *entry = find_cached_picture( fcp, picture_number );
+    if( entry )
+    {
+        entry->last_used = ++ fcp->clock;
+        return;
+    }
+    size_t size = get_frame_buffer_size( frame );
+    if( size > budget )
+        return;
+    evict_cached_pictures( fcp, budget - size );
+    if( fcp->count == fcp->capacity )
+    {
+        uint32_t capacity = fcp->capacity ? fcp->capacity * 2 : 16;
+        frame_cache_entry_t *entries = (frame_cache_entry_t *)realloc( fcp->entries, capacity * sizeof(frame_cache_entry_t) );
+        if( !entries )
+            return;
+        fcp->entries  = entries;
+        fcp->capacity = capacity;
+    }
+    AVFrame *clone = av_frame_clone( frame );
+    if( !clone )
+        return;
+    entry = &fcp->entries[ fcp->count ++ ];
+    entry->picture_number = picture_number;
+    entry->frame          = clone;
+    entry->size           = size;
+    entry->last_used      = ++ fcp->clock;
+    fcp->size += size;
+}
+
+/* Put back the last output from the decoder into the frame buffer it was output to.
+ * The decoder expects the buffer keeps it across the requests. */
+static void restore_decoder_output
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    lwlibav_video_frame_cache_t *fcp = vdhp->frame_cache;
+    if( !fcp || !fcp->stashed )
+        return;
+    av_frame_unref( vdhp->last_req_frame );
+    av_frame_move_ref( vdhp->last_req_frame, fcp->stash );
+    fcp->stashed = 0;
+}
+
+/* Return 1 if the picture is found in the cache and copied to the frame.
+ * Return 0 if not found.
+ * Return -1 otherwise. */
+static int get_cached_picture
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    AVFrame                        *frame,
+    uint32_t                        picture_number
+)
+{
+    lwlibav_video_frame_cache_t *fcp = vdhp->frame_cache;
+    if( !fcp )
+        return 0;
+    frame_cache_entry_t *entry = find_cached_picture( fcp, picture_number );
+    if( !entry )
+        return 0;
+    entry->last_used = ++ fcp->clock;
+    if( frame == vdhp->last_req_frame && !fcp->stashed )
+    {
+        av_frame_move_ref( fcp->stash, frame );
+        fcp->stashed = 1;
+    }
+    else
+        av_frame_unref( frame );
+    if( av_frame_ref( frame, entry->frame ) < 0 )
+        return -1;
+    frame->pts = vdhp->frame_list[picture_number].pts;
+    return 1;
+}
+
 static inline int copy_last_req_frame
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -867,6 +1415,12 @@ static int get_frame
                 if( picture_number == requested_picture_number )
                     /* Got the requested output frame. */
                     return 0;
+                else if( picture_number < requested_picture_number && !vdhp->last_half_frame
+                      && vdhp->frame_list[picture_number].sample_number >= get_recovered_picture_number( vdhp, rap_number )
+                      && !(vdhp->frame_list[picture_number].flags & (LW_VFRAME_FLAG_LEADING | LW_VFRAME_FLAG_CORRUPT)) )
+                    /* Keep the pictures decoded on the way since backward access would require them again.
+                     * The pictures before the recovery completes are not correct. */
+                    cache_decoded_picture( vdhp, frame, picture_number );
                 else if( vdhp->last_half_frame && (picture_number == requested_picture_number + 1)
                       && field_number_of_picture_in_frame( vdhp, frame, picture_number ) == 2 )
                     /* Got the requested output frame but the output timestamp is from one of the second displayed field. */
@@ -950,7 +1504,7 @@ static int get_frame
             av_frame_unref( frame );
             if( decode_video_packet( vdhp->ctx, frame, &got_picture, &pkt ) < 0 )
             {
-                lw_log_show( &vdhp->lh, LW_LOG_ERROR, "Failed to decode and flush a video frame." );
+                lw_log_show( lwlibav_decoder_log_handler( (lwlibav_decode_handler_t *)vdhp ), LW_LOG_ERROR, "Failed to decode and flush a video frame." );
                 return -1;
             }
             vdhp->last_fed_picture_number = current;
@@ -993,23 +1547,220 @@ static inline uint32_t get_last_half_offset
          :                     0;
 }
 
-static int get_requested_picture
+/* Return 1 if the output pictures are identified by the decoder without the heuristics on decoder delay. */
+static int is_pipelined_decoding_available
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    if( !vdhp->order_converter && !(vdhp->lw_seek_flags & SEEK_DTS_BASED) )
+        return 0;
+    /* A frame of field coded pictures is output with the identifier of either field. */
+    for( uint32_t i = 1; i <= vdhp->frame_count; i++ )
+        if( vdhp->frame_list[i].repeat_pict == 0 )
+            return 0;
+    return 1;
+}
+
+/* Prepare to decode from random accessible picture by the pipelined decoding.
+ * Return the number of picture where feeding starts if successful, or 0 otherwise. */
+static uint32_t seek_pipelined_video
 (
     lwlibav_video_decode_handler_t *vdhp,
-    AVFrame                        *frame,
-    uint32_t                        picture_number
+    uint32_t                        rap_number
 )
 {
-#define MAX_ERROR_COUNT 3   /* arbitrary */
-    if( picture_number > vdhp->frame_count )
-        picture_number = vdhp->frame_count;
-    uint32_t extradata_index;
-    uint32_t last_half_offset = get_last_half_offset( vdhp );
-    if( picture_number == vdhp->last_frame_number
-     || picture_number == vdhp->last_frame_number + last_half_offset )
+    lwlibav_video_pipeline_t *plp = vdhp->pipeline;
+    clear_decoded_frame_queue( &plp->queue );
+    plp->active  = 0;
+    plp->pending = 0;
+    int extradata_index = vdhp->frame_list[ get_presentation_picture_number( vdhp, rap_number ) ].extradata_index;
+    int64_t rap_pos = get_random_accessible_point_position( vdhp, rap_number );
+    if( extradata_index != vdhp->exh.current_index )
+        lwlibav_update_configuration( (lwlibav_decode_handler_t *)vdhp, rap_number, extradata_index, rap_pos );
+    else
+        lwlibav_flush_buffers( (lwlibav_decode_handler_t *)vdhp );
+    if( vdhp->error )
+        return 0;
+    if( lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags ) < 0 )
+        lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags | AVSEEK_FLAG_ANY );
+    ++ vdhp->seek_count;
+    vdhp->last_rap_number   = rap_number;
+    vdhp->exh.delay_count   = 0;
+    AVPacket *pkt = &vdhp->packet;
+    if( lwlibav_get_av_frame( vdhp->format, vdhp->stream_index, rap_number, pkt ) != 0 )
+        return 0;
+    /* Correct the current picture number in order to match DTS since libavformat might have sought wrong position. */
+    uint32_t picture_number = rap_number;
+    if( vdhp->lw_seek_flags & SEEK_DTS_BASED )
     {
-        /* The last frame is the requested frame. */
-        if( copy_last_req_frame( vdhp, frame ) < 0 )
+        picture_number = correct_current_frame_number( vdhp, pkt, rap_number, rap_number );
+        if( picture_number == 0 || picture_number > rap_number )
+            return 0;
+        /* Skip the packets before the random accessible picture if we got a more backward one. */
+        while( picture_number < rap_number )
+        {
+            if( lwlibav_get_av_frame( vdhp->format, vdhp->stream_index, ++picture_number, pkt ) != 0 )
+                return 0;
+        }
+    }
+    plp->active  = 1;
+    plp->pending = 1;
+    return rap_number;
+}
+
+/* Return 0 if successful.
+ * Return 1 if the pipelined decoding is unavailable.
+ * Return -1 otherwise. */
+static int get_pipelined_picture
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    AVFrame                        *frame,
+    uint32_t                        picture_number
+)
+{
+#define MAX_ERROR_COUNT 3   /* arbitrary */
+    lwlibav_video_pipeline_t *plp = vdhp->pipeline;
+    if( !plp )
+    {
+        if( !is_pipelined_decoding_available( vdhp ) )
+        {
+            vdhp->pipelined_decoding = 0;
+            return 1;
+        }
+        plp = (lwlibav_video_pipeline_t *)lw_malloc_zero( sizeof(lwlibav_video_pipeline_t) );
+        if( !plp )
+            return -1;
+        vdhp->pipeline = plp;
+    }
+    /* Continue decoding if the requested picture follows the last one and no nearer random accessible picture is present. */
+    uint32_t rap_number = vdhp->last_rap_number;
+    uint32_t current    = vdhp->last_fed_picture_number + 1;
+    int      seek_mode  = vdhp->seek_mode;
+    if( !plp->active
+     || picture_number <= vdhp->last_frame_number
+     || picture_number >  vdhp->last_frame_number + vdhp->forward_seek_threshold )
+    {
+        find_random_accessible_point( vdhp, picture_number, 0, &rap_number );
+        if( !plp->active || picture_number <= vdhp->last_frame_number || rap_number != vdhp->last_rap_number )
+            current = seek_pipelined_video( vdhp, rap_number );
+    }
+    AVPacket *pkt         = &vdhp->packet;
+    int       error_count = 0;
+    while( 1 )
+    {
+        int error_ignorance = seek_mode != SEEK_MODE_NORMAL || is_recovery_point( vdhp, rap_number );
+        uint32_t rap_presentation_number = get_presentation_picture_number( vdhp, rap_number );
+        while( current )
+        {
+            /* Take out the output pictures up to the requested one. */
+            AVFrame *output;
+            while( (output = take_decoded_frame( &plp->queue )) )
+            {
+                int64_t output_id = get_output_order_id( output );
+                if( output_id == AV_NOPTS_VALUE )
+                {
+                    /* The decoder does not pass the identifiers through. */
+                    av_frame_free( &output );
+                    close_pipeline( vdhp );
+                    vdhp->pipelined_decoding = 0;
+                    lwlibav_video_force_seek( vdhp );
+                    return 1;
+                }
+                uint32_t output_number = (uint32_t)output_id;
+                if( output_number == picture_number )
+                {
+                    av_frame_unref( frame );
+                    av_frame_move_ref( frame, output );
+                    av_frame_free( &output );
+                    vdhp->last_dec_frame  = frame;
+                    vdhp->last_half_frame = 0;
+                    return 0;
+                }
+                else if( output_number > picture_number )
+                {
+                    /* The requested picture has been lost. */
+                    av_frame_free( &output );
+                    current = 0;
+                    break;
+                }
+                if( vdhp->frame_list[output_number].sample_number >= get_recovered_picture_number( vdhp, rap_number )
+                 && !(vdhp->frame_list[output_number].flags & (LW_VFRAME_FLAG_LEADING | LW_VFRAME_FLAG_CORRUPT)) )
+                    /* Keep the pictures decoded on the way since backward access would require them again.
+                     * The pictures before the recovery completes are not correct. */
+                    cache_decoded_picture( vdhp, output, output_number );
+                av_frame_free( &output );
+            }
+            if( current == 0 || !plp->active )
+            {
+                current = 0;
+                break;
+            }
+            /* Feed the next packet, or drain the decoder at the end of the stream. */
+            int ret = 0;
+            if( plp->pending )
+                plp->pending = 0;
+            else
+                ret = current > vdhp->frame_count ? 1 : lwlibav_get_av_frame( vdhp->format, vdhp->stream_index, current, pkt );
+            if( ret != 0 )
+            {
+                plp->active = 0;
+                if( send_packet_and_receive_frames( vdhp->ctx, &plp->queue, NULL ) < 0 )
+                    current = 0;
+                continue;
+            }
+            if( pkt->flags & AV_PKT_FLAG_KEY )
+                vdhp->last_rap_number = current;
+            set_output_order_id( vdhp, pkt, current );
+            int64_t pkt_id = pkt->pts;
+            ret = send_packet_and_receive_frames( vdhp->ctx, &plp->queue, pkt );
+            vdhp->last_fed_picture_number = current;
+            ++ vdhp->decoded_picture_count;
+            ++current;
+            /* Some decoders return an error when feeding a leading picture. It's not fatal at all. */
+            if( ret < 0 && !error_ignorance && (pkt_id == AV_NOPTS_VALUE || pkt_id >= rap_presentation_number) )
+            {
+                lw_log_show( lwlibav_decoder_log_handler( (lwlibav_decode_handler_t *)vdhp ), LW_LOG_ERROR, "Failed to decode a video frame." );
+                current = 0;
+            }
+        }
+        /* Failed to get requested picture. */
+        plp->active = 0;
+        if( vdhp->error || seek_mode == SEEK_MODE_AGGRESSIVE )
+            return -1;
+        if( ++error_count > MAX_ERROR_COUNT || rap_number <= 1 )
+        {
+            if( seek_mode == SEEK_MODE_UNSAFE )
+                return -1;
+            /* Retry to decode from the same random accessible picture with error ignorance. */
+            seek_mode = SEEK_MODE_AGGRESSIVE;
+        }
+        else
+            /* Retry to decode from more past random accessible picture. */
+            find_random_accessible_point( vdhp, picture_number, rap_number - 1, &rap_number );
+        current = seek_pipelined_video( vdhp, rap_number );
+    }
+#undef MAX_ERROR_COUNT
+}
+
+static int get_requested_picture
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    AVFrame                        *frame,
+    uint32_t                        picture_number
+)
+{
+#define MAX_ERROR_COUNT 3   /* arbitrary */
+    if( picture_number > vdhp->frame_count )
+        picture_number = vdhp->frame_count;
+    restore_decoder_output( vdhp );
+    uint32_t extradata_index;
+    uint32_t last_half_offset = get_last_half_offset( vdhp );
+    if( picture_number == vdhp->last_frame_number
+     || picture_number == vdhp->last_frame_number + last_half_offset )
+    {
+        /* The last frame is the requested frame. */
+        if( copy_last_req_frame( vdhp, frame ) < 0 )
             goto video_fail;
         extradata_index = vdhp->frame_list[picture_number].extradata_index;
         goto return_frame;
@@ -1026,6 +1777,22 @@ static int get_requested_picture
         extradata_index = vdhp->frame_list[ vdhp->first_valid_frame_number ].extradata_index;
         goto return_frame;
     }
+    /* Backward access within the decoded GOPs is served without the decoder.
+     * Its state is left untouched so that the subsequent access can continue decoding. */
+    int cached = get_cached_picture( vdhp, frame, picture_number );
+    if( cached < 0 )
+        goto video_fail;
+    else if( cached == 1 )
+        return 0;
+    if( vdhp->pipelined_decoding )
+    {
+        int ret = get_pipelined_picture( vdhp, frame, picture_number );
+        if( ret < 0 )
+            goto video_fail;
+        else if( ret == 0 )
+            goto picture_decoded;
+        /* Fall back on the decoding with the heuristics on decoder delay. */
+    }
     uint32_t start_number;  /* number of picture, for normal decoding, where decoding starts excluding decoding delay */
     uint32_t rap_number;    /* number of picture, for seeking, where decoding starts excluding decoding delay */
     uint32_t last_frame_number = vdhp->last_frame_number + last_half_offset;
@@ -1047,7 +1814,8 @@ static int get_requested_picture
             /* Require starting to decode from random accessible picture. */
             rap_pos = get_random_accessible_point_position( vdhp, rap_number );
             vdhp->last_rap_number = rap_number;
-            start_number = seek_video( vdhp, frame, picture_number, rap_number, rap_pos, seek_mode != SEEK_MODE_NORMAL );
+            start_number = seek_video( vdhp, frame, picture_number, rap_number, rap_pos,
+                                       seek_mode != SEEK_MODE_NORMAL || is_recovery_point( vdhp, rap_number ) );
         }
     }
     /* Get frame containing the requested picture. */
@@ -1072,9 +1840,13 @@ static int get_requested_picture
             rap_pos = get_random_accessible_point_position( vdhp, rap_number );
             vdhp->last_rap_number = rap_number;
         }
-        start_number = seek_video( vdhp, frame, picture_number, rap_number, rap_pos, seek_mode != SEEK_MODE_NORMAL );
+        start_number = seek_video( vdhp, frame, picture_number, rap_number, rap_pos,
+                                   seek_mode != SEEK_MODE_NORMAL || is_recovery_point( vdhp, rap_number ) );
     }
+picture_decoded:
     vdhp->last_frame_number = picture_number;
+    if( !vdhp->last_half_frame )
+        cache_decoded_picture( vdhp, frame, picture_number );
     extradata_index = vdhp->frame_list[picture_number].extradata_index;
 return_frame:;
     vdhp->last_req_frame = frame;
@@ -1089,11 +1861,227 @@ return_frame:;
     return 0;
 video_fail:
     /* fatal error of decoding */
-    lw_log_show( &vdhp->lh, LW_LOG_ERROR, "Couldn't get the requested video frame." );
+    lw_log_show( lwlibav_decoder_log_handler( (lwlibav_decode_handler_t *)vdhp ), LW_LOG_ERROR, "Couldn't get the requested video frame." );
     return -1;
 #undef MAX_ERROR_COUNT
 }
 
+/* Update the access pattern and return whether the requests are in reverse playback. */
+static int detect_reverse_access
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        picture_number
+)
+{
+    if( picture_number < vdhp->last_requested_number
+     && picture_number + REVERSE_ACCESS_MAX_STEP >= vdhp->last_requested_number )
+    {
+        if( vdhp->reverse_count < REVERSE_ACCESS_THRESHOLD )
+            ++ vdhp->reverse_count;
+    }
+    else if( picture_number != vdhp->last_requested_number )
+        vdhp->reverse_count = 0;
+    vdhp->last_requested_number = picture_number;
+    return vdhp->reverse_count >= REVERSE_ACCESS_THRESHOLD;
+}
+
+/* In reverse playback, decode the pictures preceding the requested one in a row and keep them in the cache
+ * so that each GOP is decoded once. If they don't fit in the budget, only the nearest ones are decoded and
+ * the rest are done again from the random accessible point on demand. */
+static int get_backward_picture
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    AVFrame                        *frame,
+    uint32_t                        picture_number
+)
+{
+    if( picture_number > vdhp->frame_count )
+        picture_number = vdhp->frame_count;
+    if( !vdhp->frame_cache || !find_cached_picture( vdhp->frame_cache, picture_number ) )
+    {
+        /* The frame buffer holds the last requested picture, which is valid in reverse playback. */
+        size_t   frame_size = get_frame_buffer_size( frame );
+        uint64_t window     = frame_size ? MAX( get_frame_cache_budget( vdhp ) / frame_size, 1 ) : 1;
+        uint32_t start      = picture_number > window ? picture_number - (uint32_t)window + 1 : 1;
+        for( uint32_t i = start; i < picture_number; i++ )
+            if( get_requested_picture( vdhp, frame, i ) < 0 )
+                return -1;
+    }
+    if( get_requested_picture( vdhp, frame, picture_number ) < 0 )
+        return -1;
+    /* The following pictures have already been output. */
+    if( vdhp->frame_cache )
+        discard_cached_pictures( vdhp->frame_cache, picture_number + 1 );
+    return 0;
+}
+
+static void *prefetch_thread
+(
+    void *arg
+)
+{
+    lwlibav_video_decode_handler_t *vdhp = (lwlibav_video_decode_handler_t *)arg;
+    lwlibav_video_prefetcher_t     *pfp  = vdhp->prefetcher;
+    lw_mutex_lock( pfp->mutex );
+    while( 1 )
+    {
+        while( !pfp->exit && (pfp->next == 0 || pfp->next > vdhp->frame_count || pfp->count >= pfp->size) )
+            lw_cond_wait( pfp->cond, pfp->mutex );
+        if( pfp->exit )
+            break;
+        uint32_t picture_number = pfp->next;
+        pfp->decoding = 1;
+        lw_mutex_unlock( pfp->mutex );
+        /* Errors here are not reported since the host may not expect any callback from this thread.
+         * The requesting side decodes the picture by itself again and reports the error if any. */
+        vdhp->decoder_lh = &pfp->lh;
+        int ret = get_requested_picture( vdhp, pfp->decode_frame, picture_number );
+        vdhp->decoder_lh = NULL;
+        lw_mutex_lock( pfp->mutex );
+        pfp->decoding = 0;
+        if( pfp->next == picture_number )
+        {
+            AVFrame *slot = pfp->ring[ (pfp->head + pfp->count) % pfp->size ];
+            av_frame_unref( slot );
+            if( ret == 0 && av_frame_ref( slot, pfp->decode_frame ) == 0 )
+            {
+                if( pfp->count == 0 )
+                    pfp->first = picture_number;
+                ++ pfp->count;
+                ++ pfp->next;
+            }
+            else
+                pfp->next = 0;
+        }
+        lw_cond_broadcast( pfp->cond );
+    }
+    lw_mutex_unlock( pfp->mutex );
+    return NULL;
+}
+
+static int open_prefetcher
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    lwlibav_video_prefetcher_t *pfp = (lwlibav_video_prefetcher_t *)lw_malloc_zero( sizeof(lwlibav_video_prefetcher_t) );
+    if( !pfp )
+        return -1;
+    vdhp->prefetcher = pfp;
+    pfp->size  = vdhp->prefetch;
+    pfp->lh    = vdhp->lh;
+    pfp->lh.level = LW_LOG_QUIET;
+    pfp->mutex = lw_mutex_create();
+    pfp->cond  = lw_cond_create();
+    pfp->ring  = (AVFrame **)lw_malloc_zero( pfp->size * sizeof(AVFrame *) );
+    pfp->decode_frame = av_frame_alloc();
+    if( !pfp->mutex || !pfp->cond || !pfp->ring || !pfp->decode_frame )
+        goto fail;
+    for( uint32_t i = 0; i < pfp->size; i++ )
+        if( !(pfp->ring[i] = av_frame_alloc()) )
+            goto fail;
+    pfp->thread = lw_thread_create( prefetch_thread, vdhp );
+    if( !pfp->thread )
+        goto fail;
+    return 0;
+fail:
+    close_prefetcher( vdhp );
+    return -1;
+}
+
+static void flush_prefetched_pictures
+(
+    lwlibav_video_prefetcher_t *pfp,
+    uint32_t                    picture_number  /* pictures before this are discarded */
+)
+{
+    while( pfp->count && pfp->first < picture_number )
+    {
+        av_frame_unref( pfp->ring[ pfp->head ] );
+        pfp->head = (pfp->head + 1) % pfp->size;
+        ++ pfp->first;
+        -- pfp->count;
+    }
+}
+
+static int get_prefetched_picture
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        picture_number,
+    int                             reverse_access
+)
+{
+    if( picture_number > vdhp->frame_count )
+        picture_number = vdhp->frame_count;
+    if( !vdhp->prefetcher && open_prefetcher( vdhp ) < 0 )
+    {
+        lw_log_show( &vdhp->lh, LW_LOG_FATAL, "Failed to start the background video decoder." );
+        return -1;
+    }
+    lwlibav_video_prefetcher_t *pfp = vdhp->prefetcher;
+    lw_mutex_lock( pfp->mutex );
+    if( vdhp->reverse_access != reverse_access )
+    {
+        /* The background decoder refers to the access pattern while decoding, so change it only while stopped. */
+        pfp->next = 0;
+        while( pfp->decoding )
+            lw_cond_wait( pfp->cond, pfp->mutex );
+        vdhp->reverse_access = reverse_access;
+    }
+    if( picture_number == pfp->last_output )
+    {
+        lw_mutex_unlock( pfp->mutex );
+        return 1;
+    }
+    int ret = 0;
+    while( 1 )
+    {
+        if( pfp->count && picture_number >= pfp->first && picture_number < pfp->first + pfp->count )
+        {
+            /* The requested picture has already been decoded. */
+            flush_prefetched_pictures( pfp, picture_number );
+            av_frame_unref( vdhp->frame_buffer );
+            ret = av_frame_ref( vdhp->frame_buffer, pfp->ring[ pfp->head ] );
+            break;
+        }
+        if( pfp->next && picture_number >= pfp->next
+         && picture_number - pfp->next < vdhp->forward_seek_threshold )
+        {
+            /* The requested picture is coming soon. Make room and wait for it. */
+            flush_prefetched_pictures( pfp, picture_number );
+            lw_cond_broadcast( pfp->cond );
+            lw_cond_wait( pfp->cond, pfp->mutex );
+            continue;
+        }
+        /* Seek. Stop the background decoder and get the requested picture here. */
+        pfp->next = 0;
+        flush_prefetched_pictures( pfp, UINT32_MAX );
+        while( pfp->decoding )
+            lw_cond_wait( pfp->cond, pfp->mutex );
+        ret = reverse_access ? get_backward_picture ( vdhp, pfp->decode_frame, picture_number )
+                             : get_requested_picture( vdhp, pfp->decode_frame, picture_number );
+        if( ret == 0 )
+        {
+            av_frame_unref( vdhp->frame_buffer );
+            ret = av_frame_ref( vdhp->frame_buffer, pfp->decode_frame );
+        }
+        break;
+    }
+    if( ret == 0 )
+    {
+        pfp->last_output = picture_number;
+        /* Keep decoding ahead from the picture following the last one in the ring.
+         * Decoding ahead is useless in reverse playback. */
+        if( pfp->next == 0 && !reverse_access )
+            pfp->next = pfp->count ? pfp->first + pfp->count : picture_number + 1;
+    }
+    else
+        pfp->last_output = 0;
+    lw_cond_broadcast( pfp->cond );
+    lw_mutex_unlock( pfp->mutex );
+    return ret < 0 ? -1 : 0;
+}
+
 static inline int check_frame_buffer_identical
 (
     AVFrame *a,
@@ -1269,116 +2257,118 @@ static int lwlibav_repeat_control
     }
 }
 
-static int64_t lwlibav_get_ts
+static uint32_t lwlibav_vfr2cfr
 (
     lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
     uint32_t                        frame_number
 )
 {
-    return (vdhp->lw_seek_flags & (SEEK_PTS_GENERATED | SEEK_PTS_BASED)) ? vdhp->frame_list[frame_number].pts
-         : (vdhp->lw_seek_flags & SEEK_DTS_BASED)                        ? vdhp->frame_list[frame_number].dts
-         :                                                                 AV_NOPTS_VALUE;
+    /* Convert VFR to CFR. */
+    AVRational time_base = vdhp->format->streams[ vdhp->stream_index ]->time_base;
+    return lw_vfr2cfr_frame_number( vdhp->timestamp_list, vdhp->timestamp_count, vdhp->frame_count,
+                                    time_base.num, time_base.den, vohp->cfr_num, vohp->cfr_den, frame_number );
 }
 
-static uint32_t lwlibav_vfr2cfr
+/* The pixel formats described in the index may not match pixel formats supported by the active decoder.
+ * This selects the best pixel format from supported pixel formats with best effort. */
+static void handle_decoder_pix_fmt
 (
-    lwlibav_video_decode_handler_t *vdhp,
-    lwlibav_video_output_handler_t *vohp,
-    uint32_t                        frame_number
+    AVCodecParameters *codecpar,
+    const AVCodec     *codec,
+    enum AVPixelFormat pix_fmt
 )
 {
-    /* Convert VFR to CFR. */
-    double target_ts  = (double)((uint64_t)(frame_number - 1) * vohp->cfr_den) / vohp->cfr_num;
-    double current_ts = DBL_MAX;
-    AVRational time_base = vdhp->format->streams[ vdhp->stream_index ]->time_base;
-    int64_t ts = lwlibav_get_ts( vdhp, vdhp->last_ts_frame_number );
-    if( ts != AV_NOPTS_VALUE )
+    assert( codecpar && codec );
+    if( codec->pix_fmts )
+        codecpar->format = (int)avcodec_find_best_pix_fmt_of_list( codec->pix_fmts, pix_fmt, 1, NULL );
+    else
+        codecpar->format = (int)pix_fmt;
+}
+
+/* Decode from the first random accessible picture until the decoder outputs a picture. */
+static int search_first_valid_frame
+(
+    lwlibav_video_decode_handler_t *vdhp
+)
+{
+    vdhp->first_valid_frame_number = 0;
+    if( vdhp->frame_count != 1 )
     {
-        current_ts = ((double)(ts - vdhp->min_ts) * time_base.num) / time_base.den;
-        if( target_ts == current_ts )
-            return vdhp->last_ts_frame_number;
+        uint32_t rap_number;
+        find_random_accessible_point( vdhp, 1, 0, &rap_number );
+        int64_t rap_pos = get_random_accessible_point_position( vdhp, rap_number );
+        if( lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags ) < 0 )
+            lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags | AVSEEK_FLAG_ANY );
     }
-    uint32_t composition_frame_number = vdhp->last_ts_frame_number;
-    double   prev_ts = current_ts;
-    if( target_ts < current_ts )
+    uint32_t decoder_delay = get_decoder_delay( vdhp->ctx );
+    uint32_t thread_delay  = decoder_delay - vdhp->ctx->has_b_frames;
+    AVPacket *pkt = &vdhp->packet;
+    for( uint32_t i = 1; i <= vdhp->frame_count + vdhp->exh.delay_count; i++ )
     {
-        for( composition_frame_number--;
-             composition_frame_number;
-             composition_frame_number-- )
+        lwlibav_get_av_frame( vdhp->format, vdhp->stream_index, i, pkt );
+        av_frame_unref( vdhp->frame_buffer );
+        set_output_order_id( vdhp, pkt, i );
+        int got_picture;
+        int ret = decode_video_packet( vdhp->ctx, vdhp->frame_buffer, &got_picture, pkt );
+        /* Handle decoder delay derived from PAFF field coded pictures. */
+        if( i <= vdhp->frame_count && i > decoder_delay
+         && !got_picture && vdhp->frame_list[i].repeat_pict == 0 )
         {
-            ts = lwlibav_get_ts( vdhp, composition_frame_number );
-            if( ts != AV_NOPTS_VALUE )
-            {
-                current_ts = ((double)(ts - vdhp->min_ts) * time_base.num) / time_base.den;
-                prev_ts = current_ts;
-                if( current_ts <= target_ts )
-                    break;
-            }
+            /* No output picture since the second field coded picture of the next frame is not decoded yet. */
+            if( decoder_delay - thread_delay < 2 * vdhp->ctx->has_b_frames + 1UL )
+                decoder_delay = thread_delay + 2 * vdhp->ctx->has_b_frames + 1UL;
         }
-        if( composition_frame_number == 0 )
-            return 0;
-    }
-    double next_target_ts = (double)((uint64_t)frame_number * vohp->cfr_den) / vohp->cfr_num;
-    for( composition_frame_number++;
-         composition_frame_number <= vdhp->frame_count;
-         composition_frame_number++ )
-    {
-        ts = lwlibav_get_ts( vdhp, composition_frame_number );
-        if( ts != AV_NOPTS_VALUE )
+        if( ret >= 0 )
         {
-            current_ts = ((double)(ts - vdhp->min_ts) * time_base.num) / time_base.den;
-            if( current_ts >= target_ts )
+            if( got_picture )
             {
-                uint32_t prev_composition_frame_number = composition_frame_number;
-                while( lwlibav_get_ts( vdhp, --prev_composition_frame_number ) == AV_NOPTS_VALUE );
-                if( prev_composition_frame_number == 0 )
-                    frame_number = 1;
+                /* Found the first valid video frame. */
+                int64_t output_id = get_output_order_id( vdhp->frame_buffer );
+                if( output_id != AV_NOPTS_VALUE )
+                    vdhp->first_valid_frame_number = (uint32_t)output_id;
                 else
+                    vdhp->first_valid_frame_number = i - MIN( decoder_delay, vdhp->exh.delay_count );
+                if( vdhp->first_valid_frame_number > 1 || vdhp->frame_count == 1 )
                 {
-                    if( current_ts > next_target_ts )
-                        /* Between the current target and the next target, there are no input frames.
-                         * Therefore, output the previous frame. This is absolutely correct. */
-                        frame_number = prev_composition_frame_number;
-                    else
-                    {
-                        if( current_ts > (next_target_ts + target_ts) / 2 )
-                            /* The current frame is far from the current target and should be a candidate for the next target. */
-                            frame_number = prev_composition_frame_number;
-                        else
-                        {
-                            /* Choose the nearest one. */
-                            if( current_ts - target_ts >= target_ts - prev_ts )
-                                frame_number = prev_composition_frame_number;
-                            else
-                                frame_number = composition_frame_number;
-                        }
-                    }
+                    vdhp->first_valid_frame = av_frame_clone( vdhp->frame_buffer );
+                    if( !vdhp->first_valid_frame )
+                        return -1;
+                    av_frame_unref( vdhp->frame_buffer );
+                    vdhp->first_valid_frame->pts = vdhp->frame_list[ vdhp->first_valid_frame_number ].pts;
                 }
-                break;
+                return 0;
             }
-            prev_ts = current_ts;
+            else if( pkt->data )
+                /* Output is delayed. */
+                ++ vdhp->exh.delay_count;
+            else
+                /* No more output.
+                 * Failed to find the first valid video frame. */
+                return -1;
         }
     }
-    if( composition_frame_number > vdhp->frame_count )
-        frame_number = vdhp->frame_count;
-    vdhp->last_ts_frame_number = frame_number;
-    return frame_number;
+    return 0;
 }
 
-/* The pixel formats described in the index may not match pixel formats supported by the active decoder.
- * This selects the best pixel format from supported pixel formats with best effort. */
-static void handle_decoder_pix_fmt
+/* Search for the first valid frame at the first request. */
+static int resolve_first_valid_frame
 (
-    AVCodecParameters *codecpar,
-    const AVCodec     *codec,
-    enum AVPixelFormat pix_fmt
+    lwlibav_video_decode_handler_t *vdhp
 )
 {
-    assert( codecpar && codec );
-    if( codec->pix_fmts )
-        codecpar->format = (int)avcodec_find_best_pix_fmt_of_list( codec->pix_fmts, pix_fmt, 1, NULL );
-    else
-        codecpar->format = (int)pix_fmt;
+    if( vdhp->first_valid_frame_state == FIRST_VALID_FRAME_MISSING )
+        return -1;
+    if( search_first_valid_frame( vdhp ) < 0 )
+    {
+        vdhp->first_valid_frame_state = FIRST_VALID_FRAME_MISSING;
+        lw_log_show( &vdhp->lh, LW_LOG_FATAL, "Failed to find the first valid video frame." );
+        return -1;
+    }
+    vdhp->first_valid_frame_state = FIRST_VALID_FRAME_FOUND;
+    /* The decoder went ahead of the requested frame. */
+    lwlibav_video_force_seek( vdhp );
+    return 0;
 }
 
 static int get_video_frame
@@ -1390,15 +2380,22 @@ static int get_video_frame
 {
     if( vohp->repeat_control )
         return lwlibav_repeat_control( vdhp, vohp, frame_number );
+    int reverse_access = detect_reverse_access( vdhp, frame_number );
+    if( vdhp->prefetch )
+        return get_prefetched_picture( vdhp, frame_number, reverse_access );
+    vdhp->reverse_access = reverse_access;
+    restore_decoder_output( vdhp );
     if( frame_number == vdhp->last_frame_number )
         return 1;
+    if( reverse_access )
+        return get_backward_picture( vdhp, vdhp->frame_buffer, frame_number );
     return get_requested_picture( vdhp, vdhp->frame_buffer, frame_number );
 }
 
 /* Return 0 if successful.
  * Return 1 if the same frame was requested at the last call.
  * Return a negative value otherwise. */
-int lwlibav_video_get_frame
+int lwlibav_video_decode_frame
 (
     lwlibav_video_decode_handler_t *vdhp,
     lwlibav_video_output_handler_t *vohp,
@@ -1411,8 +2408,24 @@ int lwlibav_video_get_frame
         if( frame_number == 0 )
             return -1;
     }
+    if( vdhp->first_valid_frame_state != FIRST_VALID_FRAME_FOUND
+     && resolve_first_valid_frame( vdhp ) < 0 )
+        return -1;
+    return get_video_frame( vdhp, vohp, frame_number );
+}
+
+/* Return 0 if successful.
+ * Return 1 if the same frame was requested at the last call.
+ * Return a negative value otherwise. */
+int lwlibav_video_get_frame
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    uint32_t                        frame_number
+)
+{
     int ret;
-    if( (ret = get_video_frame( vdhp, vohp, frame_number )) != 0
+    if( (ret = lwlibav_video_decode_frame( vdhp, vohp, frame_number )) != 0
      || (ret = update_scaler_configuration_if_needed( &vohp->scaler, &vdhp->lh, vdhp->frame_buffer )) < 0 )
         return ret;
     return 0;
@@ -1450,66 +2463,18 @@ int lwlibav_video_find_first_valid_frame
     AVCodecParameters   *codecpar = vdhp->format->streams[ vdhp->stream_index ]->codecpar;
     handle_decoder_pix_fmt( codecpar, codec, (enum AVPixelFormat)codecpar->format );
     vdhp->ctx->pix_fmt = (enum AVPixelFormat)codecpar->format;  /* Correct decoder pixel format. */
-    vdhp->last_ts_frame_number = vdhp->frame_count;
     vdhp->av_seek_flags = (vdhp->lw_seek_flags & SEEK_POS_BASED) ? AVSEEK_FLAG_BYTE
                         : vdhp->lw_seek_flags == 0               ? AVSEEK_FLAG_FRAME
                         : 0;
     if( vdhp->frame_count != 1 )
-    {
         vdhp->av_seek_flags |= AVSEEK_FLAG_BACKWARD;
-        uint32_t rap_number;
-        find_random_accessible_point( vdhp, 1, 0, &rap_number );
-        int64_t rap_pos = get_random_accessible_point_position( vdhp, rap_number );
-        if( lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags ) < 0 )
-            lavf_seek_frame( vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags | AVSEEK_FLAG_ANY );
-    }
-    uint32_t decoder_delay = get_decoder_delay( vdhp->ctx );
-    uint32_t thread_delay  = decoder_delay - vdhp->ctx->has_b_frames;
-    AVPacket *pkt = &vdhp->packet;
-    for( uint32_t i = 1; i <= vdhp->frame_count + vdhp->exh.delay_count; i++ )
-    {
-        lwlibav_get_av_frame( vdhp->format, vdhp->stream_index, i, pkt );
-        av_frame_unref( vdhp->frame_buffer );
-        set_output_order_id( vdhp, pkt, i );
-        int got_picture;
-        int ret = decode_video_packet( vdhp->ctx, vdhp->frame_buffer, &got_picture, pkt );
-        /* Handle decoder delay derived from PAFF field coded pictures. */
-        if( i <= vdhp->frame_count && i > decoder_delay
-         && !got_picture && vdhp->frame_list[i].repeat_pict == 0 )
-        {
-            /* No output picture since the second field coded picture of the next frame is not decoded yet. */
-            if( decoder_delay - thread_delay < 2 * vdhp->ctx->has_b_frames + 1UL )
-                decoder_delay = thread_delay + 2 * vdhp->ctx->has_b_frames + 1UL;
-        }
-        if( ret >= 0 )
-        {
-            if( got_picture )
-            {
-                /* Found the first valid video frame. */
-                int64_t output_id = get_output_order_id( vdhp->frame_buffer );
-                if( output_id != AV_NOPTS_VALUE )
-                    vdhp->first_valid_frame_number = (uint32_t)output_id;
-                else
-                    vdhp->first_valid_frame_number = i - MIN( decoder_delay, vdhp->exh.delay_count );
-                if( vdhp->first_valid_frame_number > 1 || vdhp->frame_count == 1 )
-                {
-                    vdhp->first_valid_frame = av_frame_clone( vdhp->frame_buffer );
-                    if( !vdhp->first_valid_frame )
-                        return -1;
-                    av_frame_unref( vdhp->frame_buffer );
-                    vdhp->first_valid_frame->pts = vdhp->frame_list[ vdhp->first_valid_frame_number ].pts;
-                }
-                break;
-            }
-            else if( pkt->data )
-                /* Output is delayed. */
-                ++ vdhp->exh.delay_count;
-            else
-                /* No more output.
-                 * Failed to find the first valid video frame. */
-                return -1;
-        }
-    }
+    /* Decoding from the start of the stream takes the most of the time to open the source,
+     * so it is deferred until the first request.
+     * No search is needed if the index recorded that the decoder outputs the first frame. */
+    vdhp->first_valid_frame_state = vdhp->first_valid_frame_number == 1 && vdhp->frame_count != 1
+                                  ? FIRST_VALID_FRAME_FOUND
+                                  : FIRST_VALID_FRAME_PENDING;
+    lwlibav_video_force_seek( vdhp );
     return 0;
 }
 
@@ -61,6 +61,16 @@ void lwlibav_video_free_decode_handler
     lwlibav_video_decode_handler_t *vdhp
 );
 
+lwlibav_video_decode_handler_t *lwlibav_video_duplicate_decode_handler
+(
+    lwlibav_video_decode_handler_t *vdhp
+);
+
+lwlibav_video_output_handler_t *lwlibav_video_duplicate_output_handler
+(
+    lwlibav_video_output_handler_t *vohp
+);
+
 void lwlibav_video_free_output_handler
 (
     lwlibav_video_output_handler_t *vohp
@@ -91,6 +101,12 @@ void lwlibav_video_set_seek_mode
     int                             seek_mode
 );
 
+void lwlibav_video_set_seek_hint_threshold
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        seek_hint_threshold
+);
+
 void lwlibav_video_set_preferred_decoder_names
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -109,6 +125,24 @@ void lwlibav_video_set_decoder_options
     const char                     *ff_options
 );
 
+void lwlibav_video_set_prefetch
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                        prefetch
+);
+
+void lwlibav_video_set_frame_cache_size
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    size_t                          budget
+);
+
+void lwlibav_video_set_pipelined_decoding
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    int                             pipelined_decoding
+);
+
 void lwlibav_video_set_log_handler
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -158,6 +192,25 @@ AVFrame *lwlibav_video_get_frame_buffer
     lwlibav_video_decode_handler_t *vdhp
 );
 
+uint64_t lwlibav_video_get_decoded_picture_count
+(
+    lwlibav_video_decode_handler_t *vdhp
+);
+
+uint64_t lwlibav_video_get_seek_count
+(
+    lwlibav_video_decode_handler_t *vdhp
+);
+
+/* Return the valid timestamps of the frames in presentation order, which are relative to the first frame.
+ * The frames without a valid timestamp are not listed. */
+const lw_video_timestamp_t *lwlibav_video_get_timestamp_list
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    uint32_t                       *timestamp_count,
+    AVRational                     *time_base
+);
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -188,6 +241,15 @@ void lwlibav_video_set_initial_input_format
     lwlibav_video_decode_handler_t *vdhp
 );
 
+/* Decode the requested frame into the frame buffer without updating the scaler.
+ * The caller is responsible for calling update_scaler_configuration_if_needed() before the output conversion. */
+int lwlibav_video_decode_frame
+(
+    lwlibav_video_decode_handler_t *vdhp,
+    lwlibav_video_output_handler_t *vohp,
+    uint32_t                        frame_number
+);
+
 int lwlibav_video_get_frame
 (
     lwlibav_video_decode_handler_t *vdhp,
@@ -202,6 +264,7 @@ int lwlibav_video_is_keyframe
     uint32_t                        frame_number
 );
 
+/* Set up decoding for the first valid frame. The decoding itself is deferred until the first request. */
 int lwlibav_video_find_first_valid_frame
 (
     lwlibav_video_decode_handler_t *vdhp
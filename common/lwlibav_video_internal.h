@@ -25,6 +25,7 @@
 #define LW_VFRAME_FLAG_CORRUPT             0x4
 #define LW_VFRAME_FLAG_INVISIBLE           0x8
 #define LW_VFRAME_FLAG_COUNTERPART_MISSING 0x10
+#define LW_VFRAME_FLAG_RECOVERY            0x20
 
 typedef struct
 {
@@ -38,6 +39,7 @@ typedef struct
     int             poc;                /* Picture Order Count */
     int             repeat_pict;
     lw_field_info_t field_info;
+    int             recovery_frame_count;   /* the number of frames to recover from LW_VFRAME_FLAG_RECOVERY */
 } video_frame_info_t;
 
 typedef struct
@@ -45,6 +47,10 @@ typedef struct
     uint32_t decoding_to_presentation;
 } order_converter_t;
 
+typedef struct lwlibav_video_prefetcher_tag   lwlibav_video_prefetcher_t;
+typedef struct lwlibav_video_frame_cache_tag lwlibav_video_frame_cache_t;
+typedef struct lwlibav_video_pipeline_tag    lwlibav_video_pipeline_t;
+
 struct lwlibav_video_decode_handler_tag
 {
     /* common */
@@ -52,10 +58,12 @@ struct lwlibav_video_decode_handler_tag
     int                 stream_index;
     int                 error;
     lw_log_handler_t    lh;
+    lw_log_handler_t   *decoder_lh;
     lwlibav_extradata_handler_t exh;
     AVCodecContext     *ctx;
     AVIndexEntry       *index_entries;
     int                 index_entries_count;
+    const void         *mapped_index_entries;
     int                 lw_seek_flags;
     int                 av_seek_flags;
     int                 dv_in_avi;          /* unused */
@@ -68,8 +76,13 @@ struct lwlibav_video_decode_handler_tag
     video_frame_info_t *frame_list;         /* stored in presentation order */
     const char         *ff_options;
     /* */
+    int                 read_ahead;     /* the size of the read-ahead buffer in MiB, 0 = the default I/O of libavformat */
+    int                 direct_io;
+    lw_index_cache_t   *index_cache;    /* the image of the index file shared with the other instances */
     uint32_t            forward_seek_threshold;
     int                 seek_mode;
+    uint32_t            seek_hint_threshold;        /* Decoding starts from the recovery point nearest to the requested frame
+                                                     * if the keyframe is more distant than this, 0 = disabled. */
     int                 max_width;
     int                 max_height;
     int                 initial_width;
@@ -85,7 +98,8 @@ struct lwlibav_video_decode_handler_tag
     uint32_t            last_rap_number;            /* the number of the last random accessible picture */
     uint32_t            last_fed_picture_number;    /* the number of the last picture fed to the decoder
                                                      * This number could be larger than frame_count to handle flush. */
-    uint32_t            first_valid_frame_number;
+    uint32_t            first_valid_frame_number;   /* taken from the index until the search, 0 = unknown */
+    int                 first_valid_frame_state;    /* whether the first valid frame is still to be searched for at the first request */
     AVFrame            *first_valid_frame;          /* the frame buffer
                                                      * where the first valid frame data is stored */
     AVFrame            *last_req_frame;             /* the pointer to the frame buffer
@@ -96,7 +110,21 @@ struct lwlibav_video_decode_handler_tag
                                                      * where the decoder outputs temporally stored frame data */
     int64_t             stream_duration;
     int64_t             min_ts;
-    uint32_t            last_ts_frame_number;
+    lw_video_timestamp_t *timestamp_list;           /* the valid timestamps of the frames in presentation order */
+    uint32_t            timestamp_count;
     AVRational          actual_time_base;
     int                 strict_cfr;
+    int                 shared_index;               /* 1 = the frame list, the order converter, the keyframe list,
+                                                     *     the index entries and the extradata are owned by another handler */
+    uint32_t            prefetch;                   /* the maximum number of frames decoded ahead in the background */
+    lwlibav_video_prefetcher_t *prefetcher;
+    size_t              frame_cache_budget;         /* the maximum bytes of the decoded frames held in the cache */
+    lwlibav_video_frame_cache_t *frame_cache;
+    uint32_t            last_requested_number;      /* the number of the last picture requested by the host */
+    uint32_t            reverse_count;              /* the number of consecutive descending requests */
+    int                 reverse_access;             /* 1 = the requests are in reverse playback */
+    uint64_t            decoded_picture_count;      /* the number of the pictures fed to the decoder */
+    uint64_t            seek_count;                 /* the number of the seeks to random accessible pictures */
+    int                 pipelined_decoding;         /* 1 = feed packets as long as the decoder accepts them if output pictures are identifiable */
+    lwlibav_video_pipeline_t *pipeline;
 };
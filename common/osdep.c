@@ -25,11 +25,14 @@
 
 #include "osdep.h"
 #include "utils.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <process.h>
 
 int lw_string_to_wchar( int cp, const char *from, wchar_t **to )
 {
@@ -84,4 +87,398 @@ char *lw_realpath( const char *path, char *resolved )
     return ret;
 }
 
+void *lw_map_file( const char *file_path, size_t *size )
+{
+    wchar_t *wname = 0;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    /* Sharing the deletion lets lw_remove_file() take the path away from the mapped file. */
+    if( lw_string_to_wchar( CP_UTF8, file_path, &wname ) )
+        file = CreateFileW( wname, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    lw_freep( &wname );
+    if( file == INVALID_HANDLE_VALUE )
+        return NULL;
+    void *address = NULL;
+    LARGE_INTEGER file_size;
+    if( GetFileSizeEx( file, &file_size ) && file_size.QuadPart > 0 && (uint64_t)file_size.QuadPart <= SIZE_MAX )
+    {
+        HANDLE mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if( mapping )
+        {
+            /* The view keeps the mapping alive after the handles are closed. */
+            address = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+            CloseHandle( mapping );
+            if( address )
+                *size = (size_t)file_size.QuadPart;
+        }
+    }
+    CloseHandle( file );
+    return address;
+}
+
+void lw_unmap_file( void *address, size_t size )
+{
+    if( address )
+        UnmapViewOfFile( address );
+}
+
+int lw_remove_file( const char *file_path )
+{
+    wchar_t *wname = 0;
+    if( !lw_string_to_wchar( CP_UTF8, file_path, &wname ) )
+        return -1;
+    /* A mapped file stays under its name until the last view is unmapped even if deleted,
+     * so move it aside first to free the path at once. */
+    size_t   length = wcslen( wname ) + 32;
+    wchar_t *wold   = (wchar_t *)lw_malloc_zero( length * sizeof(wchar_t) );
+    int      ret    = -1;
+    if( wold )
+    {
+        _snwprintf( wold, length - 1, L"%ls.%08lx%08lx.old", wname, (unsigned long)GetCurrentProcessId(), (unsigned long)GetTickCount() );
+        if( MoveFileExW( wname, wold, 0 ) )
+        {
+            DeleteFileW( wold );
+            ret = 0;
+        }
+        else if( GetLastError() == ERROR_FILE_NOT_FOUND || DeleteFileW( wname ) )
+            ret = 0;
+    }
+    lw_freep( &wold );
+    lw_freep( &wname );
+    return ret;
+}
+
+char *lw_get_temp_file_path( const char *suffix )
+{
+    wchar_t wdir[MAX_PATH + 1];
+    char   *dir = 0;
+    DWORD   nc  = GetTempPathW( MAX_PATH + 1, wdir );
+    if( nc == 0 || nc > MAX_PATH || !lw_string_from_wchar( CP_UTF8, wdir, &dir ) )
+        return NULL;
+    /* The directory ends with a backslash. */
+    size_t length = strlen( dir ) + strlen( suffix ) + 32;
+    char  *path   = (char *)lw_malloc_zero( length );
+    if( path )
+        _snprintf( path, length - 1, "%slsmas.%lu%s", dir, (unsigned long)GetCurrentProcessId(), suffix );
+    lw_freep( &dir );
+    return path;
+}
+
+struct lw_thread_tag
+{
+    HANDLE handle;
+    void *(*func)( void * );
+    void  *arg;
+};
+
+struct lw_mutex_tag
+{
+    CRITICAL_SECTION cs;
+};
+
+struct lw_cond_tag
+{
+    CONDITION_VARIABLE cv;
+};
+
+static unsigned __stdcall thread_entry( void *arg )
+{
+    lw_thread_t *thread = (lw_thread_t *)arg;
+    thread->func( thread->arg );
+    return 0;
+}
+
+lw_thread_t *lw_thread_create( void *(*func)( void * ), void *arg )
+{
+    lw_thread_t *thread = (lw_thread_t *)lw_malloc_zero( sizeof(lw_thread_t) );
+    if( !thread )
+        return NULL;
+    thread->func   = func;
+    thread->arg    = arg;
+    thread->handle = (HANDLE)_beginthreadex( NULL, 0, thread_entry, thread, 0, NULL );
+    if( !thread->handle )
+    {
+        lw_free( thread );
+        return NULL;
+    }
+    return thread;
+}
+
+void lw_thread_join( lw_thread_t *thread )
+{
+    if( !thread )
+        return;
+    WaitForSingleObject( thread->handle, INFINITE );
+    CloseHandle( thread->handle );
+    lw_free( thread );
+}
+
+lw_mutex_t *lw_mutex_create( void )
+{
+    lw_mutex_t *mutex = (lw_mutex_t *)lw_malloc_zero( sizeof(lw_mutex_t) );
+    if( mutex )
+        InitializeCriticalSection( &mutex->cs );
+    return mutex;
+}
+
+void lw_mutex_destroy( lw_mutex_t *mutex )
+{
+    if( !mutex )
+        return;
+    DeleteCriticalSection( &mutex->cs );
+    lw_free( mutex );
+}
+
+void lw_mutex_lock( lw_mutex_t *mutex )
+{
+    EnterCriticalSection( &mutex->cs );
+}
+
+void lw_mutex_unlock( lw_mutex_t *mutex )
+{
+    LeaveCriticalSection( &mutex->cs );
+}
+
+lw_cond_t *lw_cond_create( void )
+{
+    lw_cond_t *cond = (lw_cond_t *)lw_malloc_zero( sizeof(lw_cond_t) );
+    if( cond )
+        InitializeConditionVariable( &cond->cv );
+    return cond;
+}
+
+void lw_cond_destroy( lw_cond_t *cond )
+{
+    lw_free( cond );
+}
+
+void lw_cond_wait( lw_cond_t *cond, lw_mutex_t *mutex )
+{
+    SleepConditionVariableCS( &cond->cv, &mutex->cs, INFINITE );
+}
+
+void lw_cond_signal( lw_cond_t *cond )
+{
+    WakeConditionVariable( &cond->cv );
+}
+
+void lw_cond_broadcast( lw_cond_t *cond )
+{
+    WakeAllConditionVariable( &cond->cv );
+}
+
+static SRWLOCK global_lock = SRWLOCK_INIT;
+
+void lw_global_lock( void )
+{
+    AcquireSRWLockExclusive( &global_lock );
+}
+
+void lw_global_unlock( void )
+{
+    ReleaseSRWLockExclusive( &global_lock );
+}
+
+int lw_get_cpu_count( void )
+{
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+double lw_get_time( void )
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &counter );
+    return (double)counter.QuadPart / frequency.QuadPart;
+}
+
+#else
+
+/* for clock_gettime() in strict C99 mode */
+#if !defined( _POSIX_C_SOURCE ) && !defined( __APPLE__ )
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "osdep.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+void *lw_map_file( const char *file_path, size_t *size )
+{
+    int fd = open( file_path, O_RDONLY );
+    if( fd < 0 )
+        return NULL;
+    void *address = NULL;
+    struct stat file_stat;
+    if( !fstat( fd, &file_stat ) && file_stat.st_size > 0 && (uint64_t)file_stat.st_size <= SIZE_MAX )
+    {
+        address = mmap( NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        if( address == MAP_FAILED )
+            address = NULL;
+        else
+            *size = (size_t)file_stat.st_size;
+    }
+    close( fd );
+    return address;
+}
+
+void lw_unmap_file( void *address, size_t size )
+{
+    if( address )
+        munmap( address, size );
+}
+
+int lw_remove_file( const char *file_path )
+{
+    /* The mapped file is kept until the last mapping is removed. */
+    return unlink( file_path ) && errno != ENOENT ? -1 : 0;
+}
+
+char *lw_get_temp_file_path( const char *suffix )
+{
+    const char *dir = getenv( "TMPDIR" );
+    if( !dir || dir[0] == '\0' )
+        dir = "/tmp";
+    size_t length = strlen( dir ) + strlen( suffix ) + 32;
+    char  *path   = (char *)lw_malloc_zero( length );
+    if( path )
+        snprintf( path, length, "%s/lsmas.%ld%s", dir, (long)getpid(), suffix );
+    return path;
+}
+
+struct lw_thread_tag
+{
+    pthread_t handle;
+};
+
+struct lw_mutex_tag
+{
+    pthread_mutex_t mutex;
+};
+
+struct lw_cond_tag
+{
+    pthread_cond_t cond;
+};
+
+lw_thread_t *lw_thread_create( void *(*func)( void * ), void *arg )
+{
+    lw_thread_t *thread = (lw_thread_t *)lw_malloc_zero( sizeof(lw_thread_t) );
+    if( !thread )
+        return NULL;
+    if( pthread_create( &thread->handle, NULL, func, arg ) )
+    {
+        lw_free( thread );
+        return NULL;
+    }
+    return thread;
+}
+
+void lw_thread_join( lw_thread_t *thread )
+{
+    if( !thread )
+        return;
+    pthread_join( thread->handle, NULL );
+    lw_free( thread );
+}
+
+lw_mutex_t *lw_mutex_create( void )
+{
+    lw_mutex_t *mutex = (lw_mutex_t *)lw_malloc_zero( sizeof(lw_mutex_t) );
+    if( mutex && pthread_mutex_init( &mutex->mutex, NULL ) )
+        lw_freep( &mutex );
+    return mutex;
+}
+
+void lw_mutex_destroy( lw_mutex_t *mutex )
+{
+    if( !mutex )
+        return;
+    pthread_mutex_destroy( &mutex->mutex );
+    lw_free( mutex );
+}
+
+void lw_mutex_lock( lw_mutex_t *mutex )
+{
+    pthread_mutex_lock( &mutex->mutex );
+}
+
+void lw_mutex_unlock( lw_mutex_t *mutex )
+{
+    pthread_mutex_unlock( &mutex->mutex );
+}
+
+lw_cond_t *lw_cond_create( void )
+{
+    lw_cond_t *cond = (lw_cond_t *)lw_malloc_zero( sizeof(lw_cond_t) );
+    if( cond && pthread_cond_init( &cond->cond, NULL ) )
+        lw_freep( &cond );
+    return cond;
+}
+
+void lw_cond_destroy( lw_cond_t *cond )
+{
+    if( !cond )
+        return;
+    pthread_cond_destroy( &cond->cond );
+    lw_free( cond );
+}
+
+void lw_cond_wait( lw_cond_t *cond, lw_mutex_t *mutex )
+{
+    pthread_cond_wait( &cond->cond, &mutex->mutex );
+}
+
+void lw_cond_signal( lw_cond_t *cond )
+{
+    pthread_cond_signal( &cond->cond );
+}
+
+void lw_cond_broadcast( lw_cond_t *cond )
+{
+    pthread_cond_broadcast( &cond->cond );
+}
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void lw_global_lock( void )
+{
+    pthread_mutex_lock( &global_lock );
+}
+
+void lw_global_unlock( void )
+{
+    pthread_mutex_unlock( &global_lock );
+}
+
+int lw_get_cpu_count( void )
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf( _SC_NPROCESSORS_ONLN );
+    return count > 0 ? (int)count : 1;
+#else
+    return 1;
+#endif
+}
+
+double lw_get_time( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 #endif
@@ -27,12 +27,57 @@
 #  include <stdio.h>
    FILE *lw_win32_fopen( const char *name, const char *mode );
 #  define lw_fopen lw_win32_fopen
+#  define lw_fseek _fseeki64
+#  define lw_ftell _ftelli64
    char *lw_realpath( const char *path, char *resolved );
 #else
 #  define lw_fopen fopen
+#  define lw_fseek fseeko
+#  define lw_ftell ftello
 #  define lw_realpath realpath
 #endif
 
+#include <stddef.h>
+/* Map the whole file read-only into memory.
+ * Return NULL on failure. */
+void *lw_map_file( const char *file_path, size_t *size );
+void lw_unmap_file( void *address, size_t size );
+
+/* Remove the file even if it is mapped, in which case the mapping stays valid.
+ * Return 0 if the path is free, otherwise -1. */
+int lw_remove_file( const char *file_path );
+
+/* Return the path of a file named with 'suffix' in the temporary directory, which is unique to the process.
+ * The returned string shall be freed by lw_free(). Return NULL on failure. */
+char *lw_get_temp_file_path( const char *suffix );
+
+/* Threads
+ * Every object is allocated by the create function and released by the join or destroy function. */
+typedef struct lw_thread_tag lw_thread_t;
+typedef struct lw_mutex_tag  lw_mutex_t;
+typedef struct lw_cond_tag   lw_cond_t;
+
+lw_thread_t *lw_thread_create( void *(*func)( void * ), void *arg );
+void lw_thread_join( lw_thread_t *thread );
+lw_mutex_t *lw_mutex_create( void );
+void lw_mutex_destroy( lw_mutex_t *mutex );
+void lw_mutex_lock( lw_mutex_t *mutex );
+void lw_mutex_unlock( lw_mutex_t *mutex );
+lw_cond_t *lw_cond_create( void );
+void lw_cond_destroy( lw_cond_t *cond );
+void lw_cond_wait( lw_cond_t *cond, lw_mutex_t *mutex );
+void lw_cond_signal( lw_cond_t *cond );
+void lw_cond_broadcast( lw_cond_t *cond );
+int lw_get_cpu_count( void );
+
+/* The process-wide lock for the data shared between the instances of the source filters.
+ * This needs no initialization. */
+void lw_global_lock( void );
+void lw_global_unlock( void );
+
+/* Return the time in seconds from an arbitrary point, which is never affected by the system clock changes. */
+double lw_get_time( void );
+
 #ifdef _WIN32
 #  include <wchar.h>
    int lw_string_to_wchar( int cp, const char *from, wchar_t **to );
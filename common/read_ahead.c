@@ -0,0 +1,450 @@
+/*****************************************************************************
+ * read_ahead.c
+ *****************************************************************************
+ * Copyright (C) 2012-2015 L-SMASH Works project
+ *
+ * Authors: Yusuke Nakamura <muken.the.vfrmaniac@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license.
+ * However, when distributing its binary file, it will be under LGPL or GPL. */
+
+/* for O_DIRECT and posix_fadvise() */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "cpp_compat.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Libav */
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include "osdep.h"
+#include "utils.h"
+#include "read_ahead.h"
+
+/* Every read is done by a whole block at a block aligned position,
+ * which also satisfies the alignment requirements of O_DIRECT. */
+#define READ_AHEAD_BLOCK_SIZE   (1 << 20)
+#define READ_AHEAD_MIN_BLOCKS   4
+#define READ_AHEAD_ALIGNMENT    4096
+/* the size of the reads from the demuxer */
+#define READ_AHEAD_AVIO_BUFFER_SIZE (256 * 1024)
+
+typedef enum
+{
+    BLOCK_EMPTY   = 0,
+    BLOCK_READING = 1,
+    BLOCK_READY   = 2,
+} read_ahead_block_state;
+
+typedef struct
+{
+    uint8_t               *data;
+    int64_t                pos;
+    int                    size;    /* the number of the read bytes, negative = I/O error */
+    read_ahead_block_state state;
+} read_ahead_block_t;
+
+/* The background thread keeps reading the blocks following the current position into the ring of blocks.
+ * A few blocks behind the current position are left as they are so that short backward seeks by demuxers
+ * can be served without any I/O. Any access to the blocks is done with the mutex locked except the reading itself. */
+typedef struct
+{
+#ifdef _WIN32
+    FILE               *fp;
+#else
+    int                 fd;
+    int                 direct_io;
+#endif
+    int64_t             file_size;
+    int64_t             position;       /* the current position of the reading by the demuxer */
+    read_ahead_block_t *blocks;
+    int                 block_count;
+    int                 back_count;     /* the number of the blocks kept behind the current one */
+    lw_thread_t        *thread;
+    lw_mutex_t         *mutex;
+    lw_cond_t          *cond;
+    int                 exit;
+} read_ahead_t;
+
+static void *alloc_block_data( void )
+{
+#ifdef __linux__
+    void *data;
+    return posix_memalign( &data, READ_AHEAD_ALIGNMENT, READ_AHEAD_BLOCK_SIZE ) ? NULL : data;
+#else
+    return av_malloc( READ_AHEAD_BLOCK_SIZE );
+#endif
+}
+
+static void free_block_data( void *data )
+{
+#ifdef __linux__
+    free( data );
+#else
+    av_free( data );
+#endif
+}
+
+static int open_file
+(
+    read_ahead_t *rap,
+    const char   *file_path,
+    int           direct_io
+)
+{
+#ifdef _WIN32
+    (void)direct_io;
+    rap->fp = lw_fopen( file_path, "rb" );
+    if( !rap->fp )
+        return -1;
+    setvbuf( rap->fp, NULL, _IONBF, 0 );
+    if( lw_fseek( rap->fp, 0, SEEK_END ) )
+        return -1;
+    rap->file_size = lw_ftell( rap->fp );
+    return rap->file_size < 0 ? -1 : 0;
+#else
+    rap->fd = -1;
+#ifdef __linux__
+    if( direct_io )
+    {
+        /* Some file systems refuse O_DIRECT. Then read the file in the usual way. */
+        rap->fd        = open( file_path, O_RDONLY | O_DIRECT );
+        rap->direct_io = rap->fd >= 0;
+    }
+#endif
+    if( rap->fd < 0 )
+        rap->fd = open( file_path, O_RDONLY );
+    if( rap->fd < 0 )
+        return -1;
+    struct stat file_stat;
+    if( fstat( rap->fd, &file_stat ) || !S_ISREG( file_stat.st_mode ) )
+        return -1;
+    rap->file_size = file_stat.st_size;
+#ifdef __linux__
+    /* Let the kernel read ahead more aggressively than the default. */
+    if( !rap->direct_io )
+        posix_fadvise( rap->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+    return 0;
+#endif
+}
+
+static void close_file
+(
+    read_ahead_t *rap
+)
+{
+#ifdef _WIN32
+    if( rap->fp )
+        fclose( rap->fp );
+#else
+    if( rap->fd >= 0 )
+        close( rap->fd );
+#endif
+}
+
+/* Read a block at 'pos', and return the number of the read bytes or a negative value on failure. */
+static int read_block
+(
+    read_ahead_t *rap,
+    uint8_t      *data,
+    int64_t       pos
+)
+{
+#ifdef _WIN32
+    /* Only the background thread touches the file, so the seek and the read need no lock. */
+    if( lw_fseek( rap->fp, pos, SEEK_SET ) )
+        return -1;
+    size_t read_size = fread( data, 1, READ_AHEAD_BLOCK_SIZE, rap->fp );
+    return ferror( rap->fp ) ? -1 : (int)read_size;
+#else
+    int read_size = 0;
+    while( read_size < READ_AHEAD_BLOCK_SIZE )
+    {
+        ssize_t ret = pread( rap->fd, data + read_size, READ_AHEAD_BLOCK_SIZE - read_size, pos + read_size );
+        if( ret == 0 )
+            break;
+        if( ret < 0 )
+        {
+#ifdef __linux__
+            if( errno == EINVAL && rap->direct_io )
+            {
+                /* The file system accepted O_DIRECT on open but refuses it on read. */
+                fcntl( rap->fd, F_SETFL, fcntl( rap->fd, F_GETFL ) & ~O_DIRECT );
+                rap->direct_io = 0;
+                continue;
+            }
+#endif
+            if( errno == EINTR )
+                continue;
+            return -1;
+        }
+        read_size += (int)ret;
+#ifdef __linux__
+        /* An unaligned short read with O_DIRECT means the end of file. */
+        if( rap->direct_io && read_size % READ_AHEAD_ALIGNMENT )
+            break;
+#endif
+    }
+    return read_size;
+#endif
+}
+
+static read_ahead_block_t *find_block
+(
+    read_ahead_t *rap,
+    int64_t       pos
+)
+{
+    for( int i = 0; i < rap->block_count; i++ )
+        if( rap->blocks[i].state != BLOCK_EMPTY && rap->blocks[i].pos == pos )
+            return &rap->blocks[i];
+    return NULL;
+}
+
+/* Pick the nearest block which is not read yet from the current position and a free block for it. */
+static read_ahead_block_t *get_block_to_read
+(
+    read_ahead_t *rap,
+    int64_t      *pos
+)
+{
+    int64_t current_pos = rap->position - rap->position % READ_AHEAD_BLOCK_SIZE;
+    int64_t window_head = current_pos - (int64_t)rap->back_count * READ_AHEAD_BLOCK_SIZE;
+    int64_t window_tail = window_head + (int64_t)rap->block_count * READ_AHEAD_BLOCK_SIZE;
+    for( int64_t block_pos = current_pos; block_pos < window_tail; block_pos += READ_AHEAD_BLOCK_SIZE )
+    {
+        if( block_pos > current_pos && block_pos >= rap->file_size )
+            break;
+        if( find_block( rap, block_pos ) )
+            continue;
+        /* Recycle a block out of the window. */
+        for( int i = 0; i < rap->block_count; i++ )
+        {
+            read_ahead_block_t *block = &rap->blocks[i];
+            if( block->state == BLOCK_EMPTY
+             || (block->state == BLOCK_READY && (block->pos < window_head || block->pos >= window_tail)) )
+            {
+                *pos = block_pos;
+                return block;
+            }
+        }
+        break;
+    }
+    return NULL;
+}
+
+static void *read_ahead_thread
+(
+    void *arg
+)
+{
+    read_ahead_t *rap = (read_ahead_t *)arg;
+    lw_mutex_lock( rap->mutex );
+    while( 1 )
+    {
+        int64_t             pos;
+        read_ahead_block_t *block;
+        while( !rap->exit && !(block = get_block_to_read( rap, &pos )) )
+            lw_cond_wait( rap->cond, rap->mutex );
+        if( rap->exit )
+            break;
+        block->pos   = pos;
+        block->state = BLOCK_READING;
+        lw_mutex_unlock( rap->mutex );
+        int size = read_block( rap, block->data, pos );
+        lw_mutex_lock( rap->mutex );
+        block->size  = size;
+        block->state = BLOCK_READY;
+        lw_cond_broadcast( rap->cond );
+    }
+    lw_mutex_unlock( rap->mutex );
+    return NULL;
+}
+
+static int read_packet
+(
+    void    *opaque,
+    uint8_t *buf,
+    int      buf_size
+)
+{
+    read_ahead_t *rap = (read_ahead_t *)opaque;
+    lw_mutex_lock( rap->mutex );
+    int64_t             block_pos = rap->position - rap->position % READ_AHEAD_BLOCK_SIZE;
+    read_ahead_block_t *block;
+    while( !(block = find_block( rap, block_pos )) || block->state != BLOCK_READY )
+    {
+        /* The block is read by the background thread first since it is the nearest from the current position. */
+        lw_cond_broadcast( rap->cond );
+        lw_cond_wait( rap->cond, rap->mutex );
+    }
+    int offset = (int)(rap->position - block_pos);
+    int ret;
+    if( block->size < 0 )
+        ret = AVERROR( EIO );
+    else if( offset >= block->size )
+        ret = AVERROR_EOF;
+    else
+    {
+        ret = MIN( buf_size, block->size - offset );
+        memcpy( buf, block->data + offset, ret );
+        rap->position += ret;
+        /* Let the background thread go on to the next block. */
+        if( offset + ret == READ_AHEAD_BLOCK_SIZE )
+            lw_cond_broadcast( rap->cond );
+    }
+    lw_mutex_unlock( rap->mutex );
+    return ret;
+}
+
+static int64_t seek
+(
+    void    *opaque,
+    int64_t  offset,
+    int      whence
+)
+{
+    read_ahead_t *rap = (read_ahead_t *)opaque;
+    int64_t pos;
+    lw_mutex_lock( rap->mutex );
+    switch( whence & ~AVSEEK_FORCE )
+    {
+        case AVSEEK_SIZE :
+            lw_mutex_unlock( rap->mutex );
+            return rap->file_size;
+        case SEEK_SET :
+            pos = offset;
+            break;
+        case SEEK_CUR :
+            pos = rap->position + offset;
+            break;
+        case SEEK_END :
+            pos = rap->file_size + offset;
+            break;
+        default :
+            lw_mutex_unlock( rap->mutex );
+            return AVERROR( EINVAL );
+    }
+    if( pos < 0 )
+    {
+        lw_mutex_unlock( rap->mutex );
+        return AVERROR( EINVAL );
+    }
+    /* No I/O here. The blocks in the new window are read by the background thread. */
+    if( pos / READ_AHEAD_BLOCK_SIZE != rap->position / READ_AHEAD_BLOCK_SIZE )
+        lw_cond_broadcast( rap->cond );
+    rap->position = pos;
+    lw_mutex_unlock( rap->mutex );
+    return pos;
+}
+
+static void close_read_ahead
+(
+    read_ahead_t *rap
+)
+{
+    if( !rap )
+        return;
+    if( rap->thread )
+    {
+        lw_mutex_lock( rap->mutex );
+        rap->exit = 1;
+        lw_cond_broadcast( rap->cond );
+        lw_mutex_unlock( rap->mutex );
+        lw_thread_join( rap->thread );
+    }
+    if( rap->blocks )
+    {
+        for( int i = 0; i < rap->block_count; i++ )
+            free_block_data( rap->blocks[i].data );
+        lw_free( rap->blocks );
+    }
+    if( rap->cond )
+        lw_cond_destroy( rap->cond );
+    if( rap->mutex )
+        lw_mutex_destroy( rap->mutex );
+    close_file( rap );
+    lw_free( rap );
+}
+
+AVIOContext *lw_read_ahead_open
+(
+    const char *file_path,
+    int         buffer_size,
+    int         direct_io
+)
+{
+    read_ahead_t *rap = (read_ahead_t *)lw_malloc_zero( sizeof(read_ahead_t) );
+    if( !rap )
+        return NULL;
+    AVIOContext *pb  = NULL;
+    uint8_t     *buf = NULL;
+    if( open_file( rap, file_path, direct_io ) < 0 )
+        goto fail;
+    rap->block_count = MAX( buffer_size, READ_AHEAD_MIN_BLOCKS );
+    rap->back_count  = rap->block_count / 4;
+    rap->blocks      = (read_ahead_block_t *)lw_malloc_zero( rap->block_count * sizeof(read_ahead_block_t) );
+    rap->mutex       = lw_mutex_create();
+    rap->cond        = lw_cond_create();
+    if( !rap->blocks || !rap->mutex || !rap->cond )
+        goto fail;
+    for( int i = 0; i < rap->block_count; i++ )
+        if( !(rap->blocks[i].data = (uint8_t *)alloc_block_data()) )
+            goto fail;
+    rap->thread = lw_thread_create( read_ahead_thread, rap );
+    if( !rap->thread )
+        goto fail;
+    buf = (uint8_t *)av_malloc( READ_AHEAD_AVIO_BUFFER_SIZE );
+    if( !buf )
+        goto fail;
+    pb = avio_alloc_context( buf, READ_AHEAD_AVIO_BUFFER_SIZE, 0, rap, read_packet, NULL, seek );
+    if( !pb )
+        goto fail;
+    return pb;
+fail:
+    av_free( buf );
+    close_read_ahead( rap );
+    return NULL;
+}
+
+void lw_read_ahead_close
+(
+    AVIOContext **pb
+)
+{
+    if( !pb || !*pb )
+        return;
+    close_read_ahead( (read_ahead_t *)(*pb)->opaque );
+    av_freep( &(*pb)->buffer );
+    avio_context_free( pb );
+}
@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * read_ahead.h
+ *****************************************************************************
+ * Copyright (C) 2012-2015 L-SMASH Works project
+ *
+ * Authors: Yusuke Nakamura <muken.the.vfrmaniac@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *****************************************************************************/
+
+/* This file is available under an ISC license. */
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif  /* __cplusplus */
+
+/* Open the local file 'file_path' with the I/O context which reads the file by large blocks on the background thread.
+ * 'buffer_size' is the total size of the blocks in MiB.
+ * If 'direct_io' is set to 1, the file is read bypassing the page cache of the OS where supported.
+ * Return NULL on failure, e.g. if 'file_path' is not a local file. */
+AVIOContext *lw_read_ahead_open
+(
+    const char *file_path,
+    int         buffer_size,
+    int         direct_io
+);
+
+/* Close the I/O context opened by lw_read_ahead_open() and set NULL to '*pb'. */
+void lw_read_ahead_close
+(
+    AVIOContext **pb
+);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif
@@ -33,6 +33,7 @@ extern "C"
 }
 #endif  /* __cplusplus */
 
+#include "osdep.h"
 #include "utils.h"
 #include "video_output.h"
 
@@ -203,3 +204,110 @@ void lw_cleanup_video_output_handler
         vohp->scaler.sws_ctx = NULL;
     }
 }
+
+static inline double timestamp_to_seconds
+(
+    int64_t  ts,
+    uint32_t time_base_num,
+    uint32_t time_base_den
+)
+{
+    return ((double)ts * time_base_num) / time_base_den;
+}
+
+uint32_t lw_vfr2cfr_frame_number
+(
+    const lw_video_timestamp_t *timestamp_list,
+    uint32_t                    timestamp_count,
+    uint32_t                    frame_count,
+    uint32_t                    time_base_num,
+    uint32_t                    time_base_den,
+    uint32_t                    cfr_num,
+    uint32_t                    cfr_den,
+    uint32_t                    frame_number
+)
+{
+    double target_ts = (double)((uint64_t)(frame_number - 1) * cfr_den) / cfr_num;
+    /* Find the first input frame presented at or after the target. */
+    uint32_t lo = 0;
+    uint32_t hi = timestamp_count;
+    while( lo < hi )
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if( timestamp_to_seconds( timestamp_list[mid].ts, time_base_num, time_base_den ) < target_ts )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if( lo == timestamp_count )
+        /* The target is after the last input frame. */
+        return timestamp_count ? frame_count : 0;
+    double current_ts = timestamp_to_seconds( timestamp_list[lo].ts, time_base_num, time_base_den );
+    if( current_ts == target_ts )
+        return timestamp_list[lo].frame_number;
+    if( lo == 0 )
+        return 0;
+    double   prev_ts              = timestamp_to_seconds( timestamp_list[lo - 1].ts, time_base_num, time_base_den );
+    double   next_target_ts       = (double)((uint64_t)frame_number * cfr_den) / cfr_num;
+    uint32_t prev_frame_number    = timestamp_list[lo - 1].frame_number;
+    uint32_t current_frame_number = timestamp_list[lo    ].frame_number;
+    if( current_ts > next_target_ts )
+        /* Between the current target and the next target, there are no input frames.
+         * Therefore, output the previous frame. This is absolutely correct. */
+        return prev_frame_number;
+    if( current_ts > (next_target_ts + target_ts) / 2 )
+        /* The current frame is far from the current target and should be a candidate for the next target. */
+        return prev_frame_number;
+    /* Choose the nearest one. */
+    return current_ts - target_ts >= target_ts - prev_ts ? prev_frame_number : current_frame_number;
+}
+
+int lw_write_timecodes_v2
+(
+    const char                 *file_path,
+    const lw_video_timestamp_t *timestamp_list,
+    uint32_t                    timestamp_count,
+    uint32_t                    frame_count,
+    uint32_t                    time_base_num,
+    uint32_t                    time_base_den
+)
+{
+    if( timestamp_count == 0 || (timestamp_count == 1 && frame_count > 1) )
+        return -1;
+    FILE *fp = lw_fopen( file_path, "w" );
+    if( !fp )
+        return -1;
+    fprintf( fp, "# timecode format v2\n" );
+    /* The frames without a valid timestamp are interpolated between the neighbouring listed ones,
+     * and extrapolated by the average frame duration before the first one and after the last one. */
+    const lw_video_timestamp_t *first = &timestamp_list[0];
+    const lw_video_timestamp_t *last  = &timestamp_list[timestamp_count - 1];
+    double average = last->frame_number > first->frame_number
+                   ? (double)(last->ts - first->ts) / (last->frame_number - first->frame_number)
+                   : 0.0;
+    uint32_t next = 0;  /* the index of the first listed timestamp at or after the frame */
+    for( uint32_t frame_number = 1; frame_number <= frame_count; frame_number++ )
+    {
+        while( next < timestamp_count && timestamp_list[next].frame_number < frame_number )
+            ++next;
+        double ts;
+        if( next < timestamp_count && timestamp_list[next].frame_number == frame_number )
+            ts = (double)timestamp_list[next].ts;
+        else if( next == 0 )
+            ts = first->ts - average * (first->frame_number - frame_number);
+        else if( next == timestamp_count )
+            ts = last->ts + average * (frame_number - last->frame_number);
+        else
+        {
+            const lw_video_timestamp_t *prev = &timestamp_list[next - 1];
+            const lw_video_timestamp_t *curr = &timestamp_list[next];
+            ts = prev->ts + (double)(curr->ts - prev->ts) * (frame_number - prev->frame_number)
+                                                          / (curr->frame_number - prev->frame_number);
+        }
+        fprintf( fp, "%.6f\n", ts * 1000.0 * time_base_num / time_base_den );
+    }
+    int ret = ferror( fp ) ? -1 : 0;
+    if( fclose( fp ) )
+        ret = -1;
+    return ret;
+}
@@ -47,6 +47,13 @@ typedef struct
     uint32_t bottom;
 } lw_video_frame_order_t;
 
+/* the presentation timestamp of a frame, which is ordered by frame_number and never AV_NOPTS_VALUE */
+typedef struct
+{
+    uint32_t frame_number;  /* in presentation order */
+    int64_t  ts;            /* relative to the first frame */
+} lw_video_timestamp_t;
+
 typedef struct
 {
     lw_video_scaler_handler_t scaler;
@@ -103,6 +110,32 @@ void lw_cleanup_video_output_handler
     lw_video_output_handler_t *vohp
 );
 
+/* Return the number of the input frame which is presented at a given output frame of constant framerate.
+ * Return 0 if no input frame is presented at or before it. */
+uint32_t lw_vfr2cfr_frame_number
+(
+    const lw_video_timestamp_t *timestamp_list,
+    uint32_t                    timestamp_count,
+    uint32_t                    frame_count,
+    uint32_t                    time_base_num,
+    uint32_t                    time_base_den,
+    uint32_t                    cfr_num,
+    uint32_t                    cfr_den,
+    uint32_t                    frame_number
+);
+
+/* Write the timestamps of the frames into the file in the timecode format v2 of mkvmerge.
+ * Return 0 if successful, or -1 if failed or not enough timestamps are listed. */
+int lw_write_timecodes_v2
+(
+    const char                 *file_path,
+    const lw_video_timestamp_t *timestamp_list,
+    uint32_t                    timestamp_count,
+    uint32_t                    frame_count,
+    uint32_t                    time_base_num,
+    uint32_t                    time_base_den
+);
+
 #ifdef __cplusplus
 }
 #endif  /* __cplusplus */